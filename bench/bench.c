@@ -0,0 +1,1198 @@
+#define _GNU_SOURCE
+#include "shellcore.h"
+#include "tokenize.h"
+#include "util.h"
+#include "net.h"
+#include "evloop.h"
+#include "lz.h"
+#include "shmring.h"
+#include "complete.h"
+#include "dircache.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <signal.h>
+#include <sys/wait.h>
+#include <sys/stat.h>
+#include <sys/ioctl.h>
+#include <sys/resource.h>
+#include <netinet/tcp.h>
+
+/*benchmark harness for the shell core, the network framing, the event loop and the server
+every benchmark runs a few warmup repetitions, then timed repetitions of a batch of operations; the per-operation
+time of each repetition is one sample, reported as median, p99, mean and stddev (and optionally written as JSON)
+covered: tokenizing, parsing and expansion, globbing and completion, spawning and pipelines, line round trips, epoll
+against io_uring (ping-pong, pidfd reaping, 10k connections, linked relays), session setup through the server binary
+at 1, 2 and 4 workers, output transports and compression; a benchmark whose requirements are missing is skipped
+usage: shellbench [-r reps] [-w warmup] [-f name-filter] [-j out.json]
+*/
+
+//size of the generated input for the pipeline benchmarks
+#define PIPE_INPUT_BYTES (16 * 1024 * 1024)
+//files created for the glob benchmark
+#define GLOB_FILES 5000
+//entries of the directory the server-side completion benchmark looks into
+#define COMPLETE_DIR_FILES 100000
+//bytes the socket relay benchmark moves per read, the server's largest uncompressed frame
+#define RELAY_CHUNK 12288
+//client connections the connection-scaling benchmark keeps open, and the bytes each sends per round
+#define CONNS 10000
+#define CONN_MSG 64
+//client threads opening sessions in the server connection-rate benchmarks
+#define CONNECT_THREADS 4
+//upper bound for -r
+#define MAX_REPS 10000
+//lines of the command substitution script timed under myshell and dash
+#define SUBST_SCRIPT_LINES 200
+
+typedef struct {
+    const char *name;
+    int iters;                  //operations per repetition
+    int reps;                   //default repetitions, -r overrides
+    size_t bytes;               //bytes handled per operation, 0 for latency-only benchmarks
+    void (*run)(int iters);
+    const char *(*missing)(void);   //why the benchmark cannot run here, NULL if it can (no hook: always runs)
+} Bench;
+
+//scratch directory with the generated inputs, removed at exit
+static char workdir[] = "/tmp/shellbench.XXXXXX";
+static char input_path[512];
+static int devnull = -1;
+
+//monotonic time in nanoseconds
+static double now_ns(void){
+    return (double)shellcore_now_ns();
+}
+
+/* ---- shell core ---- */
+
+static const char *sample_line = "grep -F \"quoted | pipe\" < input.txt | sort -r -n | cut -d , -f 1,3- > 'out file.txt' 2> err.log";
+
+static void bench_tokenize(int iters){
+    for(int i = 0; i < iters; i++){
+        QTok *toks;
+        int n;
+        if(qtokenize(sample_line, &toks, &n) == 0){
+            free_qtokens(toks, n);
+        }
+    }
+}
+
+static void bench_parse(int iters){
+    for(int i = 0; i < iters; i++){
+        free_pipeline(parse_pipeline(sample_line));
+    }
+}
+
+//variables, defaults and arithmetic, everything expanded without forking
+static void bench_parse_expand(int iters){
+    for(int i = 0; i < iters; i++){
+        free_pipeline(parse_pipeline("echo $HOME ${NOPE:-default} \"${PATH}\" $((3 * 7 + 1)) ${#HOME} | wc -c"));
+    }
+}
+
+//three builtin command substitutions and an arithmetic expansion, all evaluated in-process while parsing
+static const char *subst_line = "echo $(echo a b) $(printf '%s-%03d' x 7) $(pwd) $((3 * 7 + 1))";
+//the same with explicit paths, every substitution forks and execs the real program
+static char subst_forked_line[256];
+
+static void bench_subst_builtin(int iters){
+    for(int i = 0; i < iters; i++){
+        free_pipeline(parse_pipeline(subst_line));
+    }
+}
+
+static void bench_subst_forked(int iters){
+    for(int i = 0; i < iters; i++){
+        free_pipeline(parse_pipeline(subst_forked_line));
+    }
+}
+
+/*a script of SUBST_SCRIPT_LINES substitution-heavy assignments (no command of their own to run, so the time is the
+substitutions'), and the shells it is timed with (empty if missing)
+*/
+static char subst_script[600];
+static char myshell_path[600];
+static char dash_path[64];
+
+//runs the script through shell with its output on /dev/null
+static void run_script(const char *shell, int iters){
+    for(int i = 0; i < iters; i++){
+        pid_t pid = fork();
+        if(pid == 0){
+            int fd = open(subst_script, O_RDONLY);
+            if(fd < 0 || dup2(fd, STDIN_FILENO) < 0 || dup2(devnull, STDOUT_FILENO) < 0){
+                _exit(127);
+            }
+            execl(shell, shell, (char *)NULL);
+            _exit(127);
+        }
+        if(pid > 0){
+            waitpid(pid, NULL, 0);
+        }
+    }
+}
+
+static void bench_script_myshell(int iters){
+    run_script(myshell_path, iters);
+}
+
+static void bench_script_dash(int iters){
+    run_script(dash_path, iters);
+}
+
+static char glob_pattern[600];
+
+static void bench_glob(int iters){
+    for(int i = 0; i < iters; i++){
+        char *argv[64] = {xstrdup("ls"), xstrdup(glob_pattern), NULL};
+        bool quoted[64] = {false, false};
+        int argc = 2;
+        apply_globbing(argv, quoted, &argc);
+        for(int j = 0; j < argc; j++){
+            free(argv[j]);
+        }
+    }
+}
+
+//Tab on a one-letter command word, served from the cached PATH table
+static void bench_complete(int iters){
+    char *out[256];
+    for(int i = 0; i < iters; i++){
+        int n = complete_command("g", out, 256, NULL, NULL);
+        for(int j = 0; j < n; j++){
+            free(out[j]);
+        }
+    }
+}
+
+//Tab on a word with 1000 (ranked) matches in a 100k-entry directory, answered from the server's cached listing
+//the directory is only created when this benchmark runs, on its first (warmup) call
+static void bench_complete_dir(int iters){
+    static char word[600];
+    if(word[0] == '\0'){
+        char path[600];
+        snprintf(path, sizeof(path), "%s/many", workdir);
+        mkdir(path, 0755);
+        for(int i = 0; i < COMPLETE_DIR_FILES; i++){
+            snprintf(path, sizeof(path), "%s/many/f%06d", workdir, i);
+            int fd = open(path, O_WRONLY | O_CREAT, 0644);
+            if(fd >= 0){
+                close(fd);
+            }
+        }
+        snprintf(word, sizeof(word), "%s/many/f099", workdir);
+    }
+    char *out[64];
+    for(int i = 0; i < iters; i++){
+        int n = dircache_complete(word, out, 64, NULL, NULL);
+        for(int j = 0; j < n; j++){
+            free(out[j]);
+        }
+    }
+}
+
+//runs a parsed pipeline with stdout on /dev/null and waits for it
+static void run_quiet(const Pipeline *pl){
+    int io[3] = {-1, devnull, -1};
+    pid_t pids[MAX_PIPES];
+    int n = spawn_pipeline(pl, io, pids);
+    for(int i = 0; i < n; i++){
+        waitpid(pids[i], NULL, 0);
+    }
+}
+
+//parses cmd with %s replaced by the input file, once, outside the timed loop
+static Pipeline *prepare(const char *fmt){
+    char line[1024];
+    snprintf(line, sizeof(line), fmt, input_path);
+    return parse_pipeline(line);
+}
+
+static Pipeline *pl_spawn, *pl_builtin, *pl_forked, *pl_cat2, *pl_cat10, *pl_sleep3;
+
+static void bench_spawn(int iters){
+    for(int i = 0; i < iters; i++){
+        run_quiet(pl_spawn);
+    }
+}
+
+//what a client's command line costs end to end (parse, plan, PATH search, spawn) next to a prepared one
+static void bench_spawn_parsed(int iters){
+    int io[3] = {-1, devnull, -1};
+    SpawnOptions opt = {io, -1, 0};
+    pid_t pids[MAX_PIPES];
+    for(int i = 0; i < iters; i++){
+        Pipeline *pl = parse_pipeline("true --version");
+        int n = pl != NULL ? spawn_pipeline_opts(pl, &opt, pids) : 0;
+        free_pipeline(pl);
+        for(int j = 0; j < n; j++){
+            waitpid(pids[j], NULL, 0);
+        }
+    }
+}
+
+static Prepared *prep_true;
+
+static void bench_spawn_prepared(int iters){
+    int io[3] = {-1, devnull, -1};
+    SpawnOptions opt = {io, -1, 0};
+    pid_t pids[MAX_PIPES];
+    for(int i = 0; i < iters; i++){
+        int n = spawn_prepared(prep_true, &opt, pids);
+        for(int j = 0; j < n; j++){
+            waitpid(pids[j], NULL, 0);
+        }
+    }
+}
+
+static void bench_pipe_builtin(int iters){
+    for(int i = 0; i < iters; i++){
+        run_quiet(pl_builtin);
+    }
+}
+
+static void bench_pipe_forked(int iters){
+    for(int i = 0; i < iters; i++){
+        run_quiet(pl_forked);
+    }
+}
+
+static void bench_cat2(int iters){
+    for(int i = 0; i < iters; i++){
+        run_quiet(pl_cat2);
+    }
+}
+
+static void bench_cat10(int iters){
+    for(int i = 0; i < iters; i++){
+        run_quiet(pl_cat10);
+    }
+}
+
+//what a server timeout costs: a pipeline in its own process group is killed with one killpg and every stage reaped
+static void bench_timeout_kill(int iters){
+    int io[3] = {-1, devnull, -1};
+    SpawnOptions opt = {io, -1, 1};
+    pid_t pids[MAX_PIPES];
+    for(int i = 0; i < iters; i++){
+        int n = spawn_pipeline_opts(pl_sleep3, &opt, pids);
+        if(n > 0){
+            kill(-pids[0], SIGKILL);
+        }
+        for(int j = 0; j < n; j++){
+            waitpid(pids[j], NULL, 0);
+        }
+    }
+}
+
+/* ---- network framing ---- */
+
+static int rtt_unix[2] = {-1, -1};
+static int rtt_tcp[2] = {-1, -1};
+
+//echoes framed lines back until the peer closes
+static void *echo_thread(void *arg){
+    int fd = *(int *)arg;
+    char buf[MAX_BUFFER_SIZE];
+    while(receive_line(fd, buf, sizeof(buf)) > 0){
+        send_line(fd, buf);
+    }
+    return NULL;
+}
+
+//a connected TCP pair over loopback, [0] is the client side
+static int tcp_pair(int sv[2]){
+    struct sockaddr_in addr = {0};
+    socklen_t len = sizeof(addr);
+    int one = 1;
+    int lfd = socket(AF_INET, SOCK_STREAM, 0);
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if(lfd < 0 || bind(lfd, (struct sockaddr *)&addr, sizeof(addr)) < 0 || listen(lfd, 1) < 0 ||
+       getsockname(lfd, (struct sockaddr *)&addr, &len) < 0){
+        perror("tcp pair");
+        return -1;
+    }
+    sv[0] = socket(AF_INET, SOCK_STREAM, 0);
+    if(sv[0] < 0 || connect(sv[0], (struct sockaddr *)&addr, sizeof(addr)) < 0 || (sv[1] = accept(lfd, NULL, NULL)) < 0){
+        perror("tcp pair");
+        close(lfd);
+        return -1;
+    }
+    close(lfd);
+    setsockopt(sv[0], IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    setsockopt(sv[1], IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    return 0;
+}
+
+static void round_trips(int fd, int iters){
+    char buf[MAX_BUFFER_SIZE];
+    for(int i = 0; i < iters; i++){
+        send_line(fd, "ls -la | grep x | wc -l");
+        receive_line(fd, buf, sizeof(buf));
+    }
+}
+
+static void bench_rtt_unix(int iters){
+    round_trips(rtt_unix[0], iters);
+}
+
+static void bench_rtt_tcp(int iters){
+    round_trips(rtt_tcp[0], iters);
+}
+
+/* ---- event loop ---- */
+
+static EvLoop *loops[2];
+static int ping[2][2];
+
+//echoes one byte back on the same socket
+static void on_ping(EvLoop *loop, int fd, int events, void *arg){
+    char c;
+    (void)loop;
+    (void)events;
+    (void)arg;
+    if(read(fd, &c, 1) == 1 && write(fd, &c, 1) < 0){
+        perror("write");
+    }
+}
+
+static void ping_pong(int backend, int iters){
+    char c = 'x';
+    for(int i = 0; i < iters; i++){
+        if(write(ping[backend][0], &c, 1) != 1){
+            break;
+        }
+        evloop_run_once(loops[backend], -1);
+        if(read(ping[backend][0], &c, 1) != 1){
+            break;
+        }
+    }
+}
+
+static void bench_evloop_epoll(int iters){
+    ping_pong(EVLOOP_EPOLL, iters);
+}
+
+static void bench_evloop_uring(int iters){
+    ping_pong(EVLOOP_URING, iters);
+}
+
+//children the reaping benchmark still waits for
+static int unreaped;
+
+static void on_exit_pidfd(EvLoop *loop, int fd, int events, void *arg){
+    (void)events;
+    waitpid((pid_t)(long)arg, NULL, 0);
+    evloop_del(loop, fd);
+    close(fd);
+    unreaped--;
+}
+
+/*the server's reaper: iters children in flight at once, each watched through a pidfd in the event loop, all released
+together by closing the pipe they block on; measures the per-child cost of exit notification and reaping
+*/
+static void reap_children(int backend, int iters){
+    int gate[2];
+    if(pipe2(gate, O_CLOEXEC) < 0){
+        return;
+    }
+    for(int i = 0; i < iters; i++){
+        pid_t pid = fork();
+        if(pid == 0){
+            char c;
+            close(gate[1]);
+            _exit(read(gate[0], &c, 1) < 0);
+        }
+        int fd = pid > 0 ? open_pidfd(pid) : -1;
+        if(fd < 0 || evloop_add(loops[backend], fd, EV_READ, on_exit_pidfd, (void *)(long)pid) < 0){
+            perror("pidfd");
+            if(pid > 0){
+                kill(pid, SIGKILL);
+                waitpid(pid, NULL, 0);
+            }
+            break;
+        }
+        unreaped++;
+    }
+    close(gate[0]);
+    close(gate[1]);
+    while(unreaped > 0 && evloop_run_once(loops[backend], -1) >= 0){
+    }
+}
+
+static void bench_reap_epoll(int iters){
+    reap_children(EVLOOP_EPOLL, iters);
+}
+
+static void bench_reap_uring(int iters){
+    reap_children(EVLOOP_URING, iters);
+}
+
+/*many idle connections and one message on each: CONNS TCP connections accepted through evloop_accept and served by an
+echo on evloop_recv, the client side held by a child process (the two would not fit one descriptor table); one
+operation is one message echoed, which the io_uring backend does without a readiness round trip per socket
+*/
+typedef struct {
+    EvLoop *loop;
+    int listen_fd;
+    int go, done;               //pipes to and from the child: start a round, round finished
+    pid_t pid;
+    int fds[CONNS];             //accepted connections
+    long accepted;
+    long echoed;                //bytes echoed in the current round
+} ConnFleet;
+
+static ConnFleet fleets[2];
+//descriptors the process may open, both sides of a fleet need CONNS of them
+static rlim_t fd_limit;
+
+static size_t on_conn_data(EvLoop *loop, int fd, const char *data, ssize_t n, void *arg){
+    ConnFleet *f = arg;
+    if(n <= 0){
+        evloop_del(loop, fd);
+        close(fd);
+        return 0;
+    }
+    if(send(fd, data, n, MSG_NOSIGNAL) != n){
+        perror("echo");
+    }
+    f->echoed += n;
+    return n;
+}
+
+static void on_conn(EvLoop *loop, int fd, int client_fd, void *arg){
+    ConnFleet *f = arg;
+    (void)fd;
+    if(f->accepted == CONNS || evloop_add(loop, client_fd, EV_READ, NULL, f) < 0 ||
+       evloop_recv(loop, client_fd, on_conn_data) < 0){
+        close(client_fd);
+        return;
+    }
+    f->fds[f->accepted++] = client_fd;
+}
+
+//the client side: connects CONNS sockets, then for every byte on go sends one message on each and reads every echo
+static void conn_clients(const struct sockaddr_in *addr, int go, int done){
+    static int fds[CONNS];
+    char msg[CONN_MSG] = {0};
+    char c;
+    //nothing inherited is needed here, and the room is
+    for(int fd = 3; fd < (int)fd_limit; fd++){
+        if(fd != go && fd != done){
+            close(fd);
+        }
+    }
+    for(int i = 0; i < CONNS; i++){
+        fds[i] = socket(AF_INET, SOCK_STREAM, 0);
+        if(fds[i] < 0 || connect(fds[i], (const struct sockaddr *)addr, sizeof(*addr)) < 0){
+            perror("fleet connect");
+            _exit(1);
+        }
+    }
+    while(read(go, &c, 1) == 1){
+        for(int i = 0; i < CONNS; i++){
+            if(send(fds[i], msg, sizeof(msg), 0) != sizeof(msg)){
+                _exit(1);
+            }
+        }
+        for(int i = 0; i < CONNS; i++){
+            if(recv(fds[i], msg, sizeof(msg), MSG_WAITALL) != sizeof(msg)){
+                _exit(1);
+            }
+        }
+        if(write(done, &c, 1) != 1){
+            _exit(1);
+        }
+    }
+    _exit(0);
+}
+
+//closes a fleet's connections and ends its child, the descriptor table does not hold two
+static void conn_fleet_stop(ConnFleet *f){
+    if(f->loop == NULL){
+        return;
+    }
+    for(long i = 0; i < f->accepted; i++){
+        evloop_del(f->loop, f->fds[i]);
+        close(f->fds[i]);
+    }
+    close(f->listen_fd);
+    close(f->go);
+    close(f->done);
+    if(f->pid > 0){
+        waitpid(f->pid, NULL, 0);
+    }
+    evloop_destroy(f->loop);
+    memset(f, 0, sizeof(*f));
+}
+
+//sets up a backend's fleet on first use: its own loop, a listener and the child holding CONNS connections to it
+static int conn_fleet_start(int backend){
+    ConnFleet *f = &fleets[backend];
+    struct sockaddr_in addr = {0};
+    socklen_t len = sizeof(addr);
+    int go[2], done[2];
+    if(f->loop != NULL){
+        return 0;
+    }
+    conn_fleet_stop(&fleets[!backend]);
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    f->loop = evloop_create(backend);
+    f->listen_fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if(f->loop == NULL || f->listen_fd < 0 || bind(f->listen_fd, (struct sockaddr *)&addr, sizeof(addr)) < 0 ||
+       listen(f->listen_fd, SOMAXCONN) < 0 || getsockname(f->listen_fd, (struct sockaddr *)&addr, &len) < 0 ||
+       evloop_accept(f->loop, f->listen_fd, on_conn, f) < 0 || pipe2(go, O_CLOEXEC) < 0 || pipe2(done, O_CLOEXEC) < 0){
+        perror("fleet setup");
+        return -1;
+    }
+    f->pid = fork();
+    if(f->pid == 0){
+        conn_clients(&addr, go[0], done[1]);
+    }
+    close(go[0]);
+    close(done[1]);
+    f->go = go[1];
+    f->done = done[0];
+    double deadline = now_ns() + 30e9;
+    while(f->pid > 0 && f->accepted < CONNS && now_ns() < deadline && evloop_run_once(f->loop, 1000) >= 0){
+    }
+    if(f->accepted < CONNS){
+        fprintf(stderr, "fleet setup: %ld of %d connections\n", f->accepted, CONNS);
+        return -1;
+    }
+    return 0;
+}
+
+static void conn_rounds(int backend, int iters){
+    ConnFleet *f = &fleets[backend];
+    char c = 'x';
+    if(conn_fleet_start(backend) < 0){
+        exit(1);
+    }
+    for(int done = 0; done < iters; done += CONNS){
+        f->echoed = 0;
+        if(write(f->go, &c, 1) != 1){
+            return;
+        }
+        while(f->echoed < (long)CONNS * CONN_MSG && evloop_run_once(f->loop, -1) >= 0){
+        }
+        if(read(f->done, &c, 1) != 1){
+            return;
+        }
+    }
+}
+
+static void bench_conns_epoll(int iters){
+    conn_rounds(EVLOOP_EPOLL, iters);
+}
+
+static void bench_conns_uring(int iters){
+    conn_rounds(EVLOOP_URING, iters);
+}
+
+/* ---- server ---- */
+
+/*session setup through the real server binary at several worker counts (-w): CONNECT_THREADS client threads connect,
+send exit and wait for the server to hang up; one operation is one session opened and closed
+*/
+static char server_path[600];
+static pid_t server_pid;
+static int server_workers;          //-w of the running server, 0 if none
+static struct sockaddr_in server_addr;
+
+static void server_stop(void){
+    if(server_pid > 0){
+        kill(server_pid, SIGTERM);
+        waitpid(server_pid, NULL, 0);
+    }
+    server_pid = 0;
+    server_workers = 0;
+}
+
+//one session: connect, exit, wait for the close; returns -1 if the server could not be reached
+static int server_session(void){
+    char buf[64];
+    int fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if(fd < 0 || connect(fd, (struct sockaddr *)&server_addr, sizeof(server_addr)) < 0){
+        if(fd >= 0){
+            close(fd);
+        }
+        return -1;
+    }
+    send_line(fd, "exit");
+    while(recv(fd, buf, sizeof(buf), 0) > 0){
+    }
+    close(fd);
+    return 0;
+}
+
+//starts the server with that many workers on a free loopback port (the one running with another count is stopped)
+static int server_start(int workers){
+    socklen_t len = sizeof(server_addr);
+    char address[32], count[16];
+    if(server_workers == workers){
+        return 0;
+    }
+    server_stop();
+
+    //a free port: bound, read back and released for the server
+    int fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    memset(&server_addr, 0, sizeof(server_addr));
+    server_addr.sin_family = AF_INET;
+    server_addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if(fd < 0 || bind(fd, (struct sockaddr *)&server_addr, sizeof(server_addr)) < 0 ||
+       getsockname(fd, (struct sockaddr *)&server_addr, &len) < 0){
+        perror("server port");
+        return -1;
+    }
+    close(fd);
+    snprintf(address, sizeof(address), "127.0.0.1:%d", ntohs(server_addr.sin_port));
+    snprintf(count, sizeof(count), "%d", workers);
+
+    server_pid = fork();
+    if(server_pid == 0){
+        dup2(devnull, STDOUT_FILENO);
+        dup2(devnull, STDERR_FILENO);
+        execl(server_path, server_path, "-w", count, address, (char *)NULL);
+        _exit(127);
+    }
+    for(int i = 0; i < 500 && server_pid > 0; i++){
+        if(server_session() == 0){
+            server_workers = workers;
+            return 0;
+        }
+        usleep(10000);
+    }
+    fprintf(stderr, "%s did not come up on %s\n", server_path, address);
+    server_stop();
+    return -1;
+}
+
+static void *connect_thread(void *arg){
+    int n = *(int *)arg;
+    for(int i = 0; i < n; i++){
+        if(server_session() < 0){
+            perror("connect");
+            break;
+        }
+    }
+    return NULL;
+}
+
+static void server_connects(int workers, int iters){
+    pthread_t threads[CONNECT_THREADS];
+    int share[CONNECT_THREADS];
+    if(server_start(workers) < 0){
+        return;
+    }
+    for(int i = 0; i < CONNECT_THREADS; i++){
+        share[i] = iters / CONNECT_THREADS + (i < iters % CONNECT_THREADS);
+        pthread_create(&threads[i], NULL, connect_thread, &share[i]);
+    }
+    for(int i = 0; i < CONNECT_THREADS; i++){
+        pthread_join(threads[i], NULL);
+    }
+}
+
+static void bench_connect_w1(int iters){
+    server_connects(1, iters);
+}
+
+static void bench_connect_w2(int iters){
+    server_connects(2, iters);
+}
+
+static void bench_connect_w4(int iters){
+    server_connects(4, iters);
+}
+
+/* ---- output transports ---- */
+
+//ring the relay benchmark shares between "server" and "client", both ends live in this process
+static ShmRing relay_ring;
+static int relay_sock[2];
+
+//writes PIPE_INPUT_BYTES into a pipe and closes it, like a command printing a large result
+static void *output_writer(void *arg){
+    static char chunk[64 * 1024];
+    int fd = *(int *)arg;
+    for(size_t left = PIPE_INPUT_BYTES; left > 0; ){
+        ssize_t n = write(fd, chunk, left < sizeof(chunk) ? left : sizeof(chunk));
+        if(n <= 0){
+            break;
+        }
+        left -= n;
+    }
+    close(fd);
+    return NULL;
+}
+
+/*moves one command's output from its pipe to the consumer's stdout (/dev/null) the way the server relays it:
+through a socket (read, send, recv, write) or through the shared ring (readv into the ring, write from it)
+*/
+static void relay_output(int use_ring){
+    static char buf[RELAY_CHUNK];
+    int fds[2];
+    pthread_t writer;
+    if(pipe(fds) < 0){
+        return;
+    }
+    pthread_create(&writer, NULL, output_writer, &fds[1]);
+    while(1){
+        ssize_t n;
+        if(use_ring){
+            n = shmring_fill(&relay_ring, fds[0]);
+            for(size_t left = n > 0 ? n : 0; left > 0; ){
+                const char *p;
+                size_t m = shmring_peek(&relay_ring, left, &p);
+                if(write(devnull, p, m) < 0){
+                    break;
+                }
+                shmring_advance(&relay_ring, m);
+                left -= m;
+            }
+        }else if((n = read(fds[0], buf, sizeof(buf))) > 0){
+            if(send(relay_sock[0], buf, n, 0) != n || recv(relay_sock[1], buf, n, MSG_WAITALL) != n || write(devnull, buf, n) < 0){
+                break;
+            }
+        }
+        if(n <= 0){
+            break;
+        }
+    }
+    pthread_join(writer, NULL);
+    close(fds[0]);
+}
+
+static void bench_relay_socket(int iters){
+    for(int i = 0; i < iters; i++){
+        relay_output(0);
+    }
+}
+
+static void bench_relay_shm(int iters){
+    for(int i = 0; i < iters; i++){
+        relay_output(1);
+    }
+}
+
+/*a command's output through evloop_relay, the way the server sends frames on io_uring: header and payload read from
+the pipe and sent as one linked pair (emulated on epoll); a thread drains the other end of the socket
+*/
+static int relay_pairs[2][2];
+static int relay_busy;
+static int relay_eof;
+
+//the relay socket is only written to, through evloop_relay
+static void on_relay_socket(EvLoop *loop, int fd, int events, void *arg){
+    (void)loop;
+    (void)fd;
+    (void)events;
+    (void)arg;
+}
+
+static void *drain_thread(void *arg){
+    static char sink[64 * 1024];
+    int fd = *(int *)arg;
+    while(read(fd, sink, sizeof(sink)) > 0){
+    }
+    return NULL;
+}
+
+static void on_relay_done(EvLoop *loop, int fd, const char *buf, ssize_t nread, ssize_t nsent, void *arg){
+    size_t frame = sizeof(uint32_t) + (nread > 0 ? nread : 0);
+    size_t sent = nsent > 0 ? nsent : 0;
+    (void)loop;
+    (void)arg;
+    //what the socket did not take goes out blocking, the server queues it instead
+    if(nread > 0 && sent < frame && send(fd, buf + sent, frame - sent, MSG_NOSIGNAL) < 0){
+        perror("relay send");
+    }
+    relay_busy = 0;
+}
+
+static void on_relay_pipe(EvLoop *loop, int fd, int events, void *arg){
+    int avail;
+    int backend = (int)(long)arg;
+    (void)events;
+    if(relay_busy){
+        return;
+    }
+    if(ioctl(fd, FIONREAD, &avail) < 0 || avail <= 0){
+        relay_eof = 1;
+        return;
+    }
+    if(avail > RELAY_CHUNK){
+        avail = RELAY_CHUNK;
+    }
+    uint32_t header = FRAME_HEADER(FRAME_OUT, avail);
+    relay_busy = evloop_relay(loop, relay_pairs[backend][0], fd, &header, sizeof(header), avail, on_relay_done) == 0;
+}
+
+static void relay_linked(int backend, int iters){
+    EvLoop *lp = loops[backend];
+    for(int i = 0; i < iters; i++){
+        int fds[2];
+        pthread_t writer;
+        if(pipe2(fds, O_CLOEXEC) < 0){
+            return;
+        }
+        pthread_create(&writer, NULL, output_writer, &fds[1]);
+        relay_eof = 0;
+        evloop_add(lp, fds[0], EV_READ, on_relay_pipe, (void *)(long)backend);
+        while((!relay_eof || relay_busy) && evloop_run_once(lp, -1) >= 0){
+            evloop_mod(lp, fds[0], relay_busy ? 0 : EV_READ);
+        }
+        evloop_del(lp, fds[0]);
+        pthread_join(writer, NULL);
+        close(fds[0]);
+    }
+}
+
+static void bench_relay_linked_epoll(int iters){
+    relay_linked(EVLOOP_EPOLL, iters);
+}
+
+static void bench_relay_linked_uring(int iters){
+    relay_linked(EVLOOP_URING, iters);
+}
+
+/* ---- output compression ---- */
+
+static char lz_input[LZ_MAX_BLOCK];
+static char lz_output[LZ_MAX_BLOCK];
+static int lz_compressed;
+
+static void bench_lz_compress(int iters){
+    for(int i = 0; i < iters; i++){
+        lz_compressed = lz_compress(lz_input, sizeof(lz_input), lz_output, sizeof(lz_output));
+    }
+}
+
+static void bench_lz_decompress(int iters){
+    static char raw[LZ_MAX_BLOCK];
+    for(int i = 0; i < iters; i++){
+        lz_decompress(lz_output, lz_compressed, raw, sizeof(raw));
+    }
+}
+
+/* ---- availability, checked after setup ---- */
+
+static const char *need_myshell(void){
+    return myshell_path[0] ? NULL : "shell not found";
+}
+
+static const char *need_dash(void){
+    return dash_path[0] ? NULL : "shell not found";
+}
+
+static const char *need_server(void){
+    return server_path[0] ? NULL : "server not found";
+}
+
+static const char *need_uring(void){
+    return evloop_backend(loops[EVLOOP_URING]) == EVLOOP_URING ? NULL : "io_uring unavailable";
+}
+
+static const char *need_fds(void){
+    return fd_limit >= CONNS + 256 ? NULL : "descriptor limit";
+}
+
+static const char *need_uring_fds(void){
+    return need_uring() ? need_uring() : need_fds();
+}
+
+static Bench benches[] = {
+    {"tokenize",              20000, 30, 0,                bench_tokenize, NULL},
+    {"parse_pipeline",        20000, 30, 0,                bench_parse, NULL},
+    {"parse_expand",          20000, 30, 0,                bench_parse_expand, NULL},
+    {"subst_builtin",         20000, 30, 0,                bench_subst_builtin, NULL},
+    {"subst_forked",            100, 20, 0,                bench_subst_forked, NULL},
+    {"script_subst_myshell",      1, 15, 0,                bench_script_myshell, need_myshell},
+    {"script_subst_dash",         1, 15, 0,                bench_script_dash, need_dash},
+    {"apply_globbing_5000",      20, 20, 0,                bench_glob, NULL},
+    {"complete_command_g",     2000, 20, 0,                bench_complete, NULL},
+    {"complete_dir_100k",      2000, 20, 0,                bench_complete_dir, NULL},
+    {"spawn_true",              100, 20, 0,                bench_spawn, NULL},
+    {"spawn_parsed_true",       100, 20, 0,                bench_spawn_parsed, NULL},
+    {"spawn_prepared_true",     100, 20, 0,                bench_spawn_prepared, NULL},
+    {"pipeline_grep_wc_builtin",  1, 15, PIPE_INPUT_BYTES, bench_pipe_builtin, NULL},
+    {"pipeline_grep_wc_forked",   1, 15, PIPE_INPUT_BYTES, bench_pipe_forked, NULL},
+    {"pipeline_cat_2",            1, 15, PIPE_INPUT_BYTES, bench_cat2, NULL},
+    {"pipeline_cat_10",           1, 15, PIPE_INPUT_BYTES, bench_cat10, NULL},
+    {"timeout_kill_group_3",    100, 20, 0,                bench_timeout_kill, NULL},
+    {"line_rtt_unix",         10000, 20, 0,                bench_rtt_unix, NULL},
+    {"line_rtt_tcp",          10000, 20, 0,                bench_rtt_tcp, NULL},
+    {"evloop_pingpong_epoll", 20000, 20, 0,                bench_evloop_epoll, NULL},
+    {"evloop_pingpong_uring", 20000, 20, 0,                bench_evloop_uring, need_uring},
+    {"pidfd_reap_2000_epoll",  2000, 10, 0,                bench_reap_epoll, NULL},
+    {"pidfd_reap_2000_uring",  2000, 10, 0,                bench_reap_uring, need_uring},
+    {"server_connect_w1",       500, 10, 0,                bench_connect_w1, need_server},
+    {"server_connect_w2",       500, 10, 0,                bench_connect_w2, need_server},
+    {"server_connect_w4",       500, 10, 0,                bench_connect_w4, need_server},
+    {"evloop_conns_10k_epoll", CONNS, 10, CONN_MSG,        bench_conns_epoll, need_fds},
+    {"evloop_conns_10k_uring", CONNS, 10, CONN_MSG,        bench_conns_uring, need_uring_fds},
+    {"relay_linked_16m_epoll",    1, 15, PIPE_INPUT_BYTES, bench_relay_linked_epoll, NULL},
+    {"relay_linked_16m_uring",    1, 15, PIPE_INPUT_BYTES, bench_relay_linked_uring, need_uring},
+    {"relay_socket_16m",          1, 15, PIPE_INPUT_BYTES, bench_relay_socket, NULL},
+    {"relay_shm_16m",             1, 15, PIPE_INPUT_BYTES, bench_relay_shm, NULL},
+    {"lz_compress_64k",         200, 20, LZ_MAX_BLOCK,     bench_lz_compress, NULL},
+    {"lz_decompress_64k",       200, 20, LZ_MAX_BLOCK,     bench_lz_decompress, NULL},
+};
+
+//path of a program built next to shellbench, empty if it is not there
+static void sibling_path(const char *name, char *out, size_t size){
+    char exe[512];
+    ssize_t len = readlink("/proc/self/exe", exe, sizeof(exe) - 1);
+    out[0] = '\0';
+    if(len > 0){
+        exe[len] = '\0';
+        char *slash = strrchr(exe, '/');
+        snprintf(out, size, "%.*s/%s", slash ? (int)(slash - exe) : 1, slash ? exe : ".", name);
+        if(access(out, X_OK) != 0){
+            out[0] = '\0';
+        }
+    }
+}
+
+//creates the inputs every benchmark needs, returns -1 if the environment is unusable
+static int setup(void){
+    if(mkdtemp(workdir) == NULL){
+        perror("mkdtemp");
+        return -1;
+    }
+    devnull = open("/dev/null", O_WRONLY | O_CLOEXEC);
+
+    //text input for the pipelines: numbered lines, every tenth one contains the grep target
+    snprintf(input_path, sizeof(input_path), "%s/input.txt", workdir);
+    FILE *f = fopen(input_path, "w");
+    if(f == NULL || devnull < 0){
+        perror("setup");
+        return -1;
+    }
+    for(long i = 0, written = 0; written < PIPE_INPUT_BYTES; i++){
+        written += fprintf(f, "%08ld,field two,%s,some more text to fill the line\n", i, i % 10 ? "plain" : "needle");
+    }
+    fclose(f);
+    truncate(input_path, PIPE_INPUT_BYTES);
+
+    //a directory of files for globbing
+    char path[600];
+    for(int i = 0; i < GLOB_FILES; i++){
+        snprintf(path, sizeof(path), "%s/g%05d.txt", workdir, i);
+        int fd = open(path, O_WRONLY | O_CREAT, 0644);
+        if(fd >= 0){
+            close(fd);
+        }
+    }
+    snprintf(glob_pattern, sizeof(glob_pattern), "%s/g*.txt", workdir);
+
+    //the substitution benchmarks, and the shells the script is compared in (myshell is built next to shellbench)
+    snprintf(subst_forked_line, sizeof(subst_forked_line),
+             "echo $(%1$s/echo a b) $(%1$s/printf '%%s-%%03d' x 7) $(%1$s/pwd) $((3 * 7 + 1))",
+             access("/usr/bin/printf", X_OK) == 0 ? "/usr/bin" : "/bin");
+    snprintf(subst_script, sizeof(subst_script), "%s/subst.sh", workdir);
+    if((f = fopen(subst_script, "w")) == NULL){
+        perror(subst_script);
+        return -1;
+    }
+    for(int i = 0; i < SUBST_SCRIPT_LINES; i++){
+        fprintf(f, "v%d=\"$(echo line %d) $(printf '%%s-%%03d' x %d) $(pwd) $((%d * 7 + 1))\"\n", i % 10, i, i, i);
+    }
+    fclose(f);
+    sibling_path("myshell", myshell_path, sizeof(myshell_path));
+    sibling_path("server", server_path, sizeof(server_path));
+    snprintf(dash_path, sizeof(dash_path), "%s", access("/usr/bin/dash", X_OK) == 0 ? "/usr/bin/dash" :
+                                                  access("/bin/dash", X_OK) == 0 ? "/bin/dash" : "");
+
+    //pipelines are parsed once, the benchmarks time spawning and running them
+    pl_spawn = prepare("true");
+    pl_builtin = prepare("cat %s | grep needle | wc -l");
+    //explicit paths always fork+exec the real tools, for comparison with the builtin filters
+    char forked[1024];
+    const char *bin = access("/usr/bin/grep", X_OK) == 0 ? "/usr/bin" : "/bin";
+    snprintf(forked, sizeof(forked), "cat %%s | %s/grep needle | %s/wc -l", bin, bin);
+    pl_forked = prepare(forked);
+    pl_cat2 = prepare("cat %s | cat");
+    pl_cat10 = prepare("cat %s | cat | cat | cat | cat | cat | cat | cat | cat | cat");
+    pl_sleep3 = prepare("sleep 30 | sleep 30 | sleep 30");
+    prep_true = prepare_pipeline("true --version");
+
+    //one echo thread per transport
+    static pthread_t echo[2];
+    if(socketpair(AF_UNIX, SOCK_STREAM, 0, rtt_unix) < 0 || tcp_pair(rtt_tcp) < 0){
+        perror("socket pairs");
+        return -1;
+    }
+    pthread_create(&echo[0], NULL, echo_thread, &rtt_unix[1]);
+    pthread_create(&echo[1], NULL, echo_thread, &rtt_tcp[1]);
+
+    //one loop per backend, each with its own socket pair
+    for(int b = 0; b < 2; b++){
+        loops[b] = evloop_create(b);
+        if(loops[b] == NULL || socketpair(AF_UNIX, SOCK_STREAM, 0, ping[b]) < 0 ||
+           evloop_add(loops[b], ping[b][1], EV_READ, on_ping, NULL) < 0){
+            perror("event loop");
+            return -1;
+        }
+    }
+
+    //a drained socket per backend for the linked relay, and room for the connection fleets
+    static pthread_t drain[2];
+    for(int b = 0; b < 2; b++){
+        if(socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, relay_pairs[b]) < 0 ||
+           evloop_add(loops[b], relay_pairs[b][0], 0, on_relay_socket, NULL) < 0){
+            perror("relay setup");
+            return -1;
+        }
+        pthread_create(&drain[b], NULL, drain_thread, &relay_pairs[b][1]);
+    }
+    struct rlimit rl;
+    if(getrlimit(RLIMIT_NOFILE, &rl) == 0){
+        rl.rlim_cur = rl.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &rl);
+        fd_limit = rl.rlim_cur;
+    }
+
+    //the shared ring a co-located client would pass, and a socket pair for the framed path to compare with
+    int memfd = shmring_create(&relay_ring, 4 * 1024 * 1024);
+    if(memfd < 0 || socketpair(AF_UNIX, SOCK_STREAM, 0, relay_sock) < 0){
+        perror("relay setup");
+        return -1;
+    }
+    close(memfd);
+
+    //compressible input: the kind of text commands print
+    for(int n = 0, i = 0; n < (int)sizeof(lz_input); i++){
+        char line[64];
+        int len = snprintf(line, sizeof(line), "%d\tdrwxr-xr-x root root %d file%d.txt\n", i, i * 7 % 4096, i);
+        int take = len < (int)sizeof(lz_input) - n ? len : (int)sizeof(lz_input) - n;
+        memcpy(lz_input + n, line, take);
+        n += take;
+    }
+    lz_compressed = lz_compress(lz_input, sizeof(lz_input), lz_output, sizeof(lz_output));
+    return 0;
+}
+
+static void cleanup(void){
+    char cmd[600];
+    server_stop();
+    snprintf(cmd, sizeof(cmd), "rm -rf '%s'", workdir);
+    if(system(cmd) != 0){
+        fprintf(stderr, "could not remove %s\n", workdir);
+    }
+}
+
+static int compare_double(const void *a, const void *b){
+    double x = *(const double *)a;
+    double y = *(const double *)b;
+    return x < y ? -1 : x > y;
+}
+
+int main(int argc, char *argv[]){
+    int reps = 0, warmup = 2;
+    const char *filter = NULL;
+    const char *json_path = NULL;
+    int opt;
+
+    while((opt = getopt(argc, argv, "r:w:f:j:")) != -1){
+        if(opt == 'r' && atoi(optarg) > 0 && atoi(optarg) <= MAX_REPS){
+            reps = atoi(optarg);
+        }else if(opt == 'w' && atoi(optarg) >= 0){
+            warmup = atoi(optarg);
+        }else if(opt == 'f'){
+            filter = optarg;
+        }else if(opt == 'j'){
+            json_path = optarg;
+        }else{
+            fprintf(stderr, "Usage: %s [-r reps] [-w warmup] [-f name-filter] [-j out.json]\n", argv[0]);
+            return 1;
+        }
+    }
+
+    if(setup() < 0){
+        cleanup();
+        return 1;
+    }
+
+    FILE *json = NULL;
+    if(json_path != NULL && (json = fopen(json_path, "w")) == NULL){
+        perror(json_path);
+        cleanup();
+        return 1;
+    }
+    if(json){
+        fprintf(json, "{\n  \"benchmarks\": [");
+    }
+
+    printf("%-26s %12s %12s %12s %10s %10s\n", "benchmark", "median", "p99", "mean", "stddev%", "MB/s");
+    int first = 1;
+    for(size_t b = 0; b < sizeof(benches) / sizeof(benches[0]); b++){
+        Bench *bench = &benches[b];
+        if(filter != NULL && strstr(bench->name, filter) == NULL){
+            continue;
+        }
+        const char *missing = bench->missing ? bench->missing() : NULL;
+        if(missing != NULL){
+            printf("%-26s skipped (%s)\n", bench->name, missing);
+            continue;
+        }
+
+        int n = reps ? reps : bench->reps;
+        double samples[MAX_REPS];
+        for(int i = 0; i < warmup; i++){
+            bench->run(bench->iters);
+        }
+        for(int i = 0; i < n; i++){
+            double start = now_ns();
+            bench->run(bench->iters);
+            samples[i] = (now_ns() - start) / bench->iters;
+        }
+
+        //statistics over the per-operation times
+        double sum = 0, var = 0;
+        for(int i = 0; i < n; i++){
+            sum += samples[i];
+        }
+        double mean = sum / n;
+        for(int i = 0; i < n; i++){
+            var += (samples[i] - mean) * (samples[i] - mean);
+        }
+        double stddev = n > 1 ? sqrt(var / (n - 1)) : 0;
+        qsort(samples, n, sizeof(double), compare_double);
+        double median = n % 2 ? samples[n / 2] : (samples[n / 2 - 1] + samples[n / 2]) / 2;
+        double p99 = samples[(int)ceil(0.99 * n) - 1];
+        double mbps = bench->bytes ? bench->bytes / (median / 1e9) / (1024 * 1024) : 0;
+
+        printf("%-26s %10.0fns %10.0fns %10.0fns %9.1f%% ", bench->name, median, p99, mean, 100 * stddev / mean);
+        if(mbps > 0){
+            printf("%10.1f\n", mbps);
+        }else{
+            printf("%10s\n", "-");
+        }
+        fflush(stdout);
+
+        if(json){
+            fprintf(json, "%s\n    {\"name\": \"%s\", \"unit\": \"ns/op\", \"reps\": %d, \"iters\": %d, "
+                    "\"median\": %.1f, \"p99\": %.1f, \"mean\": %.1f, \"stddev\": %.1f, \"min\": %.1f, \"mb_per_s\": %.1f}",
+                    first ? "" : ",", bench->name, n, bench->iters, median, p99, mean, stddev, samples[0], mbps);
+        }
+        first = 0;
+    }
+
+    if(json){
+        fprintf(json, "\n  ]\n}\n");
+        fclose(json);
+    }
+
+    //the echo threads go away with the process
+    cleanup();
+    return 0;
+}
@@ -0,0 +1,499 @@
+#define _GNU_SOURCE
+#include "exec.h"
+#include "shellcore.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
+#include <fcntl.h>
+#include <ftw.h>
+#include <poll.h>
+#include <signal.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+/*differential conformance runner: every command line of the corpus runs through myshell and through a reference shell,
+each in a fresh sandbox directory holding the same fixture files, and the two runs must agree on stdout, stderr,
+exit status and the files left in the sandbox
+corpus format: one command line per line (a line starting here-documents takes their bodies from the lines after it),
+blank lines and lines starting with # are skipped, a directive
+  #@ ignore stdout stderr status files
+right before a case excludes those parts from its comparison (e.g. where myshell's own error messages differ from sh)
+usage: shellconform [-s shell] [-r reference] [-j jobs] [-t timeout] [-v] [corpus...]   (stdin without corpus files)
+*/
+
+//longest command line myshell accepts
+#define MAX_LINE 1024
+//output kept per stream, anything beyond it is compared by length only
+#define MAX_CAPTURE (1024 * 1024)
+//bytes of a mismatching value shown in a report
+#define SHOW_BYTES 200
+
+//parts of a run that are compared
+#define CMP_STDOUT 1
+#define CMP_STDERR 2
+#define CMP_STATUS 4
+#define CMP_FILES 8
+#define CMP_ALL (CMP_STDOUT | CMP_STDERR | CMP_STATUS | CMP_FILES)
+
+typedef struct {
+    char *line;
+    const char *where;          //corpus file
+    int lineno;
+    int compare;                //CMP_* bits
+    char *report;               //NULL if the shells agreed
+} Case;
+
+//what one shell did with one case
+typedef struct {
+    char *out, *err;
+    size_t nout, nerr;
+    int status;                 //exit status as sh reports it, -1 on timeout
+    char *files;                //"name size\n" plus contents of every sandbox file, sorted by name
+    size_t nfiles;
+} Run;
+
+//fixture created in every sandbox
+static const struct { const char *name; const char *data; } fixture[] = {
+    {"a.txt", "alpha\nbeta\ngamma\ndelta\nepsilon\n"},
+    {"b.txt", "one two three\nfour five\n\nsix\n"},
+    {"nums.txt", "10\n9\n200\n3\n-1\n42\n7\n"},
+    {"fields.csv", "id,name,score\n1,ann,90\n2,bob,75\n3,cy,88\n"},
+    {"space name.txt", "file with a space\n"},
+};
+
+static const char *shell_path = "./myshell";
+static const char *ref_path = "/bin/sh";
+static int timeout_ms = 5000;
+static int verbose = 0;
+
+static Case *cases;
+static int ncases;
+static int next_case;           //claimed with an atomic increment by the workers
+
+/* ---- corpus ---- */
+
+//parses a #@ directive, returns the compare mask it leaves
+static int parse_directive(const char *d, const char *where, int lineno){
+    int mask = CMP_ALL;
+    char buf[MAX_LINE];
+    char *save;
+    snprintf(buf, sizeof(buf), "%s", d);
+    char *w = strtok_r(buf, " \t", &save);
+    if(w == NULL || strcmp(w, "ignore") != 0){
+        fprintf(stderr, "%s:%d: unknown directive\n", where, lineno);
+        return mask;
+    }
+    while((w = strtok_r(NULL, " \t", &save)) != NULL){
+        if(strcmp(w, "stdout") == 0) mask &= ~CMP_STDOUT;
+        else if(strcmp(w, "stderr") == 0) mask &= ~CMP_STDERR;
+        else if(strcmp(w, "status") == 0) mask &= ~CMP_STATUS;
+        else if(strcmp(w, "files") == 0) mask &= ~CMP_FILES;
+        else fprintf(stderr, "%s:%d: unknown part '%s'\n", where, lineno, w);
+    }
+    return mask;
+}
+
+static int load_corpus(FILE *f, const char *where){
+    char line[MAX_LINE + 2];
+    int lineno = 0, mask = CMP_ALL;
+    static int cap = 0;
+
+    while(fgets(line, sizeof(line), f) != NULL){
+        lineno++;
+        line[strcspn(line, "\n")] = '\0';
+        if(strncmp(line, "#@", 2) == 0){
+            mask = parse_directive(line + 2, where, lineno);
+            continue;
+        }
+        if(line[strspn(line, " \t")] == '\0' || line[0] == '#'){
+            continue;
+        }
+        int first = lineno;
+        size_t len = strlen(line);
+        //here-document bodies up to their delimiters belong to the case, as a shell reading the line would take them
+        while(len < MAX_LINE && heredoc_pending(line) > 0 && fgets(line + len + 1, sizeof(line) - len - 1, f) != NULL){
+            lineno++;
+            line[len] = '\n';
+            line[len + 1 + strcspn(line + len + 1, "\n")] = '\0';
+            len = strlen(line);
+        }
+        if(len >= MAX_LINE){
+            fprintf(stderr, "%s:%d: line too long, skipped\n", where, first);
+            continue;
+        }
+        if(ncases == cap){
+            cap = cap ? cap * 2 : 256;
+            Case *tmp = realloc(cases, cap * sizeof(Case));
+            if(!tmp){
+                perror("realloc");
+                return -1;
+            }
+            cases = tmp;
+        }
+        cases[ncases++] = (Case){ strdup(line), where, first, mask, NULL };
+        mask = CMP_ALL;
+    }
+    return 0;
+}
+
+/* ---- sandbox ---- */
+
+static int write_file(const char *dir, const char *name, const char *data){
+    char path[PATH_MAX];
+    snprintf(path, sizeof(path), "%s/%s", dir, name);
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if(fd < 0){
+        return -1;
+    }
+    ssize_t n = write(fd, data, strlen(data));
+    close(fd);
+    return n == (ssize_t)strlen(data) ? 0 : -1;
+}
+
+static int make_sandbox(char *dir){
+    strcpy(dir, "/tmp/shellconform.XXXXXX");
+    if(mkdtemp(dir) == NULL){
+        perror("mkdtemp");
+        dir[0] = '\0';
+        return -1;
+    }
+    for(size_t i = 0; i < sizeof(fixture) / sizeof(fixture[0]); i++){
+        if(write_file(dir, fixture[i].name, fixture[i].data) < 0){
+            perror("fixture");
+            return -1;
+        }
+    }
+    return 0;
+}
+
+static int remove_entry(const char *path, const struct stat *st, int type, struct FTW *ftw){
+    (void)st;
+    (void)type;
+    (void)ftw;
+    remove(path);
+    return 0;
+}
+
+static void remove_sandbox(const char *dir){
+    nftw(dir, remove_entry, 16, FTW_DEPTH | FTW_PHYS);
+}
+
+static int compare_names(const void *a, const void *b){
+    return strcmp(*(char *const *)a, *(char *const *)b);
+}
+
+//appends n bytes to a growing buffer, silently stops at MAX_CAPTURE
+static void append(char **buf, size_t *len, size_t *cap, const char *data, size_t n){
+    if(*len + n > MAX_CAPTURE){
+        n = MAX_CAPTURE - *len;
+    }
+    if(*len + n > *cap){
+        size_t c = *cap ? *cap : 4096;
+        while(c < *len + n) c *= 2;
+        char *tmp = realloc(*buf, c);
+        if(!tmp){
+            return;
+        }
+        *buf = tmp;
+        *cap = c;
+    }
+    memcpy(*buf + *len, data, n);
+    *len += n;
+}
+
+//snapshot of the sandbox: every regular file's name, size and contents, directories by name, in sorted order
+static void snapshot(const char *dir, Run *r){
+    DIR *d = opendir(dir);
+    if(!d){
+        return;
+    }
+    char *names[256];
+    int n = 0;
+    struct dirent *e;
+    while((e = readdir(d)) != NULL && n < 256){
+        if(strcmp(e->d_name, ".") != 0 && strcmp(e->d_name, "..") != 0){
+            names[n++] = strdup(e->d_name);
+        }
+    }
+    closedir(d);
+    qsort(names, n, sizeof(char *), compare_names);
+
+    size_t cap = 0;
+    for(int i = 0; i < n; i++){
+        char path[PATH_MAX], head[PATH_MAX + 32];
+        struct stat st;
+        snprintf(path, sizeof(path), "%s/%s", dir, names[i]);
+        if(lstat(path, &st) == 0 && S_ISREG(st.st_mode)){
+            snprintf(head, sizeof(head), "%s %lld\n", names[i], (long long)st.st_size);
+            append(&r->files, &r->nfiles, &cap, head, strlen(head));
+            int fd = open(path, O_RDONLY);
+            char buf[8192];
+            ssize_t k;
+            while(fd >= 0 && (k = read(fd, buf, sizeof(buf))) > 0){
+                append(&r->files, &r->nfiles, &cap, buf, k);
+            }
+            if(fd >= 0) close(fd);
+        }else{
+            snprintf(head, sizeof(head), "%s (not a regular file)\n", names[i]);
+            append(&r->files, &r->nfiles, &cap, head, strlen(head));
+        }
+        free(names[i]);
+    }
+}
+
+/* ---- running a shell ---- */
+
+//reads a memfd back from the start
+static void read_capture(int fd, char **buf, size_t *len){
+    size_t cap = 0;
+    char tmp[8192];
+    ssize_t k;
+    lseek(fd, 0, SEEK_SET);
+    while((k = read(fd, tmp, sizeof(tmp))) > 0){
+        append(buf, len, &cap, tmp, k);
+    }
+}
+
+/*runs shell with the command line on its stdin inside dir, output goes to memfds so nothing can block on a full pipe
+the shell gets the line followed by EOF, so both shells see the same stdin
+*/
+static int run_shell(const char *shell, const char *line, const char *dir, Run *r){
+    memset(r, 0, sizeof(*r));
+    int in[2];
+    int out = memfd_create("stdout", MFD_CLOEXEC);
+    int err = memfd_create("stderr", MFD_CLOEXEC);
+    if(out < 0 || err < 0 || pipe2(in, O_CLOEXEC) < 0){
+        perror("run_shell");
+        return -1;
+    }
+
+    pid_t pid = fork();
+    if(pid < 0){
+        perror("fork failed");
+        return -1;
+    }
+    if(pid == 0){
+        //only async-signal-safe calls, the runner forks from several threads
+        if(chdir(dir) < 0 || dup2(in[0], STDIN_FILENO) < 0 || dup2(out, STDOUT_FILENO) < 0 || dup2(err, STDERR_FILENO) < 0){
+            _exit(126);
+        }
+        setpgid(0, 0);          //own process group so a timeout kills the whole pipeline
+        execlp(shell, shell, (char *)NULL);
+        dprintf(STDERR_FILENO, "%s: %s\n", shell, strerror(errno));
+        _exit(127);
+    }
+    close(in[0]);
+    dprintf(in[1], "%s\n", line);
+    close(in[1]);
+
+    //wait through a pidfd so a runaway command can be timed out
+    int pfd = open_pidfd(pid);
+    int status;
+    struct pollfd p = { pfd, POLLIN, 0 };
+    if(pfd >= 0 && poll(&p, 1, timeout_ms) == 0){
+        kill(-pid, SIGKILL);
+        kill(pid, SIGKILL);
+        waitpid(pid, &status, 0);
+        r->status = -1;
+    }else{
+        waitpid(pid, &status, 0);
+        r->status = WIFEXITED(status) ? WEXITSTATUS(status) : 128 + WTERMSIG(status);
+    }
+    if(pfd >= 0) close(pfd);
+
+    read_capture(out, &r->out, &r->nout);
+    read_capture(err, &r->err, &r->nerr);
+    close(out);
+    close(err);
+    snapshot(dir, r);
+    return 0;
+}
+
+//myshell prints "$ " before reading every line: once before the case and once before EOF,
+//and "> " before each here-document line of the case
+static void strip_prompts(Run *r, const char *line){
+    size_t lead = 2;
+    for(const char *p = line; (p = strchr(p, '\n')) != NULL; p++){
+        lead += 2;
+    }
+    if(r->nout >= 2 && memcmp(r->out, "$ ", 2) == 0){
+        for(size_t i = 2; i < lead; i += 2){
+            if(i + 2 > r->nout || memcmp(r->out + i, "> ", 2) != 0){
+                lead = i;
+                break;
+            }
+        }
+        memmove(r->out, r->out + lead, r->nout - lead);
+        r->nout -= lead;
+    }
+    if(r->nout >= 2 && memcmp(r->out + r->nout - 2, "$ ", 2) == 0){
+        r->nout -= 2;
+    }
+}
+
+static void free_run(Run *r){
+    free(r->out);
+    free(r->err);
+    free(r->files);
+}
+
+/* ---- comparison ---- */
+
+//prints a value for a report, non-printable bytes escaped, cut after SHOW_BYTES
+static void show(FILE *f, const char *data, size_t n){
+    fputc('"', f);
+    for(size_t i = 0; i < n && i < SHOW_BYTES; i++){
+        unsigned char c = data[i];
+        if(c == '\n') fputs("\\n", f);
+        else if(c == '"' || c == '\\') fprintf(f, "\\%c", c);
+        else if(c < 32 || c > 126) fprintf(f, "\\x%02x", c);
+        else fputc(c, f);
+    }
+    fputc('"', f);
+    if(n > SHOW_BYTES) fprintf(f, "... (%zu bytes)", n);
+}
+
+static void diff_part(FILE *f, const char *part, const char *a, size_t na, const char *b, size_t nb){
+    if(na == nb && (na == 0 || memcmp(a, b, na) == 0)){
+        return;
+    }
+    fprintf(f, "  %s differs\n    myshell:   ", part);
+    show(f, a, na);
+    fprintf(f, "\n    reference: ");
+    show(f, b, nb);
+    fputc('\n', f);
+}
+
+//runs one case through both shells, leaves a report in c->report if they disagree
+static void run_case(Case *c){
+    char dir_a[32] = "", dir_b[32] = "";
+    Run a = {0}, b = {0};
+    char *report = NULL;
+    size_t len = 0;
+    FILE *f = open_memstream(&report, &len);
+
+    if(make_sandbox(dir_a) < 0 || make_sandbox(dir_b) < 0 ||
+       run_shell(shell_path, c->line, dir_a, &a) < 0 || run_shell(ref_path, c->line, dir_b, &b) < 0){
+        fprintf(f, "  could not run the case\n");
+    }else{
+        strip_prompts(&a, c->line);
+        if(a.status == -1){
+            fprintf(f, "  myshell timed out after %d ms\n", timeout_ms);      //a hang is a failure even if the reference hangs too
+        }else if((c->compare & CMP_STATUS) && a.status != b.status){
+            fprintf(f, "  exit status differs: myshell %d, reference %d (-1 = timed out)\n", a.status, b.status);
+        }
+        if(c->compare & CMP_STDOUT) diff_part(f, "stdout", a.out, a.nout, b.out, b.nout);
+        if(c->compare & CMP_STDERR) diff_part(f, "stderr", a.err, a.nerr, b.err, b.nerr);
+        if(c->compare & CMP_FILES) diff_part(f, "files", a.files, a.nfiles, b.files, b.nfiles);
+    }
+    free_run(&a);
+    free_run(&b);
+    if(dir_a[0]) remove_sandbox(dir_a);
+    if(dir_b[0]) remove_sandbox(dir_b);
+    fclose(f);
+    if(len > 0){
+        c->report = report;
+    }else{
+        free(report);
+    }
+}
+
+static void *worker(void *arg){
+    (void)arg;
+    int i;
+    while((i = __atomic_fetch_add(&next_case, 1, __ATOMIC_RELAXED)) < ncases){
+        run_case(&cases[i]);
+    }
+    return NULL;
+}
+
+int main(int argc, char *argv[]){
+    int jobs = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    int opt;
+
+    while((opt = getopt(argc, argv, "s:r:j:t:v")) != -1){
+        if(opt == 's'){
+            shell_path = optarg;
+        }else if(opt == 'r'){
+            ref_path = optarg;
+        }else if(opt == 'j' && atoi(optarg) > 0){
+            jobs = atoi(optarg);
+        }else if(opt == 't' && atoi(optarg) > 0){
+            timeout_ms = atoi(optarg) * 1000;
+        }else if(opt == 'v'){
+            verbose = 1;
+        }else{
+            fprintf(stderr, "Usage: %s [-s shell] [-r reference] [-j jobs] [-t timeout-seconds] [-v] [corpus...]\n", argv[0]);
+            return 2;
+        }
+    }
+    if(jobs < 1) jobs = 1;
+
+    //the shells run inside their sandboxes, so relative paths have to be resolved first
+    static char shell_abs[PATH_MAX], ref_abs[PATH_MAX];
+    if(strchr(shell_path, '/') && realpath(shell_path, shell_abs) != NULL) shell_path = shell_abs;
+    if(strchr(ref_path, '/') && realpath(ref_path, ref_abs) != NULL) ref_path = ref_abs;
+
+    if(optind == argc){
+        load_corpus(stdin, "<stdin>");
+    }
+    for(int i = optind; i < argc; i++){
+        FILE *f = fopen(argv[i], "r");
+        if(!f){
+            perror(argv[i]);
+            return 2;
+        }
+        load_corpus(f, argv[i]);
+        fclose(f);
+    }
+    if(ncases == 0){
+        fprintf(stderr, "no cases\n");
+        return 2;
+    }
+
+    //both shells run with the same deterministic environment
+    setenv("LC_ALL", "C", 1);
+    unsetenv("MYSHELL_PIPE_SIZE");
+    signal(SIGPIPE, SIG_IGN);
+
+    long start = shellcore_now_ns();
+    if(jobs > ncases) jobs = ncases;
+    pthread_t threads[jobs];
+    int started = 0;
+    for(int i = 0; i < jobs; i++){
+        if(pthread_create(&threads[i], NULL, worker, NULL) != 0){
+            break;
+        }
+        started++;
+    }
+    if(started == 0){
+        worker(NULL);
+    }
+    for(int i = 0; i < started; i++){
+        pthread_join(threads[i], NULL);
+    }
+    long ms = (shellcore_now_ns() - start) / 1000000;
+
+    //reports in corpus order
+    int failed = 0;
+    for(int i = 0; i < ncases; i++){
+        Case *c = &cases[i];
+        if(c->report){
+            failed++;
+            printf("FAIL %s:%d: %s\n%s", c->where, c->lineno, c->line, c->report);
+        }else if(verbose){
+            printf("ok   %s:%d: %s\n", c->where, c->lineno, c->line);
+        }
+        free(c->report);
+        free(c->line);
+    }
+    free(cases);
+    printf("[INFO] %d cases, %d passed, %d failed in %ld ms (%d jobs)\n", ncases, ncases - failed, failed, ms, jobs);
+    return failed ? 1 : 0;
+}
@@ -0,0 +1,36 @@
+#define _GNU_SOURCE
+#include "fuzz.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+char *fuzz_string(const uint8_t *data, size_t size){
+    char *s = malloc(size + 1);
+    if(s == NULL){
+        abort();
+    }
+    memcpy(s, data, size);
+    s[size] = '\0';
+    return s;
+}
+
+const char *fuzz_sandbox(int files){
+    static char dir[] = "/tmp/shellfuzz.XXXXXX";
+    char name[32];
+
+    //parser errors go to stdout, sanitizer reports to stderr which stays open
+    if(freopen("/dev/null", "w", stdout) == NULL || mkdtemp(dir) == NULL || chdir(dir) < 0){
+        perror("fuzz sandbox");
+        exit(1);
+    }
+    for(int i = 0; i < files; i++){
+        snprintf(name, sizeof(name), "f%03d.txt", i);
+        int fd = open(name, O_WRONLY | O_CREAT, 0644);
+        if(fd >= 0){
+            close(fd);
+        }
+    }
+    return dir;
+}
@@ -0,0 +1,120 @@
+#include "fuzz.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+/*standalone main for the fuzz targets when libFuzzer is not available (gcc builds)
+usage: fuzz_x [-n iterations] [-s seed] [files...]
+files are replayed once each; without files or -n one input is read from stdin (AFL); -n runs a mutation loop seeded
+from the files (or a built-in line) that splices in shell syntax, which is enough to reach the parser's edge cases
+*/
+
+//largest input the driver builds or reads
+#define MAX_INPUT (64 * 1024)
+
+//tokens spliced into inputs, weighted towards the syntax the tokenizer and parser special-case
+static const char *dict[] = {
+    "|", "<", ">", "2>", "\"", "'", "\\", " ", "\t", "*", "?", "[", "]", "a", "ls", "\n", "f0*", "> x", "| wc", "<<E", "\nE\n", "<<<", "<<-", ">>", "2>&1", "&>", "3>", "<&",
+};
+
+static size_t read_input(FILE *f, uint8_t *buf){
+    return fread(buf, 1, MAX_INPUT, f);
+}
+
+//one random edit: flip a byte, insert a dictionary token, delete a range or duplicate a range
+static size_t mutate(uint8_t *buf, size_t n){
+    size_t pos = n ? (size_t)rand() % (n + 1) : 0;
+    switch(rand() % 4){
+    case 0:
+        if(n > 0){
+            buf[pos % n] ^= 1 << (rand() % 8);
+        }
+        break;
+    case 1: {
+        const char *tok = dict[rand() % (sizeof(dict) / sizeof(dict[0]))];
+        size_t len = strlen(tok);
+        if(n + len <= MAX_INPUT){
+            memmove(buf + pos + len, buf + pos, n - pos);
+            memcpy(buf + pos, tok, len);
+            n += len;
+        }
+        break;
+    }
+    case 2:
+        if(pos < n){
+            size_t len = 1 + (size_t)rand() % (n - pos);
+            memmove(buf + pos, buf + pos + len, n - pos - len);
+            n -= len;
+        }
+        break;
+    default:
+        if(pos < n){
+            size_t len = 1 + (size_t)rand() % (n - pos);
+            if(n + len <= MAX_INPUT){
+                memmove(buf + pos + len, buf + pos, n - pos);
+                n += len;
+            }
+        }
+        break;
+    }
+    return n;
+}
+
+int main(int argc, char *argv[]){
+    long iterations = 0;
+    unsigned seed = 1;
+    int opt;
+    static uint8_t buf[MAX_INPUT];
+    static uint8_t seedbuf[MAX_INPUT];
+
+    LLVMFuzzerInitialize(&argc, &argv);
+    while((opt = getopt(argc, argv, "n:s:")) != -1){
+        if(opt == 'n'){
+            iterations = atol(optarg);
+        }else if(opt == 's'){
+            seed = (unsigned)atol(optarg);
+        }else{
+            fprintf(stderr, "Usage: %s [-n iterations] [-s seed] [files...]\n", argv[0]);
+            return 1;
+        }
+    }
+    srand(seed);
+
+    //replay every file once, the last one also seeds the mutation loop
+    size_t seedlen = 0;
+    for(int i = optind; i < argc; i++){
+        FILE *f = fopen(argv[i], "rb");
+        if(f == NULL){
+            perror(argv[i]);
+            return 1;
+        }
+        seedlen = read_input(f, seedbuf);
+        fclose(f);
+        LLVMFuzzerTestOneInput(seedbuf, seedlen);
+    }
+    if(iterations == 0){
+        if(optind == argc){
+            size_t n = read_input(stdin, buf);
+            LLVMFuzzerTestOneInput(buf, n);
+        }
+        return 0;
+    }
+
+    if(seedlen == 0){
+        const char *line = "ls -l \"a b\" | grep 'x' > out 2> err < in";
+        seedlen = strlen(line);
+        memcpy(seedbuf, line, seedlen);
+    }
+    for(long it = 0; it < iterations; it++){
+        //a handful of stacked edits on the seed, restarting from it keeps inputs near valid syntax
+        size_t n = seedlen;
+        memcpy(buf, seedbuf, n);
+        for(int edits = 1 + rand() % 8; edits > 0; edits--){
+            n = mutate(buf, n);
+        }
+        LLVMFuzzerTestOneInput(buf, n);
+    }
+    fprintf(stderr, "%ld inputs, no crashes\n", iterations);
+    return 0;
+}
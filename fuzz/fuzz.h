@@ -0,0 +1,20 @@
+#ifndef FUZZ_H
+#define FUZZ_H
+#include <stddef.h>
+#include <stdint.h>
+
+/*libFuzzer-compatible entry points, each fuzz_*.c defines both
+built with clang -fsanitize=fuzzer they run under libFuzzer, otherwise driver.c supplies main() so the same
+binary replays files, reads one input from stdin (AFL) or runs its own mutation loop
+*/
+int LLVMFuzzerInitialize(int *argc, char ***argv);
+int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size);
+
+//copies an input into a NUL-terminated heap string, the callee frees it
+char *fuzz_string(const uint8_t *data, size_t size);
+
+//silences stdout (parser messages) and moves into an empty scratch directory so globbing sees a fixed file set
+//files > 0 creates that many entries in it, returns the directory path
+const char *fuzz_sandbox(int files);
+
+#endif
@@ -0,0 +1,61 @@
+#define _GNU_SOURCE
+#include "fuzz.h"
+#include "net.h"
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+
+//bytes handed to the socket per input, well below the default socket buffer so the write never blocks
+#define MAX_FRAME_INPUT (48 * 1024)
+
+int LLVMFuzzerInitialize(int *argc, char ***argv){
+    (void)argc;
+    (void)argv;
+    fuzz_sandbox(0);
+    return 0;
+}
+
+//writes the input into one end of a socket pair and closes it, returns the reading end
+static int feed(const uint8_t *data, size_t size){
+    int sv[2];
+    if(socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, sv) < 0){
+        abort();
+    }
+    if(size > 0 && write(sv[0], data, size) != (ssize_t)size){
+        abort();
+    }
+    close(sv[0]);
+    return sv[1];
+}
+
+/*framing: the input is raw bytes from a peer, both the blocking reader and the ring reader must consume it frame by
+frame until EOF or an error, never returning more than the buffer holds
+*/
+int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size){
+    static char buf[MAX_BUFFER_SIZE];
+    static RecvRing ring;
+    int n, type;
+
+    if(size > MAX_FRAME_INPUT){
+        size = MAX_FRAME_INPUT;
+    }
+
+    int fd = feed(data, size);
+    while((n = receive_line(fd, buf, sizeof(buf))) > 0){
+        if(n >= (int)sizeof(buf) || buf[n] != '\0'){
+            abort();
+        }
+    }
+    close(fd);
+
+    fd = feed(data, size);
+    recv_ring_init(&ring, fd);
+    while((n = receive_frame_buffered(&ring, &type, buf, sizeof(buf))) > 0){
+        if(n >= (int)sizeof(buf) || type < 0 || type > 0xff){
+            abort();
+        }
+    }
+    recv_ring_take_fds(&ring, NULL, 0);
+    close(fd);
+    return 0;
+}
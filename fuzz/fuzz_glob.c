@@ -0,0 +1,42 @@
+#include "fuzz.h"
+#include "tokenize.h"
+#include <stdlib.h>
+#include <string.h>
+
+//maximum number of arguments a command can have, the size of the argv arrays the parser passes in
+#define MAX_ARGS 64
+
+int LLVMFuzzerInitialize(int *argc, char ***argv){
+    (void)argc;
+    (void)argv;
+    fuzz_sandbox(100);                  //enough files for one * to overflow an argv
+    return 0;
+}
+
+/*glob expansion: the input is one word per line, a leading ' marks a word as quoted
+the result must fit the argv array, stay NULL-terminated and own every string exactly once (ASan checks the rest)
+*/
+int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size){
+    char *text = fuzz_string(data, size);
+    char *argv[MAX_ARGS];
+    bool quoted[MAX_ARGS];
+    int argc = 0;
+    char *save;
+
+    for(char *w = strtok_r(text, "\n", &save); w != NULL && argc < MAX_ARGS - 1; w = strtok_r(NULL, "\n", &save)){
+        int q = w[0] == '\'';
+        quoted[argc] = q;
+        argv[argc++] = strdup(w + q);
+    }
+    argv[argc] = NULL;
+
+    apply_globbing(argv, quoted, &argc);
+    if(argc < 0 || argc > MAX_ARGS - 1 || argv[argc] != NULL){
+        abort();
+    }
+    for(int i = 0; i < argc; i++){
+        free(argv[i]);
+    }
+    free(text);
+    return 0;
+}
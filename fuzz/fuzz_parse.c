@@ -0,0 +1,66 @@
+#include "fuzz.h"
+#include "parse.h"
+#include "expand.h"
+#include <stdlib.h>
+#include <string.h>
+
+int LLVMFuzzerInitialize(int *argc, char ***argv){
+    (void)argc;
+    (void)argv;
+    fuzz_sandbox(8);
+    expand_allow_commands(0);
+    return 0;
+}
+
+//two pipelines must have the same stages, words and redirections
+static void check_equal(const Pipeline *a, const Pipeline *b){
+    if(a->nstages != b->nstages){
+        abort();
+    }
+    for(int s = 0; s < a->nstages; s++){
+        const Command *x = &a->stages[s];
+        const Command *y = &b->stages[s];
+        if(x->argc != y->argc || x->nredirs != y->nredirs || x->argv[x->argc] != NULL || y->argv[y->argc] != NULL){
+            abort();
+        }
+        for(int i = 0; i < x->argc; i++){
+            if(strcmp(x->argv[i], y->argv[i]) != 0){
+                abort();
+            }
+        }
+        for(int i = 0; i < x->nredirs; i++){
+            if(x->redirs[i].fd != y->redirs[i].fd || x->redirs[i].type != y->redirs[i].type ||
+               x->redirs[i].dup_fd != y->redirs[i].dup_fd || x->redirs[i].flags != y->redirs[i].flags ||
+               strcmp(x->redirs[i].path, y->redirs[i].path) != 0){
+                abort();
+            }
+        }
+    }
+}
+
+/*parser: the input is a command line, whatever parses must survive pack -> unpack unchanged
+the raw input is also fed to pipeline_unpack, which has to reject malformed images without touching memory outside them
+*/
+int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size){
+    char *line = fuzz_string(data, size);
+    Pipeline *pl = parse_pipeline(line);
+    if(pl != NULL){
+        if(pl->nstages < 1 || pl->nstages > MAX_PIPES){
+            abort();
+        }
+        size_t len;
+        void *img = pipeline_pack(pl, &len);
+        Pipeline *copy = pipeline_unpack(img, len);
+        if(copy == NULL){
+            abort();
+        }
+        check_equal(pl, copy);
+        free(copy);
+        free(img);
+        free_pipeline(pl);
+    }
+    free(line);
+
+    free_pipeline(pipeline_unpack(data, size));
+    return 0;
+}
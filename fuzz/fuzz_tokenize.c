@@ -0,0 +1,33 @@
+#include "fuzz.h"
+#include "tokenize.h"
+#include <stdlib.h>
+#include <string.h>
+
+//maximum length for command input buffer, the tokenizer's per-token limit
+#define MAX_CMD_LENGTH 1024
+
+int LLVMFuzzerInitialize(int *argc, char ***argv){
+    (void)argc;
+    (void)argv;
+    fuzz_sandbox(0);
+    return 0;
+}
+
+//lexer: any input either fails cleanly or yields tokens that respect the length limit and are not empty unless quoted
+int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size){
+    char *line = fuzz_string(data, size);
+    QTok *toks;
+    int n;
+
+    if(qtokenize(line, &toks, &n) == 0){
+        for(int i = 0; i < n; i++){
+            size_t len = strlen(toks[i].val);
+            if(len >= MAX_CMD_LENGTH || (len == 0 && !toks[i].was_quoted)){
+                abort();
+            }
+        }
+        free_qtokens(toks, n);
+    }
+    free(line);
+    return 0;
+}
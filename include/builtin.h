@@ -0,0 +1,17 @@
+#ifndef BUILTIN_H
+#define BUILTIN_H
+#include <stddef.h>
+#include "parse.h"
+
+/*commands a command substitution runs without a fork or a pipe: echo, printf, pwd, true and false, as the only stage
+of the pipeline and without redirections; they behave like the coreutils programs they stand in for, and anything
+they do not handle the same way (an unknown option or conversion, a bad number, --help) is left to the real program
+*/
+
+/*runs pl in-process if it is one of them, appending its output to the malloc'd buffer *buf (*len bytes used, *cap
+allocated, at most max bytes appended, always NUL-terminated); returns the exit status, or -1 if pl needs a process
+of its own (the buffer is then as it was)
+*/
+int builtin_capture(const Pipeline *pl, char **buf, size_t *len, size_t *cap, size_t max);
+
+#endif
@@ -0,0 +1,40 @@
+#ifndef CGROUP_H
+#define CGROUP_H
+#include <stddef.h>
+
+/*cgroup v2 isolation for the server: every session's commands run in a leaf of their own under a delegated directory,
+with limits such as cpu.weight, memory.max and io.weight written into it, and exact accounting read back from the leaf
+*/
+
+//resources a session's commands used, from cpu.stat, memory.peak (memory.current before 5.19) and io.stat
+typedef struct {
+    long usage_usec;
+    long user_usec;
+    long system_usec;
+    long memory_peak;           //bytes, -1 without the memory controller
+    long io_rbytes;             //summed over devices, 0 without the io controller
+    long io_wbytes;
+} CgroupUsage;
+
+//adds "file=value" (e.g. memory.max=256M) to write into every session leaf, returns -1 if spec is malformed
+int cgroup_add_limit(const char *spec);
+
+/*prepares the delegated directory: moves the server into a "server" leaf if it sits in dir itself (cgroup v2 allows
+controllers only for children of a cgroup without processes) and enables cpu, memory and io for the sessions
+returns 0 on success, -1 if dir is not a usable cgroup v2 directory
+*/
+int cgroup_init(const char *dir);
+//whether cgroup_init succeeded
+int cgroup_enabled(void);
+
+//creates a session leaf with the configured limits, returns a descriptor for SpawnOptions.cgroup_fd (-1 on failure)
+//and its name in name[n]
+int cgroup_create(char *name, size_t n);
+//reads the usage of a leaf, returns 0 on success, -1 on failure
+int cgroup_usage(int fd, CgroupUsage *u);
+//kills everything running in the leaf (cgroup.kill, 5.14+), returns 0 on success, -1 on failure
+int cgroup_kill(int fd);
+//kills whatever is still running in the leaf, removes it and closes fd
+void cgroup_destroy(int fd, const char *name);
+
+#endif
@@ -0,0 +1,30 @@
+#ifndef COMPLETE_H
+#define COMPLETE_H
+
+/*completion sources for interactive line editing: command names from PATH and file names from the file system
+the PATH table is built on first use, kept sorted for prefix lookups and rebuilt when PATH or one of its directories
+changes (checked at most once a second); safe to call from several threads
+every lookup ranks its matches shortest (closest to what was typed) first and keeps the best max of them; *total gets
+the number of matches and *common (malloc'd) the prefix they all share, which lets a caller extend the word correctly
+from a truncated list; either may be NULL
+*/
+
+//most matches that are ranked, beyond that the first ones in alphabetical order are returned (nobody reads them anyway)
+#define COMPLETE_RANK_LIMIT 1024
+
+//picks the matches of prefix from a sorted table of names, stored into out as malloc'd dir followed by the name; names
+//starting with '.' only match a prefix that does; returns how many it stored
+int complete_select(char *const *names, int n, const char *prefix, const char *dir, char **out, int max, int *total, char **common);
+
+//commands (and the shell's own exit) on the current store's PATH (see env_use) starting with prefix
+int complete_command(const char *prefix, char **out, int max, int *total, char **common);
+
+//entries of word's directory whose names start with the rest of word, as "dir/name" with a '/' appended for directories
+int complete_file(const char *word, char **out, int max, int *total, char **common);
+
+//where the word ending at line[len] starts: after the last blank or shell operator
+int complete_word_start(const char *line, int len);
+//whether the word at word_start is a command name to look up on PATH: first on the line or right after a '|', no '/'
+int complete_in_command_position(const char *line, int word_start);
+
+#endif
@@ -0,0 +1,13 @@
+#ifndef DIRCACHE_H
+#define DIRCACHE_H
+
+/*directory listings the server keeps for file name completion, shared by all workers
+a directory is read once into a sorted table (directories with a trailing '/') and then kept current from inotify
+events, which are applied before every lookup, so a 100k-entry directory answers with two binary searches instead of
+a readdir; the least recently used listing is dropped when the cache is full
+*/
+
+//completes word (a path as typed, relative to the server's working directory) like complete_file() does
+int dircache_complete(const char *word, char **out, int max, int *total, char **common);
+
+#endif
@@ -0,0 +1,43 @@
+#ifndef ENV_H
+#define ENV_H
+#include "parse.h"
+
+/*shell variables: a hash table of "NAME=value" strings with an exported flag, looked up in O(1) by expansion
+stores start out sharing one table built from the process environment and copy it on their first change (copy on
+write), so a server session costs nothing until it sets a variable; the envp handed to exec is built once per change
+and reused by every command after it
+the default store (the shell's own) also passes exported changes on to the process environment
+*/
+typedef struct EnvStore EnvStore;
+
+//a store sharing the process environment, for a server session
+EnvStore *env_create(void);
+void env_free(EnvStore *e);
+
+//makes e the store the calling thread expands and execs with, NULL goes back to the default store
+void env_use(EnvStore *e);
+EnvStore *env_current(void);
+
+//value of name, NULL if it is unset; valid until the next change to e
+const char *env_get(EnvStore *e, const char *name);
+//sets name (a valid name, see env_valid_name) to value, export marks it exported, otherwise the flag is kept; 0 or -1
+int env_set(EnvStore *e, const char *name, const char *value, int export);
+//marks name exported, an unset name stays unset until it gets a value
+int env_export(EnvStore *e, const char *name);
+int env_unset(EnvStore *e, const char *name);
+//NULL-terminated "NAME=value" array of the exported variables, valid until the next change to e
+char **env_envp(EnvStore *e);
+
+//$?, the status of the last command line
+void env_set_status(EnvStore *e, int status);
+int env_status(EnvStore *e);
+
+//whether the first len bytes of s are a variable name: a letter or '_', then letters, digits and '_'
+int env_valid_name(const char *s, size_t len);
+
+/*runs the variable builtins of a one-stage pipeline without redirections: NAME=value words only, export [NAME[=value]]...
+and unset NAME...; returns 1 with *status set if it was one of them, 0 if pl is an ordinary command
+*/
+int env_builtin(EnvStore *e, const Pipeline *pl, int *status);
+
+#endif
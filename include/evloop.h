@@ -0,0 +1,73 @@
+#ifndef EVLOOP_H
+#define EVLOOP_H
+#include <stddef.h>
+#include <sys/types.h>
+
+//event loop used by the server, with an epoll backend and an io_uring backend
+//handlers are registered per file descriptor and called with the events that became ready
+
+//interest / readiness flags
+#define EV_READ  0x1
+#define EV_WRITE 0x2
+
+//backend selection for evloop_create
+#define EVLOOP_EPOLL 0
+#define EVLOOP_URING 1
+
+typedef struct EvLoop EvLoop;
+
+//callback invoked when fd becomes ready, events is a mask of EV_READ/EV_WRITE (errors and hangups report as EV_READ)
+typedef void (*ev_cb)(EvLoop *loop, int fd, int events, void *arg);
+
+//creates an event loop with the requested backend, falls back to epoll when io_uring is unavailable, returns NULL on failure
+EvLoop *evloop_create(int backend);
+
+//returns the backend actually in use, EVLOOP_EPOLL or EVLOOP_URING
+int evloop_backend(const EvLoop *loop);
+
+//registers fd with the given interest mask and callback, returns 0 on success, -1 on failure
+int evloop_add(EvLoop *loop, int fd, int events, ev_cb cb, void *arg);
+
+//changes the interest mask of a registered fd (0 pauses it without unregistering), returns 0 on success, -1 on failure
+int evloop_mod(EvLoop *loop, int fd, int events);
+
+//unregisters fd, must be called before the fd is closed, returns 0 on success, -1 on failure
+int evloop_del(EvLoop *loop, int fd);
+
+/*completion-based operations: the io_uring backend runs them natively (a multishot accept, a multishot recv into a
+ring of provided buffers, a read linked to a send) and the epoll backend emulates them from readiness, so callers
+have one code path for both; evloop_native says which one a loop does
+*/
+
+//called with each connection accepted on listening socket fd, client_fd is non-blocking and close-on-exec
+typedef void (*ev_accept_cb)(EvLoop *loop, int fd, int client_fd, void *arg);
+//registers a listening socket whose pending connections are accepted and handed to cb until evloop_del
+int evloop_accept(EvLoop *loop, int fd, ev_accept_cb cb, void *arg);
+
+/*called with n bytes received on fd, n == 0 at the end of the stream and -errno after an error; returns how many bytes
+it took, the rest is kept and offered again (before anything newer) while EV_READ stays on, or once it is turned back on
+*/
+typedef size_t (*ev_recv_cb)(EvLoop *loop, int fd, const char *data, ssize_t n, void *arg);
+//makes EV_READ on a registered socket deliver its bytes to cb instead of reporting readiness, returns 0 or -1
+int evloop_recv(EvLoop *loop, int fd, ev_recv_cb cb);
+
+/*called when a relay is over: buf holds the header and the nread bytes read (-errno if the read failed), nsent is how
+much of it went to the socket (-errno if nothing did, the send does not happen after a short read)
+*/
+typedef void (*ev_relay_cb)(EvLoop *loop, int fd, const char *buf, ssize_t nread, ssize_t nsent, void *arg);
+/*reads len bytes from from (a pipe holding at least that much) behind a hdr_len-byte header and sends header and data
+on registered socket fd, one linked read and send; cb gets the registration's arg, it is not called if fd is removed
+first; returns 0, or -1 if the relay could not be started (nothing was read)
+*/
+int evloop_relay(EvLoop *loop, int fd, int from, const void *hdr, size_t hdr_len, size_t len, ev_relay_cb cb);
+
+//whether the completion-based operations are native (io_uring) rather than emulated
+int evloop_native(const EvLoop *loop);
+
+//waits up to timeout_ms (-1 blocks) and dispatches ready handlers, returns number dispatched, -1 on failure
+int evloop_run_once(EvLoop *loop, int timeout_ms);
+
+//releases the loop, registered fds are not closed
+void evloop_destroy(EvLoop *loop);
+
+#endif
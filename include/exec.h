@@ -1,5 +1,72 @@
 #ifndef EXEC_H
 #define EXEC_H
-void execute_command(char *args[], char *inputFile, char *outputFile, char *errorFile);
-void execute_pipeline(char *cmd);
+#include <sys/types.h>
+#include "parse.h"
+
+//how a pipeline is run: consecutive builtin filter stages share one process, every other stage gets its own
+typedef struct {
+    int nprocs;
+    int first[MAX_PIPES + 1];   //first stage of each process, first[nprocs] is the number of stages
+    int builtin[MAX_PIPES];     //the process runs its stages as in-process builtin filters
+} ExecPlan;
+
+//decides which stages of a parsed pipeline share a process
+void plan_pipeline(const Pipeline *pl, ExecPlan *plan);
+
+//runs a parsed command line and waits for every stage, returns its exit status the way sh reports it (128+signal if killed)
+//a command still running after the command timeout is killed and reported as 124, like timeout(1) does
+int execute_pipeline(const Pipeline *pl);
+/*runs a parsed command line with its stdout captured (command substitution): *out gets the output, malloc'd and
+NUL-terminated, keeping at most max bytes (the rest is read and dropped), *len its length; waits like
+execute_pipeline, under the same command timeout, and returns the exit status
+*/
+int capture_pipeline(const Pipeline *pl, char **out, size_t *len, size_t max);
+//deadline for execute_pipeline in milliseconds, 0 (the default) waits as long as it takes
+void set_command_timeout(int ms);
+
+//non-waiting variant used by the server, io[] holds the descriptors for stdin/stdout/stderr
+//(NULL or a negative entry keeps the caller's), explicit redirections still take precedence
+//returns the number of processes it started (builtin filters share one), their pids are in pids[]
+int spawn_pipeline(const Pipeline *pl, const int io[3], pid_t pids[]);
+
+//stages of a pipeline that could not be started completely are killed and given to handler instead of being waited for,
+//for callers that must not block (the server's event loops)
+void spawn_set_orphan_handler(void (*handler)(pid_t pid));
+
+//how spawn_pipeline_opts starts the processes
+typedef struct {
+    const int *io;              //stdin/stdout/stderr as for spawn_pipeline
+    int cgroup_fd;              //cgroup v2 directory every process starts in, -1 keeps the caller's
+    int own_group;              //the pipeline gets a process group of its own (pgid pids[0]) so killpg() reaches all of it,
+                                //including whatever the stages fork; not for a shell reading from a terminal (job control)
+} SpawnOptions;
+int spawn_pipeline_opts(const Pipeline *pl, const SpawnOptions *opt, pid_t pids[]);
+
+/*a command line parsed, planned and resolved once for commands run over and over (the server's prepared commands):
+words are expanded (globs included) when it is prepared, and every exec'd stage's binary is held open so a run skips
+the parser and the PATH search and goes straight to fexecve
+*/
+typedef struct {
+    char *text;                 //the command line as given
+    Pipeline *pl;
+    ExecPlan plan;
+    int exec_fd[MAX_PIPES];     //O_PATH descriptor of each process's binary, -1 for builtins or names PATH lacked
+} Prepared;
+
+//returns NULL if text does not parse (the parser has printed why)
+Prepared *prepare_pipeline(const char *text);
+void free_prepared(Prepared *p);
+//spawn_pipeline_opts for a prepared command
+int spawn_prepared(const Prepared *p, const SpawnOptions *opt, pid_t pids[]);
+
+//capacity requested with F_SETPIPE_SZ for every pipe a pipeline or the server creates, 0 keeps the kernel default (64 KB)
+//larger pipes mean fewer context switches for high-throughput pipelines, the kernel caps it at /proc/sys/fs/pipe-max-size
+void set_pipe_size(int bytes);
+//applies the configured capacity to a pipe (either end), returns the resulting capacity or -1
+int tune_pipe(int fd);
+
+//opens a pidfd for a child so its exit can be waited on through an event loop, returns -1 on failure
+int open_pidfd(pid_t pid);
+//signals the process behind a pidfd (no pid reuse race), returns 0 on success, -1 on failure
+int pidfd_signal(int pidfd, int sig);
 #endif
@@ -0,0 +1,39 @@
+#ifndef EXPAND_H
+#define EXPAND_H
+#include <stddef.h>
+
+/*parameter expansion, the step between qtokenize() and apply_globbing(): variables from the current env.h store
+($NAME, ${NAME}, ${NAME:-word} and the other sh forms, ${#NAME}), $? $$ $0, command substitution $(cmd) run through
+the executor, and integer arithmetic $((expr))
+the word comes from qtokenize() with its expansions marked (see tokenize.h); results of unquoted expansions are split
+into fields on IFS (blanks by default) and an unquoted expansion that comes out empty leaves no field at all
+*/
+
+/*expands a marked word into *fields (a malloc'd array of malloc'd strings), split says whether unquoted results are
+split (not for redirection targets and assignments, which always give one field)
+returns the number of fields, or -1 after printing why the word cannot be expanded (a bad ${...} or arithmetic)
+*/
+int expand_word(const char *word, int split, char ***fields);
+//the word with its markers removed and nothing expanded (here-document delimiters), malloc'd
+char *expand_literal(const char *word);
+//whether a word still has expansions to do
+int expand_needed(const char *word);
+
+/*whether $(cmd) may start processes (the default); off, only the in-process builtins run and any other substitution
+fails the word: the server's event loop must not stop for a command while it parses a line, and the parser fuzzer must
+not run what it generates
+*/
+void expand_allow_commands(int allow);
+/*for a caller that answers someone else (the server's sessions): this thread's expansion errors are kept instead of
+printed, expand_take_error returns the last one kept and forgets it, NULL if there was none
+*/
+void expand_keep_errors(int keep);
+const char *expand_take_error(void);
+
+//length of the "$(...)", "$((...))" or "${...}" at p, quotes and nesting included; 0 if it is not closed
+size_t expand_span(const char *p);
+
+//most bytes of output a command substitution keeps, the rest is read and dropped
+#define EXPAND_SUBST_MAX (4 * 1024 * 1024)
+
+#endif
@@ -0,0 +1,16 @@
+#ifndef FDCACHE_H
+#define FDCACHE_H
+
+/*descriptors kept open between commands for repeated appends such as `cmd >> app.log`, saving the open() path walk
+only O_APPEND opens of regular files are cached; an entry is checked against the path again at most once a second,
+so a log that is rotated away keeps receiving output for up to that long
+*/
+
+//number of files kept open, 0 (the default) turns the cache off and closes whatever it held
+void set_fd_cache(int entries);
+
+//returns a close-on-exec duplicate (numbered above any n> a command can name) of the cached descriptor for path/flags,
+//opening and caching it on a miss; -1 if the open is not cacheable or fails, the caller then opens the file itself
+int fdcache_open(const char *path, int flags);
+
+#endif
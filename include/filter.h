@@ -0,0 +1,15 @@
+#ifndef FILTER_H
+#define FILTER_H
+
+//in-process versions of common text filters (grep -F, head, tail, wc, cut, sort)
+//a run of consecutive builtin stages in a pipeline shares one executor process instead of a fork+exec and a pipe each
+
+//returns 1 if args can run as a builtin filter stage (bare command name, supported options, reads stdin only)
+//a path such as /bin/grep always runs the external program
+int filter_is_builtin(char *args[]);
+
+//runs argvs[0..n) as one chain from stdin to stdout, lines are handed between stages in place without copying
+//returns the exit status of the last stage (grep reports 1 when nothing matched)
+int filter_run(char **argvs[], int n);
+
+#endif
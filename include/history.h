@@ -0,0 +1,24 @@
+#ifndef HISTORY_H
+#define HISTORY_H
+#include <stddef.h>
+
+/*command history of the interactive shell: an append-only file with one command line per line, newest last
+the file is mmap'd and indexed by line offset when it is opened, so a million entries load with one memchr pass and
+no copies; lines added later are appended to the file at once (O_APPEND, concurrent shells interleave whole lines)
+*/
+
+//loads the history file at path, creating it if needed; returns -1 if it cannot be used (history is then kept in memory only)
+int history_open(const char *path);
+//records a command line, an exact repeat of the newest entry is skipped
+void history_add(const char *line);
+//number of entries
+int history_count(void);
+//entry i (0 is the oldest) and its length in *len, not NUL-terminated
+const char *history_get(int i, size_t *len);
+
+/*incremental search: the newest entry older than entry `before` that starts with query, or failing that the newest one
+that contains it; returns its index or -1. Prefix matches come from a sorted index built on the first search
+*/
+int history_search(const char *query, int before);
+
+#endif
@@ -0,0 +1,23 @@
+#ifndef LINEEDIT_H
+#define LINEEDIT_H
+
+/*line editor of the interactive shell: raw-mode editing on a terminal, history browsing (Up/Down) and incremental
+reverse search (Ctrl-R) over history.h, and Tab completion through a completer the shell installs
+when stdin is not a terminal (or TERM=dumb) lines are read as before, prompt on stdout and no editing
+*/
+
+/*candidates for the word of line that starts at word_start (line ends at the cursor), as a NULL-terminated malloc'd
+array of malloc'd strings that replace the whole word; NULL for none
+a completer that returns only part of the matches sets *more to how many it left out and *common (malloc'd) to the
+prefix all of them share, so the word is never extended past it
+*/
+typedef char **(*LeCompleter)(const char *line, int word_start, char **common, int *more);
+
+//installs the Tab completer, NULL turns completion off
+void lineedit_set_completer(LeCompleter fn);
+
+//shows prompt and reads one line without its newline; returns a malloc'd string, "" when the line was discarded
+//with Ctrl-C, or NULL at end of input
+char *lineedit_read(const char *prompt);
+
+#endif
@@ -0,0 +1,17 @@
+#ifndef LZ_H
+#define LZ_H
+
+//small LZ4-compatible block codec used to compress streamed command output
+//inputs are limited to 64 KB per block, which covers every output frame
+
+//largest block lz_compress accepts
+#define LZ_MAX_BLOCK 65535
+
+//compresses n bytes from src into dst, returns the compressed size, or 0 if the result would not fit in cap bytes
+//(callers pass a cap below n so incompressible data is detected early and sent raw)
+int lz_compress(const void *src, int n, void *dst, int cap);
+
+//decompresses an LZ4 block into dst, returns the decompressed size, -1 if the block is corrupt or larger than cap
+int lz_decompress(const void *src, int n, void *dst, int cap);
+
+#endif
@@ -2,6 +2,7 @@
 #define NET_H
 
 #include <sys/socket.h>
+#include <sys/un.h>
 #include <netinet/in.h>
 #include <arpa/inet.h>
 #include <unistd.h>
@@ -9,26 +10,132 @@
 #include <stdlib.h>
 #include <string.h>
 #include <errno.h>
+#include <stdint.h>
 
 //maximum buffer size for network communication
 #define MAX_BUFFER_SIZE 1024
 
+//listen() backlog used unless the caller asks for another one
+#define DEFAULT_LISTEN_BACKLOG SOMAXCONN
+
+//size of the per-connection read-ahead ring buffer (must be a power of two)
+#define RECV_RING_SIZE 16384
+
+//returned by the buffered receive path when a non-blocking socket holds no complete frame yet
+#define NET_AGAIN -2
+
+//frame types, carried in the top byte of the 4-byte length header so plain send_line() frames are FRAME_CMD
+#define FRAME_CMD  0        //client -> server, command line
+#define FRAME_OUT  1        //server -> client, chunk of command output (stdout and stderr)
+#define FRAME_DONE 2        //server -> client, command finished, payload is the exit status as text
+#define FRAME_FDS  3        //client -> server over local sockets, carries stdin/stdout/stderr as SCM_RIGHTS
+#define FRAME_BUSY 4        //server -> client, command or connection refused by admission control, payload is the reason
+#define FRAME_HELLO 5       //both ways, feature negotiation, payload is a comma-separated feature list ("lz" or "none")
+#define FRAME_OUTZ 6        //server -> client, LZ-compressed FRAME_OUT, payload is the raw length (4 bytes) then the block
+#define FRAME_IN   7        //client -> server, chunk of stdin for the running command (needs the "stdin" feature)
+#define FRAME_INEOF 8       //client -> server, end of stdin, payload is the total number of bytes sent as text
+#define FRAME_CREDIT 9      //server -> client, the client may send this many more stdin bytes, payload is the count as text
+#define FRAME_CANCEL 10     //client -> server, stop the running command (its process group is killed), payload is ignored
+#define FRAME_SHM  11       //client -> server over local sockets, carries a shared output ring (see shmring.h) as SCM_RIGHTS
+#define FRAME_SHMOUT 12     //server -> client, that many more output bytes are in the shared ring, payload is the count as text
+#define FRAME_COMPLETE 13   //both ways (needs the "complete" feature), the line up to the cursor / the completions for its last word
+#define FRAME_TYPE_SHIFT 24
+#define FRAME_LEN_MASK 0x00FFFFFFu
+
+//builds the network-order header word for a frame
+#define FRAME_HEADER(type, len) htonl(((uint32_t)(type) << FRAME_TYPE_SHIFT) | ((uint32_t)(len) & FRAME_LEN_MASK))
+
+//maximum number of descriptors a peer can pass in one FRAME_FDS
+#define RING_MAX_FDS 3
+
+//per-connection read-ahead ring buffer, one recv() pulls in everything the kernel has queued
+//and every complete frame is then parsed straight out of the ring without further syscalls
+//head and tail are free-running counters, masked with RECV_RING_SIZE-1 on access
+typedef struct {
+    int fd;
+    unsigned int head;
+    unsigned int tail;
+    int fds[RING_MAX_FDS];      //descriptors received as SCM_RIGHTS and not yet claimed
+    int nfds;
+    int fed;                    //bytes are handed in with recv_ring_feed instead of read from fd
+    int fed_end;                //what follows the fed bytes: 0 more to come, 1 end of stream, -errno a failure
+    char data[RECV_RING_SIZE];
+} RecvRing;
+
 //socket helper functions for client-server communication
 //creates and binds a server socket to the specified port, returns socket file descriptor on success, -1 on failure
 int create_server_socket(int port);
 
+//creates a listening socket for an address spec: "<port>" (all IPv4 interfaces), "v4addr:port", "[v6addr]:port",
+//"unix:/path" or "@abstract" (Linux abstract namespace), reuseport sets SO_REUSEPORT on TCP sockets so several
+//listeners can share the address, backlog <= 0 uses DEFAULT_LISTEN_BACKLOG, returns socket file descriptor on success, -1 on failure
+int create_listen_socket(const char *address, int reuseport, int backlog);
+
+//returns the number of connections waiting in a TCP listening socket's accept queue (limit in *limit), -1 if unavailable
+int listen_queue_depth(int server_fd, int *limit);
+
+//returns 1 if the address spec names a Unix domain socket, 0 otherwise
+int is_local_address(const char *address);
+
 //accepts a client connection on the server socket, returns client socket file descriptor on success, -1 on failure
 int accept_client_connection(int server_fd);
 
+//accepts a pending connection on a non-blocking listening socket and makes it non-blocking too,
+//returns client socket file descriptor on success, -1 on failure (errno EAGAIN when nothing is pending)
+int accept_client_nonblocking(int server_fd);
+
+//logs the peer of a connection that was accepted without its address
+void log_client_peer(int client_fd);
+
+//switches a file descriptor to non-blocking mode and marks it close-on-exec, returns 0 on success, -1 on failure
+int set_nonblocking(int fd);
+
 //creates and connects a client socket to the specified server, returns socket file descriptor on success, -1 on failure
 int create_client_socket(const char *server_ip, int port);
 
+//connects to an address spec as accepted by create_listen_socket (except the bare port), returns socket file descriptor on success, -1 on failure
+int connect_to_address(const char *address);
+
+//passes descriptors to the server as a FRAME_FDS frame over a local socket, returns 0 on success, -1 on failure
+int send_fds(int socket_fd, const int *fds, int nfds);
+//same with another frame type for descriptors that are not stdio (FRAME_SHM)
+int send_fds_frame(int socket_fd, int type, const int *fds, int nfds);
+
 //sends a line of text over the socket, returns number of bytes sent on success, -1 on failure
 int send_line(int socket_fd, const char *line);
 
+//sends one typed frame over a blocking socket, returns number of payload bytes sent on success, -1 on failure
+int send_frame(int socket_fd, int type, const void *data, int len);
+
 //receives a line of text from the socket, returns number of bytes received on success, -1 on failure, 0 on connection closed
 int receive_line(int socket_fd, char *buffer, int buffer_size);
 
+//binds a read-ahead ring buffer to a connected socket, must be called before receive_line_buffered
+void recv_ring_init(RecvRing *ring, int socket_fd);
+
+//receives one line through the connection's ring buffer, returns number of bytes received on success, -1 on failure,
+//0 on connection closed, NET_AGAIN when the socket is non-blocking and only a partial frame has arrived so far
+int receive_line_buffered(RecvRing *ring, char *buffer, int buffer_size);
+
+//makes the ring take its bytes from recv_ring_feed rather than from the socket, for sockets read by completions
+void recv_ring_fed(RecvRing *ring);
+
+//copies received bytes into a fed ring (n == 0 is the end of the stream, -errno a failure), returns how many fit
+size_t recv_ring_feed(RecvRing *ring, const char *data, ssize_t n);
+
+//claims descriptors that arrived with the last FRAME_FDS frame, returns the number copied into fds
+int recv_ring_take_fds(RecvRing *ring, int *fds, int max);
+
+//same as receive_line_buffered but accepts every frame type and reports it in *type, empty frames are skipped
+int receive_frame_buffered(RecvRing *ring, int *type, char *buffer, int buffer_size);
+
+//stores the type of the next frame in *type without consuming it, reading ahead only when no header is buffered yet,
+//returns 1 on success, NET_AGAIN (non-blocking socket, nothing queued), 0 on connection closed or -1 on failure
+int recv_ring_peek_type(RecvRing *ring, int *type);
+
+//number of bytes read ahead and not yet consumed, frames in there do not show up as socket readiness
+int recv_ring_pending(const RecvRing *ring);
+
 //closes a socket connection
 void close_socket(int socket_fd);
 
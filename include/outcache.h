@@ -0,0 +1,38 @@
+#ifndef OUTCACHE_H
+#define OUTCACHE_H
+#include <stddef.h>
+#include "parse.h"
+
+/*result cache for idempotent commands polled over and over (df -h, cat /proc/loadavg), shared by all server workers
+a result is keyed on the parsed pipeline (argv after expansion and globbing, every redirection) and the environment it
+runs with (sessions export variables of their own; the server's cwd never changes), and kept for the TTL of the first
+rule whose pattern matches the command line; it is dropped early when a file named by a word or an input redirection
+changes (mtime, size or inode)
+identical commands arriving while one is already running wait for its result instead of running again (single-flight)
+*/
+
+//outcomes of outcache_lookup
+#define OUTCACHE_BYPASS 0       //no rule matches or the command writes files, run it normally
+#define OUTCACHE_HIT    1       //*out (malloc'd, caller frees), *len and *status hold the cached result
+#define OUTCACHE_FILL   2       //the caller runs the command and records its output into *entry
+#define OUTCACHE_WAIT   3       //an identical command is running, wait_fd is signalled when it is done, look up again then
+
+typedef struct OutEntry OutEntry;
+
+//adds a rule "pattern=seconds", matching command lines (fnmatch) are cached that long, returns -1 if spec is malformed
+int outcache_add_rule(const char *spec);
+//whether any rule is configured, the cache is off otherwise
+int outcache_enabled(void);
+
+//looks text/pl run with envp up, wait_fd is an eventfd registered as a waiter when the result is still being produced
+int outcache_lookup(const char *text, const Pipeline *pl, char *const envp[], int wait_fd, OutEntry **entry, char **out,
+                    size_t *len, int *status);
+//records output of a command being filled, an entry that grows past the size limit will not be stored
+void outcache_append(OutEntry *e, const char *data, size_t len);
+//ends a fill, the result is stored with the command's exit status if ok, dropped otherwise; waiters are woken either way
+//returns 1 if the result was stored
+int outcache_finish(OutEntry *e, int ok, int status);
+//withdraws a waiter that goes away before it is woken, must be called before wait_fd is closed
+void outcache_cancel(int wait_fd);
+
+#endif
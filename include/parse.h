@@ -1,7 +1,57 @@
 #ifndef PARSE_H
 #define PARSE_H
+#include <stddef.h>
 
-int parse_command(char *cmd, char *args[], char **inputFile, char **outputFile, char **errorFile, int isPipeline);
-int validate_pipeline(char *cmd);
+//maximum number of stages in a pipeline
+#define MAX_PIPES 10
+
+//highest descriptor a redirection can name (n>file, n<&m), single digits like sh
+#define MAX_REDIR_FD 9
+//maximum number of redirections of one stage
+#define MAX_REDIRS 64
+
+//kinds of redirection
+#define REDIR_FILE 0            //path is opened with flags onto fd
+#define REDIR_DATA 1            //path is the text itself (here-document or here-string), fed to fd
+#define REDIR_DUP  2            //dup_fd is copied onto fd (n>&m, n<&m), or fd is closed if dup_fd is -1 (n>&-)
+
+//one redirection of a stage, applied in order after the pipe connections so it wins over them
+typedef struct {
+    int fd;                     //descriptor being redirected (0..MAX_REDIR_FD)
+    int type;                   //REDIR_FILE, REDIR_DATA or REDIR_DUP
+    int flags;                  //open(2) flags for path
+    int dup_fd;                 //source descriptor for REDIR_DUP
+    char *path;                 //file name, text, or the descriptor word as written for REDIR_DUP
+} Redirect;
+
+//one stage of a pipeline: its words after globbing and its redirections
+typedef struct {
+    char **argv;                //NULL-terminated
+    int argc;
+    Redirect *redirs;
+    int nredirs;
+} Command;
+
+/*a parsed command line: stages -> words -> redirects, all in a single allocation of size bytes
+(the Command array, then the argv and Redirect arrays, then the strings), so it is released with one free()
+*/
+typedef struct {
+    size_t size;
+    int nstages;
+    Command stages[];
+} Pipeline;
+
+/*parses a whole command line, splitting stages only on unquoted |, returns NULL after printing the error if it is invalid
+the command is the first line of text, the bodies of its <<TAG here-documents follow on the next lines in order
+*/
+Pipeline *parse_pipeline(const char *text);
+//number of here-document bodies text still lacks, a shell keeps reading lines (appended after a '\n') while it is > 0
+int heredoc_pending(const char *text);
+void free_pipeline(Pipeline *pl);
+
+//position-independent copy of a pipeline (pointers become offsets) that can be sent to another process, *len gets its size
+void *pipeline_pack(const Pipeline *pl, size_t *len);
+//rebuilds a packed pipeline, every offset is checked so the input may come from an untrusted peer, NULL if it is malformed
+Pipeline *pipeline_unpack(const void *data, size_t len);
 
 #endif
@@ -1,4 +1,6 @@
 #ifndef REDIR_H
 #define REDIR_H
 int setup_redirection(const char *filename, int flags, int target_fd);
+int setup_data_redirection(const char *data, int target_fd);
+int setup_fd_redirection(int fd, int target_fd);
 #endif
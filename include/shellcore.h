@@ -0,0 +1,44 @@
+#ifndef SHELLCORE_H
+#define SHELLCORE_H
+
+/*libshellcore.a: the parser, executor and builtin filters shared by myshell, server and the benchmarks
+the API runs in three steps: parse_pipeline() -> plan_pipeline() -> spawn_pipeline()/execute_pipeline()
+words are expanded while parsing (expand.h) from the variables of the calling thread's store (env.h)
+*/
+#include "parse.h"
+#include "exec.h"
+#include "filter.h"
+#include "fdcache.h"
+#include "env.h"
+#include "expand.h"
+
+//counters kept by the library, shellcore_stats() takes a snapshot
+typedef struct {
+    long parsed;                //command lines parsed successfully
+    long parse_errors;          //command lines rejected by the parser
+    long pipelines;             //pipelines spawned (a single command counts as one)
+    long processes;             //processes forked for them
+    long builtin_stages;        //stages run as in-process builtin filters
+    long spawn_failures;        //pipelines that could not be started
+    long parse_ns;              //time spent parsing
+    long spawn_ns;              //time spent setting up and forking pipelines, not running them
+    long fd_cache_hits;         //>> redirections served from the descriptor cache
+    long fd_cache_opens;        //files opened into it
+    long prepared_runs;         //prepared commands spawned (parse and PATH search skipped)
+    long substitutions;         //command substitutions $(...) run
+    long substitutions_inproc;  //of them answered by an in-process builtin, no fork or pipe
+} ShellStats;
+
+extern ShellStats shell_stats;
+
+//updated atomically, the server parses and spawns from several worker threads
+#define SHELL_STAT_ADD(field, n) __atomic_fetch_add(&shell_stats.field, (n), __ATOMIC_RELAXED)
+
+//copies the current counters into out
+void shellcore_stats(ShellStats *out);
+//zeroes every counter, e.g. between benchmark runs
+void shellcore_stats_reset(void);
+//monotonic clock in nanoseconds, for the timing counters
+long shellcore_now_ns(void);
+
+#endif
@@ -0,0 +1,44 @@
+#ifndef SHMRING_H
+#define SHMRING_H
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+/*single-producer single-consumer byte ring in a sealed memfd, mapped by a local client and the server so relayed command
+output is read from the pipe straight into memory the client can see: one copy instead of pipe -> server -> socket -> client
+the memfd is one header page then the data area (a power of two); head and tail are free-running byte counts written
+only by the producer (server) and the consumer (client) respectively; the producer announces new bytes with a small
+socket frame, and when the ring is full it simply falls back to ordinary frames, so neither side ever waits on the other
+*/
+
+//smallest and largest data area, sizes are rounded up to a power of two
+#define SHMRING_MIN_SIZE (64 * 1024)
+#define SHMRING_MAX_SIZE (256 * 1024 * 1024)
+
+struct ShmHeader;
+
+typedef struct {
+    struct ShmHeader *hdr;      //NULL when no ring is mapped
+    char *data;
+    size_t size;                //data area, a power of two
+    size_t map_len;
+    uint64_t pos;               //private copy of our own counter (head for the producer, tail for the consumer)
+} ShmRing;
+
+//client side: creates and maps a ring of at least size bytes, sealed against resizing; returns the memfd to pass to the
+//server (the caller closes it once sent), -1 on failure
+int shmring_create(ShmRing *r, size_t size);
+//server side: maps a ring the client passed, returns -1 if fd is not a sealed memfd of a valid size
+int shmring_map(ShmRing *r, int fd);
+void shmring_unmap(ShmRing *r);
+
+//producer: reads from fd into the free space (at most two readv segments), returns the bytes added, 0 on EOF,
+//-1 on error (errno set, EAGAIN when fd is empty), -2 if the ring is full
+ssize_t shmring_fill(ShmRing *r, int fd);
+
+//consumer: the contiguous bytes at the tail, up to max, returns their length and their address in *p
+size_t shmring_peek(const ShmRing *r, size_t max, const char **p);
+//consumer: releases n bytes to the producer
+void shmring_advance(ShmRing *r, size_t n);
+
+#endif
@@ -2,6 +2,14 @@
 #define TOKENIZE_H
 #include <stdbool.h>
 
+/*markers qtokenize() leaves in a word for expand_word() (expand.h): an expansion ("${NAME}", "$(cmd)", "$((expr))",
+$NAME being written as ${NAME}) follows QTOK_EXPAND, or QTOK_EXPAND_QUOTED inside double quotes where its result is not
+split; a byte of the input that is itself a marker is escaped with QTOK_LITERAL
+*/
+#define QTOK_EXPAND '\x01'
+#define QTOK_EXPAND_QUOTED '\x02'
+#define QTOK_LITERAL '\x03'
+
 typedef struct {
     char *val;
     bool was_quoted;
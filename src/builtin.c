@@ -0,0 +1,399 @@
+#define _GNU_SOURCE
+#include "builtin.h"
+#include <errno.h>
+#include <inttypes.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+//how backslash escapes are read: in a printf format (\NNN), in a %b argument and in echo -e (\0NNN as well)
+#define ESC_FORMAT 0
+#define ESC_ARG 1
+#define ESC_ECHO 2
+
+//output appended to the caller's buffer
+typedef struct {
+    char **buf;
+    size_t *len, *cap;
+    size_t start;               //where this command's output began
+    size_t max;
+    int failed;                 //out of memory, or something the real program has to do
+    int stop;                   //\c was seen, nothing more is written
+} Out;
+
+static void out_add(Out *o, const char *p, size_t n){
+    size_t room = o->max - (*o->len - o->start);
+    if(n > room){
+        n = room;
+    }
+    if(*o->len + n + 1 > *o->cap){
+        size_t cap = *o->cap ? *o->cap : 256;
+        while(cap < *o->len + n + 1){
+            cap *= 2;
+        }
+        char *tmp = realloc(*o->buf, cap);
+        if(tmp == NULL){
+            o->failed = 1;
+            return;
+        }
+        *o->buf = tmp;
+        *o->cap = cap;
+    }
+    memcpy(*o->buf + *o->len, p, n);
+    *o->len += n;
+    (*o->buf)[*o->len] = '\0';
+}
+
+//snprintf straight into the buffer
+static void out_format(Out *o, const char *spec, ...){
+    va_list ap, again;
+    va_start(ap, spec);
+    va_copy(again, ap);
+    int n = vsnprintf(NULL, 0, spec, ap);
+    va_end(ap);
+    if(n < 0){
+        o->failed = 1;
+    }else{
+        char small[256];
+        char *text = (size_t)n < sizeof(small) ? small : malloc(n + 1);
+        if(text == NULL){
+            o->failed = 1;
+        }else{
+            vsnprintf(text, n + 1, spec, again);
+            out_add(o, text, n);
+            if(text != small){
+                free(text);
+            }
+        }
+    }
+    va_end(again);
+}
+
+static int is_octal(char c){
+    return c >= '0' && c <= '7';
+}
+
+static int hex_value(char c){
+    if(c >= '0' && c <= '9') return c - '0';
+    if(c >= 'a' && c <= 'f') return c - 'a' + 10;
+    if(c >= 'A' && c <= 'F') return c - 'A' + 10;
+    return -1;
+}
+
+//writes the escape after a backslash at p, returns how many bytes of p it took
+static size_t put_escape(Out *o, const char *p, int mode){
+    static const char from[] = "abefnrtv\\";
+    static const char to[] = "\a\b\033\f\n\r\t\v\\";
+    const char *hit = *p ? strchr(from, *p) : NULL;
+    if(hit != NULL){
+        out_add(o, &to[hit - from], 1);
+        return 1;
+    }
+    if(*p == 'c'){
+        o->stop = 1;
+        return 1;
+    }
+    if(*p == '"' && mode != ESC_ECHO){
+        out_add(o, p, 1);
+        return 1;
+    }
+    if(*p == 'x' && hex_value(p[1]) >= 0){
+        size_t n = 1;
+        int v = 0;
+        while(n < 3 && hex_value(p[n]) >= 0){
+            v = v * 16 + hex_value(p[n++]);
+        }
+        char c = v;
+        out_add(o, &c, 1);
+        return n;
+    }
+    if((*p == 'x' || *p == 'u' || *p == 'U') && mode != ESC_ECHO){
+        o->failed = 1;                  //printf's error or its unicode conversion
+        return 1;
+    }
+    if(is_octal(*p)){
+        size_t skip = mode != ESC_FORMAT && *p == '0', n = 0;
+        int v = 0;
+        while(n < 3 && is_octal(p[skip + n])){
+            v = v * 8 + (p[skip + n++] - '0');
+        }
+        char c = v;
+        out_add(o, &c, 1);
+        return skip + n;
+    }
+    //anything else is kept as written, backslash included
+    out_add(o, "\\", 1);
+    if(*p == '\0'){
+        return 0;
+    }
+    out_add(o, p, 1);
+    return 1;
+}
+
+//writes s with its backslash escapes decoded
+static void put_escaped(Out *o, const char *s, int mode){
+    while(*s && !o->stop){
+        size_t run = strcspn(s, "\\");
+        out_add(o, s, run);
+        s += run;
+        if(*s == '\\'){
+            s++;
+            s += put_escape(o, s, mode);
+        }
+    }
+}
+
+//echo of coreutils: -n, -e and -E (also combined, like -ne), escapes only with -e
+static int run_echo(Out *o, char **argv){
+    int newline = 1, escapes = 0;
+    int i = 1;
+    for(; argv[i] != NULL && argv[i][0] == '-' && argv[i][1] != '\0'; i++){
+        if(strspn(argv[i] + 1, "neE") != strlen(argv[i] + 1)){
+            break;
+        }
+        for(const char *f = argv[i] + 1; *f; f++){
+            if(*f == 'n'){
+                newline = 0;
+            }else{
+                escapes = *f == 'e';
+            }
+        }
+    }
+    for(int first = i; argv[i] != NULL && !o->stop; i++){
+        if(i > first){
+            out_add(o, " ", 1);
+        }
+        if(escapes){
+            put_escaped(o, argv[i], ESC_ECHO);
+        }else{
+            out_add(o, argv[i], strlen(argv[i]));
+        }
+    }
+    if(newline && !o->stop){
+        out_add(o, "\n", 1);
+    }
+    return 0;
+}
+
+/*a numeric printf argument: a number in C syntax, or 'c / "c for the character's code
+an argument printf would complain about is left to it (o->failed)
+*/
+static intmax_t int_arg(Out *o, const char *s, int is_unsigned){
+    if((s[0] == '\'' || s[0] == '"') && s[1] != '\0'){
+        return (unsigned char)s[1];
+    }
+    char *end;
+    errno = 0;
+    intmax_t v = is_unsigned && s[strspn(s, " \t")] != '-' ? (intmax_t)strtoumax(s, &end, 0) : strtoimax(s, &end, 0);
+    if(s[0] == '\0' || *end != '\0' || errno != 0){
+        o->failed = 1;
+    }
+    return v;
+}
+
+static long double float_arg(Out *o, const char *s){
+    if((s[0] == '\'' || s[0] == '"') && s[1] != '\0'){
+        return (unsigned char)s[1];
+    }
+    char *end;
+    errno = 0;
+    long double v = strtold(s, &end);
+    if(s[0] == '\0' || *end != '\0' || errno != 0){
+        o->failed = 1;
+    }
+    return v;
+}
+
+/*one %-conversion of a printf format at p (just after the '%'), consuming arguments from *args
+returns the number of bytes of the format it took
+*/
+static size_t put_conversion(Out *o, const char *p, char ***args){
+    char spec[48] = "%";
+    size_t n = 1, i = 0;
+    int star[2], nstar = 0;
+    //flags, width and precision are passed on to snprintf, a '*' takes its value from the arguments
+    while(p[i] && strchr("-+ #0'", p[i]) && n < 8){
+        spec[n++] = p[i++];
+    }
+    for(int part = 0; part < 2; part++){
+        if(part == 1){
+            if(p[i] != '.'){
+                break;
+            }
+            spec[n++] = p[i++];
+        }
+        if(p[i] == '*'){
+            const char *a = **args ? *(*args)++ : "0";
+            intmax_t v = int_arg(o, a, 0);
+            if(v < -100000 || v > 100000){
+                o->failed = 1;
+            }
+            star[nstar++] = (int)v;
+            spec[n++] = p[i++];
+        }else{
+            while(p[i] >= '0' && p[i] <= '9' && n < sizeof(spec) - 8){
+                spec[n++] = p[i++];
+            }
+        }
+    }
+    char conv = p[i];
+    if(conv == '\0'){
+        o->failed = 1;                  //a format ending in '%'
+        return i;
+    }
+    i++;
+    const char *arg = conv && **args ? *(*args)++ : NULL;
+    if(o->failed){
+        return i;
+    }
+    switch(conv){
+    case 's':
+    case 'b':
+        if(conv == 'b' && arg != NULL){
+            //%b decodes the argument first, a \c in it stops all output
+            char *text = NULL;
+            size_t len = 0, cap = 0;
+            Out tmp = {&text, &len, &cap, 0, o->max, 0, 0};
+            put_escaped(&tmp, arg, ESC_ARG);
+            o->failed |= tmp.failed;
+            o->stop |= tmp.stop;
+            spec[n++] = 's';
+            if(!o->failed){
+                if(nstar == 2) out_format(o, spec, star[0], star[1], text ? text : "");
+                else if(nstar == 1) out_format(o, spec, star[0], text ? text : "");
+                else out_format(o, spec, text ? text : "");
+            }
+            free(text);
+            return i;
+        }
+        spec[n++] = 's';
+        if(nstar == 2) out_format(o, spec, star[0], star[1], arg ? arg : "");
+        else if(nstar == 1) out_format(o, spec, star[0], arg ? arg : "");
+        else out_format(o, spec, arg ? arg : "");
+        return i;
+    case 'c':
+        //what %c makes of a missing or empty argument is left to printf
+        if(arg == NULL || arg[0] == '\0' || nstar > 1){
+            o->failed = 1;
+            return i;
+        }
+        spec[n++] = 'c';
+        if(nstar == 1) out_format(o, spec, star[0], arg[0]);
+        else out_format(o, spec, arg[0]);
+        return i;
+    case 'd':
+    case 'i':
+    case 'o':
+    case 'u':
+    case 'x':
+    case 'X': {
+        intmax_t v = arg ? int_arg(o, arg, conv != 'd' && conv != 'i') : 0;
+        spec[n++] = 'j';
+        spec[n++] = conv;
+        if(o->failed) return i;
+        if(nstar == 2) out_format(o, spec, star[0], star[1], v);
+        else if(nstar == 1) out_format(o, spec, star[0], v);
+        else out_format(o, spec, v);
+        return i;
+    }
+    case 'e':
+    case 'E':
+    case 'f':
+    case 'F':
+    case 'g':
+    case 'G':
+    case 'a':
+    case 'A': {
+        long double v = arg ? float_arg(o, arg) : 0;
+        spec[n++] = 'L';
+        spec[n++] = conv;
+        if(o->failed) return i;
+        if(nstar == 2) out_format(o, spec, star[0], star[1], v);
+        else if(nstar == 1) out_format(o, spec, star[0], v);
+        else out_format(o, spec, v);
+        return i;
+    }
+    }
+    //length modifiers, %q and the rest: the real printf
+    o->failed = 1;
+    return i;
+}
+
+//printf of coreutils: the format is reused until every argument has been converted
+static int run_printf(Out *o, char **argv){
+    if(argv[1] == NULL || (argv[2] == NULL && strncmp(argv[1], "--", 2) == 0)){
+        return -1;                      //usage, --help and --version
+    }
+    const char *format = argv[1];
+    char **args = argv + 2;
+    do{
+        char **before = args;
+        for(const char *p = format; *p && !o->stop && !o->failed; ){
+            if(*p == '\\'){
+                p++;
+                p += put_escape(o, p, ESC_FORMAT);
+            }else if(*p == '%' && p[1] == '%'){
+                out_add(o, "%", 1);
+                p += 2;
+            }else if(*p == '%'){
+                p++;
+                p += put_conversion(o, p, &args);
+            }else{
+                size_t run = strcspn(p, "\\%");
+                out_add(o, p, run);
+                p += run;
+            }
+        }
+        if(args == before && *args != NULL){
+            return -1;                  //printf warns about the arguments it ignores
+        }
+    }while(*args != NULL && !o->stop && !o->failed);
+    return 0;
+}
+
+//pwd of coreutils, which prints the physical directory unless told -L
+static int run_pwd(Out *o, char **argv){
+    if(argv[1] != NULL && (strcmp(argv[1], "-P") != 0 || argv[2] != NULL)){
+        return -1;
+    }
+    char *cwd = getcwd(NULL, 0);
+    if(cwd == NULL){
+        return -1;                      //the real pwd reports why
+    }
+    out_add(o, cwd, strlen(cwd));
+    out_add(o, "\n", 1);
+    free(cwd);
+    return 0;
+}
+
+int builtin_capture(const Pipeline *pl, char **buf, size_t *len, size_t *cap, size_t max){
+    if(pl->nstages != 1 || pl->stages[0].nredirs != 0){
+        return -1;
+    }
+    char **argv = pl->stages[0].argv;
+    //only --help and --version make true and false do anything else
+    int sole_option = argv[1] != NULL && argv[2] == NULL && strncmp(argv[1], "--", 2) == 0;
+    Out o = {buf, len, cap, *len, max, 0, 0};
+    int status;
+    if(strcmp(argv[0], "echo") == 0){
+        status = sole_option ? -1 : run_echo(&o, argv);
+    }else if(strcmp(argv[0], "printf") == 0){
+        status = run_printf(&o, argv);
+    }else if(strcmp(argv[0], "pwd") == 0){
+        status = run_pwd(&o, argv);
+    }else if(strcmp(argv[0], "true") == 0 || strcmp(argv[0], "false") == 0){
+        status = sole_option ? -1 : argv[0][0] == 'f';
+    }else{
+        return -1;
+    }
+    if(status < 0 || o.failed){
+        *len = o.start;
+        if(*buf != NULL){
+            (*buf)[*len] = '\0';
+        }
+        return -1;
+    }
+    return status;
+}
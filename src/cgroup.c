@@ -0,0 +1,243 @@
+#define _GNU_SOURCE
+#include "cgroup.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+//number of limits -L can configure
+#define MAX_LIMITS 16
+//leaves that could not be removed yet (processes still exiting), retried when the next one is created
+#define MAX_GRAVES 64
+
+typedef struct {
+    char *file;
+    char *value;
+    int warned;                 //the write failed once already, do not repeat the warning for every session
+} Limit;
+
+//set up before the workers start, read-only afterwards
+static Limit limits[MAX_LIMITS];
+static int nlimits;
+static int base_fd = -1;
+
+static long next_id;
+static pthread_mutex_t graves_lock = PTHREAD_MUTEX_INITIALIZER;
+static char *graves[MAX_GRAVES];
+static int ngraves;
+
+int cgroup_add_limit(const char *spec){
+    const char *eq = strchr(spec, '=');
+    if(eq == NULL || eq == spec || eq[1] == '\0' || strchr(spec, '/') != NULL || nlimits == MAX_LIMITS){
+        return -1;
+    }
+    limits[nlimits].file = strndup(spec, eq - spec);
+    limits[nlimits].value = strdup(eq + 1);
+    if(limits[nlimits].file == NULL || limits[nlimits].value == NULL){
+        return -1;
+    }
+    nlimits++;
+    return 0;
+}
+
+//writes text into a control file of the cgroup directory dir_fd, returns 0 on success, -1 on failure (errno set)
+static int write_control(int dir_fd, const char *file, const char *text){
+    int fd = openat(dir_fd, file, O_WRONLY | O_CLOEXEC);
+    if(fd < 0){
+        return -1;
+    }
+    ssize_t n = write(fd, text, strlen(text));
+    int saved = errno;
+    close(fd);
+    errno = saved;
+    return n < 0 ? -1 : 0;
+}
+
+//reads a control file into buf, returns its length or -1
+static ssize_t read_control(int dir_fd, const char *file, char *buf, size_t cap){
+    int fd = openat(dir_fd, file, O_RDONLY | O_CLOEXEC);
+    if(fd < 0){
+        return -1;
+    }
+    ssize_t n = read(fd, buf, cap - 1);
+    close(fd);
+    if(n >= 0){
+        buf[n] = '\0';
+    }
+    return n;
+}
+
+//whether pid is listed in a cgroup.procs text
+static int lists_pid(const char *procs, pid_t pid){
+    for(const char *p = procs; *p; ){
+        char *end;
+        if(strtol(p, &end, 10) == pid && end != p){
+            return 1;
+        }
+        p = *end ? end + 1 : end;
+    }
+    return 0;
+}
+
+int cgroup_init(const char *dir){
+    char buf[4096];
+    int fd = open(dir, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if(fd < 0 || read_control(fd, "cgroup.controllers", buf, sizeof(buf)) < 0){
+        fprintf(stderr, "[WARN] %s is not a cgroup v2 directory: %s\n", dir, strerror(errno));
+        if(fd >= 0){
+            close(fd);
+        }
+        return -1;
+    }
+    char controllers[sizeof(buf)];
+    strcpy(controllers, buf);
+    controllers[strcspn(controllers, "\n")] = '\0';
+
+    //a cgroup with processes cannot hand controllers to its children, the server steps into a leaf of its own
+    if(read_control(fd, "cgroup.procs", buf, sizeof(buf)) > 0 && lists_pid(buf, getpid())){
+        if(mkdirat(fd, "server", 0755) < 0 && errno != EEXIST){
+            perror("cgroup mkdir server");
+        }else{
+            int server_fd = openat(fd, "server", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+            if(server_fd < 0 || write_control(server_fd, "cgroup.procs", "0") < 0){
+                perror("cgroup move server");
+            }
+            if(server_fd >= 0){
+                close(server_fd);
+            }
+        }
+    }
+
+    //controllers the limits need, each one on its own so a missing one does not take the others down
+    static const char *wanted[] = {"cpu", "memory", "io"};
+    char enabled[64] = "";
+    for(size_t i = 0; i < sizeof(wanted) / sizeof(wanted[0]); i++){
+        char op[16];
+        snprintf(op, sizeof(op), "+%s", wanted[i]);
+        if(write_control(fd, "cgroup.subtree_control", op) == 0){
+            strcat(enabled, enabled[0] ? "," : "");
+            strcat(enabled, wanted[i]);
+        }
+    }
+    printf("[INFO] Sessions run in cgroups under %s (controllers: %s)\n", dir, enabled[0] ? enabled : "none");
+    if(controllers[0] == '\0' && nlimits > 0){
+        fprintf(stderr, "[WARN] No controllers are delegated to %s, limits will not apply\n", dir);
+    }
+    base_fd = fd;
+    return 0;
+}
+
+int cgroup_enabled(void){
+    return base_fd >= 0;
+}
+
+//retries removing leaves whose processes were still exiting
+static void bury_graves(void){
+    pthread_mutex_lock(&graves_lock);
+    for(int i = 0; i < ngraves; ){
+        if(unlinkat(base_fd, graves[i], AT_REMOVEDIR) == 0 || errno == ENOENT){
+            free(graves[i]);
+            graves[i] = graves[--ngraves];
+        }else{
+            i++;
+        }
+    }
+    pthread_mutex_unlock(&graves_lock);
+}
+
+int cgroup_create(char *name, size_t n){
+    bury_graves();
+    snprintf(name, n, "session-%d-%ld", (int)getpid(), __atomic_add_fetch(&next_id, 1, __ATOMIC_RELAXED));
+    if(mkdirat(base_fd, name, 0755) < 0){
+        perror("cgroup mkdir");
+        return -1;
+    }
+    int fd = openat(base_fd, name, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if(fd < 0){
+        perror("cgroup open");
+        unlinkat(base_fd, name, AT_REMOVEDIR);
+        return -1;
+    }
+    for(int i = 0; i < nlimits; i++){
+        if(write_control(fd, limits[i].file, limits[i].value) < 0 && !__atomic_exchange_n(&limits[i].warned, 1, __ATOMIC_RELAXED)){
+            fprintf(stderr, "[WARN] cgroup: cannot set %s=%s: %s\n", limits[i].file, limits[i].value, strerror(errno));
+        }
+    }
+    return fd;
+}
+
+//value of "key N" in a flat keyed file such as cpu.stat, -1 if it is missing
+static long keyed_value(const char *text, const char *key){
+    size_t n = strlen(key);
+    for(const char *p = text; *p; ){
+        if(strncmp(p, key, n) == 0 && p[n] == ' '){
+            return atol(p + n + 1);
+        }
+        p = strchr(p, '\n');
+        if(p == NULL){
+            break;
+        }
+        p++;
+    }
+    return -1;
+}
+
+int cgroup_usage(int fd, CgroupUsage *u){
+    char buf[4096];
+    memset(u, 0, sizeof(*u));
+    if(read_control(fd, "cpu.stat", buf, sizeof(buf)) < 0){
+        return -1;
+    }
+    u->usage_usec = keyed_value(buf, "usage_usec");
+    u->user_usec = keyed_value(buf, "user_usec");
+    u->system_usec = keyed_value(buf, "system_usec");
+
+    u->memory_peak = -1;
+    if(read_control(fd, "memory.peak", buf, sizeof(buf)) > 0 || read_control(fd, "memory.current", buf, sizeof(buf)) > 0){
+        u->memory_peak = atol(buf);
+    }
+
+    //one line per device: "maj:min rbytes=N wbytes=N rios=N ..."
+    if(read_control(fd, "io.stat", buf, sizeof(buf)) > 0){
+        for(char *p = buf; (p = strstr(p, "bytes=")) != NULL; p += 6){
+            if(p[-1] == 'r'){
+                u->io_rbytes += atol(p + 6);
+            }else if(p[-1] == 'w'){
+                u->io_wbytes += atol(p + 6);
+            }
+        }
+    }
+    return 0;
+}
+
+int cgroup_kill(int fd){
+    if(write_control(fd, "cgroup.kill", "1") < 0){
+        if(errno != ENOENT){
+            perror("cgroup.kill");
+        }
+        return -1;
+    }
+    return 0;
+}
+
+void cgroup_destroy(int fd, const char *name){
+    //background jobs a command left behind die with the session
+    cgroup_kill(fd);
+    close(fd);
+    if(unlinkat(base_fd, name, AT_REMOVEDIR) == 0){
+        return;
+    }
+    //still populated while the killed processes exit, removed later
+    pthread_mutex_lock(&graves_lock);
+    if(ngraves < MAX_GRAVES){
+        graves[ngraves] = strdup(name);
+        ngraves += graves[ngraves] != NULL;
+    }else{
+        fprintf(stderr, "[WARN] cgroup %s left behind\n", name);
+    }
+    pthread_mutex_unlock(&graves_lock);
+}
@@ -1,17 +1,38 @@
 #include "net.h"
+#include "lz.h"
+#include "shmring.h"
+#include "parse.h"
+#include "lineedit.h"
+#include "history.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <signal.h>
+#include <poll.h>
 
 //maximum length for command input buffer
 #define MAX_CMD_LENGTH 1024 
+//largest command frame the server accepts, here-document bodies included
+#define MAX_FRAME_LENGTH (RECV_RING_SIZE - 8)
+//stdin bytes sent per FRAME_IN
+#define IN_CHUNK 8192
 
 //global variable for signal handling
 static int client_fd = -1;
+//read-ahead buffer for the server's replies
+static RecvRing server_ring;
+//output ring shared with the server (-m), hdr is NULL when output only comes in frames
+static ShmRing out_ring;
+//set while a command runs, Ctrl-C then asks the server to stop it instead of quitting (a second Ctrl-C quits)
+static volatile sig_atomic_t running;
+static volatile sig_atomic_t cancel_requested;
 
 //signal handler for graceful shutdown, closes socket and exits cleanly
 void signal_handler(int sig){
+    if(sig == SIGINT && running && !cancel_requested){
+        cancel_requested = 1;                   //picked up by the poll it interrupts
+        return;
+    }
     printf("\n[INFO] Shutting down client...\n");
     if(client_fd >= 0){
         close_socket(client_fd);
@@ -19,22 +40,303 @@ void signal_handler(int sig){
     exit(0);
 }
 
+/*handles one frame from the server while a command runs: output goes to stdout, credit is added to *credit
+returns 1 once the command is over (*status gets its exit status), 0 to keep going, -1 on a corrupt frame
+*/
+static int handle_frame(int type, char *reply, int n, long *credit, int *status){
+    static char raw[LZ_MAX_BLOCK];
+
+    if(type == FRAME_OUT){
+        fwrite(reply, 1, n, stdout);
+    }else if(type == FRAME_OUTZ){
+        uint32_t expect;
+        if(n < (int)sizeof(expect)){
+            fprintf(stderr, "Error: truncated compressed frame\n");
+            return -1;
+        }
+        memcpy(&expect, reply, sizeof(expect));
+        int m = lz_decompress(reply + sizeof(expect), n - sizeof(expect), raw, sizeof(raw));
+        if(m < 0 || (uint32_t)m != ntohl(expect)){
+            fprintf(stderr, "Error: corrupt compressed frame\n");
+            return -1;
+        }
+        fwrite(raw, 1, m, stdout);
+    }else if(type == FRAME_SHMOUT){
+        //that many bytes follow in the shared ring, in order with the frames around this one
+        long left = atol(reply);
+        if(out_ring.hdr == NULL || left < 0 || (size_t)left > out_ring.size){
+            fprintf(stderr, "Error: bad shared ring notice\n");
+            return -1;
+        }
+        while(left > 0){
+            const char *p;
+            size_t m = shmring_peek(&out_ring, left, &p);
+            fwrite(p, 1, m, stdout);
+            shmring_advance(&out_ring, m);
+            left -= m;
+        }
+    }else if(type == FRAME_CREDIT){
+        *credit += atol(reply);
+    }else if(type == FRAME_DONE){
+        fflush(stdout);
+        *status = atoi(reply);
+        return 1;
+    }else if(type == FRAME_BUSY){
+        //the server shed this command (or the whole connection) under load
+        printf("Server busy: %s\n", reply);
+        fflush(stdout);
+        *status = 1;
+        return 1;
+    }
+    return 0;
+}
+
+/*a send failed because the server hung up, but what it said before (a FRAME_BUSY refusal, the end of the command)
+is still readable: runs it through handle_frame, returns the command's status or -1 if nothing final came
+*/
+static int read_last_answer(void){
+    static char reply[RECV_RING_SIZE];
+    long credit = 0;
+    int status = 0;
+    int type, n;
+
+    while((n = receive_frame_buffered(&server_ring, &type, reply, sizeof(reply))) > 0){
+        int rc = handle_frame(type, reply, n, &credit, &status);
+        if(rc != 0){
+            status = rc < 0 ? -1 : status;
+            break;
+        }
+    }
+    return n > 0 ? status : -1;
+}
+
+//forwards a pending Ctrl-C to the server as FRAME_CANCEL, returns -1 if the connection is gone
+static int send_cancel(void){
+    if(cancel_requested != 1){
+        return 0;
+    }
+    cancel_requested = 2;
+    return send_frame(client_fd, FRAME_CANCEL, "1", 1);
+}
+
+//relays FRAME_OUT chunks to stdout until the FRAME_DONE for the current command, returns its status or -1 if the connection is gone
+static int wait_for_result(void){
+    static char reply[RECV_RING_SIZE];
+    long credit = 0;
+    int status = 0;
+    int type;
+
+    while(1){
+        //poll rather than block in recv so a Ctrl-C can be forwarded
+        if(recv_ring_pending(&server_ring) == 0){
+            struct pollfd p = { client_fd, POLLIN, 0 };
+            if(poll(&p, 1, -1) < 0){
+                if(errno == EINTR){
+                    if(send_cancel() < 0){
+                        return -1;
+                    }
+                    continue;
+                }
+                perror("poll");
+                return -1;
+            }
+        }
+        int n = receive_frame_buffered(&server_ring, &type, reply, sizeof(reply));
+        if(n <= 0){
+            printf("\n[INFO] Server closed the connection\n");
+            return -1;
+        }
+        int rc = handle_frame(type, reply, n, &credit, &status);
+        if(rc != 0){
+            return rc < 0 ? -1 : status;
+        }
+    }
+}
+
+/*like wait_for_result, but also streams our stdin to the command as FRAME_IN chunks, never more than the server
+has granted with FRAME_CREDIT, then FRAME_INEOF; returns the command's status or -1 if the connection is gone
+*/
+static int stream_command(void){
+    static char reply[RECV_RING_SIZE];
+    char chunk[IN_CHUNK];
+    long credit = 0, sent = 0;
+    int in_open = 1;
+    int status = 0;
+    int type;
+
+    while(1){
+        //frames already read ahead do not make the socket readable again
+        if(recv_ring_pending(&server_ring) == 0){
+            struct pollfd p[2] = {
+                { client_fd, POLLIN, 0 },
+                { STDIN_FILENO, in_open && credit > 0 ? POLLIN : 0, 0 },
+            };
+            if(poll(p, 2, -1) < 0){
+                if(errno == EINTR){
+                    if(send_cancel() < 0){
+                        return -1;
+                    }
+                    continue;
+                }
+                perror("poll");
+                return -1;
+            }
+            if(p[1].revents && p[1].events){              //POLLHUP is reported even while we are out of credit
+                ssize_t n = read(STDIN_FILENO, chunk, credit < IN_CHUNK ? credit : IN_CHUNK);
+                if(n < 0 && errno == EINTR){
+                    continue;
+                }
+                if(n > 0){
+                    if(send_frame(client_fd, FRAME_IN, chunk, n) < 0){
+                        return read_last_answer();
+                    }
+                    credit -= n;
+                    sent += n;
+                }else{
+                    char total[24];
+                    snprintf(total, sizeof(total), "%ld", sent);
+                    if(send_frame(client_fd, FRAME_INEOF, total, strlen(total)) < 0){
+                        return read_last_answer();
+                    }
+                    in_open = 0;
+                }
+            }
+            if(!(p[0].revents)){
+                continue;
+            }
+        }
+
+        int n = receive_frame_buffered(&server_ring, &type, reply, sizeof(reply));
+        if(n <= 0){
+            fprintf(stderr, "[INFO] Server closed the connection\n");
+            return -1;
+        }
+        int rc = handle_frame(type, reply, n, &credit, &status);
+        if(rc != 0){
+            return rc < 0 ? -1 : status;
+        }
+    }
+}
+
+//runs the command just sent until the server reports it finished, with Ctrl-C turned into a cancel meanwhile
+static int run_command(int stream){
+    cancel_requested = 0;
+    running = 1;
+    int status = stream ? stream_command() : wait_for_result();
+    running = 0;
+    return status;
+}
+
+/*Tab completion answered by the server: sends the line up to the cursor (a lone blank for an empty one, empty frames
+are not delivered) and turns the answer, the number of matches and their common prefix followed by the best of them one
+per line, into the line editor's candidates
+*/
+static char **complete_remote(const char *line, int word_start, char **common, int *more){
+    static char reply[RECV_RING_SIZE];
+    int type, n;
+    (void)word_start;                           //the server finds the word the same way
+    if(send_frame(client_fd, FRAME_COMPLETE, line[0] ? line : " ", line[0] ? strlen(line) : 1) < 0){
+        return NULL;
+    }
+    do{
+        n = receive_frame_buffered(&server_ring, &type, reply, sizeof(reply));
+    }while(n > 0 && type != FRAME_COMPLETE);
+    char *shared = n > 0 ? strchr(reply, '\n') : NULL;
+    char *names = shared ? strchr(shared + 1, '\n') : NULL;
+    if(names == NULL){
+        return NULL;
+    }
+    *names++ = '\0';
+    int count = 0;
+    for(const char *p = names; (p = strchr(p, '\n')) != NULL; p++){
+        count++;
+    }
+    char **c = calloc(count + 1, sizeof(char *));
+    if(c == NULL){
+        return NULL;
+    }
+    for(int i = 0; i < count; i++){
+        char *nl = strchr(names, '\n');
+        c[i] = strndup(names, nl - names);
+        names = nl + 1;
+    }
+    *common = strdup(shared + 1);
+    *more = atoi(reply) - count;
+    return c;
+}
+
+/*reads the here-document bodies a command line announces (see heredoc_pending), prompting with "> " like sh
+returns the whole text or NULL if it would not fit in one command frame
+*/
+static char *read_heredocs(const char *cmd){
+    static char text[MAX_FRAME_LENGTH];
+    char line[MAX_CMD_LENGTH];
+    size_t len = strlen(cmd);
+
+    memcpy(text, cmd, len + 1);
+    while(heredoc_pending(text) > 0){
+        printf("> ");
+        fflush(stdout);
+        if(fgets(line, sizeof(line), stdin) == NULL){
+            break;                      //the server's parser reports the missing delimiter
+        }
+        line[strcspn(line, "\n")] = '\0';
+        size_t n = strlen(line);
+        if(len + 1 + n >= sizeof(text)){
+            fprintf(stderr, "Error: here-document too large, stream it with -c instead\n");
+            return NULL;
+        }
+        text[len++] = '\n';
+        memcpy(text + len, line, n + 1);
+        len += n;
+    }
+    return text;
+}
+
 //client main function, connects to server, displays prompt, reads commands, and sends them
 int main(int argc, char *argv[]){
     char *server_ip;
     int port;
-    char cmd_buffer[MAX_CMD_LENGTH];
+    char *cmd_buffer = NULL;
+    int pass_stdio = 0;
+    int compress = 0;
+    long ring_kb = 0;
+    double timeout = 0;
+    const char *command = NULL;
+    int opt;
+
+    /*parse options, -p hands our stdin/stdout/stderr to the server (local sockets only), -z asks for compressed output
+    -c runs a single command with our stdin streamed to it (e.g. producer | client -c "sort" <address>) and exits with its status
+    -t seconds asks the server to kill commands running longer than that (it may enforce a shorter deadline of its own)
+    -m kb shares an output ring of that size with the server (local sockets only), large outputs then skip the socket
+    */
+    while((opt = getopt(argc, argv, "pzc:t:m:")) != -1){
+        if(opt == 'p'){
+            pass_stdio = 1;
+        }else if(opt == 'z'){
+            compress = 1;
+        }else if(opt == 'c' && strlen(optarg) < MAX_FRAME_LENGTH){
+            command = optarg;
+        }else if(opt == 't' && atof(optarg) > 0){
+            timeout = atof(optarg);
+        }else if(opt == 'm' && atol(optarg) > 0){
+            ring_kb = atol(optarg);
+        }else{
+            fprintf(stderr, "Usage: %s [-p] [-z] [-t timeout] [-m ring_kb] [-c command] <server_ip> <port> | %s [-p] [-z] [-t timeout] [-m ring_kb] [-c command] <address>\n", argv[0], argv[0]);
+            exit(1);
+        }
+    }
 
     //check command line arguments
-    if(argc != 3){
-        fprintf(stderr, "Usage: %s <server_ip> <port>\n", argv[0]);
+    if(argc - optind != 1 && argc - optind != 2){
+        fprintf(stderr, "Usage: %s [-p] [-z] [-t timeout] [-m ring_kb] [-c command] <server_ip> <port> | %s [-p] [-z] [-t timeout] [-m ring_kb] [-c command] <address>\n", argv[0], argv[0]);
         exit(1);
     }
 
-    server_ip = argv[1];
-    port = atoi(argv[2]);
+    server_ip = argv[optind];
+    port = argc - optind == 2 ? atoi(argv[optind + 1]) : 0;
     
-    if(port <= 0 || port > 65535){
+    if(argc - optind == 2 && (port <= 0 || port > 65535)){
         fprintf(stderr, "Error: Invalid port number\n");
         exit(1);
     }
@@ -42,53 +344,180 @@ int main(int argc, char *argv[]){
     //set up signal handlers for graceful shutdown
     signal(SIGINT, signal_handler);
     signal(SIGTERM, signal_handler);
+    //a server that hung up (e.g. refused the session as busy) makes send fail instead of killing us before we read why
+    signal(SIGPIPE, SIG_IGN);
 
-    //connect to server
-    client_fd = create_client_socket(server_ip, port);
+    //connect to server, a single argument is an address spec such as unix:/path, @name or [::1]:5050
+    client_fd = port ? create_client_socket(server_ip, port) : connect_to_address(server_ip);
     if(client_fd < 0){
         fprintf(stderr, "Error: Failed to connect to server\n");
         exit(1);
     }
+    //in one-shot mode stdout carries nothing but the command's output
+    if(!command){
+        if(port){
+            printf("[INFO] Connected to server %s:%d\n", server_ip, port);
+        }else{
+            printf("[INFO] Connected to server %s\n", server_ip);
+        }
+    }
+    recv_ring_init(&server_ring, client_fd);
+
+    //the ring goes over before the hello so the server can accept it there
+    if(ring_kb > 0){
+        int memfd = shmring_create(&out_ring, (size_t)ring_kb * 1024);
+        if(memfd >= 0 && send_fds_frame(client_fd, FRAME_SHM, &memfd, 1) < 0){
+            fprintf(stderr, "[WARN] Cannot share an output ring (server must be on a local socket)\n");
+            shmring_unmap(&out_ring);
+        }
+        if(memfd >= 0){
+            close(memfd);
+        }
+    }
+
+    /*negotiate compressed output, stdin streaming, the shared ring, the command deadline and (for someone typing) Tab
+    completion, the server answers with the features it accepted
+    */
+    int stream = command != NULL && !pass_stdio;
+    int interactive = command == NULL && isatty(STDIN_FILENO);
+    int complete = 0;
+    if(compress || stream || timeout > 0 || out_ring.hdr != NULL || interactive){
+        char accepted[64];
+        char features[64];
+        snprintf(features, sizeof(features), "%s%s%s%s", compress ? "lz," : "", stream ? "stdin," : "", out_ring.hdr != NULL ? "shm," : "",
+                 interactive ? "complete," : "");
+        if(timeout > 0){
+            snprintf(features + strlen(features), sizeof(features) - strlen(features), "timeout=%g,", timeout);
+        }
+        features[strlen(features) - 1] = '\0';         //drop the trailing comma
+        int type = 0;
+        int n = send_frame(client_fd, FRAME_HELLO, features, strlen(features)) < 0 ? -2 :
+                receive_frame_buffered(&server_ring, &type, accepted, sizeof(accepted));
+        if(n <= 0 || type != FRAME_HELLO){
+            //a refused session gets FRAME_BUSY instead of the answer, which is reported as such
+            long credit = 0;
+            int status;
+            int rc = n == -2 ? read_last_answer() : n > 0 ? handle_frame(type, accepted, n, &credit, &status) : -1;
+            if(rc <= 0){
+                fprintf(stderr, "Error: Failed to negotiate features\n");
+            }
+            exit(1);
+        }
+        if(compress && !command){
+            printf("[INFO] Output compression: %s\n", strstr(accepted, "lz") ? "lz" : "none");
+        }
+        if(out_ring.hdr != NULL && !command){
+            printf("[INFO] Shared output ring: %s\n", strstr(accepted, "shm") ? "yes" : "no");
+        }
+        const char *deadline = strstr(accepted, "timeout=");
+        if(timeout > 0 && !command){
+            printf("[INFO] Command timeout: %s\n", deadline ? deadline + 8 : "none");
+        }
+        stream = stream && strstr(accepted, "stdin") != NULL;
+        complete = strstr(accepted, "complete") != NULL;
+    }
+
+    //hand our own descriptors over so command output lands on them directly instead of being relayed
+    if(pass_stdio){
+        int fds[3] = {STDIN_FILENO, STDOUT_FILENO, STDERR_FILENO};
+        if(send_fds(client_fd, fds, 3) < 0){
+            if(read_last_answer() < 0){
+                fprintf(stderr, "Error: Failed to pass descriptors (server must be on a local socket)\n");
+            }
+            exit(1);
+        }
+    }
+
+    //one-shot mode: nothing but the command's output on stdout, our exit status is the command's
+    if(command){
+        int status = 1;
+        if(send_line(client_fd, command) < 0){
+            status = read_last_answer();
+            if(status < 0){
+                fprintf(stderr, "Error: Failed to send command\n");
+            }
+        }else{
+            fflush(stdout);
+            status = run_command(stream);
+        }
+        close_socket(client_fd);
+        return status < 0 ? 1 : status;
+    }
 
     printf("[INFO] Connected to server successfully\n");
 
+    //lines are edited locally with their own history, e.g. MYSHELL_HISTFILE=/tmp/h to keep it elsewhere
+    if(interactive){
+        const char *histfile = getenv("MYSHELL_HISTFILE");
+        const char *home = getenv("HOME");
+        char path[4096];
+        if(histfile == NULL && home != NULL){
+            snprintf(path, sizeof(path), "%s/.myshell_client_history", home);
+            histfile = path;
+        }
+        if(histfile != NULL){
+            history_open(histfile);
+        }
+        if(complete){
+            lineedit_set_completer(complete_remote);
+        }
+    }
+
     //main client loop
     while(1){
-        //display prompt
-        printf("$ ");
+        //display prompt and read command from user input (edited in place on a terminal)
         fflush(stdout);
-
-        //read command from user input
-        if(fgets(cmd_buffer, sizeof(cmd_buffer), stdin) == NULL){
+        free(cmd_buffer);
+        cmd_buffer = lineedit_read("$ ");
+        if(cmd_buffer == NULL){
             //handle Ctrl+D (EOF)
             printf("\n[INFO] End of input, exiting...\n");
             break;
         }
 
-        //remove newline character
-        cmd_buffer[strcspn(cmd_buffer, "\n")] = '\0';
-
         //skip empty commands
         if(strlen(cmd_buffer) == 0){
             continue;
         }
+        if(strlen(cmd_buffer) >= MAX_FRAME_LENGTH){
+            fprintf(stderr, "Error: Command too long\n");
+            continue;
+        }
+        if(interactive){
+            history_add(cmd_buffer);
+        }
+
+        //here-documents continue on the following lines and travel with the command
+        const char *text = heredoc_pending(cmd_buffer) > 0 ? read_heredocs(cmd_buffer) : cmd_buffer;
+        if(text == NULL){
+            continue;
+        }
 
         //send command to server
-        if(send_line(client_fd, cmd_buffer) < 0){
-            perror("Error sending command");
+        if(send_line(client_fd, text) < 0){
+            if(read_last_answer() < 0){
+                printf("\n[INFO] Server closed the connection\n");
+            }
             break;
         }
 
         printf("[INFO] Command sent to server: \"%s\"\n", cmd_buffer);
+        fflush(stdout);                                    //the command may write to the same stdout
 
         //handle exit command
         if(strcmp(cmd_buffer, "exit") == 0){
             printf("[INFO] Exiting client...\n");
             break;
         }
+
+        //print the command's output until the server reports it finished
+        if(run_command(0) < 0){
+            break;
+        }
     }
 
     //clean up
+    free(cmd_buffer);
     close_socket(client_fd);
     return 0;
 }
@@ -0,0 +1,317 @@
+#define _GNU_SOURCE
+#include "complete.h"
+#include "shellcore.h"
+#include <dirent.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+//how long the PATH table is trusted before the directories are looked at again
+#define RECHECK_NS 1000000000L
+//PATH directories watched for changes, later ones are still scanned but not rechecked
+#define MAX_PATH_DIRS 64
+
+typedef struct {
+    char *path;
+    struct timespec mtime;
+} PathDir;
+
+static pthread_mutex_t table_lock = PTHREAD_MUTEX_INITIALIZER;
+static char **names;                //sorted, without duplicates
+static int nnames;
+static char *table_path;            //the PATH value the table was built from
+static PathDir dirs[MAX_PATH_DIRS];
+static int ndirs;
+static long checked;
+
+static int compare_names(const void *a, const void *b){
+    return strcmp(*(char *const *)a, *(char *const *)b);
+}
+
+static void free_table(void){
+    for(int i = 0; i < nnames; i++){
+        free(names[i]);
+    }
+    free(names);
+    names = NULL;
+    nnames = 0;
+    for(int i = 0; i < ndirs; i++){
+        free(dirs[i].path);
+    }
+    ndirs = 0;
+    free(table_path);
+    table_path = NULL;
+}
+
+//appends a copy of name to the table, *cap is its allocated length
+static void add_name(const char *name, int *cap){
+    if(nnames == *cap){
+        int ncap = *cap ? *cap * 2 : 1024;
+        char **tmp = realloc(names, ncap * sizeof(char *));
+        if(tmp == NULL){
+            return;
+        }
+        names = tmp;
+        *cap = ncap;
+    }
+    if((names[nnames] = strdup(name)) != NULL){
+        nnames++;
+    }
+}
+
+//adds the executables of one directory to the growing table
+static void scan_dir(const char *dir, int *cap){
+    DIR *d = opendir(dir);
+    if(d == NULL){
+        return;
+    }
+    int dfd = dirfd(d);
+    struct dirent *de;
+    while((de = readdir(d)) != NULL){
+        struct stat st;
+        if(de->d_name[0] == '.' || fstatat(dfd, de->d_name, &st, 0) < 0 || !S_ISREG(st.st_mode) || !(st.st_mode & 0111)){
+            continue;
+        }
+        add_name(de->d_name, cap);
+    }
+    closedir(d);
+}
+
+static void build_table(const char *path){
+    int cap = 0;
+    free_table();
+    table_path = strdup(path);
+    add_name("exit", &cap);
+    char *copy = strdup(path);
+    for(char *save = NULL, *dir = copy ? strtok_r(copy, ":", &save) : NULL; dir != NULL; dir = strtok_r(NULL, ":", &save)){
+        struct stat st;
+        if(ndirs < MAX_PATH_DIRS && stat(dir, &st) == 0 && (dirs[ndirs].path = strdup(dir)) != NULL){
+            dirs[ndirs++].mtime = st.st_mtim;
+        }
+        scan_dir(dir, &cap);
+    }
+    free(copy);
+    qsort(names, nnames, sizeof(char *), compare_names);
+    int out = 0;
+    for(int i = 0; i < nnames; i++){
+        if(out > 0 && strcmp(names[out - 1], names[i]) == 0){
+            free(names[i]);                 //the first directory on PATH wins, the name is the same either way
+        }else{
+            names[out++] = names[i];
+        }
+    }
+    nnames = out;
+}
+
+//whether the table no longer matches PATH or a directory in it was modified since it was built
+static int table_stale(const char *path){
+    if(table_path == NULL || strcmp(table_path, path) != 0){
+        return 1;
+    }
+    for(int i = 0; i < ndirs; i++){
+        struct stat st;
+        if(stat(dirs[i].path, &st) < 0 || st.st_mtim.tv_sec != dirs[i].mtime.tv_sec || st.st_mtim.tv_nsec != dirs[i].mtime.tv_nsec){
+            return 1;
+        }
+    }
+    return 0;
+}
+
+//first position from lo on whose name is not below key
+static int lower_bound(char *const *names, int lo, int n, const char *key){
+    int hi = n;
+    while(lo < hi){
+        int mid = (lo + hi) / 2;
+        if(strcmp(names[mid], key) < 0){
+            lo = mid + 1;
+        }else{
+            hi = mid;
+        }
+    }
+    return lo;
+}
+
+//first position from lo on whose name does not start with prefix (names that do are contiguous from lower_bound)
+static int prefix_end(char *const *names, int lo, int n, const char *prefix, size_t len){
+    int hi = n;
+    while(lo < hi){
+        int mid = (lo + hi) / 2;
+        if(strncmp(names[mid], prefix, len) == 0){
+            lo = mid + 1;
+        }else{
+            hi = mid;
+        }
+    }
+    return lo;
+}
+
+int complete_select(char *const *names, int n, const char *prefix, const char *dir, char **out, int max, int *total, char **common){
+    size_t len = strlen(prefix);
+    int lo = lower_bound(names, 0, n, prefix);
+    int hi = prefix_end(names, lo, n, prefix, len);
+    //matches as up to two runs: an empty prefix skips the run of hidden names in the middle
+    int runs[2][2] = {{lo, hi}, {hi, hi}};
+    if(len == 0){
+        int hidden = lower_bound(names, 0, n, ".");
+        runs[0][1] = hidden;
+        runs[1][0] = prefix_end(names, hidden, n, ".", 1);
+    }
+    int count = (runs[0][1] - runs[0][0]) + (runs[1][1] - runs[1][0]);
+    if(total != NULL){
+        *total = count;
+    }
+    if(common != NULL){
+        *common = NULL;
+        if(count > 0){
+            const char *first = names[runs[0][1] > runs[0][0] ? runs[0][0] : runs[1][0]];
+            const char *last = names[runs[1][1] > runs[1][0] ? runs[1][1] - 1 : runs[0][1] - 1];
+            int shared = 0;
+            while(first[shared] != '\0' && first[shared] == last[shared]){
+                shared++;
+            }
+            if(asprintf(common, "%s%.*s", dir, shared, first) < 0){
+                *common = NULL;
+            }
+        }
+    }
+    if(max <= 0 || count == 0){
+        return 0;
+    }
+
+    //the max shortest matches, equal lengths in table order (insertion into a sorted pick list)
+    int *pick = malloc(max * sizeof(int));
+    size_t *pick_len = malloc(max * sizeof(size_t));
+    int npick = 0;
+    for(int r = 0; r < 2 && pick && pick_len; r++){
+        for(int i = runs[r][0]; i < runs[r][1]; i++){
+            if(count > COMPLETE_RANK_LIMIT){
+                if(npick == max){
+                    break;
+                }
+                pick[npick++] = i;
+                continue;
+            }
+            size_t l = strlen(names[i]);
+            if(npick == max && l >= pick_len[max - 1]){
+                continue;
+            }
+            int k = npick < max ? npick++ : max - 1;
+            while(k > 0 && pick_len[k - 1] > l){
+                pick[k] = pick[k - 1];
+                pick_len[k] = pick_len[k - 1];
+                k--;
+            }
+            pick[k] = i;
+            pick_len[k] = l;
+        }
+    }
+    int stored = 0;
+    for(int i = 0; i < npick; i++){
+        if(asprintf(&out[stored], "%s%s", dir, names[pick[i]]) >= 0){
+            stored++;
+        }
+    }
+    free(pick);
+    free(pick_len);
+    return stored;
+}
+
+int complete_command(const char *prefix, char **out, int max, int *total, char **common){
+    pthread_mutex_lock(&table_lock);
+    //the PATH of the store this thread runs commands with (a server session's own), a different one rebuilds at once
+    const char *path = env_get(env_current(), "PATH");
+    if(path == NULL){
+        path = "/bin:/usr/bin";
+    }
+    long now = shellcore_now_ns();
+    if(names == NULL || table_path == NULL || strcmp(table_path, path) != 0 || (now - checked > RECHECK_NS && table_stale(path))){
+        build_table(path);
+    }
+    checked = now;
+    int n = complete_select(names, nnames, prefix, "", out, max, total, common);
+    pthread_mutex_unlock(&table_lock);
+    return n;
+}
+
+int complete_file(const char *word, char **out, int max, int *total, char **common){
+    const char *slash = strrchr(word, '/');
+    const char *base = slash ? slash + 1 : word;
+    size_t dir_len = slash ? (size_t)(slash - word) + 1 : 0;
+    size_t base_len = strlen(base);
+    char dir[4096];
+
+    if(total != NULL){
+        *total = 0;
+    }
+    if(common != NULL){
+        *common = NULL;
+    }
+    if(dir_len >= sizeof(dir)){
+        return 0;
+    }
+    if(dir_len == 0){
+        strcpy(dir, ".");
+    }else{
+        memcpy(dir, word, dir_len);
+        dir[dir_len] = '\0';
+    }
+    DIR *d = opendir(dir);
+    if(d == NULL){
+        return 0;
+    }
+    //the matching entries as a small sorted table, directories with their '/'
+    char **found = NULL;
+    int nfound = 0, cap = 0;
+    struct dirent *de;
+    while((de = readdir(d)) != NULL){
+        if(strncmp(de->d_name, base, base_len) != 0 || strcmp(de->d_name, ".") == 0 || strcmp(de->d_name, "..") == 0){
+            continue;
+        }
+        int is_dir = de->d_type == DT_DIR;
+        if(de->d_type == DT_UNKNOWN || de->d_type == DT_LNK){
+            struct stat st;
+            is_dir = fstatat(dirfd(d), de->d_name, &st, 0) == 0 && S_ISDIR(st.st_mode);
+        }
+        if(nfound == cap){
+            cap = cap ? cap * 2 : 64;
+            char **tmp = realloc(found, cap * sizeof(char *));
+            if(tmp == NULL){
+                break;
+            }
+            found = tmp;
+        }
+        if(asprintf(&found[nfound], "%s%s", de->d_name, is_dir ? "/" : "") >= 0){
+            nfound++;
+        }
+    }
+    closedir(d);
+    if(nfound > 1){
+        qsort(found, nfound, sizeof(char *), compare_names);
+    }
+    memcpy(dir, word, dir_len);
+    dir[dir_len] = '\0';
+    int n = complete_select(found, nfound, base, dir, out, max, total, common);
+    for(int i = 0; i < nfound; i++){
+        free(found[i]);
+    }
+    free(found);
+    return n;
+}
+
+int complete_word_start(const char *line, int len){
+    while(len > 0 && strchr(" \t|<>;&", line[len - 1]) == NULL){
+        len--;
+    }
+    return len;
+}
+
+int complete_in_command_position(const char *line, int word_start){
+    int before = word_start;
+    while(before > 0 && (line[before - 1] == ' ' || line[before - 1] == '\t')){
+        before--;
+    }
+    return (before == 0 || line[before - 1] == '|') && strchr(line + word_start, '/') == NULL;
+}
@@ -0,0 +1,258 @@
+#define _GNU_SOURCE
+#include "dircache.h"
+#include "complete.h"
+#include <dirent.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/inotify.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+//number of listings kept, the least recently used one is dropped
+#define DIRCACHE_ENTRIES 16
+//changes that keep a listing current, and the directory itself going away
+#define WATCH_MASK (IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO | IN_DELETE_SELF | IN_MOVE_SELF | IN_ONLYDIR)
+
+typedef struct {
+    int wd;                     //inotify watch of the directory, 0 for a free slot
+    int dfd;                    //the directory, for telling what a new entry is
+    char **names;               //sorted, directories with a trailing '/'
+    int n, cap;
+    long used;                  //for least recently used eviction
+} CachedDir;
+
+static pthread_mutex_t cache_lock = PTHREAD_MUTEX_INITIALIZER;
+static CachedDir dirs[DIRCACHE_ENTRIES];
+static int inotify_fd = -1;
+static long use_clock;
+
+static int compare_names(const void *a, const void *b){
+    return strcmp(*(char *const *)a, *(char *const *)b);
+}
+
+static CachedDir *find_dir(int wd){
+    for(int i = 0; i < DIRCACHE_ENTRIES; i++){
+        if(dirs[i].wd == wd){
+            return &dirs[i];
+        }
+    }
+    return NULL;
+}
+
+//frees a listing, unwatch is 0 when the kernel already removed the watch
+static void drop_dir(CachedDir *d, int unwatch){
+    if(unwatch){
+        inotify_rm_watch(inotify_fd, d->wd);
+    }
+    for(int i = 0; i < d->n; i++){
+        free(d->names[i]);
+    }
+    free(d->names);
+    close(d->dfd);
+    memset(d, 0, sizeof(*d));
+}
+
+//position of name in the listing, or where it would go; *found tells which
+static int locate(const CachedDir *d, const char *name, int *found){
+    int lo = 0, hi = d->n;
+    while(lo < hi){
+        int mid = (lo + hi) / 2;
+        if(strcmp(d->names[mid], name) < 0){
+            lo = mid + 1;
+        }else{
+            hi = mid;
+        }
+    }
+    *found = lo < d->n && strcmp(d->names[lo], name) == 0;
+    return lo;
+}
+
+//adds a name unless it is there already (events can repeat what the initial read saw)
+static void insert_name(CachedDir *d, const char *name){
+    int found;
+    int at = locate(d, name, &found);
+    if(found){
+        return;
+    }
+    if(d->n == d->cap){
+        int cap = d->cap ? d->cap * 2 : 64;
+        char **tmp = realloc(d->names, cap * sizeof(char *));
+        if(tmp == NULL){
+            return;
+        }
+        d->names = tmp;
+        d->cap = cap;
+    }
+    char *copy = strdup(name);
+    if(copy == NULL){
+        return;
+    }
+    memmove(d->names + at + 1, d->names + at, (d->n - at) * sizeof(char *));
+    d->names[at] = copy;
+    d->n++;
+}
+
+static int remove_name(CachedDir *d, const char *name){
+    int found;
+    int at = locate(d, name, &found);
+    if(!found){
+        return 0;
+    }
+    free(d->names[at]);
+    memmove(d->names + at, d->names + at + 1, (d->n - at - 1) * sizeof(char *));
+    d->n--;
+    return 1;
+}
+
+//name as it is listed: directories, and links to them, get a trailing '/'
+static void listed_name(int dfd, const char *name, int is_dir, char *out, size_t size){
+    struct stat st;
+    if(!is_dir && fstatat(dfd, name, &st, 0) == 0 && S_ISDIR(st.st_mode)){
+        is_dir = 1;
+    }
+    snprintf(out, size, "%s%s", name, is_dir ? "/" : "");
+}
+
+//applies the inotify events queued since the last lookup
+static void drain_events(void){
+    char buf[16384] __attribute__((aligned(__alignof__(struct inotify_event))));
+    ssize_t len;
+    while((len = read(inotify_fd, buf, sizeof(buf))) > 0){
+        const struct inotify_event *ev;
+        for(char *p = buf; p < buf + len; p += sizeof(struct inotify_event) + ev->len){
+            ev = (const struct inotify_event *)p;
+            if(ev->mask & IN_Q_OVERFLOW){
+                //events were lost, nothing cached can be trusted
+                for(int i = 0; i < DIRCACHE_ENTRIES; i++){
+                    if(dirs[i].wd != 0){
+                        drop_dir(&dirs[i], 1);
+                    }
+                }
+                continue;
+            }
+            CachedDir *d = find_dir(ev->wd);
+            if(d == NULL){
+                continue;
+            }
+            if(ev->mask & (IN_IGNORED | IN_DELETE_SELF | IN_MOVE_SELF)){
+                drop_dir(d, !(ev->mask & IN_IGNORED));
+                continue;
+            }
+            if(ev->len == 0){
+                continue;
+            }
+            char name[NAME_MAX + 2];
+            if(ev->mask & (IN_CREATE | IN_MOVED_TO)){
+                listed_name(d->dfd, ev->name, ev->mask & IN_ISDIR, name, sizeof(name));
+                insert_name(d, name);
+            }else if(ev->mask & (IN_DELETE | IN_MOVED_FROM)){
+                //a link to a directory was listed with a '/' that the event does not report
+                snprintf(name, sizeof(name), "%s%s", ev->name, ev->mask & IN_ISDIR ? "/" : "");
+                if(!remove_name(d, name) && !(ev->mask & IN_ISDIR)){
+                    snprintf(name, sizeof(name), "%s/", ev->name);
+                    remove_name(d, name);
+                }
+            }
+        }
+    }
+}
+
+//reads a directory into a free (or the least recently used) slot, watched as wd
+static CachedDir *load_dir(const char *path, int wd){
+    CachedDir *d = &dirs[0];
+    for(int i = 0; i < DIRCACHE_ENTRIES; i++){
+        if(dirs[i].wd == 0){
+            d = &dirs[i];
+            break;
+        }
+        if(dirs[i].used < d->used){
+            d = &dirs[i];
+        }
+    }
+    if(d->wd != 0){
+        drop_dir(d, 1);
+    }
+    int dfd = open(path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    int fd = dfd >= 0 ? openat(dfd, ".", O_RDONLY | O_DIRECTORY | O_CLOEXEC) : -1;
+    DIR *dir = fd >= 0 ? fdopendir(fd) : NULL;
+    if(dir == NULL){
+        if(fd >= 0){
+            close(fd);
+        }
+        if(dfd >= 0){
+            close(dfd);
+        }
+        inotify_rm_watch(inotify_fd, wd);
+        return NULL;
+    }
+    d->wd = wd;
+    d->dfd = dfd;
+    struct dirent *de;
+    while((de = readdir(dir)) != NULL){
+        if(strcmp(de->d_name, ".") == 0 || strcmp(de->d_name, "..") == 0){
+            continue;
+        }
+        if(d->n == d->cap){
+            int cap = d->cap ? d->cap * 2 : 64;
+            char **tmp = realloc(d->names, cap * sizeof(char *));
+            if(tmp == NULL){
+                break;
+            }
+            d->names = tmp;
+            d->cap = cap;
+        }
+        char name[NAME_MAX + 2];
+        int is_dir = de->d_type == DT_DIR;
+        if(de->d_type == DT_UNKNOWN || de->d_type == DT_LNK){
+            listed_name(dfd, de->d_name, is_dir, name, sizeof(name));
+        }else{
+            snprintf(name, sizeof(name), "%s%s", de->d_name, is_dir ? "/" : "");
+        }
+        if((d->names[d->n] = strdup(name)) != NULL){
+            d->n++;
+        }
+    }
+    closedir(dir);
+    if(d->n > 1){
+        qsort(d->names, d->n, sizeof(char *), compare_names);
+    }
+    return d;
+}
+
+int dircache_complete(const char *word, char **out, int max, int *total, char **common){
+    const char *slash = strrchr(word, '/');
+    size_t dir_len = slash ? (size_t)(slash - word) + 1 : 0;
+    char dir[PATH_MAX];
+    if(dir_len >= sizeof(dir)){
+        return complete_file(word, out, max, total, common);
+    }
+    memcpy(dir, word, dir_len);
+    dir[dir_len] = '\0';
+
+    pthread_mutex_lock(&cache_lock);
+    if(inotify_fd < 0){
+        inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    }
+    if(inotify_fd >= 0){
+        drain_events();
+    }
+    //the watch identifies the directory however it was spelled, and a directory replaced under the same path gets a new one
+    int wd = inotify_fd >= 0 ? inotify_add_watch(inotify_fd, dir_len ? dir : ".", WATCH_MASK) : -1;
+    CachedDir *d = wd > 0 ? find_dir(wd) : NULL;
+    if(d == NULL && wd > 0){
+        d = load_dir(dir_len ? dir : ".", wd);
+    }
+    if(d == NULL){
+        //not a directory, or out of watches: a plain read
+        pthread_mutex_unlock(&cache_lock);
+        return complete_file(word, out, max, total, common);
+    }
+    d->used = ++use_clock;
+    int n = complete_select(d->names, d->n, word + dir_len, dir, out, max, total, common);
+    pthread_mutex_unlock(&cache_lock);
+    return n;
+}
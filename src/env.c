@@ -0,0 +1,388 @@
+#define _GNU_SOURCE
+#include "env.h"
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+extern char **environ;
+
+//slot of an unset variable, probing goes on past it
+static char deleted_slot[1];
+#define DELETED deleted_slot
+
+typedef struct {
+    char *kv;                   //"NAME=value", NULL for a slot never used, DELETED once unset
+    uint32_t hash;
+    uint32_t name_len;
+    int exported;
+} EnvSlot;
+
+typedef struct {
+    int refs;                   //stores sharing the table, a store copies it before changing it while this is > 1
+    uint32_t cap;               //number of slots, a power of two
+    uint32_t used;              //slots that are not empty (unset ones included), kept below 3/4 of cap
+    EnvSlot *slots;
+    char **envp;                //exported variables for exec, built on first use after a change
+} EnvTable;
+
+struct EnvStore {
+    EnvTable *t;
+    int status;                 //$?
+    int mirror;                 //exported changes go to the process environment too (the default store)
+};
+
+//the process environment as it was at first use, never changed itself so every store can start from it
+static EnvTable *base;
+static EnvStore default_store;
+static pthread_once_t base_once = PTHREAD_ONCE_INIT;
+static _Thread_local EnvStore *current;
+
+//FNV-1a
+static uint32_t hash_name(const char *name, size_t len){
+    uint32_t h = 2166136261u;
+    for(size_t i = 0; i < len; i++){
+        h = (h ^ (unsigned char)name[i]) * 16777619u;
+    }
+    return h;
+}
+
+int env_valid_name(const char *s, size_t len){
+    if(len == 0 || !((s[0] >= 'a' && s[0] <= 'z') || (s[0] >= 'A' && s[0] <= 'Z') || s[0] == '_')){
+        return 0;
+    }
+    for(size_t i = 1; i < len; i++){
+        char c = s[i];
+        if(!((c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') || c == '_')){
+            return 0;
+        }
+    }
+    return 1;
+}
+
+static EnvTable *table_new(uint32_t cap){
+    EnvTable *t = calloc(1, sizeof(EnvTable));
+    if(t == NULL){
+        return NULL;
+    }
+    if((t->slots = calloc(cap, sizeof(EnvSlot))) == NULL){
+        free(t);
+        return NULL;
+    }
+    t->cap = cap;
+    t->refs = 1;
+    return t;
+}
+
+static void table_release(EnvTable *t){
+    if(t == NULL || __atomic_sub_fetch(&t->refs, 1, __ATOMIC_ACQ_REL) > 0){
+        return;
+    }
+    for(uint32_t i = 0; i < t->cap; i++){
+        if(t->slots[i].kv != NULL && t->slots[i].kv != DELETED){
+            free(t->slots[i].kv);
+        }
+    }
+    free(t->slots);
+    free(t->envp);
+    free(t);
+}
+
+/*slot holding name, or NULL; *free_slot (if not NULL) gets the slot an insertion of name would use
+linear probing, a lookup stops at the first never-used slot
+*/
+static EnvSlot *lookup(const EnvTable *t, const char *name, size_t len, uint32_t hash, EnvSlot **free_slot){
+    EnvSlot *reuse = NULL;
+    for(uint32_t i = hash & (t->cap - 1); ; i = (i + 1) & (t->cap - 1)){
+        EnvSlot *s = &t->slots[i];
+        if(s->kv == NULL){
+            if(free_slot){
+                *free_slot = reuse ? reuse : s;
+            }
+            return NULL;
+        }
+        if(s->kv == DELETED){
+            if(reuse == NULL){
+                reuse = s;
+            }
+        }else if(s->hash == hash && s->name_len == len && memcmp(s->kv, name, len) == 0){
+            return s;
+        }
+    }
+}
+
+//puts a slot's contents into a table known not to hold the name and to have room (copies and rehashes)
+static void place(EnvTable *t, const EnvSlot *from){
+    uint32_t i = from->hash & (t->cap - 1);
+    while(t->slots[i].kv != NULL){
+        i = (i + 1) & (t->cap - 1);
+    }
+    t->slots[i] = *from;
+    t->used++;
+}
+
+//doubles the table once it is 3/4 full, unset slots are dropped on the way; -1 when out of memory
+static int grow(EnvTable *t){
+    if((t->used + 1) * 4 < t->cap * 3){
+        return 0;
+    }
+    EnvSlot *old = t->slots;
+    uint32_t old_cap = t->cap;
+    if((t->slots = calloc(old_cap * 2, sizeof(EnvSlot))) == NULL){
+        t->slots = old;
+        return -1;
+    }
+    t->cap = old_cap * 2;
+    t->used = 0;
+    for(uint32_t i = 0; i < old_cap; i++){
+        if(old[i].kv != NULL && old[i].kv != DELETED){
+            place(t, &old[i]);
+        }
+    }
+    free(old);
+    return 0;
+}
+
+static void base_init(void){
+    size_t n = 0;
+    while(environ && environ[n]){
+        n++;
+    }
+    uint32_t cap = 64;
+    while(cap * 3 < (n + 1) * 4){
+        cap *= 2;
+    }
+    base = table_new(cap);
+    if(base == NULL){
+        perror("malloc");
+        abort();
+    }
+    for(size_t i = 0; i < n; i++){
+        const char *eq = strchr(environ[i], '=');
+        if(eq == NULL){
+            continue;
+        }
+        size_t len = eq - environ[i];
+        uint32_t hash = hash_name(environ[i], len);
+        EnvSlot *free_slot;
+        if(lookup(base, environ[i], len, hash, &free_slot) != NULL){
+            continue;                   //getenv() sees the first one as well
+        }
+        char *kv = strdup(environ[i]);
+        if(kv == NULL){
+            continue;
+        }
+        *free_slot = (EnvSlot){kv, hash, len, 1};
+        base->used++;
+    }
+    //the default store holds a reference of its own, so its first change copies the table like any other store's
+    base->refs = 2;
+    default_store.t = base;
+    default_store.mirror = 1;
+}
+
+EnvStore *env_create(void){
+    pthread_once(&base_once, base_init);
+    EnvStore *e = calloc(1, sizeof(EnvStore));
+    if(e == NULL){
+        return NULL;
+    }
+    __atomic_add_fetch(&base->refs, 1, __ATOMIC_RELAXED);
+    e->t = base;
+    return e;
+}
+
+void env_free(EnvStore *e){
+    if(e == NULL){
+        return;
+    }
+    if(current == e){
+        current = NULL;
+    }
+    table_release(e->t);
+    free(e);
+}
+
+void env_use(EnvStore *e){
+    current = e;
+}
+
+EnvStore *env_current(void){
+    pthread_once(&base_once, base_init);
+    return current ? current : &default_store;
+}
+
+//the store's table made private to it (copied if it is shared), its envp dropped since a change follows; NULL on OOM
+static EnvTable *writable(EnvStore *e){
+    EnvTable *t = e->t;
+    if(__atomic_load_n(&t->refs, __ATOMIC_ACQUIRE) > 1){
+        EnvTable *copy = table_new(t->cap);
+        if(copy == NULL){
+            return NULL;
+        }
+        for(uint32_t i = 0; i < t->cap; i++){
+            EnvSlot s = t->slots[i];
+            if(s.kv == NULL || s.kv == DELETED){
+                continue;
+            }
+            if((s.kv = strdup(s.kv)) == NULL){
+                table_release(copy);
+                return NULL;
+            }
+            place(copy, &s);
+        }
+        table_release(t);
+        e->t = t = copy;
+    }
+    free(t->envp);
+    t->envp = NULL;
+    return t;
+}
+
+const char *env_get(EnvStore *e, const char *name){
+    size_t len = strlen(name);
+    EnvSlot *s = lookup(e->t, name, len, hash_name(name, len), NULL);
+    return s ? s->kv + len + 1 : NULL;
+}
+
+int env_set(EnvStore *e, const char *name, const char *value, int export){
+    size_t len = strlen(name);
+    uint32_t hash = hash_name(name, len);
+    EnvTable *t = writable(e);
+    char *kv = malloc(len + strlen(value) + 2);
+    if(t == NULL || kv == NULL || grow(t) < 0){
+        free(kv);
+        return -1;
+    }
+    sprintf(kv, "%s=%s", name, value);
+    EnvSlot *free_slot;
+    EnvSlot *s = lookup(t, name, len, hash, &free_slot);
+    if(s != NULL){
+        free(s->kv);
+        s->kv = kv;
+        s->exported |= export;
+    }else{
+        if(free_slot->kv == NULL){
+            t->used++;
+        }
+        *free_slot = (EnvSlot){kv, hash, len, export};
+        s = free_slot;
+    }
+    if(e->mirror && s->exported){
+        setenv(name, value, 1);
+    }
+    return 0;
+}
+
+int env_export(EnvStore *e, const char *name){
+    size_t len = strlen(name);
+    EnvSlot *s = lookup(e->t, name, len, hash_name(name, len), NULL);
+    if(s == NULL || s->exported){
+        return 0;
+    }
+    EnvTable *t = writable(e);
+    if(t == NULL){
+        return -1;
+    }
+    s = lookup(t, name, len, hash_name(name, len), NULL);
+    s->exported = 1;
+    if(e->mirror){
+        setenv(name, s->kv + len + 1, 1);
+    }
+    return 0;
+}
+
+int env_unset(EnvStore *e, const char *name){
+    size_t len = strlen(name);
+    uint32_t hash = hash_name(name, len);
+    if(lookup(e->t, name, len, hash, NULL) == NULL){
+        return 0;
+    }
+    EnvTable *t = writable(e);
+    if(t == NULL){
+        return -1;
+    }
+    EnvSlot *s = lookup(t, name, len, hash, NULL);
+    free(s->kv);
+    s->kv = DELETED;
+    if(e->mirror){
+        unsetenv(name);
+    }
+    return 0;
+}
+
+char **env_envp(EnvStore *e){
+    EnvTable *t = e->t;
+    char **envp = __atomic_load_n(&t->envp, __ATOMIC_ACQUIRE);
+    if(envp != NULL){
+        return envp;
+    }
+    size_t n = 0;
+    for(uint32_t i = 0; i < t->cap; i++){
+        n += t->slots[i].kv != NULL && t->slots[i].kv != DELETED && t->slots[i].exported;
+    }
+    if((envp = malloc((n + 1) * sizeof(char *))) == NULL){
+        return environ;
+    }
+    n = 0;
+    for(uint32_t i = 0; i < t->cap; i++){
+        if(t->slots[i].kv != NULL && t->slots[i].kv != DELETED && t->slots[i].exported){
+            envp[n++] = t->slots[i].kv;
+        }
+    }
+    envp[n] = NULL;
+    //a table shared between sessions may be asked from several threads at once, the first array published wins
+    char **expected = NULL;
+    if(!__atomic_compare_exchange_n(&t->envp, &expected, envp, 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)){
+        free(envp);
+        envp = expected;
+    }
+    return envp;
+}
+
+void env_set_status(EnvStore *e, int status){
+    e->status = status;
+}
+
+int env_status(EnvStore *e){
+    return e->status;
+}
+
+int env_builtin(EnvStore *e, const Pipeline *pl, int *status){
+    if(pl->nstages != 1 || pl->stages[0].nredirs != 0){
+        return 0;
+    }
+    const Command *c = &pl->stages[0];
+    int assign = 1;
+    for(int i = 0; i < c->argc && assign; i++){
+        const char *eq = strchr(c->argv[i], '=');
+        assign = eq != NULL && env_valid_name(c->argv[i], eq - c->argv[i]);
+    }
+    int unset = !assign && strcmp(c->argv[0], "unset") == 0;
+    if(!assign && !unset && strcmp(c->argv[0], "export") != 0){
+        return 0;
+    }
+    *status = 0;
+    for(int i = assign ? 0 : 1; i < c->argc; i++){
+        const char *word = c->argv[i];
+        const char *eq = strchr(word, '=');
+        size_t len = eq ? (size_t)(eq - word) : strlen(word);
+        if(!env_valid_name(word, len) || (unset && eq)){
+            printf("Bad variable name.\n");
+            *status = 1;
+            continue;
+        }
+        char *name = strndup(word, len);
+        int rc = -1;
+        if(name != NULL){
+            rc = unset ? env_unset(e, name) : eq ? env_set(e, name, eq + 1, !assign) : env_export(e, name);
+        }
+        if(rc < 0){
+            perror("env");
+            *status = 1;
+        }
+        free(name);
+    }
+    return 1;
+}
@@ -0,0 +1,1095 @@
+#define _GNU_SOURCE
+#include "evloop.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <poll.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+
+//maximum number of events dispatched per wakeup
+#define EV_BATCH 256
+//submission queue depth for the io_uring backend
+#define URING_ENTRIES 1024
+//user_data tag for internal io_uring operations (timeouts, poll removals, cancels) whose completions are ignored
+#define URING_INTERNAL UINT64_MAX
+//buffers multishot recv picks from, shared by every socket of a loop (a power of two)
+#define RECV_BUFS 1024
+#define RECV_BUF_SIZE 4096
+//buffer group id of that ring
+#define RECV_BGID 0
+//incremental buffer consumption (kernel 6.12+), older headers do not have it
+#ifndef IOU_PBUF_RING_INC
+#define IOU_PBUF_RING_INC 2
+#endif
+#ifndef IORING_CQE_F_BUF_MORE
+#define IORING_CQE_F_BUF_MORE (1U << 4)
+#endif
+//struct io_uring_buf_reg as newer headers have it, older ones call flags pad
+typedef struct {
+    uint64_t ring_addr;
+    uint32_t ring_entries;
+    uint16_t bgid;
+    uint16_t flags;
+    uint64_t resv[3];
+} BufReg;
+//bytes read per readiness report when receiving is emulated
+#define RECV_CHUNK 65536
+//relays one loop can have in flight
+#define MAX_RELAYS 64
+
+//what a completion belongs to, kept in the top byte of its cookie
+#define OP_POLL 0
+#define OP_RECV 1
+#define OP_ACCEPT 2
+#define OP_RELAY_READ 3
+#define OP_RELAY_SEND 4
+//generations are 24 bits wide, the cookie carries them between the op and the fd
+#define GEN_MASK 0xFFFFFFu
+
+//per-fd registration
+typedef struct {
+    ev_cb cb;
+    ev_accept_cb accept_cb;     //evloop_accept: EV_READ accepts connections
+    ev_recv_cb recv_cb;         //evloop_recv: EV_READ delivers the bytes received
+    void *arg;
+    int events;
+    int active;
+    int polled;                 //readiness mask of the poll in flight (io_uring) or of the epoll registration
+    int armed;                  //io_uring only, a one-shot poll is in flight
+    int streaming;              //io_uring only, a multishot accept or recv is in flight (until its last completion)
+    int stopping;               //  and its cancel has been submitted
+    int ended;                  //the stream hit its end or failed, nothing more is received
+    uint32_t gen;               //bumped whenever the poll changes, stale readiness (also for a reused fd) is dropped
+    uint32_t id;                //bumped on add and del only, completions carrying data stay valid across interest changes
+    char *held;                 //received bytes the callback has not taken yet
+    size_t held_len, held_cap;
+    int held_end;               //what came after them: 0, 1 for the end of the stream, -errno for an error
+} EvHandler;
+
+//a linked read and send, its buffer lives until both have completed
+typedef struct {
+    int used;
+    int pending;                //completions still to come, 0 once an emulated relay is done
+    int fd;
+    uint32_t id;
+    ev_relay_cb cb;
+    char *buf;
+    ssize_t nread, nsent;
+} EvRelay;
+
+struct EvLoop {
+    int backend;
+    int fd;                 //epoll fd or io_uring fd
+    EvHandler *handlers;    //indexed by fd
+    int nhandlers;
+    char *scratch;          //RECV_CHUNK bytes for emulated receives
+    struct {
+        int fd;
+        uint32_t id;
+    } *due;                 //fds whose held bytes are offered again at the start of the next iteration
+    int ndue, due_cap;
+    EvRelay relays[MAX_RELAYS];
+    int relays_done;        //emulated relays finished and not reported yet
+
+    //io_uring ring state, mapped from the kernel
+    unsigned *sq_head, *sq_tail, *sq_mask, *sq_array;
+    unsigned *cq_head, *cq_tail, *cq_mask;
+    struct io_uring_sqe *sqes;
+    struct io_uring_cqe *cqes;
+    void *sq_ptr, *cq_ptr;
+    size_t sq_size, cq_size, sqes_size;
+    unsigned to_submit;
+    struct __kernel_timespec timeout;
+    //provided buffers for multishot recv, registered with the kernel
+    struct io_uring_buf_ring *buf_ring;
+    char *bufs;
+    unsigned *buf_used;     //incremental ring: bytes of each buffer filled so far, NULL if every receive takes a whole one
+    uint16_t buf_tail;
+    int native_accept;      //multishot accept works, cleared if the kernel rejects it
+    int native_recv;        //the buffers are registered and multishot recv works
+};
+
+//packs the operation, the fd (or relay slot) and a generation into the 64-bit cookie handed to the kernel
+static uint64_t ev_cookie(int op, int fd, uint32_t gen){
+    return ((uint64_t)op << 56) | ((uint64_t)(gen & GEN_MASK) << 32) | (uint32_t)fd;
+}
+
+static int cookie_op(uint64_t cookie){
+    return (int)(cookie >> 56);
+}
+
+static int cookie_fd(uint64_t cookie){
+    return (int)(uint32_t)cookie;
+}
+
+static uint32_t cookie_gen(uint64_t cookie){
+    return (uint32_t)(cookie >> 32) & GEN_MASK;
+}
+
+//grows the handler table so that fd is a valid index
+static int ev_reserve(EvLoop *loop, int fd){
+    if(fd < loop->nhandlers){
+        return 0;
+    }
+    int n = loop->nhandlers ? loop->nhandlers : 64;
+    while(n <= fd){
+        n *= 2;
+    }
+    EvHandler *tmp = realloc(loop->handlers, n * sizeof(EvHandler));
+    if(!tmp){
+        perror("realloc");
+        return -1;
+    }
+    memset(tmp + loop->nhandlers, 0, (n - loop->nhandlers) * sizeof(EvHandler));
+    loop->handlers = tmp;
+    loop->nhandlers = n;
+    return 0;
+}
+
+/*io_uring backend
+The kernel rings are driven with raw syscalls (no liburing dependency). Readiness is delivered with one-shot
+IORING_OP_POLL_ADD requests that are re-armed after each dispatch, so the backend plugs into the same handler
+model as epoll while batching all re-arms and the wait itself into a single io_uring_enter() per iteration.
+Listening sockets are served by a multishot accept and sockets registered with evloop_recv by a multishot recv
+into a ring of provided buffers, so neither costs a readiness round trip per connection or per read; a relay is a
+read linked to a send, submitted together.
+*/
+static int uring_setup(EvLoop *loop){
+    struct io_uring_params p;
+    memset(&p, 0, sizeof(p));
+
+    int fd = syscall(__NR_io_uring_setup, URING_ENTRIES, &p);
+    if(fd < 0){
+        return -1;
+    }
+    fcntl(fd, F_SETFD, FD_CLOEXEC);
+
+    loop->sq_size = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    loop->cq_size = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    if(p.features & IORING_FEAT_SINGLE_MMAP){
+        if(loop->cq_size > loop->sq_size){
+            loop->sq_size = loop->cq_size;
+        }
+        loop->cq_size = loop->sq_size;
+    }
+
+    loop->sq_ptr = mmap(NULL, loop->sq_size, PROT_READ|PROT_WRITE, MAP_SHARED|MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+    if(loop->sq_ptr == MAP_FAILED){
+        close(fd);
+        return -1;
+    }
+    if(p.features & IORING_FEAT_SINGLE_MMAP){
+        loop->cq_ptr = loop->sq_ptr;
+    }else{
+        loop->cq_ptr = mmap(NULL, loop->cq_size, PROT_READ|PROT_WRITE, MAP_SHARED|MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+        if(loop->cq_ptr == MAP_FAILED){
+            munmap(loop->sq_ptr, loop->sq_size);
+            close(fd);
+            return -1;
+        }
+    }
+
+    loop->sqes_size = p.sq_entries * sizeof(struct io_uring_sqe);
+    loop->sqes = mmap(NULL, loop->sqes_size, PROT_READ|PROT_WRITE, MAP_SHARED|MAP_POPULATE, fd, IORING_OFF_SQES);
+    if(loop->sqes == MAP_FAILED){
+        if(loop->cq_ptr != loop->sq_ptr){
+            munmap(loop->cq_ptr, loop->cq_size);
+        }
+        munmap(loop->sq_ptr, loop->sq_size);
+        close(fd);
+        return -1;
+    }
+
+    char *sq = loop->sq_ptr;
+    char *cq = loop->cq_ptr;
+    loop->sq_head = (unsigned *)(sq + p.sq_off.head);
+    loop->sq_tail = (unsigned *)(sq + p.sq_off.tail);
+    loop->sq_mask = (unsigned *)(sq + p.sq_off.ring_mask);
+    loop->sq_array = (unsigned *)(sq + p.sq_off.array);
+    loop->cq_head = (unsigned *)(cq + p.cq_off.head);
+    loop->cq_tail = (unsigned *)(cq + p.cq_off.tail);
+    loop->cq_mask = (unsigned *)(cq + p.cq_off.ring_mask);
+    loop->cqes = (struct io_uring_cqe *)(cq + p.cq_off.cqes);
+    loop->fd = fd;
+    return 0;
+}
+
+//hands buffer bid back to the kernel for the next receive
+static void uring_give_buf(EvLoop *loop, int bid){
+    struct io_uring_buf *b = &loop->buf_ring->bufs[loop->buf_tail & (RECV_BUFS - 1)];
+    b->addr = (uint64_t)(uintptr_t)(loop->bufs + (size_t)bid * RECV_BUF_SIZE);
+    b->len = RECV_BUF_SIZE;
+    b->bid = bid;
+    loop->buf_tail++;
+    __atomic_store_n(&loop->buf_ring->tail, loop->buf_tail, __ATOMIC_RELEASE);
+}
+
+/*registers the ring of buffers multishot recv picks from (kernel 5.19+), returns -1 if it cannot be used; where the
+kernel consumes buffers incrementally, receives share a buffer until it is full, so many connections with a little data
+each do not run out of buffers (which ends their receives) long before the memory is used
+*/
+static int uring_setup_bufs(EvLoop *loop){
+    size_t ring_size = RECV_BUFS * sizeof(struct io_uring_buf);
+    void *ring = mmap(NULL, ring_size, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+    if(ring == MAP_FAILED){
+        return -1;
+    }
+    char *bufs = malloc((size_t)RECV_BUFS * RECV_BUF_SIZE);
+    BufReg reg;
+    memset(&reg, 0, sizeof(reg));
+    reg.ring_addr = (uint64_t)(uintptr_t)ring;
+    reg.ring_entries = RECV_BUFS;
+    reg.bgid = RECV_BGID;
+    reg.flags = IOU_PBUF_RING_INC;
+    unsigned *used = calloc(RECV_BUFS, sizeof(unsigned));
+    if(bufs == NULL || used == NULL){
+        free(bufs);
+        free(used);
+        munmap(ring, ring_size);
+        return -1;
+    }
+    if(syscall(__NR_io_uring_register, loop->fd, IORING_REGISTER_PBUF_RING, &reg, 1) < 0){
+        free(used);
+        used = NULL;
+        reg.flags = 0;
+        if(syscall(__NR_io_uring_register, loop->fd, IORING_REGISTER_PBUF_RING, &reg, 1) < 0){
+            free(bufs);
+            munmap(ring, ring_size);
+            return -1;
+        }
+    }
+    loop->buf_ring = ring;
+    loop->buf_used = used;
+    loop->bufs = bufs;
+    for(int i = 0; i < RECV_BUFS; i++){
+        uring_give_buf(loop, i);
+    }
+    return 0;
+}
+
+//hands queued submissions to the kernel, optionally waiting for at least min_complete completions
+static int uring_enter(EvLoop *loop, unsigned min_complete){
+    unsigned flags = min_complete ? IORING_ENTER_GETEVENTS : 0;
+    for(;;){
+        int rc = syscall(__NR_io_uring_enter, loop->fd, loop->to_submit, min_complete, flags, NULL, 0);
+        if(rc >= 0){
+            loop->to_submit -= (unsigned)rc < loop->to_submit ? (unsigned)rc : loop->to_submit;
+            return 0;
+        }
+        if(errno != EINTR){
+            return -1;
+        }
+        if(min_complete){
+            return 0;               //interrupted wait, let the caller come back around
+        }
+    }
+}
+
+//makes sure n submission entries can be taken in a row (a linked chain must not be split), flushing the queue if needed
+static int uring_room(EvLoop *loop, unsigned n){
+    unsigned used = *loop->sq_tail - __atomic_load_n(loop->sq_head, __ATOMIC_ACQUIRE);
+    if(used + n <= *loop->sq_mask + 1){
+        return 0;
+    }
+    if(uring_enter(loop, 0) < 0){
+        return -1;
+    }
+    used = *loop->sq_tail - __atomic_load_n(loop->sq_head, __ATOMIC_ACQUIRE);
+    return used + n <= *loop->sq_mask + 1 ? 0 : -1;
+}
+
+//returns a zeroed submission entry, flushing the queue to the kernel first if it is full
+static struct io_uring_sqe *uring_get_sqe(EvLoop *loop){
+    if(uring_room(loop, 1) < 0){
+        return NULL;
+    }
+    unsigned idx = *loop->sq_tail & *loop->sq_mask;
+    struct io_uring_sqe *sqe = &loop->sqes[idx];
+    memset(sqe, 0, sizeof(*sqe));
+    loop->sq_array[idx] = idx;
+    return sqe;
+}
+
+//publishes the entry returned by the last uring_get_sqe
+static void uring_commit_sqe(EvLoop *loop){
+    __atomic_store_n(loop->sq_tail, *loop->sq_tail + 1, __ATOMIC_RELEASE);
+    loop->to_submit++;
+}
+
+//arms a one-shot poll for a readiness mask
+static int uring_arm(EvLoop *loop, int fd, int mask){
+    EvHandler *h = &loop->handlers[fd];
+    struct io_uring_sqe *sqe = uring_get_sqe(loop);
+    if(!sqe){
+        return -1;
+    }
+    sqe->opcode = IORING_OP_POLL_ADD;
+    sqe->fd = fd;
+    sqe->poll_events = ((mask & EV_READ) ? POLLIN : 0) | ((mask & EV_WRITE) ? POLLOUT : 0);
+    sqe->user_data = ev_cookie(OP_POLL, fd, h->gen);
+    uring_commit_sqe(loop);
+    h->armed = 1;
+    h->polled = mask;
+    return 0;
+}
+
+//cancels the poll currently in flight for fd, if any
+static void uring_disarm(EvLoop *loop, int fd){
+    EvHandler *h = &loop->handlers[fd];
+    if(!h->armed){
+        return;
+    }
+    struct io_uring_sqe *sqe = uring_get_sqe(loop);
+    if(sqe){
+        sqe->opcode = IORING_OP_POLL_REMOVE;
+        sqe->fd = -1;
+        sqe->addr = ev_cookie(OP_POLL, fd, h->gen);
+        sqe->user_data = URING_INTERNAL;
+        uring_commit_sqe(loop);
+    }
+    h->armed = 0;
+}
+
+//arms the multishot accept or recv that serves EV_READ on fd
+static int uring_stream_start(EvLoop *loop, int fd){
+    EvHandler *h = &loop->handlers[fd];
+    struct io_uring_sqe *sqe = uring_get_sqe(loop);
+    if(!sqe){
+        return -1;
+    }
+    sqe->fd = fd;
+    if(h->accept_cb != NULL){
+        sqe->opcode = IORING_OP_ACCEPT;
+        sqe->accept_flags = SOCK_NONBLOCK | SOCK_CLOEXEC;
+        sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+        sqe->user_data = ev_cookie(OP_ACCEPT, fd, h->id);
+    }else{
+        sqe->opcode = IORING_OP_RECV;
+        sqe->ioprio = IORING_RECV_MULTISHOT;
+        sqe->flags = IOSQE_BUFFER_SELECT;
+        sqe->buf_group = RECV_BGID;
+        sqe->user_data = ev_cookie(OP_RECV, fd, h->id);
+    }
+    uring_commit_sqe(loop);
+    h->streaming = 1;
+    h->stopping = 0;
+    return 0;
+}
+
+//cancels fd's multishot operation, its last completion (-ECANCELED, or data that was already on the way) still comes
+static void uring_stream_stop(EvLoop *loop, int fd){
+    EvHandler *h = &loop->handlers[fd];
+    struct io_uring_sqe *sqe = uring_get_sqe(loop);
+    if(sqe){
+        sqe->opcode = IORING_OP_ASYNC_CANCEL;
+        sqe->fd = -1;
+        sqe->addr = ev_cookie(h->accept_cb != NULL ? OP_ACCEPT : OP_RECV, fd, h->id);
+        sqe->user_data = URING_INTERNAL;
+        uring_commit_sqe(loop);
+    }
+    h->stopping = 1;
+}
+
+//creates an event loop with the requested backend, falls back to epoll when io_uring is unavailable
+EvLoop *evloop_create(int backend){
+    EvLoop *loop = calloc(1, sizeof(EvLoop));
+    if(loop != NULL && (loop->scratch = malloc(RECV_CHUNK)) == NULL){
+        free(loop);
+        loop = NULL;
+    }
+    if(!loop){
+        perror("calloc");
+        return NULL;
+    }
+
+    if(backend == EVLOOP_URING){
+        if(uring_setup(loop) == 0){
+            loop->backend = EVLOOP_URING;
+            loop->native_accept = 1;
+            loop->native_recv = uring_setup_bufs(loop) == 0;
+            if(!loop->native_recv){
+                fprintf(stderr, "[WARN] io_uring provided buffers unavailable, receiving on readiness\n");
+            }
+            return loop;
+        }
+        fprintf(stderr, "[WARN] io_uring unavailable (%s), falling back to epoll\n", strerror(errno));
+    }
+
+    loop->backend = EVLOOP_EPOLL;
+    loop->fd = epoll_create1(EPOLL_CLOEXEC);
+    if(loop->fd < 0){
+        perror("epoll_create1 failed");
+        free(loop->scratch);
+        free(loop);
+        return NULL;
+    }
+    return loop;
+}
+
+//returns the backend actually in use
+int evloop_backend(const EvLoop *loop){
+    return loop->backend;
+}
+
+int evloop_native(const EvLoop *loop){
+    return loop->backend == EVLOOP_URING && loop->native_recv;
+}
+
+//translates an interest mask into epoll flags
+static uint32_t epoll_mask(int events){
+    return ((events & EV_READ) ? EPOLLIN : 0) | ((events & EV_WRITE) ? EPOLLOUT : 0);
+}
+
+//whether EV_READ on h is served by a multishot operation rather than by a poll
+static int ev_streamed(const EvLoop *loop, const EvHandler *h){
+    return (h->accept_cb != NULL && loop->native_accept) || (h->recv_cb != NULL && loop->native_recv);
+}
+
+//the readiness fd is polled for: its interest, without EV_READ where a stream serves it or nothing more will arrive
+static int ev_poll_mask(const EvLoop *loop, const EvHandler *h){
+    if(ev_streamed(loop, h) || (h->recv_cb != NULL && h->ended)){
+        return h->events & ~EV_READ;
+    }
+    return h->events;
+}
+
+/*brings what the kernel watches for fd in line with the handler: the poll (or epoll registration) for its readiness,
+and on io_uring the multishot operation while EV_READ is on; returns 0 on success, -1 on failure
+*/
+static int ev_sync(EvLoop *loop, int fd){
+    EvHandler *h = &loop->handlers[fd];
+    int mask = ev_poll_mask(loop, h);
+
+    if(loop->backend == EVLOOP_EPOLL){
+        if(mask == h->polled){
+            return 0;
+        }
+        h->gen = (h->gen + 1) & GEN_MASK;
+        struct epoll_event ev;
+        ev.events = epoll_mask(mask);
+        ev.data.u64 = ev_cookie(OP_POLL, fd, h->gen);
+        if(epoll_ctl(loop->fd, EPOLL_CTL_MOD, fd, &ev) < 0){
+            perror("epoll_ctl mod failed");
+            return -1;
+        }
+        h->polled = mask;
+        return 0;
+    }
+
+    if(h->armed && h->polled != mask){
+        uring_disarm(loop, fd);
+        h->gen = (h->gen + 1) & GEN_MASK;
+    }
+    if(!h->armed && mask && uring_arm(loop, fd, mask) < 0){
+        return -1;
+    }
+    //a stream being cancelled is re-armed from its last completion, two must never race for the same bytes
+    int want = ev_streamed(loop, h) && (h->events & EV_READ) && !h->ended;
+    if(want && !h->streaming){
+        return uring_stream_start(loop, fd);
+    }
+    if(!want && h->streaming && !h->stopping){
+        uring_stream_stop(loop, fd);
+    }
+    return 0;
+}
+
+//registers fd with its callbacks, for evloop_add and evloop_accept
+static int ev_register(EvLoop *loop, int fd, int events, ev_cb cb, ev_accept_cb accept_cb, void *arg){
+    if(ev_reserve(loop, fd) < 0){
+        return -1;
+    }
+    EvHandler *h = &loop->handlers[fd];
+    uint32_t gen = h->gen;
+    uint32_t id = h->id;
+    free(h->held);
+    memset(h, 0, sizeof(*h));
+    h->cb = cb;
+    h->accept_cb = accept_cb;
+    h->arg = arg;
+    h->events = events;
+    h->active = 1;
+    h->gen = (gen + 1) & GEN_MASK;
+    h->id = (id + 1) & GEN_MASK;
+
+    if(loop->backend == EVLOOP_URING){
+        return ev_sync(loop, fd);
+    }
+
+    struct epoll_event ev;
+    h->polled = ev_poll_mask(loop, h);
+    ev.events = epoll_mask(h->polled);
+    ev.data.u64 = ev_cookie(OP_POLL, fd, h->gen);
+    if(epoll_ctl(loop->fd, EPOLL_CTL_ADD, fd, &ev) < 0){
+        perror("epoll_ctl add failed");
+        h->active = 0;
+        return -1;
+    }
+    return 0;
+}
+
+//registers fd with the given interest mask and callback
+int evloop_add(EvLoop *loop, int fd, int events, ev_cb cb, void *arg){
+    return ev_register(loop, fd, events, cb, NULL, arg);
+}
+
+int evloop_accept(EvLoop *loop, int fd, ev_accept_cb cb, void *arg){
+    return ev_register(loop, fd, EV_READ, NULL, cb, arg);
+}
+
+int evloop_recv(EvLoop *loop, int fd, ev_recv_cb cb){
+    if(fd >= loop->nhandlers || !loop->handlers[fd].active){
+        return -1;
+    }
+    loop->handlers[fd].recv_cb = cb;
+    return ev_sync(loop, fd);
+}
+
+//queues fd to have its held bytes offered again at the start of the next iteration
+static void ev_due(EvLoop *loop, int fd){
+    if(loop->ndue == loop->due_cap){
+        int cap = loop->due_cap ? loop->due_cap * 2 : 16;
+        void *tmp = realloc(loop->due, cap * sizeof(*loop->due));
+        if(!tmp){
+            perror("realloc");
+            return;                 //offered with the next bytes that arrive instead
+        }
+        loop->due = tmp;
+        loop->due_cap = cap;
+    }
+    loop->due[loop->ndue].fd = fd;
+    loop->due[loop->ndue].id = loop->handlers[fd].id;
+    loop->ndue++;
+}
+
+//changes the interest mask of a registered fd
+int evloop_mod(EvLoop *loop, int fd, int events){
+    if(fd >= loop->nhandlers || !loop->handlers[fd].active){
+        return -1;
+    }
+    EvHandler *h = &loop->handlers[fd];
+    if(h->events == events){
+        return 0;
+    }
+    //bytes kept while reading was paused go out before anything received later
+    if((events & EV_READ) && !(h->events & EV_READ) && (h->held_len > 0 || h->held_end)){
+        ev_due(loop, fd);
+    }
+    h->events = events;
+    return ev_sync(loop, fd);
+}
+
+//unregisters fd
+int evloop_del(EvLoop *loop, int fd){
+    if(fd >= loop->nhandlers || !loop->handlers[fd].active){
+        return -1;
+    }
+    EvHandler *h = &loop->handlers[fd];
+
+    if(loop->backend == EVLOOP_URING){
+        uring_disarm(loop, fd);
+        if(h->streaming && !h->stopping){
+            uring_stream_stop(loop, fd);
+        }
+    }else if(epoll_ctl(loop->fd, EPOLL_CTL_DEL, fd, NULL) < 0){
+        perror("epoll_ctl del failed");
+    }
+    free(h->held);
+    h->held = NULL;
+    h->held_len = h->held_cap = 0;
+    h->held_end = 0;
+    h->active = 0;
+    h->gen = (h->gen + 1) & GEN_MASK;
+    h->id = (h->id + 1) & GEN_MASK;
+    return 0;
+}
+
+//keeps received bytes behind the ones already held
+static void ev_hold(EvHandler *h, const char *data, size_t n){
+    if(h->held_len + n > h->held_cap){
+        size_t cap = h->held_cap ? h->held_cap : 4096;
+        while(cap < h->held_len + n){
+            cap *= 2;
+        }
+        char *tmp = realloc(h->held, cap);
+        if(!tmp){
+            perror("realloc");
+            h->ended = 1;           //the stream has a hole now, report it broken
+            h->held_end = -ENOMEM;
+            return;
+        }
+        h->held = tmp;
+        h->held_cap = cap;
+    }
+    memcpy(h->held + h->held_len, data, n);
+    h->held_len += n;
+}
+
+/*offers fd's held bytes, then the end of its stream, to the recv callback while EV_READ is on and the callback keeps
+taking some; returns 1 if the callback ran
+*/
+static int ev_offer(EvLoop *loop, int fd){
+    int ran = 0;
+    for(;;){
+        EvHandler *h = &loop->handlers[fd];
+        if(!h->active || h->recv_cb == NULL || !(h->events & EV_READ)){
+            return ran;
+        }
+        uint32_t id = h->id;
+        if(h->held_len > 0){
+            //detached while the callback looks at them, it may remove fd (which frees what is held)
+            char *buf = h->held;
+            size_t len = h->held_len;
+            size_t cap = h->held_cap;
+            h->held = NULL;
+            h->held_len = h->held_cap = 0;
+            size_t took = h->recv_cb(loop, fd, buf, len, h->arg);
+            ran = 1;
+            h = &loop->handlers[fd];
+            if(!h->active || h->id != id || took >= len){
+                free(buf);
+                if(took == 0){
+                    return ran;
+                }
+                continue;
+            }
+            memmove(buf, buf + took, len - took);
+            h->held = buf;
+            h->held_len = len - took;
+            h->held_cap = cap;
+            if(took == 0){
+                return ran;         //offered again once more bytes arrive or reading is resumed
+            }
+            continue;
+        }
+        if(h->held_end){
+            int end = h->held_end;
+            h->held_end = 0;
+            h->recv_cb(loop, fd, NULL, end > 0 ? 0 : end, h->arg);
+            return 1;
+        }
+        return ran;
+    }
+}
+
+//hands bytes received on fd to its callback, or holds them while reading is paused or older bytes are still waiting
+static void ev_received(EvLoop *loop, int fd, const char *data, size_t n){
+    EvHandler *h = &loop->handlers[fd];
+    if(h->held_len > 0 || !(h->events & EV_READ)){
+        ev_hold(h, data, n);
+        ev_offer(loop, fd);
+        return;
+    }
+    uint32_t id = h->id;
+    size_t took = h->recv_cb(loop, fd, data, n, h->arg);
+    h = &loop->handlers[fd];
+    if(h->active && h->id == id && took < n){
+        ev_hold(h, data + took, n - took);
+        if(took > 0){
+            ev_offer(loop, fd);
+        }
+    }
+}
+
+//the stream on fd is over (end is 1 for its end, -errno for an error), reported once the held bytes are taken
+static void ev_ended(EvLoop *loop, int fd, int end){
+    EvHandler *h = &loop->handlers[fd];
+    h->ended = 1;
+    if(h->held_end == 0){
+        h->held_end = end;
+    }
+    ev_offer(loop, fd);
+}
+
+//emulated receive: one recv() per readiness report
+static void ev_recv_ready(EvLoop *loop, int fd){
+    ssize_t n;
+    do{
+        n = recv(fd, loop->scratch, RECV_CHUNK, 0);
+    }while(n < 0 && errno == EINTR);
+    if(n > 0){
+        ev_received(loop, fd, loop->scratch, n);
+    }else if(n == 0){
+        ev_ended(loop, fd, 1);
+    }else if(errno != EAGAIN && errno != EWOULDBLOCK){
+        ev_ended(loop, fd, -errno);
+    }
+}
+
+//emulated accept: every pending connection, each handed to the callback
+static void ev_accept_ready(EvLoop *loop, int fd){
+    for(;;){
+        int client_fd = accept4(fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if(client_fd < 0){
+            if(errno == EINTR){
+                continue;
+            }
+            if(errno != EAGAIN && errno != EWOULDBLOCK){
+                perror("accept failed");
+            }
+            return;
+        }
+        EvHandler *h = &loop->handlers[fd];
+        if(!h->active || h->accept_cb == NULL){
+            close(client_fd);           //the callback removed the listener meanwhile
+            return;
+        }
+        h->accept_cb(loop, fd, client_fd, h->arg);
+    }
+}
+
+//dispatches one readiness notification if the cookie still matches a live registration
+static int ev_dispatch(EvLoop *loop, uint64_t cookie, int events){
+    int fd = cookie_fd(cookie);
+    if(fd >= loop->nhandlers){
+        return 0;
+    }
+    EvHandler *h = &loop->handlers[fd];
+    if(!h->active || h->gen != cookie_gen(cookie)){
+        return 0;                   //stale event for an fd that was removed or changed meanwhile
+    }
+    if(loop->backend == EVLOOP_URING){
+        h->armed = 0;
+    }
+    uint32_t id = h->id;
+
+    if(ev_streamed(loop, h)){
+        //the stream delivers data and errors itself, an error seen by the poll is left to the writer to find
+        events = (events & EV_READ) && (h->polled & EV_WRITE) ? EV_WRITE : events & EV_WRITE;
+        if(events && h->cb != NULL){
+            h->cb(loop, fd, events, h->arg);
+        }
+    }else if(h->accept_cb != NULL){
+        ev_accept_ready(loop, fd);
+    }else if(h->recv_cb != NULL){
+        if(events & EV_READ){
+            ev_recv_ready(loop, fd);
+        }
+        h = &loop->handlers[fd];
+        if((events & EV_WRITE) && h->active && h->id == id && h->cb != NULL){
+            h->cb(loop, fd, EV_WRITE, h->arg);
+        }
+    }else{
+        h->cb(loop, fd, events, h->arg);
+    }
+    h = &loop->handlers[fd];        //the callback may have grown (moved) the handler table
+
+    //one-shot polls are re-armed unless the callback removed or already re-armed the fd, an ended stream stops being polled
+    if(h->active && h->id == id){
+        ev_sync(loop, fd);
+    }
+    return 1;
+}
+
+//a multishot accept completion: a new connection, or the end of the accept (re-armed while the listener is registered)
+static void uring_accepted(EvLoop *loop, const struct io_uring_cqe *cqe){
+    int fd = cookie_fd(cqe->user_data);
+    uint32_t id = cookie_gen(cqe->user_data);
+    EvHandler *h = fd < loop->nhandlers ? &loop->handlers[fd] : NULL;
+    int live = h != NULL && h->active && h->id == id && h->accept_cb != NULL;
+
+    if(live && !(cqe->flags & IORING_CQE_F_MORE)){
+        h->streaming = h->stopping = 0;
+    }
+    if(cqe->res >= 0){
+        if(live){
+            h->accept_cb(loop, fd, cqe->res, h->arg);
+        }else{
+            close(cqe->res);
+        }
+    }else if(live && cqe->res == -EINVAL){
+        fprintf(stderr, "[WARN] io_uring multishot accept unsupported, accepting on readiness\n");
+        loop->native_accept = 0;
+    }else if(live && cqe->res != -ECANCELED){
+        fprintf(stderr, "accept failed: %s\n", strerror(-cqe->res));
+    }
+    h = fd < loop->nhandlers ? &loop->handlers[fd] : NULL;
+    if(live && h->active && h->id == id && !h->streaming){
+        ev_sync(loop, fd);
+    }
+}
+
+//a multishot recv completion: bytes in a provided buffer (returned right after), the end of the stream, or of the recv
+static void uring_received(EvLoop *loop, const struct io_uring_cqe *cqe){
+    int fd = cookie_fd(cqe->user_data);
+    uint32_t id = cookie_gen(cqe->user_data);
+    int bid = (cqe->flags & IORING_CQE_F_BUFFER) ? (int)(cqe->flags >> IORING_CQE_BUFFER_SHIFT) : -1;
+    size_t off = bid >= 0 && loop->buf_used != NULL ? loop->buf_used[bid] : 0;
+    EvHandler *h = fd < loop->nhandlers ? &loop->handlers[fd] : NULL;
+    int live = h != NULL && h->active && h->id == id && h->recv_cb != NULL;
+
+    if(live && !(cqe->flags & IORING_CQE_F_MORE)){
+        h->streaming = h->stopping = 0;
+    }
+    if(live && cqe->res > 0 && bid >= 0){
+        ev_received(loop, fd, loop->bufs + (size_t)bid * RECV_BUF_SIZE + off, cqe->res);
+    }else if(live && cqe->res == -EINVAL){
+        fprintf(stderr, "[WARN] io_uring multishot recv unsupported, receiving on readiness\n");
+        loop->native_recv = 0;
+    }else if(live && cqe->res <= 0 && cqe->res != -ECANCELED && cqe->res != -ENOBUFS){
+        ev_ended(loop, fd, cqe->res == 0 ? 1 : cqe->res);
+    }
+    //out of buffers ends the recv, it is re-armed below with the ones this batch gives back
+    if(bid >= 0 && loop->buf_used != NULL && (cqe->flags & IORING_CQE_F_BUF_MORE)){
+        loop->buf_used[bid] += cqe->res > 0 ? cqe->res : 0;        //the kernel fills the rest of it later
+    }else if(bid >= 0){
+        if(loop->buf_used != NULL){
+            loop->buf_used[bid] = 0;
+        }
+        uring_give_buf(loop, bid);
+    }
+    h = fd < loop->nhandlers ? &loop->handlers[fd] : NULL;
+    if(live && h->active && h->id == id && !h->streaming){
+        ev_sync(loop, fd);
+    }
+}
+
+//reports a finished relay if its socket is still registered the same way, then frees it; returns 1 if the callback ran
+static int ev_relay_done(EvLoop *loop, EvRelay *r){
+    EvRelay done = *r;
+    memset(r, 0, sizeof(*r));       //free before the callback, which may start the next relay
+    EvHandler *h = done.fd < loop->nhandlers ? &loop->handlers[done.fd] : NULL;
+    int ran = 0;
+    if(h != NULL && h->active && h->id == done.id){
+        done.cb(loop, done.fd, done.buf, done.nread, done.nsent, h->arg);
+        ran = 1;
+    }
+    free(done.buf);
+    return ran;
+}
+
+//one half of a linked relay completed
+static int uring_relayed(EvLoop *loop, const struct io_uring_cqe *cqe){
+    unsigned slot = (uint32_t)cqe->user_data;
+    if(slot >= MAX_RELAYS || !loop->relays[slot].used){
+        return 0;
+    }
+    EvRelay *r = &loop->relays[slot];
+    if(cookie_op(cqe->user_data) == OP_RELAY_READ){
+        r->nread = cqe->res;
+    }else{
+        r->nsent = cqe->res;
+    }
+    return --r->pending == 0 ? ev_relay_done(loop, r) : 0;
+}
+
+int evloop_relay(EvLoop *loop, int fd, int from, const void *hdr, size_t hdr_len, size_t len, ev_relay_cb cb){
+    if(fd >= loop->nhandlers || !loop->handlers[fd].active){
+        return -1;
+    }
+    EvRelay *r = NULL;
+    for(int i = 0; i < MAX_RELAYS && r == NULL; i++){
+        if(!loop->relays[i].used){
+            r = &loop->relays[i];
+        }
+    }
+    char *buf = r != NULL ? malloc(hdr_len + len + 1) : NULL;
+    if(buf == NULL){
+        return -1;
+    }
+    memcpy(buf, hdr, hdr_len);
+
+    if(loop->backend == EVLOOP_URING){
+        //the send only runs if the read filled the whole payload, a short read breaks the link and cancels it
+        int slot = r - loop->relays;
+        if(uring_room(loop, 2) < 0){
+            free(buf);
+            return -1;
+        }
+        struct io_uring_sqe *sqe = uring_get_sqe(loop);
+        sqe->opcode = IORING_OP_READ;
+        sqe->fd = from;
+        sqe->addr = (uint64_t)(uintptr_t)(buf + hdr_len);
+        sqe->len = len;
+        sqe->off = (uint64_t)-1;
+        sqe->flags = IOSQE_IO_LINK;
+        sqe->user_data = ev_cookie(OP_RELAY_READ, slot, 0);
+        uring_commit_sqe(loop);
+        sqe = uring_get_sqe(loop);
+        sqe->opcode = IORING_OP_SEND;
+        sqe->fd = fd;
+        sqe->addr = (uint64_t)(uintptr_t)buf;
+        sqe->len = hdr_len + len;
+        sqe->msg_flags = MSG_NOSIGNAL;
+        sqe->user_data = ev_cookie(OP_RELAY_SEND, slot, 0);
+        uring_commit_sqe(loop);
+        r->pending = 2;
+    }else{
+        //emulated: done right away and reported at the start of the next iteration, like a completion would be
+        ssize_t n;
+        do{
+            n = read(from, buf + hdr_len, len);
+        }while(n < 0 && errno == EINTR);
+        r->nread = n < 0 ? -errno : n;
+        r->nsent = -ECANCELED;
+        if(n == (ssize_t)len){
+            do{
+                n = send(fd, buf, hdr_len + len, MSG_NOSIGNAL | MSG_DONTWAIT);
+            }while(n < 0 && errno == EINTR);
+            r->nsent = n < 0 ? -errno : n;
+        }
+        r->pending = 0;
+        loop->relays_done++;
+    }
+    r->used = 1;
+    r->fd = fd;
+    r->id = loop->handlers[fd].id;
+    r->cb = cb;
+    r->buf = buf;
+    return 0;
+}
+
+//reports emulated relays and offers held bytes that became due, returns how many callbacks ran
+static int ev_run_deferred(EvLoop *loop){
+    int ran = 0;
+    if(loop->relays_done > 0){
+        loop->relays_done = 0;
+        for(int i = 0; i < MAX_RELAYS; i++){
+            if(loop->relays[i].used && loop->relays[i].pending == 0){
+                ran += ev_relay_done(loop, &loop->relays[i]);
+            }
+        }
+    }
+    //fds queued by the callbacks below wait for the next iteration
+    int n = loop->ndue;
+    for(int i = 0; i < n; i++){
+        int fd = loop->due[i].fd;
+        if(fd < loop->nhandlers && loop->handlers[fd].active && loop->handlers[fd].id == loop->due[i].id){
+            ran += ev_offer(loop, fd);
+            if(loop->handlers[fd].active){
+                ev_sync(loop, fd);
+            }
+        }
+    }
+    if(n > 0){
+        memmove(loop->due, loop->due + n, (loop->ndue - n) * sizeof(*loop->due));
+        loop->ndue -= n;
+    }
+    return ran;
+}
+
+//waits up to timeout_ms and dispatches ready handlers
+static int uring_run_once(EvLoop *loop, int timeout_ms){
+    if(timeout_ms > 0){
+        //a timeout that also completes as soon as any other completion arrives, so none pile up
+        struct io_uring_sqe *sqe = uring_get_sqe(loop);
+        if(sqe){
+            loop->timeout.tv_sec = timeout_ms / 1000;
+            loop->timeout.tv_nsec = (long long)(timeout_ms % 1000) * 1000000;
+            sqe->opcode = IORING_OP_TIMEOUT;
+            sqe->fd = -1;
+            sqe->addr = (uint64_t)(uintptr_t)&loop->timeout;
+            sqe->len = 1;
+            sqe->off = 1;
+            sqe->user_data = URING_INTERNAL;
+            uring_commit_sqe(loop);
+        }
+    }
+    if(uring_enter(loop, timeout_ms == 0 ? 0 : 1) < 0){
+        perror("io_uring_enter failed");
+        return -1;
+    }
+
+    int dispatched = 0;
+    unsigned head = *loop->cq_head;
+    while(head != __atomic_load_n(loop->cq_tail, __ATOMIC_ACQUIRE) && dispatched < EV_BATCH){
+        struct io_uring_cqe cqe = loop->cqes[head & *loop->cq_mask];
+        head++;
+        __atomic_store_n(loop->cq_head, head, __ATOMIC_RELEASE);
+        if(cqe.user_data == URING_INTERNAL){
+            continue;
+        }
+        switch(cookie_op(cqe.user_data)){
+        case OP_POLL:
+            if(cqe.res != -ECANCELED){
+                int events = EV_READ;
+                if(cqe.res >= 0){
+                    events = ((cqe.res & (POLLIN|POLLHUP|POLLERR)) ? EV_READ : 0) | ((cqe.res & POLLOUT) ? EV_WRITE : 0);
+                }
+                dispatched += ev_dispatch(loop, cqe.user_data, events);
+            }
+            break;
+        case OP_ACCEPT:
+            uring_accepted(loop, &cqe);
+            dispatched++;
+            break;
+        case OP_RECV:
+            uring_received(loop, &cqe);
+            dispatched++;
+            break;
+        default:
+            dispatched += uring_relayed(loop, &cqe);
+            break;
+        }
+    }
+    return dispatched;
+}
+
+//waits up to timeout_ms (-1 blocks) and dispatches ready handlers
+int evloop_run_once(EvLoop *loop, int timeout_ms){
+    //deferred work runs first and keeps the wait from blocking, more may be due once it has run
+    int ran = ev_run_deferred(loop);
+    if(ran > 0 || loop->ndue > 0 || loop->relays_done > 0){
+        timeout_ms = 0;
+    }
+    if(loop->backend == EVLOOP_URING){
+        int n = uring_run_once(loop, timeout_ms);
+        return n < 0 ? n : n + ran;
+    }
+
+    struct epoll_event evs[EV_BATCH];
+    int n = epoll_wait(loop->fd, evs, EV_BATCH, timeout_ms);
+    if(n < 0){
+        if(errno == EINTR){
+            return ran;
+        }
+        perror("epoll_wait failed");
+        return -1;
+    }
+
+    int dispatched = ran;
+    for(int i = 0; i < n; i++){
+        int events = ((evs[i].events & (EPOLLIN|EPOLLHUP|EPOLLERR)) ? EV_READ : 0) |
+                     ((evs[i].events & EPOLLOUT) ? EV_WRITE : 0);
+        dispatched += ev_dispatch(loop, evs[i].data.u64, events);
+    }
+    return dispatched;
+}
+
+//releases the loop
+void evloop_destroy(EvLoop *loop){
+    if(!loop){
+        return;
+    }
+    if(loop->backend == EVLOOP_URING){
+        munmap(loop->sqes, loop->sqes_size);
+        if(loop->cq_ptr != loop->sq_ptr){
+            munmap(loop->cq_ptr, loop->cq_size);
+        }
+        munmap(loop->sq_ptr, loop->sq_size);
+    }
+    close(loop->fd);
+    if(loop->buf_ring != NULL){
+        munmap(loop->buf_ring, RECV_BUFS * sizeof(struct io_uring_buf));
+        free(loop->bufs);
+        free(loop->buf_used);
+    }
+    for(int i = 0; i < loop->nhandlers; i++){
+        free(loop->handlers[i].held);
+    }
+    for(int i = 0; i < MAX_RELAYS; i++){
+        free(loop->relays[i].buf);
+    }
+    free(loop->due);
+    free(loop->scratch);
+    free(loop->handlers);
+    free(loop);
+}
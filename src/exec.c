@@ -1,223 +1,647 @@
+#define _GNU_SOURCE
 #include "exec.h"
 #include "parse.h"
 #include "redir.h"
+#include "filter.h"
+#include "shellcore.h"
+#include "env.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
 #include <sys/wait.h>
 #include <fcntl.h>
+#include <errno.h>
+#include <signal.h>
+#include <sys/syscall.h>
+#include <stdint.h>
+#include <poll.h>
+#include <sys/stat.h>
 
-//maximum length for command input buffer
-#define MAX_CMD_LENGTH 1024 
-//maximum number of arguments a command can have
-#define MAX_ARGS 64         
-//maximum number of pipes in a pipeline
-#define MAX_PIPES 10
-
-//structure definition for pipeline stages
-//each stage in a pipeline is a separate command with its own arguments and redirections
-typedef struct {
-    char *args[MAX_ARGS];
-    char *inputFile;
-    char *outputFile;
-    char *errorFile;
-} Stage;
-
-/*utility function to skip leading whitespace characters.
-This function advances the pointer past any spaces, tabs, or newlines at the beginning of a string, returning a pointer to the first non-whitespace character
+//pipe capacity for pipelines, 0 means leave the kernel default alone
+static int pipe_size = 0;
+//deadline execute_pipeline gives a command line in milliseconds, 0 waits forever
+static int command_timeout = 0;
+//takes over reaping the stages of a partial pipeline, NULL reaps them here
+static void (*orphan_handler)(pid_t pid) = NULL;
+
+void set_pipe_size(int bytes){
+    pipe_size = bytes > 0 ? bytes : 0;
+}
+
+void set_command_timeout(int ms){
+    command_timeout = ms > 0 ? ms : 0;
+}
+
+void spawn_set_orphan_handler(void (*handler)(pid_t pid)){
+    orphan_handler = handler;
+}
+
+int tune_pipe(int fd){
+    if(pipe_size > 0 && fcntl(fd, F_SETPIPE_SZ, pipe_size) < 0){
+        perror("F_SETPIPE_SZ failed");
+    }
+    return fcntl(fd, F_GETPIPE_SZ);
+}
+
+/*wire a child's standard streams to the descriptors in io[] before its own redirections are applied
+a NULL io or a negative entry keeps whatever the caller had (the terminal for the local shell); the server passes
+either the write end of a result pipe for stdout/stderr or the client's own descriptors received over a local socket
 */
-static char* skip_whitespace(char *str){
-    //loop through string while current character is whitespace
-    while(*str == ' ' || *str == '\t' || *str == '\n'){
-        str++;
+static void child_route_stdio(const int io[3]){
+    if(io == NULL){
+        return;
     }
-    return str;
+    for(int target = 0; target < 3; target++){
+        if(io[target] >= 0 && io[target] != target && dup2(io[target], target) < 0){
+            dprintf(STDERR_FILENO, "dup2 failed: %s\n", strerror(errno));
+            _exit(EXIT_FAILURE);
+        }
+    }
+    //the originals are close-on-exec, nothing else to tidy up here
+}
+
+//opens a pidfd for a child so its exit can be waited on through an event loop, returns -1 (ENOSYS on old kernels) on failure
+int open_pidfd(pid_t pid){
+#ifdef SYS_pidfd_open
+    return syscall(SYS_pidfd_open, pid, 0);
+#else
+    (void)pid;
+    errno = ENOSYS;
+    return -1;
+#endif
 }
 
-/*Execute a single command with optional file redirections
-This function creates a child process to run the command and handles redirections. The parent process waits for the child to complete before returning
+//sends sig to the process behind a pidfd, which unlike kill() cannot hit a recycled pid, returns 0 on success, -1 on failure
+int pidfd_signal(int pidfd, int sig){
+#ifdef SYS_pidfd_send_signal
+    return syscall(SYS_pidfd_send_signal, pidfd, sig, NULL, 0);
+#else
+    (void)pidfd;
+    (void)sig;
+    errno = ENOSYS;
+    return -1;
+#endif
+}
+
+//PATH searched when the variable is unset, execvp's default
+#define DEFAULT_PATH "/bin:/usr/bin"
+
+/*puts the candidate for name in the PATH element that starts at dir and ends at end into file (an empty element is
+the current directory), returns -1 if it does not fit; no stdio, it also runs between fork and exec
 */
-void execute_command(char *args[], char *inputFile, char *outputFile, char *errorFile) {
-    //create a child process using fork()
-    pid_t pid = fork();
+static int path_candidate(char *file, size_t size, const char *dir, const char *end, const char *name){
+    size_t dlen = end == dir ? 1 : (size_t)(end - dir);
+    size_t nlen = strlen(name);
+    if(dlen + nlen + 2 > size){
+        return -1;
+    }
+    memcpy(file, end == dir ? "." : dir, dlen);
+    file[dlen] = '/';
+    memcpy(file + dlen + 1, name, nlen + 1);
+    return 0;
+}
 
-    if(pid < 0){
-        perror("fork failed");
+//execs file, a file that is not a binary is run by /bin/sh as execvp does; returns only if that fails
+static void exec_file(const char *file, char *const argv[], char *const envp[]){
+    execve(file, argv, envp);
+    if(errno != ENOEXEC){
         return;
     }
-    
-    if(pid == 0){
-        //child process : execute the command with redirections, set up input redirection if specified, redirect stdin to read from inputFile
-        if(inputFile && setup_redirection(inputFile, O_RDONLY, STDIN_FILENO) < 0){
-            exit(EXIT_FAILURE);
-        }
-        
-        //set up output redirection if specified
-        //redirect stdout to write to outputFile
-        if(outputFile && setup_redirection(outputFile, O_WRONLY|O_CREAT|O_TRUNC, STDOUT_FILENO) < 0){
-            exit(EXIT_FAILURE);
-        }
-        
-        //set up error redirection if specified
-        //redirect stderr to write to errorFile
-        if(errorFile && setup_redirection(errorFile, O_WRONLY|O_CREAT|O_TRUNC, STDERR_FILENO) < 0){
-            exit(EXIT_FAILURE);
-        }
-        
-        //execute the command using execvp, it searches PATH environment variable for the executable
-        if(execvp(args[0], args) < 0){
-            printf("Command not found.\n");
-            exit(EXIT_FAILURE);
-        }
-    }else{
-        //parent process : wait for child to complete, wait() blocks until child process terminates
-        //this ensures the shell waits for command completion before showing next prompt
-        wait(NULL);
+    int argc = 0;
+    while(argv[argc] != NULL){
+        argc++;
     }
+    char *sh_argv[argc + 2];
+    sh_argv[0] = "/bin/sh";
+    sh_argv[1] = (char *)file;
+    memcpy(sh_argv + 2, argv + 1, argc * sizeof(char *));     //argv[1..] and the NULL
+    execve("/bin/sh", sh_argv, envp);
 }
 
-/*main pipeline execution function that handles commands with pipes (|)
-this function creates multiple processes and connects their input/output streams using pipe() and dup2() system calls to simulate shell pipeline behavior
+/*execvpe with the PATH of the store the command runs with, execvpe itself would search the process environment's
+one and a server session can have its own; returns only if nothing could be exec'd
 */
-void execute_pipeline(char *cmd){
-    //validate that the pipeline syntax is correct
-    if(validate_pipeline(cmd) != 0){
+static void exec_search(char *const argv[], char *const envp[], const char *path){
+    if(strchr(argv[0], '/') != NULL){
+        exec_file(argv[0], argv, envp);
         return;
     }
-    
-    //array to store information about each stage in the pipeline
-    Stage stages[MAX_PIPES];
-    int numStages = 0;                  //counter for number of stages found
-    int hasErrors = 0;                  //flag to track if any stage had parsing errors
-    
-    //split the command by pipe characters using strtok_r
-    char *saveptr;                                          //save pointer for strtok_r
-    char *stage_cmd = strtok_r(cmd, "|", &saveptr);         //get first stage
-    
-    //parse each stage of the pipeline
-    while(stage_cmd != NULL && numStages < MAX_PIPES){
-        stage_cmd = skip_whitespace(stage_cmd);
-        
-        //local variables to hold parsed information for this stage
-        char *args[MAX_ARGS];                   //command arguments array
-        char *inputFile = NULL;                  //input redirection file
-        char *outputFile = NULL;                //output redirection file
-        char *errorFile = NULL;                 //error redirection file
-        
-        parse_command(stage_cmd, args, &inputFile, &outputFile, &errorFile, 1);
-        
-        //check if parsing failed (args[0] is NULL indicates parsing error)
-        if(args[0] == NULL){
-            hasErrors = 1;                  //set error flag
-            numStages++;
-            stage_cmd = strtok_r(NULL, "|", &saveptr);
-            continue;
+    for(const char *dir = path != NULL ? path : DEFAULT_PATH; ; ){
+        const char *end = strchrnul(dir, ':');
+        char file[4096];
+        if(path_candidate(file, sizeof(file), dir, end, argv[0]) == 0){
+            exec_file(file, argv, envp);
         }
-        
-        //copy to stage structure
-        int k = 0;
-        for(int i = 0; args[i] != NULL; i++){
-            stages[numStages].args[k++] = args[i];
+        if(*end == '\0'){
+            return;
         }
-        stages[numStages].args[k] = NULL;               //null-terminate immediately after last arg
-        
-        //store redirection information for this stage
-        stages[numStages].inputFile = inputFile;
-        stages[numStages].outputFile = outputFile;
-        stages[numStages].errorFile = errorFile;
-        
-        numStages++;
-        stage_cmd = strtok_r(NULL, "|", &saveptr);
+        dir = end + 1;
     }
-    
-    //check if we have at least one valid stage to execute
-    if(numStages == 0){
+}
+
+/*closes every descriptor above stderr in a child that runs builtin filters instead of exec'ing, close-on-exec does not
+help there and it would keep the parent's pipes open for as long as it runs (in the server: other commands' pipes,
+the write end of its own stdin stream, client sockets)
+*/
+static void close_inherited_fds(void){
+#ifdef SYS_close_range
+    if(syscall(SYS_close_range, 3, ~0U, 0) == 0){
         return;
     }
-    
-    //don't execute pipeline if there were parsing errors
-    if(hasErrors){
-        return;
+#endif
+    long max = sysconf(_SC_OPEN_MAX);
+    for(long fd = 3; fd < max; fd++){
+        close(fd);
     }
-    
-    //create pipes
+}
+
+//clone3 arguments up to the cgroup field (kernel 5.7), declared here since older headers lack them
+struct clone_args_cgroup {
+    uint64_t flags;
+    uint64_t pidfd;
+    uint64_t child_tid;
+    uint64_t parent_tid;
+    uint64_t exit_signal;
+    uint64_t stack;
+    uint64_t stack_size;
+    uint64_t tls;
+    uint64_t set_tid;
+    uint64_t set_tid_size;
+    uint64_t cgroup;
+};
+#ifndef CLONE_INTO_CGROUP
+#define CLONE_INTO_CGROUP 0x200000000ULL
+#endif
+
+//cleared once the kernel turns clone3 or CLONE_INTO_CGROUP down, every later child takes the fork() path
+static int clone3_usable = 1;
+
+/*forks a child that starts in the cgroup v2 directory cgroup_fd, or in the caller's cgroup if it is -1
+clone3 with CLONE_INTO_CGROUP places it atomically; a child that goes on to run builtin filters (malloc, stdio) needs
+fork() to be safe in a threaded caller, so it, like every child on kernels without clone3, moves itself via cgroup.procs
+*/
+static pid_t fork_into(int cgroup_fd, int execs){
+#ifdef SYS_clone3
+    if(cgroup_fd >= 0 && execs && __atomic_load_n(&clone3_usable, __ATOMIC_RELAXED)){
+        struct clone_args_cgroup args;
+        memset(&args, 0, sizeof(args));
+        args.flags = CLONE_INTO_CGROUP;
+        args.exit_signal = SIGCHLD;
+        args.cgroup = cgroup_fd;
+        pid_t pid = syscall(SYS_clone3, &args, sizeof(args));
+        if(pid >= 0 || (errno != ENOSYS && errno != E2BIG && errno != EINVAL)){
+            return pid;
+        }
+        __atomic_store_n(&clone3_usable, 0, __ATOMIC_RELAXED);
+    }
+#endif
+    pid_t pid = fork();
+    if(pid == 0 && cgroup_fd >= 0){
+        int fd = openat(cgroup_fd, "cgroup.procs", O_WRONLY | O_CLOEXEC);
+        if(fd < 0 || write(fd, "0", 1) < 0){
+            dprintf(STDERR_FILENO, "cgroup: %s\n", strerror(errno));
+        }
+        if(fd >= 0){
+            close(fd);
+        }
+    }
+    return pid;
+}
+
+/*groups the stages into processes, a run of consecutive builtin filters shares one executor process
+stages with explicit redirections always get a process of their own
+*/
+void plan_pipeline(const Pipeline *pl, ExecPlan *plan){
+    int prev = 0;
+    plan->nprocs = 0;
+    for(int i = 0; i < pl->nstages; i++){
+        int builtin = pl->stages[i].nredirs == 0 && filter_is_builtin(pl->stages[i].argv);
+        if(i == 0 || !builtin || !prev){
+            plan->builtin[plan->nprocs] = builtin;
+            plan->first[plan->nprocs++] = i;
+        }
+        prev = builtin;
+    }
+    plan->first[plan->nprocs] = pl->nstages;
+}
+
+/*pipeline spawning function, runs every stage of a parsed pipeline (a single command is a pipeline of one)
+this function creates multiple processes and connects their input/output streams using pipe() and dup2() system calls to simulate shell pipeline behavior
+the stages are left running, their pids are stored in pids[] and the number of processes is returned (-1 on error),
+which can be fewer than the number of stages since builtin filters share a process
+*/
+static int spawn_plan(const Pipeline *pl, const ExecPlan *plan, const int *exec_fd, const SpawnOptions *opt, pid_t pids[]){
+    int numStages = pl->nstages;
+    int numUnits = plan->nprocs;
+    const int *unitStart = plan->first;
+
+    //create pipes between the processes
     int pipes[MAX_PIPES][2];
-    for(int i = 0; i < numStages - 1; i++){
+    for(int i = 0; i < numUnits - 1; i++){
         if(pipe(pipes[i]) < 0){
             perror("pipe failed");
-            return;
+            for(int j = 0; j < i; j++){
+                close(pipes[j][0]);
+                close(pipes[j][1]);
+            }
+            return -1;
         }
+        tune_pipe(pipes[i][0]);
     }
     
-    //create a child process for each stage
-    pid_t pids[MAX_PIPES];
-    for(int i = 0; i < numStages; i++){
-        pids[i] = fork();
+    //flush buffered output so the children do not inherit (and later re-emit) it
+    fflush(stdout);
+    //the exported variables of the store this thread runs with, rebuilt only when one has changed
+    char **envp = env_envp(env_current());
+    //and the PATH its commands are looked up in (exported or not, as in sh)
+    const char *path = env_get(env_current(), "PATH");
+
+    //create a child process for each unit
+    int started = 0;
+    for(int i = 0; i < numUnits; i++){
+        const Command *cmd = &pl->stages[unitStart[i]];
+
+        //appends to files held in the descriptor cache are resolved here, the child only has to dup2 them
+        int cached[MAX_REDIRS];
+        for(int j = 0; j < cmd->nredirs; j++){
+            const Redirect *r = &cmd->redirs[j];
+            cached[j] = r->type == REDIR_FILE ? fdcache_open(r->path, r->flags) : -1;
+        }
+        pids[i] = fork_into(opt->cgroup_fd, !plan->builtin[i]);
+        //both sides join the group so it exists whichever runs first, the parent's call fails harmlessly once the child has exec'd
+        if(opt->own_group && pids[i] > 0){
+            setpgid(pids[i], pids[0]);
+        }
+        if(pids[i] != 0){
+            for(int j = 0; j < cmd->nredirs; j++){
+                if(cached[j] >= 0){
+                    close(cached[j]);
+                }
+            }
+        }
         
         if(pids[i] < 0){
             perror("fork failed");
-            return;
+            break;
         }else if(pids[i] == 0){
-            /*child process : execute this stage of the pipeline
-            handle explicit file redirections first (they override pipe connections)
+            /*child process : execute this part of the pipeline
+            the io[] streams go first, then the pipe connections, then explicit file redirections (they override pipe connections)
+            the server forks from several threads, so the child only uses dprintf/_exit and never touches stdio locks or buffers
             */
-            if(stages[i].inputFile && setup_redirection(stages[i].inputFile, O_RDONLY, STDIN_FILENO) < 0){
-                exit(EXIT_FAILURE);
-            }
-            if(stages[i].outputFile && setup_redirection(stages[i].outputFile, O_WRONLY|O_CREAT|O_TRUNC, STDOUT_FILENO) < 0){
-                exit(EXIT_FAILURE);
+            if(opt->own_group){
+                setpgid(0, i == 0 ? 0 : pids[0]);
             }
-            if(stages[i].errorFile && setup_redirection(stages[i].errorFile, O_WRONLY|O_CREAT|O_TRUNC, STDERR_FILENO) < 0){
-                exit(EXIT_FAILURE);
-            }
-            
-            //connect input from previous stage (only if no explicit input redirection)
-            if(i > 0 && stages[i].inputFile == NULL){
+            child_route_stdio(opt->io);
+            signal(SIGPIPE, SIG_DFL);   //a caller ignoring SIGPIPE (the server) must not pass that on to the commands
+
+            //connect input from previous unit and output to the next one
+            if(i > 0){
                 dup2(pipes[i-1][0], STDIN_FILENO);
             }
-            //connect output to next stage (only if no explicit output redirection)
-            if(i < numStages - 1 && stages[i].outputFile == NULL){
+            if(i < numUnits - 1){
                 dup2(pipes[i][1], STDOUT_FILENO);
             }
             
-            //close pipe file descriptors that are not being used by this stage
-            for(int j = 0; j < numStages - 1; j++){
-                //close read end if this stage is not reading from this pipe
-                if(i == 0 || j != i-1){
-                    close(pipes[j][0]);
+            //close pipe file descriptors, the ones in use were duplicated onto the standard streams
+            for(int j = 0; j < numUnits - 1; j++){
+                close(pipes[j][0]);
+                close(pipes[j][1]);
+            }
+
+            /*redirections apply left to right, so 2>&1 >f keeps stderr on the old stdout
+            n>&m may only copy the standard streams or a descriptor this command opened itself, anything else in the
+            child belongs to the caller (the server's sockets and pipes)
+            */
+            unsigned opened = 07;
+            for(int j = 0; j < cmd->nredirs; j++){
+                const Redirect *r = &cmd->redirs[j];
+                int rc;
+                if(r->type == REDIR_DUP){
+                    if(r->dup_fd >= 0 && !(opened & (1u << r->dup_fd))){
+                        dprintf(STDERR_FILENO, "%d: Bad file descriptor.\n", r->dup_fd);
+                        _exit(EXIT_FAILURE);
+                    }
+                    rc = setup_fd_redirection(r->dup_fd, r->fd);
+                }else if(cached[j] >= 0){
+                    rc = setup_fd_redirection(cached[j], r->fd);
+                }else if(r->type == REDIR_DATA){
+                    rc = setup_data_redirection(r->path, r->fd);
+                }else{
+                    rc = setup_redirection(r->path, r->flags, r->fd);
+                }
+                if(rc < 0){
+                    _exit(EXIT_FAILURE);
+                }
+                if(r->type == REDIR_DUP && r->dup_fd < 0){
+                    opened &= ~(1u << r->fd);
+                }else{
+                    opened |= 1u << r->fd;
                 }
-                //close write end if this stage is not writing to this pipe
-                if(i == numStages-1 || j != i){
-                    close(pipes[j][1]);
+            }
+
+            //a run of builtin filters is executed right here, lines pass between the stages without pipes or copies
+            if(plan->builtin[i]){
+                char **argvs[MAX_PIPES];
+                int n = unitStart[i+1] - unitStart[i];
+                for(int j = 0; j < n; j++){
+                    argvs[j] = cmd[j].argv;
                 }
+                close_inherited_fds();
+                _exit(filter_run(argvs, n));
             }
             
-            //execute the command
-            if(execvp(stages[i].args[0], stages[i].args) < 0){
-                //if we reach here, execvp failed, and an error message is printed to stderr (not stdout) to avoid interfering with pipeline
-                fprintf(stderr, "Command not found in pipe sequence.\n");
-                exit(EXIT_FAILURE);
+            //a prepared command's binary was resolved in advance, a script (its interpreter cannot reopen a
+            //close-on-exec descriptor) or a vanished binary falls back to the normal PATH search
+            if(exec_fd != NULL && exec_fd[i] >= 0){
+                fexecve(exec_fd[i], cmd->argv, envp);
+            }
+            //execute the command, searching the PATH of the variables it runs with
+            exec_search(cmd->argv, envp, path);
+            if(numStages == 1){
+                dprintf(STDOUT_FILENO, "Command not found.\n");
+            }else{
+                //inside a pipeline the error is printed to stderr (not stdout) to avoid interfering with the data
+                dprintf(STDERR_FILENO, "Command not found in pipe sequence.\n");
             }
+            _exit(127);                 //the status sh uses for a missing command
         }
+        started++;
     }
     
-    /*parent process : close all pipes and wait for children
-    close all pipe file descriptors in parent
-    */
-    for(int i = 0; i < numStages - 1; i++){
+    //parent process : close all pipe file descriptors in parent
+    for(int i = 0; i < numUnits - 1; i++){
         close(pipes[i][0]);
         close(pipes[i][1]);
     }
-    
-    //wait for the last process
+
+    //a failed fork leaves a partial pipeline, kill and reap what did start and report failure
+    if(started < numUnits){
+        for(int i = 0; i < started; i++){
+            kill(pids[i], SIGKILL);
+            if(orphan_handler != NULL){
+                orphan_handler(pids[i]);
+            }else{
+                waitpid(pids[i], NULL, 0);
+            }
+        }
+        return -1;
+    }
+    return numUnits;
+}
+
+int spawn_pipeline(const Pipeline *pl, const int io[3], pid_t pids[]){
+    SpawnOptions opt = {io, -1, 0};
+    return spawn_pipeline_opts(pl, &opt, pids);
+}
+
+//spawn_plan with the library's counters, start is when the caller began setting the pipeline up
+static int spawn_counted(const Pipeline *pl, const ExecPlan *plan, const int *exec_fd, const SpawnOptions *opt, pid_t pids[], long start){
+    int n = spawn_plan(pl, plan, exec_fd, opt, pids);
+    if(n < 0){
+        SHELL_STAT_ADD(spawn_failures, 1);
+    }else{
+        SHELL_STAT_ADD(pipelines, 1);
+        SHELL_STAT_ADD(processes, n);
+        for(int i = 0; i < plan->nprocs; i++){
+            if(plan->builtin[i]){
+                SHELL_STAT_ADD(builtin_stages, plan->first[i+1] - plan->first[i]);
+            }
+        }
+    }
+    SHELL_STAT_ADD(spawn_ns, shellcore_now_ns() - start);
+    return n;
+}
+
+int spawn_pipeline_opts(const Pipeline *pl, const SpawnOptions *opt, pid_t pids[]){
+    ExecPlan plan;
+    long start = shellcore_now_ns();
+
+    plan_pipeline(pl, &plan);
+    return spawn_counted(pl, &plan, NULL, opt, pids, start);
+}
+
+//opens the binary exec_search would run for name, O_PATH so it works for execute-only files; -1 if there is none
+static int resolve_command(const char *name){
+    if(strchr(name, '/') != NULL){
+        return access(name, X_OK) == 0 ? open(name, O_PATH | O_CLOEXEC) : -1;
+    }
+    const char *path = env_get(env_current(), "PATH");
+    for(const char *dir = path != NULL ? path : DEFAULT_PATH; ; ){
+        const char *end = strchrnul(dir, ':');
+        char file[4096];
+        struct stat st;
+        if(path_candidate(file, sizeof(file), dir, end, name) == 0 && access(file, X_OK) == 0 && stat(file, &st) == 0 &&
+           S_ISREG(st.st_mode)){
+            return open(file, O_PATH | O_CLOEXEC);
+        }
+        if(*end == '\0'){
+            return -1;
+        }
+        dir = end + 1;
+    }
+}
+
+Prepared *prepare_pipeline(const char *text){
+    Prepared *p = calloc(1, sizeof(Prepared));
+    if(p == NULL){
+        return NULL;
+    }
+    for(int i = 0; i < MAX_PIPES; i++){
+        p->exec_fd[i] = -1;
+    }
+    if((p->text = strdup(text)) == NULL || (p->pl = parse_pipeline(text)) == NULL){
+        free_prepared(p);
+        return NULL;
+    }
+    plan_pipeline(p->pl, &p->plan);
+    for(int i = 0; i < p->plan.nprocs; i++){
+        const Command *cmd = &p->pl->stages[p->plan.first[i]];
+        if(!p->plan.builtin[i] && cmd->argc > 0){
+            p->exec_fd[i] = resolve_command(cmd->argv[0]);
+        }
+    }
+    return p;
+}
+
+void free_prepared(Prepared *p){
+    if(p == NULL){
+        return;
+    }
+    for(int i = 0; i < MAX_PIPES; i++){
+        if(p->exec_fd[i] >= 0){
+            close(p->exec_fd[i]);
+        }
+    }
+    free_pipeline(p->pl);
+    free(p->text);
+    free(p);
+}
+
+int spawn_prepared(const Prepared *p, const SpawnOptions *opt, pid_t pids[]){
+    SHELL_STAT_ADD(prepared_runs, 1);
+    return spawn_counted(p->pl, &p->plan, p->exec_fd, opt, pids, shellcore_now_ns());
+}
+
+/*waits up to the command timeout for every stage to exit, watching their pidfds, and kills the ones still running then
+returns 1 if the deadline passed, 0 otherwise (also when there is no deadline or no pidfd support, the caller just waits)
+*/
+static int wait_deadline(const pid_t pids[], int n){
+    struct pollfd p[MAX_PIPES];
+    int running = 0;
+    int expired = 0;
+
+    if(command_timeout == 0){
+        return 0;
+    }
+    for(int i = 0; i < n; i++){
+        p[i].fd = open_pidfd(pids[i]);
+        p[i].events = POLLIN;
+        if(p[i].fd < 0){
+            while(i-- > 0){
+                close(p[i].fd);
+            }
+            return 0;
+        }
+    }
+    long deadline = shellcore_now_ns() + command_timeout * 1000000L;
+    for(running = n; running > 0; ){
+        long left = (deadline - shellcore_now_ns()) / 1000000L;
+        int rc = left > 0 ? poll(p, n, left) : 0;
+        if(rc < 0 && errno == EINTR){
+            continue;
+        }
+        if(rc <= 0){
+            expired = rc == 0;
+            break;
+        }
+        //an exited stage stays a zombie until waitpid, its pidfd is done
+        for(int i = 0; i < n; i++){
+            if(p[i].fd >= 0 && p[i].revents){
+                close(p[i].fd);
+                p[i].fd = -1;
+                running--;
+            }
+        }
+    }
+    for(int i = 0; i < n; i++){
+        if(p[i].fd >= 0){
+            if(expired){
+                pidfd_signal(p[i].fd, SIGKILL);
+            }
+            close(p[i].fd);
+        }
+    }
+    return expired;
+}
+
+/*main execution function for the local shell
+spawns every stage and waits for all of them before returning, this ensures the shell waits for command completion before showing next prompt
+*/
+int execute_pipeline(const Pipeline *pl){
+    pid_t pids[MAX_PIPES];
     int status;
+    //assignments, export and unset change the shell's own variables, nothing to fork
+    if(env_builtin(env_current(), pl, &status)){
+        return status;
+    }
+    int numStages = spawn_pipeline(pl, NULL, pids);
+    if(numStages <= 0){
+        return 1;
+    }
+    int timedOut = wait_deadline(pids, numStages);
+    
+    //wait for the last process, its status is the status of the pipeline
     waitpid(pids[numStages-1], &status, 0);
     
     //wait for all other children to avoid zombie processes
     for(int i = 0; i < numStages; i++){
         if(i != numStages-1){                       //don't wait twice for last process
-            waitpid(pids[i], &status, 0);
+            waitpid(pids[i], NULL, 0);
+        }
+    }
+    if(timedOut){
+        fprintf(stderr, "Command timed out.\n");
+        return 124;                     //the status timeout(1) uses
+    }
+    return WIFEXITED(status) ? WEXITSTATUS(status) : 128 + WTERMSIG(status);
+}
+
+int capture_pipeline(const Pipeline *pl, char **out, size_t *len, size_t max){
+    pid_t pids[MAX_PIPES];
+    int fds[2];
+    *out = NULL;
+    *len = 0;
+    if(pipe2(fds, O_CLOEXEC) < 0){
+        perror("pipe failed");
+        return 1;
+    }
+    int io[3] = {-1, fds[1], -1};
+    SpawnOptions opt = {io, -1, 0};
+    int numStages = spawn_pipeline_opts(pl, &opt, pids);
+    close(fds[1]);
+    if(numStages <= 0){
+        close(fds[0]);
+        return 1;
+    }
+
+    //the output is drained before anything is waited for, a command that fills the pipe would never exit otherwise
+    long deadline = command_timeout ? shellcore_now_ns() + command_timeout * 1000000L : 0;
+    int timedOut = 0;
+    size_t cap = 0;
+    char discard[4096];
+    for(;;){
+        if(deadline){
+            struct pollfd p = {fds[0], POLLIN, 0};
+            long left = (deadline - shellcore_now_ns()) / 1000000L;
+            int rc = left > 0 ? poll(&p, 1, left) : 0;
+            if(rc < 0 && errno == EINTR){
+                continue;
+            }
+            if(rc == 0){
+                timedOut = 1;
+                break;
+            }
+        }
+        if(*len == cap && cap < max){
+            size_t grown = cap ? cap * 2 : 4096;
+            char *tmp = realloc(*out, (grown < max ? grown : max) + 1);
+            if(tmp != NULL){
+                *out = tmp;
+                cap = grown < max ? grown : max;
+            }
+        }
+        ssize_t n = *len < cap ? read(fds[0], *out + *len, cap - *len) : read(fds[0], discard, sizeof(discard));
+        if(n < 0 && errno == EINTR){
+            continue;
+        }
+        if(n <= 0){
+            break;
         }
+        if(*len < cap){
+            *len += n;
+        }
+    }
+    close(fds[0]);
+    if(*out != NULL){
+        (*out)[*len] = '\0';
+    }
+    if(timedOut){
+        for(int i = 0; i < numStages; i++){
+            kill(pids[i], SIGKILL);
+        }
+    }else{
+        timedOut = wait_deadline(pids, numStages);
+    }
+
+    int status;
+    waitpid(pids[numStages-1], &status, 0);
+    for(int i = 0; i < numStages - 1; i++){
+        waitpid(pids[i], NULL, 0);
+    }
+    if(timedOut){
+        fprintf(stderr, "Command timed out.\n");
+        return 124;
     }
+    return WIFEXITED(status) ? WEXITSTATUS(status) : 128 + WTERMSIG(status);
 }
@@ -0,0 +1,654 @@
+#define _GNU_SOURCE
+#include "expand.h"
+#include "builtin.h"
+#include "env.h"
+#include "exec.h"
+#include "parse.h"
+#include "tokenize.h"
+#include "shellcore.h"
+#include <ctype.h>
+#include <limits.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+//IFS when it is unset
+#define DEFAULT_IFS " \t\n"
+//longest variable name looked up
+#define MAX_NAME 256
+
+static int allow_commands = 1;
+
+void expand_allow_commands(int allow){
+    allow_commands = allow;
+}
+
+//this thread keeps its expansion errors for expand_take_error instead of printing them, and the last one kept
+static _Thread_local int keep_errors = 0;
+static _Thread_local char last_error[256];
+
+void expand_keep_errors(int keep){
+    keep_errors = keep;
+    last_error[0] = '\0';
+}
+
+const char *expand_take_error(void){
+    static _Thread_local char taken[sizeof(last_error)];
+    if(last_error[0] == '\0'){
+        return NULL;
+    }
+    memcpy(taken, last_error, sizeof(taken));
+    last_error[0] = '\0';
+    return taken;
+}
+
+//says why a word cannot be expanded, on stdout like the parser's errors unless the thread keeps them
+__attribute__((format(printf, 1, 2)))
+static void expand_fail(const char *fmt, ...){
+    va_list ap;
+    va_start(ap, fmt);
+    if(keep_errors){
+        vsnprintf(last_error, sizeof(last_error), fmt, ap);
+    }else{
+        vprintf(fmt, ap);
+    }
+    va_end(ap);
+}
+
+//growing string an expansion result is built in
+typedef struct {
+    char *s;
+    size_t len, cap;
+} Buf;
+
+static int buf_add(Buf *b, const char *p, size_t n){
+    if(b->len + n + 1 > b->cap){
+        size_t cap = b->cap ? b->cap : 64;
+        while(cap < b->len + n + 1){
+            cap *= 2;
+        }
+        char *tmp = realloc(b->s, cap);
+        if(tmp == NULL){
+            perror("realloc");
+            return -1;
+        }
+        b->s = tmp;
+        b->cap = cap;
+    }
+    memcpy(b->s + b->len, p, n);
+    b->len += n;
+    b->s[b->len] = '\0';
+    return 0;
+}
+
+//the fields one word expands to
+typedef struct {
+    char **v;
+    int n, cap;
+    Buf cur;                    //field being built
+    int started;                //cur is a field even if it stays empty (it has text, or a quoted expansion)
+    int split;                  //unquoted results are split on ifs
+    char ifs[32];
+} Fields;
+
+static int end_field(Fields *f){
+    if(f->n + 1 >= f->cap){
+        int cap = f->cap ? f->cap * 2 : 4;
+        char **tmp = realloc(f->v, cap * sizeof(char *));
+        if(tmp == NULL){
+            perror("realloc");
+            return -1;
+        }
+        f->v = tmp;
+        f->cap = cap;
+    }
+    if(f->cur.s == NULL && buf_add(&f->cur, "", 0) < 0){
+        return -1;
+    }
+    f->v[f->n++] = f->cur.s;
+    f->v[f->n] = NULL;
+    memset(&f->cur, 0, sizeof(f->cur));
+    f->started = 0;
+    return 0;
+}
+
+static int add_text(Fields *f, const char *p, size_t n){
+    f->started = 1;
+    return buf_add(&f->cur, p, n);
+}
+
+//adds an expansion's result, split into fields unless it was quoted (or the word is never split)
+static int add_result(Fields *f, const char *p, size_t n, int quoted){
+    if(quoted || !f->split){
+        return add_text(f, p, n);
+    }
+    for(size_t i = 0; i < n; ){
+        size_t run = 0;
+        while(i + run < n && strchr(f->ifs, p[i + run]) == NULL){
+            run++;
+        }
+        if(run > 0){
+            if(add_text(f, p + i, run) < 0){
+                return -1;
+            }
+            i += run;
+        }else{
+            if(f->started && end_field(f) < 0){
+                return -1;
+            }
+            i++;
+        }
+    }
+    return 0;
+}
+
+size_t expand_span(const char *p){
+    char open = p[1];
+    char close = open == '(' ? ')' : '}';
+    int depth = 0;
+    if(p[0] != '$' || (open != '(' && open != '{')){
+        return 0;
+    }
+    for(const char *q = p + 1; *q; q++){
+        if(*q == '\\' && q[1]){
+            q++;
+        }else if(*q == '\''){
+            if((q = strchr(q + 1, '\'')) == NULL){
+                return 0;
+            }
+        }else if(*q == '"'){
+            for(q++; *q && *q != '"'; q++){
+                if(*q == '\\' && q[1]){
+                    q++;
+                }
+            }
+            if(*q == '\0'){
+                return 0;
+            }
+        }else if(*q == open){
+            depth++;
+        }else if(*q == close && --depth == 0){
+            return q - p + 1;
+        }
+    }
+    return 0;
+}
+
+static int expand_dollar(const char *p, size_t span, Buf *out);
+
+//length of the parameter name at the start of s[0..len): a variable name, a number, or one special character
+static size_t name_length(const char *s, size_t len){
+    size_t n = 0;
+    if(len == 0){
+        return 0;
+    }
+    if(isdigit((unsigned char)s[0])){
+        while(n < len && isdigit((unsigned char)s[n])){
+            n++;
+        }
+        return n;
+    }
+    if(strchr("?$#!@*-", s[0]) != NULL){
+        return 1;
+    }
+    while(n < len && (isalnum((unsigned char)s[n]) || s[n] == '_')){
+        n++;
+    }
+    return env_valid_name(s, n) ? n : 0;
+}
+
+//value of a parameter, NULL if it is unset; numbers are formatted into tmp
+static const char *param_value(const char *name, char tmp[32]){
+    if(strcmp(name, "?") == 0){
+        snprintf(tmp, 32, "%d", env_status(env_current()));
+        return tmp;
+    }
+    if(strcmp(name, "$") == 0){
+        snprintf(tmp, 32, "%ld", (long)getpid());
+        return tmp;
+    }
+    if(strcmp(name, "#") == 0){
+        return "0";
+    }
+    if(strcmp(name, "0") == 0){
+        return "myshell";
+    }
+    if(strcmp(name, "-") == 0){
+        return "";
+    }
+    if(!env_valid_name(name, strlen(name))){
+        return NULL;                    //positional parameters and $!, a line has none
+    }
+    return env_get(env_current(), name);
+}
+
+/*expands text as it was written inside ${...} or $((...)): quotes are removed, backslash escapes the next character,
+and $ forms are expanded (results are never split here)
+*/
+static int expand_raw(const char *p, size_t n, Buf *out){
+    int in_d = 0;
+    for(size_t i = 0; i < n; ){
+        char c = p[i];
+        if(c == '\'' && !in_d){
+            const char *end = memchr(p + i + 1, '\'', n - i - 1);
+            size_t len = end ? (size_t)(end - p) - i - 1 : n - i - 1;
+            if(buf_add(out, p + i + 1, len) < 0){
+                return -1;
+            }
+            i += len + 2;
+        }else if(c == '"'){
+            in_d = !in_d;
+            i++;
+        }else if(c == '\\' && i + 1 < n){
+            if(buf_add(out, p + i + 1, 1) < 0){
+                return -1;
+            }
+            i += 2;
+        }else if(c == '$' && i + 1 < n && (p[i+1] == '(' || p[i+1] == '{')){
+            size_t span = expand_span(p + i);
+            if(span == 0 || span > n - i){
+                expand_fail("Bad substitution.\n");
+                return -1;
+            }
+            if(expand_dollar(p + i, span, out) < 0){
+                return -1;
+            }
+            i += span;
+        }else if(c == '$' && name_length(p + i + 1, n - i - 1) > 0){
+            char tmp[32];
+            size_t len = name_length(p + i + 1, n - i - 1);
+            char *name = strndup(p + i + 1, len);
+            const char *v = name ? param_value(name, tmp) : NULL;
+            free(name);
+            if(v != NULL && buf_add(out, v, strlen(v)) < 0){
+                return -1;
+            }
+            i += len + 1;
+        }else{
+            if(buf_add(out, &c, 1) < 0){
+                return -1;
+            }
+            i++;
+        }
+    }
+    return 0;
+}
+
+/*${...} with body = what is between the braces: NAME, #NAME (length), and NAME followed by :- - := = :+ + :? ?
+and a word, the colon forms treating an empty value like an unset one
+*/
+static int expand_param(const char *body, size_t len, Buf *out){
+    char tmp[32];
+    int length = len > 1 && body[0] == '#';
+    if(length){
+        body++;
+        len--;
+    }
+    size_t n = name_length(body, len);
+    if(n == 0 || n >= MAX_NAME || (length && n != len)){
+        expand_fail("Bad substitution.\n");
+        return -1;
+    }
+    char name[MAX_NAME];
+    memcpy(name, body, n);
+    name[n] = '\0';
+    const char *value = param_value(name, tmp);
+    if(length){
+        snprintf(tmp, sizeof(tmp), "%zu", value ? strlen(value) : 0);
+        return buf_add(out, tmp, strlen(tmp));
+    }
+    if(n == len){
+        return value ? buf_add(out, value, strlen(value)) : 0;
+    }
+
+    int colon = body[n] == ':';
+    char op = n + colon < len ? body[n + colon] : '\0';
+    if(op == '\0' || strchr("-=+?", op) == NULL){
+        expand_fail("Bad substitution.\n");
+        return -1;
+    }
+    const char *word = body + n + colon + 1;
+    size_t word_len = len - n - colon - 1;
+    int set = value != NULL && !(colon && value[0] == '\0');
+    if(op == '+'){
+        return set ? expand_raw(word, word_len, out) : 0;
+    }
+    if(op == '-' && !set){
+        return expand_raw(word, word_len, out);
+    }
+    if(set){
+        return buf_add(out, value, strlen(value));
+    }
+    Buf w = {0};
+    if(expand_raw(word, word_len, &w) < 0 || buf_add(&w, "", 0) < 0){
+        free(w.s);
+        return -1;
+    }
+    int rc = 0;
+    if(op == '='){
+        if(!env_valid_name(name, n)){
+            expand_fail("%s: cannot assign in this way.\n", name);
+            rc = -1;
+        }else if(env_set(env_current(), name, w.s, 0) < 0 || buf_add(out, w.s, w.len) < 0){
+            rc = -1;
+        }
+    }else{
+        expand_fail("%s: %s\n", name, w.len ? w.s : "parameter not set");
+        rc = -1;
+    }
+    free(w.s);
+    return rc;
+}
+
+/*$(cmd): echo, printf, pwd, true and false write straight into the result (builtin.h), anything else runs through
+the executor with its output captured (or is an error where commands are not allowed); trailing newlines are dropped
+*/
+static int expand_command(const char *body, size_t len, Buf *out){
+    char *text = strndup(body, len);
+    if(text == NULL){
+        perror("strndup");
+        return -1;
+    }
+    if(text[strspn(text, " \t\r\n")] == '\0'){
+        free(text);
+        return 0;
+    }
+    Pipeline *pl = parse_pipeline(text);
+    free(text);
+    if(pl == NULL){
+        return -1;                      //the parser said why
+    }
+    size_t start = out->len;
+    SHELL_STAT_ADD(substitutions, 1);
+    int status = builtin_capture(pl, &out->s, &out->len, &out->cap, EXPAND_SUBST_MAX);
+    if(status >= 0){
+        SHELL_STAT_ADD(substitutions_inproc, 1);
+    }else if(!allow_commands){
+        expand_fail("%s: only echo, printf, pwd, true and false can be substituted here.\n", pl->stages[0].argv[0]);
+        free_pipeline(pl);
+        return -1;
+    }else{
+        char *data;
+        size_t n;
+        status = capture_pipeline(pl, &data, &n, EXPAND_SUBST_MAX);
+        int rc = buf_add(out, data ? data : "", n);
+        free(data);
+        if(rc < 0){
+            free_pipeline(pl);
+            return -1;
+        }
+    }
+    free_pipeline(pl);
+    env_set_status(env_current(), status);
+
+    while(out->len > start && out->s[out->len-1] == '\n'){
+        out->len--;
+    }
+    //a NUL cannot be part of a word, sh drops it as well
+    size_t kept = start;
+    for(size_t i = start; i < out->len; i++){
+        if(out->s[i] != '\0'){
+            out->s[kept++] = out->s[i];
+        }
+    }
+    out->len = kept;
+    if(out->s != NULL){
+        out->s[out->len] = '\0';
+    }
+    return 0;
+}
+
+//arithmetic evaluation state, a recursive descent over the expanded text
+typedef struct {
+    const char *p;
+    int err;                    //1 for a syntax error, 2 for a division by zero
+} Arith;
+
+//binary operators by precedence (higher binds tighter), two-character spellings first
+static const struct {
+    const char *op;
+    int prec;
+} binary_ops[] = {
+    {"||", 1}, {"&&", 2}, {"==", 6}, {"!=", 6}, {"<=", 7}, {">=", 7}, {"<<", 8}, {">>", 8},
+    {"|", 3}, {"^", 4}, {"&", 5}, {"<", 7}, {">", 7}, {"+", 9}, {"-", 9}, {"*", 10}, {"/", 10}, {"%", 10},
+};
+
+static long arith_expr(Arith *a);
+
+static void arith_blanks(Arith *a){
+    while(isspace((unsigned char)*a->p)){
+        a->p++;
+    }
+}
+
+//numbers, variables (their value read as a number, 0 if unset), unary operators and parentheses
+static long arith_primary(Arith *a){
+    arith_blanks(a);
+    char c = *a->p;
+    if(c == '('){
+        a->p++;
+        long v = arith_expr(a);
+        arith_blanks(a);
+        if(*a->p != ')'){
+            a->err = a->err ? a->err : 1;
+            return 0;
+        }
+        a->p++;
+        return v;
+    }
+    if(c == '-' || c == '+' || c == '!' || c == '~'){
+        a->p++;
+        long v = arith_primary(a);
+        return c == '-' ? (long)(0UL - (unsigned long)v) : c == '!' ? !v : c == '~' ? ~v : v;
+    }
+    if(isdigit((unsigned char)c)){
+        char *end;
+        long v = (long)strtoul(a->p, &end, 0);
+        a->p = end;
+        return v;
+    }
+    if(isalpha((unsigned char)c) || c == '_'){
+        size_t n = 0;
+        while(isalnum((unsigned char)a->p[n]) || a->p[n] == '_'){
+            n++;
+        }
+        char name[MAX_NAME];
+        if(n >= MAX_NAME){
+            a->err = 1;
+            return 0;
+        }
+        memcpy(name, a->p, n);
+        name[n] = '\0';
+        a->p += n;
+        const char *v = env_get(env_current(), name);
+        return v ? (long)strtoul(v, NULL, 0) : 0;
+    }
+    a->err = 1;
+    return 0;
+}
+
+static long arith_apply(Arith *a, const char *op, long x, long y){
+    unsigned long ux = x, uy = y;
+    switch(op[0]){
+    case '+': return (long)(ux + uy);
+    case '-': return (long)(ux - uy);
+    case '*': return (long)(ux * uy);
+    case '/':
+    case '%':
+        if(y == 0){
+            a->err = 2;
+            return 0;
+        }
+        if(x == LONG_MIN && y == -1){
+            return op[0] == '/' ? LONG_MIN : 0;
+        }
+        return op[0] == '/' ? x / y : x % y;
+    case '^': return x ^ y;
+    case '=': return x == y;
+    case '!': return x != y;
+    case '|': return op[1] ? (x || y) : (x | y);
+    case '&': return op[1] ? (x && y) : (x & y);
+    case '<':
+        if(op[1] == '<') return (long)(ux << (y & 63));
+        return op[1] ? x <= y : x < y;
+    case '>':
+        if(op[1] == '>') return x >> (y & 63);
+        return op[1] ? x >= y : x > y;
+    }
+    return 0;
+}
+
+//precedence climbing over binary_ops
+static long arith_binary(Arith *a, int min_prec){
+    long lhs = arith_primary(a);
+    while(!a->err){
+        arith_blanks(a);
+        const char *op = NULL;
+        int prec = 0;
+        for(size_t i = 0; i < sizeof(binary_ops) / sizeof(binary_ops[0]); i++){
+            if(strncmp(a->p, binary_ops[i].op, strlen(binary_ops[i].op)) == 0){
+                op = binary_ops[i].op;
+                prec = binary_ops[i].prec;
+                break;
+            }
+        }
+        if(op == NULL || prec < min_prec){
+            break;
+        }
+        a->p += strlen(op);
+        long rhs = arith_binary(a, prec + 1);
+        lhs = arith_apply(a, op, lhs, rhs);
+    }
+    return lhs;
+}
+
+//cond ? a : b above everything else
+static long arith_expr(Arith *a){
+    long cond = arith_binary(a, 1);
+    arith_blanks(a);
+    if(a->err || *a->p != '?'){
+        return cond;
+    }
+    a->p++;
+    long yes = arith_expr(a);
+    arith_blanks(a);
+    if(*a->p != ':'){
+        a->err = a->err ? a->err : 1;
+        return 0;
+    }
+    a->p++;
+    long no = arith_expr(a);
+    return cond ? yes : no;
+}
+
+//$((expr)), body is "(expr)": expanded first, then evaluated in long arithmetic that wraps around
+static int expand_arith(const char *body, size_t len, Buf *out){
+    Buf text = {0};
+    if(expand_raw(body, len, &text) < 0 || buf_add(&text, "", 0) < 0){
+        free(text.s);
+        return -1;
+    }
+    Arith a = {text.s, 0};
+    long v = arith_expr(&a);
+    arith_blanks(&a);
+    if(a.err == 0 && *a.p != '\0'){
+        a.err = 1;
+    }
+    free(text.s);
+    if(a.err){
+        expand_fail("%s", a.err == 2 ? "Division by zero.\n" : "Bad arithmetic expression.\n");
+        return -1;
+    }
+    char num[24];
+    int n = snprintf(num, sizeof(num), "%ld", v);
+    return buf_add(out, num, n);
+}
+
+//one "${...}", "$(...)" or "$((...))" of span bytes at p
+static int expand_dollar(const char *p, size_t span, Buf *out){
+    if(p[1] == '{'){
+        return expand_param(p + 2, span - 3, out);
+    }
+    if(p[2] == '(' && p[span-2] == ')'){
+        return expand_arith(p + 2, span - 3, out);
+    }
+    return expand_command(p + 2, span - 3, out);
+}
+
+int expand_word(const char *word, int split, char ***fields){
+    Fields f;
+    memset(&f, 0, sizeof(f));
+    f.split = split;
+    const char *ifs = env_get(env_current(), "IFS");
+    snprintf(f.ifs, sizeof(f.ifs), "%s", ifs ? ifs : DEFAULT_IFS);
+
+    for(const char *p = word; *p; ){
+        if(*p == QTOK_LITERAL && p[1]){
+            if(add_text(&f, p + 1, 1) < 0){
+                goto fail;
+            }
+            p += 2;
+        }else if(*p == QTOK_EXPAND || *p == QTOK_EXPAND_QUOTED){
+            int quoted = *p == QTOK_EXPAND_QUOTED;
+            size_t span = expand_span(p + 1);
+            Buf value = {0};
+            if(span == 0){
+                expand_fail("Bad substitution.\n");
+                goto fail;
+            }
+            if(expand_dollar(p + 1, span, &value) < 0 || add_result(&f, value.s ? value.s : "", value.len, quoted) < 0){
+                free(value.s);
+                goto fail;
+            }
+            free(value.s);
+            //"$EMPTY" is still an (empty) argument
+            if(quoted){
+                f.started = 1;
+            }
+            p += 1 + span;
+        }else{
+            size_t run = strcspn(p, "\x01\x02\x03");
+            if(add_text(&f, p, run) < 0){
+                goto fail;
+            }
+            p += run;
+        }
+    }
+    if((f.started || !split) && end_field(&f) < 0){
+        goto fail;
+    }
+    *fields = f.v;
+    return f.n;
+
+fail:
+    for(int i = 0; i < f.n; i++){
+        free(f.v[i]);
+    }
+    free(f.v);
+    free(f.cur.s);
+    return -1;
+}
+
+char *expand_literal(const char *word){
+    char *out = malloc(strlen(word) + 1);
+    if(out == NULL){
+        perror("malloc");
+        return NULL;
+    }
+    char *q = out;
+    for(const char *p = word; *p; p++){
+        if(*p == QTOK_LITERAL && p[1]){
+            *q++ = *++p;
+        }else if(*p != QTOK_EXPAND && *p != QTOK_EXPAND_QUOTED){
+            *q++ = *p;
+        }
+    }
+    *q = '\0';
+    return out;
+}
+
+int expand_needed(const char *word){
+    return strpbrk(word, "\x01\x02\x03") != NULL;
+}
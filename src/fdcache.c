@@ -0,0 +1,130 @@
+#define _GNU_SOURCE
+#include "fdcache.h"
+#include "parse.h"
+#include "shellcore.h"
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define REVALIDATE_NS 1000000000L      //how long an entry is trusted before its path is looked up again
+
+typedef struct {
+    char *path;                 //NULL for a free slot
+    int flags;
+    int fd;
+    dev_t dev;                  //the file fd refers to, compared against the path on revalidation
+    ino_t ino;
+    long checked;               //when the path last resolved to that file
+    long used;                  //for least recently used eviction
+} FdEntry;
+
+//one cache for the whole process, the server opens redirections from several worker threads
+static pthread_mutex_t cache_lock = PTHREAD_MUTEX_INITIALIZER;
+static FdEntry *cache;
+static int capacity;
+
+static void drop_entry(FdEntry *e){
+    close(e->fd);
+    free(e->path);
+    memset(e, 0, sizeof(*e));
+}
+
+void set_fd_cache(int entries){
+    pthread_mutex_lock(&cache_lock);
+    for(int i = 0; i < capacity; i++){
+        if(cache[i].path != NULL){
+            drop_entry(&cache[i]);
+        }
+    }
+    free(cache);
+    cache = entries > 0 ? calloc(entries, sizeof(FdEntry)) : NULL;
+    capacity = cache != NULL ? entries : 0;
+    pthread_mutex_unlock(&cache_lock);
+}
+
+/*opens path for the cache, or returns -1 for anything but a regular file: a FIFO would block the caller (the server
+loop), devices and the like are left to the child that needs them
+*/
+static int open_cacheable(const char *path, int flags, struct stat *st){
+    int fd = open(path, flags | O_CLOEXEC | O_NONBLOCK, 0644);
+    if(fd < 0){
+        return -1;
+    }
+    if(fstat(fd, st) < 0 || !S_ISREG(st->st_mode) || fcntl(fd, F_SETFL, flags & ~O_NONBLOCK) < 0){
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+int fdcache_open(const char *path, int flags){
+    if(!(flags & O_APPEND) || (flags & O_TRUNC)){
+        return -1;
+    }
+    pthread_mutex_lock(&cache_lock);
+    if(capacity == 0){
+        pthread_mutex_unlock(&cache_lock);
+        return -1;
+    }
+
+    long now = shellcore_now_ns();
+    FdEntry *e = NULL;
+    FdEntry *victim = &cache[0];
+    for(int i = 0; i < capacity && e == NULL; i++){
+        if(cache[i].path == NULL){
+            if(victim->path != NULL){
+                victim = &cache[i];
+            }
+        }else if(cache[i].flags == flags && strcmp(cache[i].path, path) == 0){
+            e = &cache[i];
+        }else if(victim->path != NULL && cache[i].used < victim->used){
+            victim = &cache[i];
+        }
+    }
+
+    //the path may have been renamed or removed since (log rotation), reopen it then
+    struct stat st;
+    if(e != NULL && now - e->checked >= REVALIDATE_NS){
+        if(stat(path, &st) == 0 && st.st_dev == e->dev && st.st_ino == e->ino){
+            e->checked = now;
+        }else{
+            drop_entry(e);
+            victim = e;
+            e = NULL;
+        }
+    }
+
+    if(e != NULL){
+        SHELL_STAT_ADD(fd_cache_hits, 1);
+    }else{
+        int fd = open_cacheable(path, flags, &st);
+        char *copy = fd >= 0 ? strdup(path) : NULL;
+        if(copy == NULL){
+            if(fd >= 0){
+                close(fd);
+            }
+            pthread_mutex_unlock(&cache_lock);
+            return -1;
+        }
+        if(victim->path != NULL){
+            drop_entry(victim);
+        }
+        e = victim;
+        e->path = copy;
+        e->flags = flags;
+        e->fd = fd;
+        e->dev = st.st_dev;
+        e->ino = st.st_ino;
+        e->checked = now;
+        SHELL_STAT_ADD(fd_cache_opens, 1);
+    }
+    e->used = now;
+
+    //the child moves it onto the target with dup2, keep it clear of every descriptor a redirection can name
+    int fd = fcntl(e->fd, F_DUPFD_CLOEXEC, MAX_REDIR_FD + 1);
+    pthread_mutex_unlock(&cache_lock);
+    return fd;
+}
@@ -0,0 +1,662 @@
+#define _GNU_SOURCE
+#include "filter.h"
+#include "exec.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <ctype.h>
+
+//initial size of the input buffer, it only grows when a single line does not fit
+#define FILTER_IN_SIZE 65536
+//output is collected and written to stdout in blocks of this size
+#define FILTER_OUT_SIZE 65536
+//line count head and tail use without -n
+#define DEFAULT_LINES 10
+//cut fields that can be listed individually, ranges past this only work open-ended (N-)
+#define CUT_MAX_FIELDS 64
+
+//stage kinds
+enum { F_GREP, F_HEAD, F_TAIL, F_WC, F_CUT, F_SORT };
+
+//wc counters
+#define WC_LINES 1
+#define WC_WORDS 2
+#define WC_BYTES 4
+
+//a line held by sort or tail, s is a private copy with a '\n' stored after len bytes
+typedef struct {
+    char *s;
+    size_t len;                 //sort strips the line's own '\n', tail keeps the line as it came
+    double key;                 //numeric sort key
+} Line;
+
+typedef struct {
+    int kind;
+    //grep
+    const char *pattern;
+    size_t patlen;
+    int invert;
+    int matched;
+    //head and tail, tail +N streams from line N instead of buffering
+    long count;
+    long seen;
+    int from_start;
+    //wc
+    int wc_flags;
+    long lines, words, bytes;
+    int in_word;
+    //cut
+    char delim;
+    unsigned long long fields;  //bit i selects field i+1
+    long open_from;             //every field from this one on is selected (0 for none)
+    //scratch space for lines a stage rewrites (cut, or a missing final '\n')
+    char *scratch;
+    size_t scratch_cap;
+    //sort keeps every line, tail a ring of the last count lines
+    Line *held;
+    size_t nheld, held_cap;
+    int reverse, numeric;
+} FilterStage;
+
+typedef struct {
+    FilterStage stages[MAX_PIPES];
+    int n;
+    int stop;                   //no stage needs more input (a head is satisfied or stdout is gone)
+    int broken;                 //stdout was closed, remaining output is dropped
+    char out[FILTER_OUT_SIZE];
+    size_t out_len;
+} FilterChain;
+
+static void stage_push(FilterChain *c, int k, const char *line, size_t len);
+
+//parses a plain non-negative number, returns -1 for anything else
+static long parse_count(const char *s){
+    char *end;
+    if(s == NULL || !isdigit((unsigned char)*s)){
+        return -1;
+    }
+    errno = 0;
+    long v = strtol(s, &end, 10);
+    if(*end != '\0' || errno != 0){
+        return -1;
+    }
+    return v;
+}
+
+//head/tail [-n N | -nN | -N], tail also takes +N
+static int parse_head_tail(FilterStage *st, char *args[]){
+    st->count = DEFAULT_LINES;
+    for(int i = 1; args[i] != NULL; i++){
+        const char *num;
+        if(strcmp(args[i], "-n") == 0){
+            if((num = args[++i]) == NULL){
+                return -1;
+            }
+        }else if(strncmp(args[i], "-n", 2) == 0){
+            num = args[i] + 2;
+        }else if(args[i][0] == '-' && isdigit((unsigned char)args[i][1])){
+            num = args[i] + 1;
+        }else{
+            return -1;                  //file operand or an option we do not implement
+        }
+        st->from_start = 0;
+        if(st->kind == F_TAIL && num[0] == '+'){
+            st->from_start = 1;
+            num++;
+        }
+        if((st->count = parse_count(num)) < 0){
+            return -1;
+        }
+    }
+    return 0;
+}
+
+//grep [-F] [-v] pattern, without -F the pattern must not contain regex metacharacters
+static int parse_grep(FilterStage *st, char *args[]){
+    int fixed = 0;
+    int i;
+    for(i = 1; args[i] != NULL && args[i][0] == '-' && args[i][1] != '\0'; i++){
+        if(strcmp(args[i], "--") == 0){
+            i++;
+            break;
+        }
+        for(const char *o = args[i] + 1; *o; o++){
+            if(*o == 'F'){
+                fixed = 1;
+            }else if(*o == 'v'){
+                st->invert = 1;
+            }else{
+                return -1;
+            }
+        }
+    }
+    //exactly one pattern and no files
+    if(args[i] == NULL || args[i + 1] != NULL){
+        return -1;
+    }
+    if(!fixed && strpbrk(args[i], ".[]*^$\\") != NULL){
+        return -1;
+    }
+    st->pattern = args[i];
+    st->patlen = strlen(args[i]);
+    return 0;
+}
+
+//wc [-l] [-w] [-c], all three when none is given
+static int parse_wc(FilterStage *st, char *args[]){
+    for(int i = 1; args[i] != NULL; i++){
+        if(args[i][0] != '-' || args[i][1] == '\0'){
+            return -1;
+        }
+        for(const char *o = args[i] + 1; *o; o++){
+            if(*o == 'l'){
+                st->wc_flags |= WC_LINES;
+            }else if(*o == 'w'){
+                st->wc_flags |= WC_WORDS;
+            }else if(*o == 'c'){
+                st->wc_flags |= WC_BYTES;
+            }else{
+                return -1;
+            }
+        }
+    }
+    if(st->wc_flags == 0){
+        st->wc_flags = WC_LINES | WC_WORDS | WC_BYTES;
+    }
+    return 0;
+}
+
+//cut field list: comma-separated N, N-M, N- and -M
+static int parse_fields(FilterStage *st, const char *list){
+    const char *p = list;
+    char *end;
+    while(*p){
+        long lo = 1;
+        long hi;
+        int have_num = 0;
+        if(isdigit((unsigned char)*p)){
+            lo = strtol(p, &end, 10);
+            p = end;
+            have_num = 1;
+        }
+        if(*p == '-'){
+            p++;
+            if(isdigit((unsigned char)*p)){
+                hi = strtol(p, &end, 10);
+                p = end;
+                have_num = 1;
+            }else{
+                hi = 0;                 //open-ended
+            }
+        }else{
+            hi = lo;
+        }
+        if(!have_num || lo < 1 || (hi != 0 && hi < lo)){
+            return -1;
+        }
+        if(hi == 0){
+            if(st->open_from == 0 || lo < st->open_from){
+                st->open_from = lo;
+            }
+        }else if(hi > CUT_MAX_FIELDS){
+            return -1;
+        }else{
+            for(long f = lo; f <= hi; f++){
+                st->fields |= 1ULL << (f - 1);
+            }
+        }
+        if(*p == ','){
+            p++;
+        }else if(*p != '\0'){
+            return -1;
+        }
+    }
+    return 0;
+}
+
+//cut -f LIST [-d C]
+static int parse_cut(FilterStage *st, char *args[]){
+    int have_fields = 0;
+    st->delim = '\t';
+    for(int i = 1; args[i] != NULL; i++){
+        const char *a = args[i];
+        if(a[0] != '-' || (a[1] != 'd' && a[1] != 'f')){
+            return -1;
+        }
+        const char *val = a[2] ? a + 2 : args[++i];
+        if(val == NULL){
+            return -1;
+        }
+        if(a[1] == 'd'){
+            if(strlen(val) != 1){
+                return -1;
+            }
+            st->delim = val[0];
+        }else{
+            if(parse_fields(st, val) < 0){
+                return -1;
+            }
+            have_fields = 1;
+        }
+    }
+    return have_fields ? 0 : -1;
+}
+
+//sort only runs in-process when the locale collates bytewise, otherwise the real sort gets the order right
+static int collation_is_bytewise(void){
+    const char *loc = getenv("LC_ALL");
+    if(loc == NULL || *loc == '\0'){
+        loc = getenv("LC_COLLATE");
+    }
+    if(loc == NULL || *loc == '\0'){
+        loc = getenv("LANG");
+    }
+    return loc == NULL || *loc == '\0' || strcmp(loc, "C") == 0 || strcmp(loc, "POSIX") == 0 ||
+           strncmp(loc, "C.", 2) == 0;
+}
+
+//sort [-r] [-n]
+static int parse_sort(FilterStage *st, char *args[]){
+    if(!collation_is_bytewise()){
+        return -1;
+    }
+    for(int i = 1; args[i] != NULL; i++){
+        if(args[i][0] != '-' || args[i][1] == '\0'){
+            return -1;
+        }
+        for(const char *o = args[i] + 1; *o; o++){
+            if(*o == 'r'){
+                st->reverse = 1;
+            }else if(*o == 'n'){
+                st->numeric = 1;
+            }else{
+                return -1;
+            }
+        }
+    }
+    return 0;
+}
+
+//fills in a stage from its argv, returns -1 if it is not a builtin or uses options we do not implement
+static int stage_parse(FilterStage *st, char *args[]){
+    memset(st, 0, sizeof(*st));
+    if(args == NULL || args[0] == NULL){
+        return -1;
+    }
+    if(strcmp(args[0], "grep") == 0){
+        st->kind = F_GREP;
+        return parse_grep(st, args);
+    }
+    if(strcmp(args[0], "head") == 0 || strcmp(args[0], "tail") == 0){
+        st->kind = args[0][0] == 'h' ? F_HEAD : F_TAIL;
+        return parse_head_tail(st, args);
+    }
+    if(strcmp(args[0], "wc") == 0){
+        st->kind = F_WC;
+        return parse_wc(st, args);
+    }
+    if(strcmp(args[0], "cut") == 0){
+        st->kind = F_CUT;
+        return parse_cut(st, args);
+    }
+    if(strcmp(args[0], "sort") == 0){
+        st->kind = F_SORT;
+        return parse_sort(st, args);
+    }
+    return -1;
+}
+
+int filter_is_builtin(char *args[]){
+    FilterStage st;
+    return stage_parse(&st, args) == 0;
+}
+
+//writes len bytes to stdout, a closed stdout stops the chain like SIGPIPE would
+static void write_all(FilterChain *c, const char *data, size_t len){
+    while(len > 0 && !c->broken){
+        ssize_t w = write(STDOUT_FILENO, data, len);
+        if(w < 0){
+            if(errno == EINTR){
+                continue;
+            }
+            c->stop = c->broken = 1;
+            break;
+        }
+        data += w;
+        len -= w;
+    }
+}
+
+static void out_flush(FilterChain *c){
+    write_all(c, c->out, c->out_len);
+    c->out_len = 0;
+}
+
+static void out_write(FilterChain *c, const char *data, size_t len){
+    if(len > sizeof(c->out) - c->out_len){
+        out_flush(c);
+        if(len > sizeof(c->out)){
+            write_all(c, data, len);    //a line larger than the whole buffer goes straight out
+            return;
+        }
+    }
+    memcpy(c->out + c->out_len, data, len);
+    c->out_len += len;
+}
+
+//hands a line to stage k, or to stdout past the last stage
+static void emit(FilterChain *c, int k, const char *line, size_t len){
+    if(k == c->n){
+        out_write(c, line, len);
+    }else{
+        stage_push(c, k, line, len);
+    }
+}
+
+//makes sure the stage's scratch buffer holds need bytes
+static char *stage_scratch(FilterStage *st, size_t need){
+    if(need > st->scratch_cap){
+        size_t cap = st->scratch_cap ? st->scratch_cap : 256;
+        while(cap < need){
+            cap *= 2;
+        }
+        char *p = realloc(st->scratch, cap);
+        if(p == NULL){
+            dprintf(STDERR_FILENO, "filter: out of memory\n");
+            _exit(EXIT_FAILURE);
+        }
+        st->scratch = p;
+        st->scratch_cap = cap;
+    }
+    return st->scratch;
+}
+
+//emits a line that must end in '\n', only an unterminated last line gets copied to add one
+static void emit_terminated(FilterChain *c, int k, const char *line, size_t len){
+    FilterStage *st = &c->stages[k];
+    if(len > 0 && line[len - 1] == '\n'){
+        emit(c, k + 1, line, len);
+        return;
+    }
+    char *buf = stage_scratch(st, len + 1);
+    memcpy(buf, line, len);
+    buf[len] = '\n';
+    emit(c, k + 1, buf, len + 1);
+}
+
+//stores a private '\n'-terminated copy of a line (without its own '\n' in len)
+static void line_store(Line *l, const char *line, size_t len){
+    char *p = realloc(l->s, len + 1);
+    if(p == NULL){
+        dprintf(STDERR_FILENO, "filter: out of memory\n");
+        _exit(EXIT_FAILURE);
+    }
+    memcpy(p, line, len);
+    p[len] = '\n';
+    l->s = p;
+    l->len = len;
+}
+
+//the number sort -n compares: optional blanks, a sign, digits and one decimal point, 0 if there is none
+static double numeric_key(const char *s, size_t len){
+    char num[64];
+    size_t i = 0, k = 0;
+    int dot = 0;
+    while(i < len && (s[i] == ' ' || s[i] == '\t')){
+        i++;
+    }
+    if(i < len && s[i] == '-'){
+        num[k++] = s[i++];
+    }
+    while(i < len && k < sizeof(num) - 1 && (isdigit((unsigned char)s[i]) || (s[i] == '.' && !dot))){
+        dot |= s[i] == '.';
+        num[k++] = s[i++];
+    }
+    num[k] = '\0';
+    return strtod(num, NULL);
+}
+
+//sort order for qsort, qsort has no context argument so the flags are set just before sorting
+static int sort_reverse, sort_numeric;
+
+static int line_compare(const void *a, const void *b){
+    const Line *x = a;
+    const Line *y = b;
+    int r = 0;
+    if(sort_numeric && x->key != y->key){
+        r = x->key < y->key ? -1 : 1;
+    }else{
+        //bytewise, also the last resort for equal numbers like sort does
+        size_t n = x->len < y->len ? x->len : y->len;
+        r = memcmp(x->s, y->s, n);
+        if(r == 0 && x->len != y->len){
+            r = x->len < y->len ? -1 : 1;
+        }
+    }
+    return sort_reverse ? -r : r;
+}
+
+static void stage_push(FilterChain *c, int k, const char *line, size_t len){
+    FilterStage *st = &c->stages[k];
+    size_t body = len > 0 && line[len - 1] == '\n' ? len - 1 : len;
+
+    switch(st->kind){
+    case F_GREP: {
+        int hit = memmem(line, body, st->pattern, st->patlen) != NULL;
+        if(hit != st->invert){
+            st->matched = 1;
+            emit_terminated(c, k, line, len);
+        }
+        break;
+    }
+    case F_HEAD:
+        if(st->seen < st->count){
+            st->seen++;
+            emit(c, k + 1, line, len);
+        }
+        if(st->seen >= st->count){
+            c->stop = 1;                //everything downstream is decided, stop reading input
+        }
+        break;
+    case F_TAIL:
+        st->seen++;
+        if(st->from_start){
+            if(st->seen >= st->count){
+                emit(c, k + 1, line, len);
+            }
+        }else if(st->count > 0){
+            if(st->held == NULL){
+                st->held = calloc(st->count, sizeof(Line));
+                if(st->held == NULL){
+                    dprintf(STDERR_FILENO, "filter: out of memory\n");
+                    _exit(EXIT_FAILURE);
+                }
+            }
+            Line *slot = &st->held[(st->seen - 1) % st->count];
+            line_store(slot, line, len);    //the whole line, tail keeps a missing final '\n' missing
+        }
+        break;
+    case F_WC:
+        st->bytes += len;
+        st->lines += body != len;
+        for(size_t i = 0; i < len; i++){
+            int space = isspace((unsigned char)line[i]);
+            st->words += !space && !st->in_word;
+            st->in_word = !space;
+        }
+        break;
+    case F_CUT: {
+        if(memchr(line, st->delim, body) == NULL){
+            emit_terminated(c, k, line, len);
+            break;
+        }
+        char *out = stage_scratch(st, body + 1);
+        size_t olen = 0;
+        long field = 1;
+        const char *p = line;
+        const char *end = line + body;
+        while(p <= end){
+            const char *d = memchr(p, st->delim, end - p);
+            const char *fend = d ? d : end;
+            int selected = (st->open_from && field >= st->open_from) ||
+                           (field <= CUT_MAX_FIELDS && (st->fields >> (field - 1)) & 1);
+            if(selected){
+                if(olen > 0){
+                    out[olen++] = st->delim;
+                }
+                memcpy(out + olen, p, fend - p);
+                olen += fend - p;
+            }
+            if(d == NULL){
+                break;
+            }
+            p = d + 1;
+            field++;
+        }
+        out[olen++] = '\n';
+        emit(c, k + 1, out, olen);
+        break;
+    }
+    case F_SORT:
+        if(st->nheld == st->held_cap){
+            size_t cap = st->held_cap ? st->held_cap * 2 : 1024;
+            Line *p = realloc(st->held, cap * sizeof(Line));
+            if(p == NULL){
+                dprintf(STDERR_FILENO, "filter: out of memory\n");
+                _exit(EXIT_FAILURE);
+            }
+            st->held = p;
+            st->held_cap = cap;
+        }
+        Line *l = &st->held[st->nheld++];
+        l->s = NULL;
+        line_store(l, line, body);
+        l->key = st->numeric ? numeric_key(line, body) : 0;
+        break;
+    }
+}
+
+//end of input for stage k, stages that buffer emit their result now
+static void stage_finish(FilterChain *c, int k){
+    FilterStage *st = &c->stages[k];
+    char buf[96];
+    int n = 0;
+
+    switch(st->kind){
+    case F_TAIL:
+        if(!st->from_start && st->count > 0){
+            long first = st->seen > st->count ? st->seen - st->count : 0;
+            for(long i = first; i < st->seen; i++){
+                Line *l = &st->held[i % st->count];
+                emit(c, k + 1, l->s, l->len);
+                free(l->s);
+            }
+        }
+        break;
+    case F_WC: {
+        long counts[3] = {st->lines, st->words, st->bytes};
+        int flags[3] = {WC_LINES, WC_WORDS, WC_BYTES};
+        //a single count prints bare, several are padded to 7 columns like wc on a pipe
+        int single = st->wc_flags == WC_LINES || st->wc_flags == WC_WORDS || st->wc_flags == WC_BYTES;
+        for(int i = 0; i < 3; i++){
+            if(st->wc_flags & flags[i]){
+                n += snprintf(buf + n, sizeof(buf) - n, single ? "%ld" : (n ? " %7ld" : "%7ld"), counts[i]);
+            }
+        }
+        buf[n++] = '\n';
+        emit(c, k + 1, buf, n);
+        break;
+    }
+    case F_SORT:
+        sort_reverse = st->reverse;
+        sort_numeric = st->numeric;
+        qsort(st->held, st->nheld, sizeof(Line), line_compare);
+        for(size_t i = 0; i < st->nheld; i++){
+            emit(c, k + 1, st->held[i].s, st->held[i].len + 1);
+            free(st->held[i].s);
+        }
+        break;
+    default:
+        break;
+    }
+    free(st->held);
+    free(st->scratch);
+}
+
+int filter_run(char **argvs[], int n){
+    static FilterChain chain;
+    FilterChain *c = &chain;
+
+    memset(c, 0, sizeof(*c));
+    c->n = n;
+    for(int k = 0; k < n; k++){
+        if(stage_parse(&c->stages[k], argvs[k]) < 0){
+            dprintf(STDERR_FILENO, "filter: unsupported stage %s\n", argvs[k][0]);
+            return EXIT_FAILURE;
+        }
+        if(c->stages[k].kind == F_HEAD && c->stages[k].count == 0){
+            c->stop = 1;
+        }
+    }
+
+    size_t cap = FILTER_IN_SIZE;
+    size_t have = 0;
+    char *buf = malloc(cap);
+    if(buf == NULL){
+        dprintf(STDERR_FILENO, "filter: out of memory\n");
+        return EXIT_FAILURE;
+    }
+
+    while(!c->stop){
+        ssize_t r = read(STDIN_FILENO, buf + have, cap - have);
+        if(r < 0){
+            if(errno == EINTR){
+                continue;
+            }
+            dprintf(STDERR_FILENO, "filter: read failed: %s\n", strerror(errno));
+            break;
+        }
+        if(r == 0){
+            break;
+        }
+        have += r;
+
+        //hand every complete line down the chain straight out of the read buffer
+        char *p = buf;
+        char *end = buf + have;
+        char *nl;
+        while(!c->stop && (nl = memchr(p, '\n', end - p)) != NULL){
+            emit(c, 0, p, nl + 1 - p);
+            p = nl + 1;
+        }
+
+        //keep the partial last line, the buffer only grows when one line fills it
+        have = end - p;
+        memmove(buf, p, have);
+        if(have == cap){
+            char *grown = realloc(buf, cap * 2);
+            if(grown == NULL){
+                dprintf(STDERR_FILENO, "filter: out of memory\n");
+                free(buf);
+                return EXIT_FAILURE;
+            }
+            buf = grown;
+            cap *= 2;
+        }
+    }
+    if(have > 0 && !c->stop){
+        emit(c, 0, buf, have);          //unterminated last line
+    }
+    free(buf);
+
+    for(int k = 0; k < n; k++){
+        stage_finish(c, k);
+    }
+    out_flush(c);
+
+    //grep reports whether it selected anything, the other filters always succeed
+    FilterStage *last = &c->stages[n - 1];
+    return last->kind == F_GREP && !last->matched ? 1 : 0;
+}
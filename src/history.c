@@ -0,0 +1,283 @@
+#define _GNU_SOURCE
+#include "history.h"
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+//entries loaded from the file: the mapping, where each line starts in it and how long it is
+static const char *map;
+static size_t map_len;
+static uint32_t *offsets, *lengths;
+static int nmapped;
+//entries added since, newest last
+static char **added;
+static int nadded, added_cap;
+static int hist_fd = -1;
+//mapped entries ordered by text (then by age), built on the first search
+static int *by_text;
+
+int history_open(const char *path){
+    hist_fd = open(path, O_RDWR | O_CREAT | O_APPEND | O_CLOEXEC, 0600);
+    struct stat st;
+    if(hist_fd < 0 || fstat(hist_fd, &st) < 0){
+        return -1;
+    }
+    //offsets are 32-bit, a file beyond 4 GB is not loaded (new entries are still appended)
+    if(st.st_size == 0 || st.st_size > UINT32_MAX){
+        return 0;
+    }
+    void *p = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, hist_fd, 0);
+    if(p == MAP_FAILED){
+        return -1;
+    }
+    map = p;
+    map_len = st.st_size;
+    madvise(p, map_len, MADV_SEQUENTIAL);
+
+    int cap = 0;
+    for(const char *line = map, *end = map + map_len; line < end; ){
+        const char *nl = memchr(line, '\n', end - line);
+        if(nl == NULL){
+            nl = end;                       //a last line cut short by a crash still counts
+        }
+        if(nl > line){
+            if(nmapped == cap){
+                cap = cap ? cap * 2 : 4096;
+                uint32_t *tmp = realloc(offsets, cap * sizeof(uint32_t));
+                uint32_t *ltmp = tmp ? realloc(lengths, cap * sizeof(uint32_t)) : NULL;
+                offsets = tmp ? tmp : offsets;
+                if(ltmp == NULL){
+                    break;
+                }
+                lengths = ltmp;
+            }
+            offsets[nmapped] = line - map;
+            lengths[nmapped++] = nl - line;
+        }
+        line = nl + 1;
+    }
+    return 0;
+}
+
+int history_count(void){
+    return nmapped + nadded;
+}
+
+const char *history_get(int i, size_t *len){
+    if(i >= nmapped){
+        *len = strlen(added[i - nmapped]);
+        return added[i - nmapped];
+    }
+    *len = lengths[i];
+    return map + offsets[i];
+}
+
+void history_add(const char *line){
+    size_t len = strlen(line);
+    if(len == 0 || strchr(line, '\n') != NULL){
+        return;
+    }
+    if(history_count() > 0){
+        size_t last_len;
+        const char *last = history_get(history_count() - 1, &last_len);
+        if(last_len == len && memcmp(last, line, len) == 0){
+            return;
+        }
+    }
+    if(nadded == added_cap){
+        int cap = added_cap ? added_cap * 2 : 64;
+        char **tmp = realloc(added, cap * sizeof(char *));
+        if(tmp == NULL){
+            return;
+        }
+        added = tmp;
+        added_cap = cap;
+    }
+    if((added[nadded] = strdup(line)) == NULL){
+        return;
+    }
+    nadded++;
+    if(hist_fd >= 0){
+        //one write per entry so shells sharing the file never split each other's lines
+        struct iovec iov[2] = {{(void *)line, len}, {"\n", 1}};
+        if(writev(hist_fd, iov, 2) < 0){
+            close(hist_fd);
+            hist_fd = -1;
+        }
+    }
+}
+
+//orders mapped entries by text, equal ones oldest first
+static int compare_entries(const void *a, const void *b){
+    int i = *(const int *)a, j = *(const int *)b;
+    size_t li, lj;
+    const char *ti = history_get(i, &li);
+    const char *tj = history_get(j, &lj);
+    int cmp = memcmp(ti, tj, li < lj ? li : lj);
+    if(cmp == 0){
+        cmp = li < lj ? -1 : li > lj ? 1 : i - j;
+    }
+    return cmp;
+}
+
+typedef struct {
+    uint64_t key;               //8 bytes of the entry, big-endian so integer order is text order
+    uint32_t index;
+} SortKey;
+
+//runs shorter than this are sorted by comparing text
+#define RADIX_MIN_RUN 64
+
+//sorts n keys of entries that agree on their first depth bytes, by the 8 bytes after that (stable LSD radix sort)
+static void radix_pass(SortKey *keys, SortKey *tmp, int n, size_t depth){
+    for(int i = 0; i < n; i++){
+        uint32_t e = keys[i].index;
+        const char *text = map + offsets[e] + depth;
+        size_t left = lengths[e] > depth ? lengths[e] - depth : 0;
+        uint64_t key = 0;
+        for(size_t b = 0; b < 8; b++){
+            key = key << 8 | (b < left ? (unsigned char)text[b] : 0);
+        }
+        keys[i].key = key;
+    }
+    //all eight byte counts in one read of the keys
+    static int count[8][257];
+    memset(count, 0, sizeof(count));
+    for(int i = 0; i < n; i++){
+        for(int p = 0; p < 8; p++){
+            count[p][(keys[i].key >> (p * 8) & 0xff) + 1]++;
+        }
+    }
+    SortKey *src = keys, *dst = tmp;
+    for(int p = 0; p < 8; p++){
+        int *c = count[p];
+        if(c[(src[0].key >> (p * 8) & 0xff) + 1] == n){
+            continue;                       //every entry has the same byte here
+        }
+        for(int b = 0; b < 256; b++){
+            c[b + 1] += c[b];
+        }
+        for(int i = 0; i < n; i++){
+            dst[c[src[i].key >> (p * 8) & 0xff]++] = src[i];
+        }
+        SortKey *swap = src;
+        src = dst;
+        dst = swap;
+    }
+    if(src != keys){
+        memcpy(keys, src, n * sizeof(SortKey));
+    }
+}
+
+//sorts entries that agree on their first depth bytes: radix on the next 8, then each run sharing those too one level down
+static void sort_keys(SortKey *keys, SortKey *tmp, int n, size_t depth){
+    if(n < RADIX_MIN_RUN){
+        int idx[RADIX_MIN_RUN];
+        for(int i = 0; i < n; i++){
+            idx[i] = keys[i].index;
+        }
+        qsort(idx, n, sizeof(int), compare_entries);
+        for(int i = 0; i < n; i++){
+            keys[i].index = idx[i];
+        }
+        return;
+    }
+    radix_pass(keys, tmp, n, depth);
+    for(int start = 0, end; start < n; start = end){
+        for(end = start + 1; end < n && keys[end].key == keys[start].key; end++){
+        }
+        //a key ending in a zero byte is a whole entry (there are no NULs in lines), equal ones are already oldest first
+        if(end - start > 1 && (keys[start].key & 0xff) != 0){
+            sort_keys(keys + start, tmp, end - start, depth + 8);
+        }
+    }
+}
+
+/*builds by_text with a most-significant-first radix sort, 8 bytes per level: a million entries index in well under
+the time a qsort comparing whole lines takes
+*/
+static void build_index(void){
+    SortKey *keys = malloc(nmapped * sizeof(SortKey));
+    SortKey *tmp = malloc(nmapped * sizeof(SortKey));
+    by_text = malloc(nmapped * sizeof(int));
+    if(keys == NULL || tmp == NULL || by_text == NULL){
+        free(by_text);
+        by_text = NULL;
+    }else{
+        for(int i = 0; i < nmapped; i++){
+            keys[i].index = i;
+        }
+        sort_keys(keys, tmp, nmapped, 0);
+        for(int i = 0; i < nmapped; i++){
+            by_text[i] = keys[i].index;
+        }
+    }
+    free(keys);
+    free(tmp);
+}
+
+//first position in by_text whose entry is not below query (entries starting with query sort at or after it)
+static int lower_bound(const char *query, size_t qlen){
+    int lo = 0, hi = nmapped;
+    while(lo < hi){
+        int mid = (lo + hi) / 2;
+        size_t len;
+        const char *text = history_get(by_text[mid], &len);
+        int cmp = memcmp(text, query, len < qlen ? len : qlen);
+        if(cmp < 0 || (cmp == 0 && len < qlen)){
+            lo = mid + 1;
+        }else{
+            hi = mid;
+        }
+    }
+    return lo;
+}
+
+static int starts_with(int i, const char *query, size_t qlen){
+    size_t len;
+    const char *text = history_get(i, &len);
+    return len >= qlen && memcmp(text, query, qlen) == 0;
+}
+
+int history_search(const char *query, int before){
+    size_t qlen = strlen(query);
+    if(before > history_count()){
+        before = history_count();
+    }
+    //entries of this session are the newest, a few of them are simply scanned
+    for(int i = before - 1; i >= nmapped; i--){
+        if(starts_with(i, query, qlen)){
+            return i;
+        }
+    }
+
+    int best = -1;
+    if(nmapped > 0 && by_text == NULL){
+        build_index();
+    }
+    if(by_text != NULL){
+        for(int k = lower_bound(query, qlen); k < nmapped && starts_with(by_text[k], query, qlen); k++){
+            if(by_text[k] < before && by_text[k] > best){
+                best = by_text[k];
+            }
+        }
+    }
+    if(best >= 0){
+        return best;
+    }
+
+    //no entry starts with it, look for it anywhere in a line
+    for(int i = before - 1; i >= 0; i--){
+        size_t len;
+        const char *text = history_get(i, &len);
+        if(memmem(text, len, query, qlen) != NULL){
+            return i;
+        }
+    }
+    return -1;
+}
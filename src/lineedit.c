@@ -0,0 +1,502 @@
+#define _GNU_SOURCE
+#include "lineedit.h"
+#include "history.h"
+#include "complete.h"
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <termios.h>
+#include <unistd.h>
+
+#define KEY_CTRL(c) ((c) & 0x1f)
+#define KEY_BACKSPACE 127
+#define KEY_ESC 27
+//escape sequences are decoded into codes above the byte range
+enum { KEY_UP = 256, KEY_DOWN, KEY_LEFT, KEY_RIGHT, KEY_HOME, KEY_END, KEY_DELETE };
+
+typedef struct {
+    char *buf;
+    size_t len, cap, pos;
+    const char *prompt;
+    int cols;
+    int hist;           //history entry shown, history_count() while on the line being typed
+    char *draft;        //the line being typed, kept while browsing history
+} Line;
+
+static LeCompleter completer;
+static struct termios saved_termios;
+static int raw_active;
+
+void lineedit_set_completer(LeCompleter fn){
+    completer = fn;
+}
+
+static void write_all(const char *s, size_t n){
+    while(n > 0){
+        ssize_t w = write(STDOUT_FILENO, s, n);
+        if(w < 0 && errno == EINTR){
+            continue;
+        }
+        if(w <= 0){
+            return;
+        }
+        s += w;
+        n -= w;
+    }
+}
+
+static void raw_off(void){
+    if(raw_active){
+        tcsetattr(STDIN_FILENO, TCSAFLUSH, &saved_termios);
+        raw_active = 0;
+    }
+}
+
+static int raw_on(void){
+    static int registered;
+    if(tcgetattr(STDIN_FILENO, &saved_termios) < 0){
+        return -1;
+    }
+    if(!registered){
+        atexit(raw_off);
+        registered = 1;
+    }
+    struct termios raw = saved_termios;
+    raw.c_iflag &= ~(BRKINT | ICRNL | INPCK | ISTRIP | IXON);
+    raw.c_oflag &= ~OPOST;
+    raw.c_cflag |= CS8;
+    raw.c_lflag &= ~(ECHO | ICANON | IEXTEN | ISIG);
+    raw.c_cc[VMIN] = 1;
+    raw.c_cc[VTIME] = 0;
+    if(tcsetattr(STDIN_FILENO, TCSAFLUSH, &raw) < 0){
+        return -1;
+    }
+    raw_active = 1;
+    return 0;
+}
+
+//next byte of input, -1 at end of input
+static int read_byte(void){
+    unsigned char c;
+    ssize_t n;
+    while((n = read(STDIN_FILENO, &c, 1)) < 0 && errno == EINTR){
+    }
+    return n == 1 ? c : -1;
+}
+
+//next key, with the usual VT100/xterm sequences for arrows, Home, End and Delete decoded
+static int read_key(void){
+    int c = read_byte();
+    if(c != KEY_ESC){
+        return c;
+    }
+    int a = read_byte();
+    int b = read_byte();
+    if(a == 'O'){
+        return b == 'H' ? KEY_HOME : b == 'F' ? KEY_END : KEY_ESC;
+    }
+    if(a != '['){
+        return KEY_ESC;
+    }
+    switch(b){
+    case 'A': return KEY_UP;
+    case 'B': return KEY_DOWN;
+    case 'C': return KEY_RIGHT;
+    case 'D': return KEY_LEFT;
+    case 'H': return KEY_HOME;
+    case 'F': return KEY_END;
+    }
+    if(b >= '0' && b <= '9' && read_byte() == '~'){
+        switch(b){
+        case '1': case '7': return KEY_HOME;
+        case '4': case '8': return KEY_END;
+        case '3': return KEY_DELETE;
+        }
+    }
+    return KEY_ESC;
+}
+
+static int reserve(Line *l, size_t need){
+    if(need <= l->cap){
+        return 0;
+    }
+    size_t cap = l->cap * 2 > need ? l->cap * 2 : need;
+    char *tmp = realloc(l->buf, cap);
+    if(tmp == NULL){
+        return -1;
+    }
+    l->buf = tmp;
+    l->cap = cap;
+    return 0;
+}
+
+static void set_line(Line *l, const char *text, size_t n){
+    if(reserve(l, n + 1) < 0){
+        return;
+    }
+    memcpy(l->buf, text, n);
+    l->len = l->pos = n;
+    l->buf[n] = '\0';
+}
+
+//replaces buf[from..to) with n bytes of text, the cursor ends up after them
+static void splice(Line *l, size_t from, size_t to, const char *text, size_t n){
+    if(reserve(l, l->len - (to - from) + n + 1) < 0){
+        return;
+    }
+    memmove(l->buf + from + n, l->buf + to, l->len - to + 1);
+    memcpy(l->buf + from, text, n);
+    l->len = l->len - (to - from) + n;
+    l->pos = from + n;
+}
+
+/*redraws the line in one write: the prompt and the part of the line around the cursor that fits the terminal width
+(long lines scroll horizontally instead of wrapping, so the redraw never has to track rows)
+*/
+static void refresh_with(Line *l, const char *prompt, const char *text, size_t len, size_t pos){
+    size_t plen = strlen(prompt);
+    size_t width = l->cols > (int)plen + 1 ? l->cols - plen - 1 : 1;
+    size_t start = pos >= width ? pos - width + 1 : 0;
+    size_t shown = len - start < width ? len - start : width;
+    char *out = NULL;
+    size_t out_len = 0;
+    FILE *f = open_memstream(&out, &out_len);
+    if(f == NULL){
+        return;
+    }
+    fprintf(f, "\r%s%.*s\x1b[0K\r", prompt, (int)shown, text + start);
+    if(plen + pos - start > 0){
+        fprintf(f, "\x1b[%zuC", plen + pos - start);
+    }
+    fclose(f);
+    write_all(out, out_len);
+    free(out);
+}
+
+static void refresh(Line *l){
+    refresh_with(l, l->prompt, l->buf, l->len, l->pos);
+}
+
+//shows history entry i, or the draft for history_count()
+static void show_history(Line *l, int i){
+    if(l->hist == history_count()){
+        free(l->draft);
+        l->draft = strdup(l->buf);
+    }
+    l->hist = i;
+    if(i == history_count()){
+        set_line(l, l->draft ? l->draft : "", l->draft ? strlen(l->draft) : 0);
+    }else{
+        size_t n;
+        const char *text = history_get(i, &n);
+        set_line(l, text, n);
+    }
+    refresh(l);
+}
+
+/*Ctrl-R: searches history as the query is typed, Ctrl-R again goes to older matches
+returns the key that ended the search with the match in the line (Enter runs it, other keys edit it), or 0 when
+Ctrl-C / Ctrl-G cancelled it and the line is back as it was
+*/
+static int reverse_search(Line *l){
+    char query[256] = "";
+    size_t qlen = 0;
+    int match = -1;
+    char *orig = strdup(l->buf);
+    size_t orig_pos = l->pos;
+    int key;
+
+    for(;;){
+        char prompt[300];
+        snprintf(prompt, sizeof(prompt), "(%sreverse-i-search)`%s': ", match < 0 && qlen > 0 ? "failed " : "", query);
+        size_t n = 0;
+        const char *text = match >= 0 ? history_get(match, &n) : "";
+        const char *at = match >= 0 && qlen > 0 ? memmem(text, n, query, qlen) : NULL;
+        refresh_with(l, prompt, text, n, at ? (size_t)(at - text) : 0);
+
+        key = read_key();
+        if(key == KEY_CTRL('r')){
+            int older = history_search(query, match >= 0 ? match : history_count());
+            if(older >= 0){
+                match = older;
+            }
+        }else if(key == KEY_BACKSPACE || key == KEY_CTRL('h')){
+            if(qlen > 0){
+                query[--qlen] = '\0';
+                match = qlen > 0 ? history_search(query, history_count()) : -1;
+            }
+        }else if(key >= 32 && key < KEY_BACKSPACE && qlen + 1 < sizeof(query)){
+            query[qlen++] = key;
+            query[qlen] = '\0';
+            //the current match stays if it still matches
+            match = history_search(query, match >= 0 ? match + 1 : history_count());
+        }else{
+            break;
+        }
+    }
+
+    if(key == KEY_CTRL('c') || key == KEY_CTRL('g') || key < 0){
+        set_line(l, orig ? orig : "", orig ? strlen(orig) : 0);
+        l->pos = orig_pos;
+        key = key < 0 ? key : 0;
+    }else if(match >= 0){
+        size_t n;
+        const char *text = history_get(match, &n);
+        set_line(l, text, n);
+        l->hist = match;
+    }
+    free(orig);
+    refresh(l);
+    return key;
+}
+
+static void free_candidates(char **c){
+    for(int i = 0; c && c[i]; i++){
+        free(c[i]);
+    }
+    free(c);
+}
+
+//prints the candidates in columns below the line (and how many were left out), the line is redrawn after them
+static void list_candidates(Line *l, char **c, int more){
+    size_t widest = 0;
+    int n = 0;
+    for(; c[n]; n++){
+        size_t w = strlen(c[n]);
+        widest = w > widest ? w : widest;
+    }
+    int per_row = l->cols / (int)(widest + 2);
+    per_row = per_row > 0 ? per_row : 1;
+    char *out = NULL;
+    size_t out_len = 0;
+    FILE *f = open_memstream(&out, &out_len);
+    if(f == NULL){
+        return;
+    }
+    fputs("\r\n", f);
+    for(int i = 0; i < n; i++){
+        fprintf(f, "%-*s", (int)(widest + 2), c[i]);
+        if((i + 1) % per_row == 0 || i + 1 == n){
+            fputs("\r\n", f);
+        }
+    }
+    if(more > 0){
+        fprintf(f, "(%d more)\r\n", more);
+    }
+    fclose(f);
+    write_all(out, out_len);
+    free(out);
+}
+
+/*Tab: a single candidate replaces the word (followed by a space unless it is a directory), several extend the word
+to their common prefix, and a second Tab in a row lists them
+*/
+static void complete(Line *l, int listing){
+    size_t start = complete_word_start(l->buf, (int)l->pos);
+    char *common = NULL;
+    int more = 0;
+    char *head = strndup(l->buf, l->pos);
+    char **c = head ? completer(head, (int)start, &common, &more) : NULL;
+    free(head);
+    if(c == NULL || c[0] == NULL){
+        write_all("\a", 1);
+    }else if(c[1] == NULL && more == 0){
+        size_t n = strlen(c[0]);
+        splice(l, start, l->pos, c[0], n);
+        if(n > 0 && c[0][n - 1] != '/'){
+            splice(l, l->pos, l->pos, " ", 1);
+        }
+    }else{
+        size_t shared = strlen(c[0]);
+        for(int i = 1; c[i]; i++){
+            size_t k = 0;
+            while(k < shared && c[i][k] == c[0][k]){
+                k++;
+            }
+            shared = k;
+        }
+        if(common != NULL && strlen(common) < shared){
+            shared = strlen(common);
+        }
+        if(shared > l->pos - start){
+            splice(l, start, l->pos, c[0], shared);
+        }else if(listing){
+            list_candidates(l, c, more);
+        }else{
+            write_all("\a", 1);
+        }
+    }
+    free(common);
+    free_candidates(c);
+    refresh(l);
+}
+
+//deletes the word before the cursor along with the blanks after it
+static void delete_word(Line *l){
+    size_t from = l->pos;
+    while(from > 0 && l->buf[from - 1] == ' '){
+        from--;
+    }
+    while(from > 0 && l->buf[from - 1] != ' '){
+        from--;
+    }
+    splice(l, from, l->pos, "", 0);
+}
+
+static char *edit(const char *prompt){
+    Line l = {.prompt = prompt, .cols = 80, .hist = history_count()};
+    struct winsize ws;
+    if(ioctl(STDOUT_FILENO, TIOCGWINSZ, &ws) == 0 && ws.ws_col > 0){
+        l.cols = ws.ws_col;
+    }
+    if(reserve(&l, 128) < 0){
+        return NULL;
+    }
+    l.buf[0] = '\0';
+    refresh(&l);
+
+    int last = 0;
+    for(;;){
+        int key = read_key();
+        if(key == KEY_CTRL('r')){
+            key = reverse_search(&l);
+            if(key == 0 || key == KEY_ESC){
+                last = key;
+                continue;
+            }
+        }
+        switch(key){
+        case '\r':
+        case '\n':
+            write_all("\r\n", 2);
+            free(l.draft);
+            return l.buf;
+        case -1:
+        case KEY_CTRL('d'):
+            //end of input (or Ctrl-D) on an empty line ends the shell, Ctrl-D elsewhere deletes like Delete
+            if(l.len == 0 || key == -1){
+                write_all("\r\n", 2);
+                free(l.draft);
+                if(l.len == 0){
+                    free(l.buf);
+                    return NULL;
+                }
+                return l.buf;
+            }
+            if(l.pos < l.len){
+                splice(&l, l.pos, l.pos + 1, "", 0);
+            }
+            break;
+        case KEY_DELETE:
+            if(l.pos < l.len){
+                splice(&l, l.pos, l.pos + 1, "", 0);
+            }
+            break;
+        case KEY_CTRL('c'):
+            write_all("^C\r\n", 4);
+            l.len = 0;
+            l.buf[0] = '\0';
+            free(l.draft);
+            return l.buf;
+        case KEY_BACKSPACE:
+        case KEY_CTRL('h'):
+            if(l.pos > 0){
+                splice(&l, l.pos - 1, l.pos, "", 0);
+            }
+            break;
+        case '\t':
+            if(completer != NULL){
+                complete(&l, last == '\t');
+            }
+            break;
+        case KEY_CTRL('a'):
+        case KEY_HOME:
+            l.pos = 0;
+            break;
+        case KEY_CTRL('e'):
+        case KEY_END:
+            l.pos = l.len;
+            break;
+        case KEY_CTRL('b'):
+        case KEY_LEFT:
+            if(l.pos > 0){
+                l.pos--;
+            }
+            break;
+        case KEY_CTRL('f'):
+        case KEY_RIGHT:
+            if(l.pos < l.len){
+                l.pos++;
+            }
+            break;
+        case KEY_CTRL('k'):
+            l.len = l.pos;
+            l.buf[l.len] = '\0';
+            break;
+        case KEY_CTRL('u'):
+            splice(&l, 0, l.pos, "", 0);
+            break;
+        case KEY_CTRL('w'):
+            delete_word(&l);
+            break;
+        case KEY_CTRL('l'):
+            write_all("\x1b[H\x1b[2J", 7);
+            break;
+        case KEY_CTRL('p'):
+        case KEY_UP:
+            if(l.hist > 0){
+                show_history(&l, l.hist - 1);
+            }
+            break;
+        case KEY_CTRL('n'):
+        case KEY_DOWN:
+            if(l.hist < history_count()){
+                show_history(&l, l.hist + 1);
+            }
+            break;
+        default:
+            if(key >= 32 && key < KEY_BACKSPACE){
+                char c = key;
+                splice(&l, l.pos, l.pos, &c, 1);
+            }else if(key >= 128 && key < 256){
+                char c = key;               //UTF-8 bytes go in as they come
+                splice(&l, l.pos, l.pos, &c, 1);
+            }
+            break;
+        }
+        last = key;
+        refresh(&l);
+    }
+}
+
+//a plain read for input that is not a terminal, the prompt is written with the rest of the output
+static char *read_plain(const char *prompt){
+    printf("%s", prompt);
+    char *line = NULL;
+    size_t cap = 0;
+    ssize_t n = getline(&line, &cap, stdin);
+    if(n < 0){
+        free(line);
+        return NULL;
+    }
+    if(n > 0 && line[n-1] == '\n'){
+        line[n-1] = '\0';
+    }
+    return line;
+}
+
+char *lineedit_read(const char *prompt){
+    const char *term = getenv("TERM");
+    if(!isatty(STDIN_FILENO) || !isatty(STDOUT_FILENO) || (term && strcmp(term, "dumb") == 0)){
+        return read_plain(prompt);
+    }
+    fflush(stdout);
+    if(raw_on() < 0){
+        return read_plain(prompt);
+    }
+    char *line = edit(prompt);
+    raw_off();
+    return line;
+}
@@ -0,0 +1,188 @@
+#include "lz.h"
+#include <stdint.h>
+#include <string.h>
+
+//hash table size for match finding (4096 entries, fits comfortably on the stack)
+#define LZ_HASH_BITS 12
+//shortest match the format can encode
+#define MINMATCH 4
+//the format requires the last 5 bytes to be literals and the last match to start 12 bytes before the end
+#define LASTLITERALS 5
+#define MFLIMIT 12
+
+static uint32_t read32(const uint8_t *p){
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static uint32_t lz_hash(uint32_t v){
+    return (v * 2654435761u) >> (32 - LZ_HASH_BITS);
+}
+
+//writes the 15+ continuation bytes of a literal or match length, returns the advanced output pointer or NULL if it would overflow
+static uint8_t *put_length(uint8_t *op, uint8_t *oend, int len){
+    for(len -= 15; len >= 255; len -= 255){
+        if(op >= oend){
+            return NULL;
+        }
+        *op++ = 255;
+    }
+    if(op >= oend){
+        return NULL;
+    }
+    *op++ = (uint8_t)len;
+    return op;
+}
+
+//emits one sequence (literals, then an optional match), returns the advanced output pointer or NULL on overflow
+static uint8_t *put_sequence(uint8_t *op, uint8_t *oend, const uint8_t *lit, int litlen, int offset, int mlen){
+    if(op >= oend){
+        return NULL;
+    }
+    uint8_t *token = op++;
+    *token = (uint8_t)((litlen >= 15 ? 15 : litlen) << 4);
+    if(litlen >= 15 && (op = put_length(op, oend, litlen)) == NULL){
+        return NULL;
+    }
+    if(litlen > oend - op){
+        return NULL;
+    }
+    memcpy(op, lit, litlen);
+    op += litlen;
+
+    if(offset == 0){
+        return op;                  //final literal-only sequence
+    }
+    if(oend - op < 2){
+        return NULL;
+    }
+    *op++ = (uint8_t)(offset & 0xff);
+    *op++ = (uint8_t)(offset >> 8);
+    mlen -= MINMATCH;
+    *token |= (uint8_t)(mlen >= 15 ? 15 : mlen);
+    if(mlen >= 15 && (op = put_length(op, oend, mlen)) == NULL){
+        return NULL;
+    }
+    return op;
+}
+
+/* Greedy single-pass compressor: hash the next 4 bytes, take the candidate if it really matches, extend it.
+   The scan step grows with the distance since the last match, so incompressible input is skipped over quickly.
+*/
+int lz_compress(const void *src, int n, void *dst, int cap){
+    const uint8_t *base = src;
+    const uint8_t *ip = base;
+    const uint8_t *anchor = base;
+    const uint8_t *iend = base + n;
+    uint8_t *op = dst;
+    uint8_t *oend = op + cap;
+    uint16_t table[1 << LZ_HASH_BITS];
+
+    if(n < 0 || n > LZ_MAX_BLOCK){
+        return 0;
+    }
+
+    if(n >= MFLIMIT + 1){
+        const uint8_t *mflimit = iend - MFLIMIT;
+        const uint8_t *matchlimit = iend - LASTLITERALS;
+        memset(table, 0, sizeof(table));
+
+        while(ip < mflimit){
+            uint32_t seq = read32(ip);
+            uint32_t h = lz_hash(seq);
+            const uint8_t *ref = base + table[h];
+            table[h] = (uint16_t)(ip - base);
+
+            if(ref >= ip || read32(ref) != seq){
+                ip += 1 + ((ip - anchor) >> 6);
+                continue;
+            }
+
+            //extend the match forward, stopping where the trailing literals must begin
+            const uint8_t *m = ip + MINMATCH;
+            const uint8_t *r = ref + MINMATCH;
+            while(m < matchlimit && *m == *r){
+                m++;
+                r++;
+            }
+
+            op = put_sequence(op, oend, anchor, (int)(ip - anchor), (int)(ip - ref), (int)(m - ip));
+            if(op == NULL){
+                return 0;
+            }
+            ip = anchor = m;
+        }
+    }
+
+    op = put_sequence(op, oend, anchor, (int)(iend - anchor), 0, 0);
+    if(op == NULL){
+        return 0;
+    }
+    return (int)(op - (uint8_t *)dst);
+}
+
+//decompresses an LZ4 block, every length and offset is bounds-checked since the input comes off the network
+int lz_decompress(const void *src, int n, void *dst, int cap){
+    const uint8_t *ip = src;
+    const uint8_t *iend = ip + n;
+    uint8_t *op = dst;
+    uint8_t *oend = op + cap;
+
+    while(ip < iend){
+        uint8_t token = *ip++;
+        int b;
+
+        //literals
+        int litlen = token >> 4;
+        if(litlen == 15){
+            do{
+                if(ip >= iend){
+                    return -1;
+                }
+                b = *ip++;
+                litlen += b;
+            }while(b == 255);
+        }
+        if(litlen > iend - ip || litlen > oend - op){
+            return -1;
+        }
+        memcpy(op, ip, litlen);
+        op += litlen;
+        ip += litlen;
+        if(ip == iend){
+            break;                  //the last sequence has no match part
+        }
+
+        //match
+        if(iend - ip < 2){
+            return -1;
+        }
+        int offset = ip[0] | (ip[1] << 8);
+        ip += 2;
+        if(offset == 0 || offset > op - (uint8_t *)dst){
+            return -1;
+        }
+        int mlen = token & 15;
+        if(mlen == 15){
+            do{
+                if(ip >= iend){
+                    return -1;
+                }
+                b = *ip++;
+                mlen += b;
+            }while(b == 255);
+        }
+        mlen += MINMATCH;
+        if(mlen > oend - op){
+            return -1;
+        }
+        //byte copy, matches may overlap their own output
+        const uint8_t *match = op - offset;
+        for(int i = 0; i < mlen; i++){
+            op[i] = match[i];
+        }
+        op += mlen;
+    }
+    return (int)(op - (uint8_t *)dst);
+}
@@ -1,70 +1,149 @@
 #include "parse.h"
 #include "exec.h"
+#include "fdcache.h"
+#include "lineedit.h"
+#include "history.h"
+#include "complete.h"
+#include "env.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
 
-//maximum length for command input buffer
-#define MAX_CMD_LENGTH 1024 
-//maximum number of arguments a command can have
-#define MAX_ARGS 64         
+//most completion candidates offered for one Tab
+#define MAX_CANDIDATES 256
+
+/*reads the here-document bodies a command line announces, line by line until every delimiter has been seen (or EOF)
+returns the command line followed by the body lines, each after a '\n', as parse_pipeline() expects it
+*/
+static char *read_heredocs(const char *cmd){
+    char *text = NULL;
+    size_t len = 0;
+    FILE *f = open_memstream(&text, &len);
+    if(!f){
+        perror("open_memstream");
+        return NULL;
+    }
+    fputs(cmd, f);
+    fflush(f);
+
+    char *line = NULL;
+    size_t cap = 0;
+    while(heredoc_pending(text) > 0){
+        //continuation prompt, like sh's PS2
+        printf("> ");
+        ssize_t n = getline(&line, &cap, stdin);
+        if(n < 0){
+            break;                      //the parser reports the missing delimiter
+        }
+        if(n > 0 && line[n-1] == '\n'){
+            line[n-1] = '\0';
+        }
+        fprintf(f, "\n%s", line);
+        fflush(f);
+    }
+    free(line);
+    fclose(f);
+    return text;
+}
+
+/*Tab completion for the line editor: a word in command position (at the start of the line or after a '|') without a
+'/' is completed from the PATH table, anything else from the file system
+*/
+static char **complete_word(const char *line, int word_start, char **common, int *more){
+    char **out = calloc(MAX_CANDIDATES + 1, sizeof(char *));
+    if(!out){
+        return NULL;
+    }
+    int total, n;
+    if(complete_in_command_position(line, word_start)){
+        n = complete_command(line + word_start, out, MAX_CANDIDATES, &total, common);
+    }else{
+        n = complete_file(line + word_start, out, MAX_CANDIDATES, &total, common);
+    }
+    *more = total - n;
+    return out;
+}
 
 /*Main function
 This function implements the main shell loop that reads commands and executes them
 It handles both single commands and pipelines, with proper error handling
 */
 int main() {
-    //buffer to store user input command
-    char cmd[MAX_CMD_LENGTH];
-    //array to store parsed command arguments
-    char *args[MAX_ARGS];
-    //point er to store redirection filenames
-    char *inputFile, *outputFile, *errorFile;
+    //line read from the user (or the script)
+    char *cmd = NULL;
+    //status of the last command line, returned on exit like sh does (2 for a line that does not parse)
+    int status = 0;
+
+    //pipe capacity for pipelines, e.g. MYSHELL_PIPE_SIZE=1048576 for high-throughput pipelines
+    const char *pipe_size = getenv("MYSHELL_PIPE_SIZE");
+    if(pipe_size != NULL){
+        set_pipe_size(atoi(pipe_size));
+    }
+    //deadline for every command line in seconds, e.g. MYSHELL_TIMEOUT=30 for unattended scripts
+    const char *timeout = getenv("MYSHELL_TIMEOUT");
+    if(timeout != NULL){
+        set_command_timeout((int)(atof(timeout) * 1000));
+    }
+    //descriptor cache for repeated appends, e.g. MYSHELL_FD_CACHE=8 for scripts that keep doing >> app.log
+    const char *fd_cache = getenv("MYSHELL_FD_CACHE");
+    if(fd_cache != NULL){
+        set_fd_cache(atoi(fd_cache));
+    }
+    
+    //history and completion only for someone typing, e.g. MYSHELL_HISTFILE=/tmp/h to keep a separate history
+    int interactive = isatty(STDIN_FILENO);
+    if(interactive){
+        const char *histfile = getenv("MYSHELL_HISTFILE");
+        const char *home = getenv("HOME");
+        char path[4096];
+        if(histfile == NULL && home != NULL){
+            snprintf(path, sizeof(path), "%s/.myshell_history", home);
+            histfile = path;
+        }
+        if(histfile != NULL){
+            history_open(histfile);
+        }
+        lineedit_set_completer(complete_word);
+    }
     
     while (1) {
-        //display shell prompt
-        printf("$ ");
-        
-        //read command from user input
-        if (fgets(cmd, MAX_CMD_LENGTH, stdin) == NULL) {
+        //display shell prompt and read command from user input (edited in place on a terminal)
+        free(cmd);
+        cmd = lineedit_read("$ ");
+        if (cmd == NULL) {
             break;
         }
         
-        //remove newline and skip empty commands
-        cmd[strcspn(cmd, "\n")] = '\0';
-        
-        //skip empty commands
-        if(strlen(cmd) == 0){
+        //skip empty commands (blank lines too, they are not parse errors)
+        if(cmd[strspn(cmd, " \t\r")] == '\0'){
             continue;
         }
+        if(interactive){
+            history_add(cmd);
+        }
         
         //handle exit command
         if(strcmp(cmd, "exit") == 0){
             break;
         }
         
-        //execute command (pipeline or single)
-        if(strchr(cmd, '|') != NULL){
-            //command contains pipe symbol - execute as pipeline
-            execute_pipeline(cmd);
-        }else if(parse_command(cmd, args, &inputFile, &outputFile, &errorFile, 0) == 0){
-            //single command - parse and execute if parsing succeeded
-            execute_command(args, inputFile, outputFile, errorFile);
-            //free argv strings created by qtokenize/globbing
-            for(int i=0; args[i]!=NULL; i++){
-                free(args[i]);
-            }
-            if(inputFile){
-                free(inputFile);
-            }
-            if(outputFile){
-                free(outputFile);
-            }
-            if(errorFile){
-                free(errorFile);
-            }
+        //here-documents continue on the following lines
+        char *text = heredoc_pending(cmd) > 0 ? read_heredocs(cmd) : NULL;
+
+        //parse once and execute (a single command is a pipeline of one stage)
+        Pipeline *pl = parse_pipeline(text ? text : cmd);
+        free(text);
+        if(pl != NULL){
+            status = execute_pipeline(pl);
+            free_pipeline(pl);
+        }else{
+            status = 2;
         }
+        //$? for the next line
+        env_set_status(env_current(), status);
     }
+    free(cmd);
     
-    return 0;
+    return status;
 }
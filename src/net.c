@@ -1,38 +1,131 @@
+#define _GNU_SOURCE
 #include "net.h"
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/uio.h>
+#include <fcntl.h>
+#include <netinet/tcp.h>
 
-//creates and binds a server socket to the specified port, returns socket file descriptor on success, -1 on failure
-int create_server_socket(int port){
+//resolves an address spec into a socket address: "unix:/path", "@abstract", "[v6addr]:port" or "v4addr:port"
+//returns 0 on success, -1 if the spec cannot be parsed
+static int parse_address(const char *spec, struct sockaddr_storage *ss, socklen_t *len){
+    memset(ss, 0, sizeof(*ss));
+
+    //local transports: filesystem path or Linux abstract namespace (leading NUL in sun_path)
+    if(strncmp(spec, "unix:", 5) == 0 || spec[0] == '@'){
+        struct sockaddr_un *un = (struct sockaddr_un *)ss;
+        const char *path = spec[0] == '@' ? spec + 1 : spec + 5;
+        size_t n = strlen(path);
+        size_t off = spec[0] == '@' ? 1 : 0;
+        if(n == 0 || n + off >= sizeof(un->sun_path)){
+            return -1;
+        }
+        un->sun_family = AF_UNIX;
+        memcpy(un->sun_path + off, path, n);
+        *len = offsetof(struct sockaddr_un, sun_path) + off + n + (off ? 0 : 1);
+        return 0;
+    }
+
+    //TCP: the port follows the last colon, IPv6 hosts are bracketed
+    const char *colon = strrchr(spec, ':');
+    if(!colon){
+        return -1;
+    }
+    int port = atoi(colon + 1);
+    if(port <= 0 || port > 65535){
+        return -1;
+    }
+    char host[INET6_ADDRSTRLEN + 2];
+    size_t hl = colon - spec;
+    if(hl >= sizeof(host)){
+        return -1;
+    }
+    memcpy(host, spec, hl);
+    host[hl] = '\0';
+
+    if(host[0] == '['){
+        struct sockaddr_in6 *in6 = (struct sockaddr_in6 *)ss;
+        if(hl < 2 || host[hl-1] != ']'){
+            return -1;
+        }
+        host[hl-1] = '\0';
+        in6->sin6_family = AF_INET6;
+        in6->sin6_port = htons(port);
+        if(inet_pton(AF_INET6, host + 1, &in6->sin6_addr) <= 0){
+            return -1;
+        }
+        *len = sizeof(*in6);
+        return 0;
+    }
+
+    struct sockaddr_in *in = (struct sockaddr_in *)ss;
+    in->sin_family = AF_INET;
+    in->sin_port = htons(port);
+    if(hl == 0 || strcmp(host, "*") == 0){
+        in->sin_addr.s_addr = INADDR_ANY;
+    }else if(inet_pton(AF_INET, host, &in->sin_addr) <= 0){
+        return -1;
+    }
+    *len = sizeof(*in);
+    return 0;
+}
+
+//formats a peer address for log messages
+static void format_peer(const struct sockaddr_storage *ss, char *out, size_t size){
+    char ip[INET6_ADDRSTRLEN];
+    if(ss->ss_family == AF_INET){
+        const struct sockaddr_in *in = (const struct sockaddr_in *)ss;
+        inet_ntop(AF_INET, &in->sin_addr, ip, sizeof(ip));
+        snprintf(out, size, "%s:%d", ip, ntohs(in->sin_port));
+    }else if(ss->ss_family == AF_INET6){
+        const struct sockaddr_in6 *in6 = (const struct sockaddr_in6 *)ss;
+        inet_ntop(AF_INET6, &in6->sin6_addr, ip, sizeof(ip));
+        snprintf(out, size, "[%s]:%d", ip, ntohs(in6->sin6_port));
+    }else{
+        snprintf(out, size, "local socket");
+    }
+}
+
+//creates, binds and starts listening on a socket for an already resolved address, returns socket file descriptor on success, -1 on failure
+//with reuseport several sockets can bind the same TCP address and the kernel spreads incoming connections across them
+//backlog bounds the queue of connections waiting for accept(), bursts beyond it are dropped and retried by the client
+static int listen_on(const struct sockaddr *addr, socklen_t addrlen, int reuseport, int backlog){
     int server_fd;
-    struct sockaddr_in address;
     int opt = 1;
 
     //create socket file descriptor
-    if((server_fd = socket(AF_INET, SOCK_STREAM, 0)) == 0){
+    if((server_fd = socket(addr->sa_family, SOCK_STREAM, 0)) < 0){
         perror("socket failed");
         return -1;
     }
 
-    //set socket options to allow address reuse
-    if(setsockopt(server_fd, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt))){
+    //set socket options to allow address reuse (meaningless for local sockets)
+    if(addr->sa_family != AF_UNIX && setsockopt(server_fd, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt))){
         perror("setsockopt failed");
         close(server_fd);
         return -1;
     }
+    if(reuseport && addr->sa_family != AF_UNIX && setsockopt(server_fd, SOL_SOCKET, SO_REUSEPORT, &opt, sizeof(opt))){
+        perror("setsockopt SO_REUSEPORT failed");
+        close(server_fd);
+        return -1;
+    }
 
-    //configure address structure
-    address.sin_family = AF_INET;
-    address.sin_addr.s_addr = INADDR_ANY;
-    address.sin_port = htons(port);
+    //a filesystem socket left behind by a previous run would make bind fail
+    const struct sockaddr_un *un = (const struct sockaddr_un *)addr;
+    if(addr->sa_family == AF_UNIX && un->sun_path[0] != '\0'){
+        unlink(un->sun_path);
+    }
 
     //bind socket to address
-    if(bind(server_fd, (struct sockaddr *)&address, sizeof(address)) < 0){
+    if(bind(server_fd, addr, addrlen) < 0){
         perror("bind failed");
         close(server_fd);
         return -1;
     }
 
     //start listening for connections
-    if(listen(server_fd, 3) < 0){
+    if(listen(server_fd, backlog > 0 ? backlog : DEFAULT_LISTEN_BACKLOG) < 0){
         perror("listen failed");
         close(server_fd);
         return -1;
@@ -41,11 +134,69 @@ int create_server_socket(int port){
     return server_fd;
 }
 
+//creates and binds a server socket to the specified port, returns socket file descriptor on success, -1 on failure
+int create_server_socket(int port){
+    struct sockaddr_in address;
+
+    //configure address structure
+    memset(&address, 0, sizeof(address));
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = INADDR_ANY;
+    address.sin_port = htons(port);
+
+    return listen_on((struct sockaddr *)&address, sizeof(address), 0, DEFAULT_LISTEN_BACKLOG);
+}
+
+//creates a listening socket for an address spec, a bare port number listens on every IPv4 interface like create_server_socket
+int create_listen_socket(const char *address, int reuseport, int backlog){
+    struct sockaddr_storage ss;
+    socklen_t len;
+
+    if(address[0] != '\0' && strspn(address, "0123456789") == strlen(address)){
+        struct sockaddr_in *in = (struct sockaddr_in *)&ss;
+        int port = atoi(address);
+        if(port <= 0 || port > 65535){
+            fprintf(stderr, "invalid port number\n");
+            return -1;
+        }
+        memset(&ss, 0, sizeof(ss));
+        in->sin_family = AF_INET;
+        in->sin_addr.s_addr = INADDR_ANY;
+        in->sin_port = htons(port);
+        len = sizeof(*in);
+    }else if(parse_address(address, &ss, &len) < 0){
+        fprintf(stderr, "invalid listen address: %s\n", address);
+        return -1;
+    }
+    return listen_on((struct sockaddr *)&ss, len, reuseport, backlog);
+}
+
+//reads the accept-queue fill level of a listening TCP socket, returns the number of connections waiting, -1 if unavailable
+//for listening sockets the kernel reports the queue length in tcpi_unacked and its limit in tcpi_sacked
+int listen_queue_depth(int server_fd, int *limit){
+    struct tcp_info info;
+    socklen_t len = sizeof(info);
+    memset(&info, 0, sizeof(info));
+    if(getsockopt(server_fd, IPPROTO_TCP, TCP_INFO, &info, &len) < 0){
+        return -1;
+    }
+    if(limit){
+        *limit = info.tcpi_sacked;
+    }
+    return info.tcpi_unacked;
+}
+
+//reports whether an address spec names a local (Unix domain) socket, those cannot be sharded with SO_REUSEPORT
+int is_local_address(const char *address){
+    return strncmp(address, "unix:", 5) == 0 || address[0] == '@';
+}
+
 //accepts a client connection on the server socket, blocks until a client connects, returns client socket file descriptor on success, -1 on failure
 int accept_client_connection(int server_fd){
-    struct sockaddr_in address;
+    struct sockaddr_storage address;
     int addrlen = sizeof(address);
     int client_fd;
+    char peer[INET6_ADDRSTRLEN + 8];
 
     printf("[INFO] Waiting for client connection...\n");
     
@@ -54,79 +205,257 @@ int accept_client_connection(int server_fd){
         return -1;
     }
 
-    printf("[INFO] Client connected from %s:%d\n", 
-           inet_ntoa(address.sin_addr), ntohs(address.sin_port));
+    format_peer(&address, peer, sizeof(peer));
+    printf("[INFO] Client connected from %s\n", peer);
     
     return client_fd;
 }
 
-//creates and connects a client socket to the specified server, establishes connection to the server, returns socket file descriptor on success, -1 on failure
-int create_client_socket(const char *server_ip, int port){
+//switches a file descriptor to non-blocking mode and marks it close-on-exec so it never leaks into children
+int set_nonblocking(int fd){
+    int flags = fcntl(fd, F_GETFL, 0);
+    if(flags < 0 || fcntl(fd, F_SETFL, flags | O_NONBLOCK) < 0){
+        perror("fcntl failed");
+        return -1;
+    }
+    if(fcntl(fd, F_SETFD, FD_CLOEXEC) < 0){
+        perror("fcntl failed");
+        return -1;
+    }
+    return 0;
+}
+
+//accepts a pending connection on a non-blocking listening socket, never blocks, returns -1 with errno EAGAIN when nothing is pending
+int accept_client_nonblocking(int server_fd){
+    struct sockaddr_storage address;
+    socklen_t addrlen = sizeof(address);
     int client_fd;
-    struct sockaddr_in serv_addr;
+    char peer[INET6_ADDRSTRLEN + 8];
 
-    //create socket file descriptor
-    if((client_fd = socket(AF_INET, SOCK_STREAM, 0)) < 0){
-        perror("socket creation failed");
+    client_fd = accept(server_fd, (struct sockaddr *)&address, &addrlen);
+    if(client_fd < 0){
+        if(errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR){
+            perror("accept failed");
+        }
+        return -1;
+    }
+    if(set_nonblocking(client_fd) < 0){
+        close(client_fd);
         return -1;
     }
 
-    //configure server address structure
-    serv_addr.sin_family = AF_INET;
-    serv_addr.sin_port = htons(port);
+    format_peer(&address, peer, sizeof(peer));
+    printf("[INFO] Client connected from %s\n", peer);
 
-    //convert IP address from string to binary format
-    if(inet_pton(AF_INET, server_ip, &serv_addr.sin_addr) <= 0){
-        perror("invalid address/address not supported");
-        close(client_fd);
+    return client_fd;
+}
+
+//logs where a connection accepted without its address (multishot accept) comes from
+void log_client_peer(int client_fd){
+    struct sockaddr_storage address;
+    socklen_t addrlen = sizeof(address);
+    char peer[INET6_ADDRSTRLEN + 8];
+
+    if(getpeername(client_fd, (struct sockaddr *)&address, &addrlen) < 0){
+        address.ss_family = AF_UNSPEC;
+    }
+    format_peer(&address, peer, sizeof(peer));
+    printf("[INFO] Client connected from %s\n", peer);
+}
+
+//connects a socket to an already resolved address, returns socket file descriptor on success, -1 on failure
+static int connect_to(const struct sockaddr *addr, socklen_t addrlen){
+    int client_fd;
+
+    //create socket file descriptor
+    if((client_fd = socket(addr->sa_family, SOCK_STREAM, 0)) < 0){
+        perror("socket creation failed");
         return -1;
     }
 
     //connect to server
-    if(connect(client_fd, (struct sockaddr *)&serv_addr, sizeof(serv_addr)) < 0){
+    if(connect(client_fd, addr, addrlen) < 0){
         perror("connection failed");
         close(client_fd);
         return -1;
     }
+    return client_fd;
+}
+
+//creates and connects a client socket to the specified server, establishes connection to the server, returns socket file descriptor on success, -1 on failure
+int create_client_socket(const char *server_ip, int port){
+    struct sockaddr_storage ss;
+    socklen_t len;
+    int client_fd;
+
+    //configure server address structure, IPv6 literals contain a colon
+    memset(&ss, 0, sizeof(ss));
+    if(strchr(server_ip, ':') != NULL){
+        struct sockaddr_in6 *in6 = (struct sockaddr_in6 *)&ss;
+        in6->sin6_family = AF_INET6;
+        in6->sin6_port = htons(port);
+        len = sizeof(*in6);
+        if(inet_pton(AF_INET6, server_ip, &in6->sin6_addr) <= 0){
+            fprintf(stderr, "invalid address/address not supported\n");
+            return -1;
+        }
+    }else{
+        struct sockaddr_in *in = (struct sockaddr_in *)&ss;
+        in->sin_family = AF_INET;
+        in->sin_port = htons(port);
+        len = sizeof(*in);
+        //convert IP address from string to binary format
+        if(inet_pton(AF_INET, server_ip, &in->sin_addr) <= 0){
+            fprintf(stderr, "invalid address/address not supported\n");
+            return -1;
+        }
+    }
+
+    if((client_fd = connect_to((struct sockaddr *)&ss, len)) < 0){
+        return -1;
+    }
 
-    printf("[INFO] Connected to server %s:%d\n", server_ip, port);
     return client_fd;
 }
 
-//sends a line of text over the socket, sends the entire line including null terminator, returns number of bytes sent on success, -1 on failure
-int send_line(int socket_fd, const char *line){
-    int len = strlen(line);
-    int total_sent = 0;
-    int bytes_sent;
+//connects to an address spec ("unix:/path", "@abstract", "[v6addr]:port", "v4addr:port"), returns socket file descriptor on success, -1 on failure
+int connect_to_address(const char *address){
+    struct sockaddr_storage ss;
+    socklen_t len;
+    int client_fd;
+
+    if(parse_address(address, &ss, &len) < 0){
+        fprintf(stderr, "invalid address: %s\n", address);
+        return -1;
+    }
+    if((client_fd = connect_to((struct sockaddr *)&ss, len)) < 0){
+        return -1;
+    }
+
+    return client_fd;
+}
+
+//sends fds to the peer as SCM_RIGHTS ancillary data attached to a FRAME_FDS frame, only works over local sockets, returns 0 on success, -1 on failure
+int send_fds(int socket_fd, const int *fds, int nfds){
+    return send_fds_frame(socket_fd, FRAME_FDS, fds, nfds);
+}
+
+int send_fds_frame(int socket_fd, int type, const int *fds, int nfds){
+    //the payload is the descriptor count, frames are never empty
+    struct {
+        uint32_t header;
+        char count;
+    } frame;
+    struct iovec iov;
+    struct msghdr msg;
+    union {
+        struct cmsghdr align;
+        char buf[CMSG_SPACE(RING_MAX_FDS * sizeof(int))];
+    } control;
+
+    if(nfds <= 0 || nfds > RING_MAX_FDS){
+        return -1;
+    }
+    frame.header = FRAME_HEADER(type, 1);
+    frame.count = '0' + nfds;
+    iov.iov_base = &frame;
+    iov.iov_len = sizeof(frame.header) + 1;
+
+    memset(&msg, 0, sizeof(msg));
+    memset(&control, 0, sizeof(control));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control.buf;
+    msg.msg_controllen = CMSG_SPACE(nfds * sizeof(int));
+
+    struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(nfds * sizeof(int));
+    memcpy(CMSG_DATA(cmsg), fds, nfds * sizeof(int));
 
-    //send the line length first (as 4-byte integer)
-    int line_len = htonl(len);
-    if(send(socket_fd, &line_len, sizeof(line_len), 0) < 0){
-        perror("send length failed");
+    //the 5-byte frame is tiny, a short write here is not expected on a blocking socket
+    if(sendmsg(socket_fd, &msg, 0) != (ssize_t)iov.iov_len){
+        perror("send fds failed");
         return -1;
     }
+    return 0;
+}
+
+//sends one typed frame, header and payload go out in a single sendmsg() where possible, returns number of payload bytes sent on success, -1 on failure
+int send_frame(int socket_fd, int type, const void *data, int len){
+    uint32_t line_len = FRAME_HEADER(type, len);            //type and length first (as 4-byte integer)
+    struct iovec iov[2];
+    struct msghdr msg;
+    size_t total = sizeof(line_len) + len;
+    size_t done = 0;
+
+    iov[0].iov_base = &line_len;
+    iov[0].iov_len = sizeof(line_len);
+    iov[1].iov_base = (void *)data;
+    iov[1].iov_len = len;
 
-    //send the actual line data
-    while(total_sent < len){
-        bytes_sent = send(socket_fd, line + total_sent, len - total_sent, 0);
+    //keep sending until both header and data are out, advancing the iovecs past partial writes
+    while(done < total){
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_iov = iov;
+        msg.msg_iovlen = 2;
+        ssize_t bytes_sent = sendmsg(socket_fd, &msg, 0);
         if(bytes_sent < 0){
+            if(errno == EINTR){
+                continue;
+            }
             perror("send data failed");
             return -1;
         }
-        total_sent += bytes_sent;
+        done += bytes_sent;
+        for(int i = 0; i < 2 && bytes_sent > 0; i++){
+            size_t step = (size_t)bytes_sent < iov[i].iov_len ? (size_t)bytes_sent : iov[i].iov_len;
+            iov[i].iov_base = (char *)iov[i].iov_base + step;
+            iov[i].iov_len -= step;
+            bytes_sent -= step;
+        }
     }
 
-    return total_sent;
+    return len;
+}
+
+//sends a line of text over the socket as a FRAME_CMD frame, returns number of bytes sent on success, -1 on failure
+int send_line(int socket_fd, const char *line){
+    return send_frame(socket_fd, FRAME_CMD, line, strlen(line));
+}
+
+//reads exactly len bytes from the socket, returns len on success, 0 if the peer closed first, -1 on failure
+static int recv_all(int socket_fd, void *buf, int len){
+    int total_received = 0;
+    while(total_received < len){
+        int bytes_received = recv(socket_fd, (char *)buf + total_received, len - total_received, MSG_WAITALL);
+        if(bytes_received == 0){
+            return 0;
+        }
+        if(bytes_received < 0){
+            if(errno == EINTR){
+                continue;
+            }
+            return -1;
+        }
+        total_received += bytes_received;
+    }
+    return total_received;
 }
 
 //receives a line of text from the socket, reads the line length first, then the actual data, returns number of bytes received on success, -1 on failure, 0 on connection closed
 int receive_line(int socket_fd, char *buffer, int buffer_size){
-    int line_len;
-    int total_received = 0;
-    int bytes_received;
+    uint32_t line_len;
+    int rc;
 
-    //receive the line length first
-    if(recv(socket_fd, &line_len, sizeof(line_len), MSG_WAITALL) < 0){
+    //receive the line length first, a short read here would desync the stream so insist on all 4 bytes
+    rc = recv_all(socket_fd, &line_len, sizeof(line_len));
+    if(rc <= 0){
+        if(rc == 0){
+            printf("[INFO] Client disconnected\n");
+            return 0;
+        }
         perror("receive length failed");
         return -1;
     }
@@ -134,27 +463,239 @@ int receive_line(int socket_fd, char *buffer, int buffer_size){
     line_len = ntohl(line_len);
     
     //check if the line is too long for our buffer
-    if(line_len >= buffer_size){
-        fprintf(stderr, "Received line too long (%d bytes)\n", line_len);
+    if(line_len >= (uint32_t)buffer_size){
+        fprintf(stderr, "Received line too long (%u bytes)\n", line_len);
         return -1;
     }
 
     //receive the actual line data
-    while(total_received < line_len){
-        bytes_received = recv(socket_fd, buffer + total_received, line_len - total_received, MSG_WAITALL);
-        if(bytes_received <= 0){
-            if(bytes_received == 0){
-                printf("[INFO] Client disconnected\n");
-                return 0;                                   //connection closed
+    rc = recv_all(socket_fd, buffer, line_len);
+    if(rc < 0){
+        perror("receive data failed");
+        return -1;
+    }
+    if(rc == 0 && line_len > 0){
+        printf("[INFO] Client disconnected\n");
+        return 0;                                           //connection closed
+    }
+
+    buffer[line_len] = '\0';                                //null terminate the received string
+    return line_len;
+}
+
+//binds a read-ahead ring buffer to a connected socket
+void recv_ring_init(RecvRing *ring, int socket_fd){
+    ring->fd = socket_fd;
+    ring->head = 0;
+    ring->tail = 0;
+    ring->nfds = 0;
+    ring->fed = 0;
+    ring->fed_end = 0;
+}
+
+//from now on the ring only holds what recv_ring_feed puts in, the owner receives from the socket itself
+void recv_ring_fed(RecvRing *ring){
+    ring->fed = 1;
+}
+
+//copies as much as fits behind the buffered bytes, the end of the stream is reported once they are parsed
+size_t recv_ring_feed(RecvRing *ring, const char *data, ssize_t n){
+    if(n <= 0){
+        ring->fed_end = n == 0 ? 1 : (int)n;
+        return 0;
+    }
+    unsigned int space = RECV_RING_SIZE - (ring->tail - ring->head);
+    unsigned int pos = ring->tail & (RECV_RING_SIZE - 1);
+    unsigned int first = RECV_RING_SIZE - pos;
+    size_t len = (size_t)n < space ? (size_t)n : space;
+    if(first > len){
+        first = len;
+    }
+    memcpy(ring->data + pos, data, first);
+    memcpy(ring->data, data + first, len - first);
+    ring->tail += len;
+    return len;
+}
+
+//hands over descriptors that arrived as SCM_RIGHTS, returns how many were copied into fds
+int recv_ring_take_fds(RecvRing *ring, int *fds, int max){
+    int n = ring->nfds < max ? ring->nfds : max;
+    if(n > 0){
+        memcpy(fds, ring->fds, n * sizeof(int));
+    }
+    //anything the caller has no room for is closed rather than leaked
+    for(int i = n; i < ring->nfds; i++){
+        close(ring->fds[i]);
+    }
+    ring->nfds = 0;
+    return n;
+}
+
+//copies n bytes starting offset bytes past the ring head into dst, handling wrap-around
+static void ring_peek(const RecvRing *ring, unsigned int offset, void *dst, unsigned int n){
+    unsigned int pos = (ring->head + offset) & (RECV_RING_SIZE - 1);
+    unsigned int first = RECV_RING_SIZE - pos;
+    if(first > n){
+        first = n;
+    }
+    memcpy(dst, ring->data + pos, first);
+    memcpy((char *)dst + first, ring->data, n - first);
+}
+
+//keeps descriptors received as SCM_RIGHTS until the FRAME_FDS frame they came with is parsed
+static void ring_stash_fds(RecvRing *ring, struct msghdr *msg){
+    for(struct cmsghdr *c = CMSG_FIRSTHDR(msg); c != NULL; c = CMSG_NXTHDR(msg, c)){
+        if(c->cmsg_level != SOL_SOCKET || c->cmsg_type != SCM_RIGHTS){
+            continue;
+        }
+        //the control buffer only has room for RING_MAX_FDS, the kernel drops the rest and sets MSG_CTRUNC
+        int count = (c->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+        for(int i = 0; i < count; i++){
+            int fd;
+            memcpy(&fd, CMSG_DATA(c) + i * sizeof(int), sizeof(int));
+            if(ring->nfds < RING_MAX_FDS){
+                ring->fds[ring->nfds++] = fd;
+            }else{
+                close(fd);
+            }
+        }
+    }
+}
+
+//pulls as many bytes as the socket has queued into the free part of the ring with one recvmsg()
+//returns bytes read, 0 on connection closed, -1 on failure, NET_AGAIN if a non-blocking socket has nothing
+static int ring_fill(RecvRing *ring){
+    unsigned int used = ring->tail - ring->head;
+    unsigned int space = RECV_RING_SIZE - used;
+    unsigned int pos = ring->tail & (RECV_RING_SIZE - 1);
+    unsigned int first = RECV_RING_SIZE - pos;
+    struct iovec iov[2];
+    struct msghdr msg;
+    union {
+        struct cmsghdr align;
+        char buf[CMSG_SPACE(RING_MAX_FDS * sizeof(int))];
+    } control;
+
+    if(ring->fed){
+        //nothing to read here, the owner feeds what arrives
+        if(ring->fed_end < 0){
+            errno = -ring->fed_end;
+            return -1;
+        }
+        return ring->fed_end > 0 ? 0 : NET_AGAIN;
+    }
+
+    if(first > space){
+        first = space;
+    }
+    iov[0].iov_base = ring->data + pos;
+    iov[0].iov_len = first;
+    iov[1].iov_base = ring->data;
+    iov[1].iov_len = space - first;
+
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = iov;
+    msg.msg_iovlen = iov[1].iov_len ? 2 : 1;
+
+    for(;;){
+        //local peers may pass descriptors along with their bytes, they arrive close-on-exec
+        msg.msg_control = control.buf;
+        msg.msg_controllen = sizeof(control.buf);
+        ssize_t n = recvmsg(ring->fd, &msg, MSG_CMSG_CLOEXEC);
+        if(n > 0){
+            ring->tail += n;
+            ring_stash_fds(ring, &msg);
+            return n;
+        }
+        if(n == 0){
+            return 0;
+        }
+        if(errno == EINTR){
+            continue;
+        }
+        if(errno == EAGAIN || errno == EWOULDBLOCK){
+            return NET_AGAIN;
+        }
+        return -1;
+    }
+}
+
+//receives one frame through the connection's ring buffer, parsing already-buffered frames before touching the socket
+int receive_frame_buffered(RecvRing *ring, int *type, char *buffer, int buffer_size){
+    for(;;){
+        unsigned int used = ring->tail - ring->head;
+
+        //try to parse a complete frame out of what is already buffered
+        if(used >= sizeof(uint32_t)){
+            uint32_t line_len;
+            ring_peek(ring, 0, &line_len, sizeof(line_len));
+            line_len = ntohl(line_len);
+            *type = line_len >> FRAME_TYPE_SHIFT;
+            line_len &= FRAME_LEN_MASK;
+
+            //reject frames that can never fit, either in the caller's buffer or in the ring itself
+            if(line_len >= (uint32_t)buffer_size || line_len > RECV_RING_SIZE - sizeof(uint32_t)){
+                fprintf(stderr, "Received line too long (%u bytes)\n", line_len);
+                return -1;
+            }
+
+            if(used >= sizeof(uint32_t) + line_len){
+                ring_peek(ring, sizeof(uint32_t), buffer, line_len);
+                ring->head += sizeof(uint32_t) + line_len;
+                if(line_len == 0){
+                    continue;                               //empty frames carry nothing, and 0 means closed
+                }
+                buffer[line_len] = '\0';                    //null terminate the received string
+                return line_len;
             }
+        }
+
+        //partial frame (or nothing) buffered, read ahead as much as the kernel will give us
+        int rc = ring_fill(ring);
+        if(rc == 0){
+            return 0;                                       //connection closed, callers report it
+        }
+        if(rc == NET_AGAIN){
+            return NET_AGAIN;                               //partial frame stays buffered for the next call
+        }
+        if(rc < 0){
+            perror("receive data failed");
+            return -1;
+        }
+    }
+}
+
+//type of the next frame, reading ahead only if not even its header is buffered
+int recv_ring_peek_type(RecvRing *ring, int *type){
+    while(ring->tail - ring->head < sizeof(uint32_t)){
+        int rc = ring_fill(ring);
+        if(rc == 0 || rc == NET_AGAIN){
+            return rc;
+        }
+        if(rc < 0){
             perror("receive data failed");
             return -1;
         }
-        total_received += bytes_received;
     }
+    uint32_t header;
+    ring_peek(ring, 0, &header, sizeof(header));
+    *type = ntohl(header) >> FRAME_TYPE_SHIFT;
+    return 1;
+}
 
-    buffer[line_len] = '\0';                                //null terminate the received string
-    return total_received;
+int recv_ring_pending(const RecvRing *ring){
+    return ring->tail - ring->head;
+}
+
+//receives one line through the connection's ring buffer, frames of other types are rejected
+int receive_line_buffered(RecvRing *ring, char *buffer, int buffer_size){
+    int type;
+    int rc = receive_frame_buffered(ring, &type, buffer, buffer_size);
+    if(rc > 0 && type != FRAME_CMD){
+        fprintf(stderr, "Unexpected frame type %d\n", type);
+        return -1;
+    }
+    return rc;
 }
 
 //closes a socket connection, properly closes the socket file descriptor
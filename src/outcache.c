@@ -0,0 +1,346 @@
+#define _GNU_SOURCE
+#include "outcache.h"
+#include "shellcore.h"
+#include <fcntl.h>
+#include <fnmatch.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+//number of results kept, the least recently used one is replaced
+#define OUTCACHE_ENTRIES 64
+//largest output stored, bigger results are passed through uncached
+#define OUTCACHE_MAX_OUTPUT (1024 * 1024)
+//files watched per entry
+#define OUTCACHE_MAX_INPUTS 16
+//number of TTL rules
+#define OUTCACHE_MAX_RULES 32
+
+//one file the result depends on, as it was when the command started
+typedef struct {
+    char *path;
+    struct timespec mtime;
+    off_t size;
+    ino_t ino;
+} OutInput;
+
+struct OutEntry {
+    char *key;                  //serialized environment and pipeline, NULL for a free slot
+    size_t key_len;
+    int filling;                //a command is producing the result, never evicted while set
+    int too_big;                //the output outgrew OUTCACHE_MAX_OUTPUT, the fill will not be stored
+    char *out;
+    size_t len, cap;
+    int status;                 //exit status of the command
+    long expires;               //monotonic ns
+    long used;                  //for least recently used eviction
+    OutInput inputs[OUTCACHE_MAX_INPUTS];
+    int ninputs;
+    int *waiters;               //eventfds of sessions waiting for the fill
+    int nwaiters, waiters_cap;
+};
+
+typedef struct {
+    char *pattern;
+    long ttl_ns;
+} OutRule;
+
+static pthread_mutex_t cache_lock = PTHREAD_MUTEX_INITIALIZER;
+static OutEntry entries[OUTCACHE_ENTRIES];
+//rules are only added while the options are parsed, before any worker starts
+static OutRule rules[OUTCACHE_MAX_RULES];
+static int nrules;
+
+int outcache_add_rule(const char *spec){
+    const char *eq = strrchr(spec, '=');
+    char *end;
+    if(eq == NULL || eq == spec || nrules == OUTCACHE_MAX_RULES){
+        return -1;
+    }
+    double ttl = strtod(eq + 1, &end);
+    if(end == eq + 1 || *end != '\0' || ttl <= 0){
+        return -1;
+    }
+    char *pattern = strndup(spec, eq - spec);
+    if(pattern == NULL){
+        return -1;
+    }
+    rules[nrules].pattern = pattern;
+    rules[nrules].ttl_ns = (long)(ttl * 1e9);
+    nrules++;
+    return 0;
+}
+
+int outcache_enabled(void){
+    return nrules > 0;
+}
+
+//TTL of the first rule matching the command line (here-document bodies are not part of it), 0 if none does
+static long rule_ttl(const char *text){
+    size_t n = strcspn(text, "\n");
+    char line[n + 1];
+    memcpy(line, text, n);
+    line[n] = '\0';
+    for(int i = 0; i < nrules; i++){
+        if(fnmatch(rules[i].pattern, line, 0) == 0){
+            return rules[i].ttl_ns;
+        }
+    }
+    return 0;
+}
+
+//whether running pl has no effect besides its output: nothing is opened for writing
+static int read_only(const Pipeline *pl){
+    for(int s = 0; s < pl->nstages; s++){
+        for(int j = 0; j < pl->stages[s].nredirs; j++){
+            const Redirect *r = &pl->stages[s].redirs[j];
+            if(r->type == REDIR_FILE && (r->flags & O_ACCMODE) != O_RDONLY){
+                return 0;
+            }
+        }
+    }
+    return 1;
+}
+
+//serializes envp (ended by an empty string, no entry is empty) then every word and redirection of pl, stages end with
+//an empty string, returns NULL if out of memory
+static char *make_key(const Pipeline *pl, char *const envp[], size_t *len){
+    char *key = NULL;
+    FILE *f = open_memstream(&key, len);
+    if(f == NULL){
+        return NULL;
+    }
+    for(int i = 0; envp != NULL && envp[i] != NULL; i++){
+        fwrite(envp[i], 1, strlen(envp[i]) + 1, f);
+    }
+    fputc('\0', f);
+    for(int s = 0; s < pl->nstages; s++){
+        const Command *c = &pl->stages[s];
+        for(int j = 0; j < c->argc; j++){
+            fwrite(c->argv[j], 1, strlen(c->argv[j]) + 1, f);
+        }
+        for(int j = 0; j < c->nredirs; j++){
+            const Redirect *r = &c->redirs[j];
+            fprintf(f, "%d %d %d %d", r->fd, r->type, r->flags, r->dup_fd);
+            fwrite(r->path, 1, strlen(r->path) + 1, f);
+        }
+        fputc('\0', f);
+    }
+    if(fclose(f) != 0){
+        free(key);
+        return NULL;
+    }
+    return key;
+}
+
+//remembers a file the result may depend on, words that do not name an existing file are ignored
+static void add_input(OutEntry *e, const char *path){
+    struct stat st;
+    if(e->ninputs == OUTCACHE_MAX_INPUTS || stat(path, &st) < 0){
+        return;
+    }
+    OutInput *in = &e->inputs[e->ninputs];
+    if((in->path = strdup(path)) == NULL){
+        return;
+    }
+    in->mtime = st.st_mtim;
+    in->size = st.st_size;
+    in->ino = st.st_ino;
+    e->ninputs++;
+}
+
+//whether every watched file is still the one the result was produced from
+static int inputs_unchanged(const OutEntry *e){
+    for(int i = 0; i < e->ninputs; i++){
+        const OutInput *in = &e->inputs[i];
+        struct stat st;
+        if(stat(in->path, &st) < 0 || st.st_ino != in->ino || st.st_size != in->size ||
+           st.st_mtim.tv_sec != in->mtime.tv_sec || st.st_mtim.tv_nsec != in->mtime.tv_nsec){
+            return 0;
+        }
+    }
+    return 1;
+}
+
+//forgets an entry's result and inputs, the key and waiters stay
+static void reset_entry(OutEntry *e){
+    for(int i = 0; i < e->ninputs; i++){
+        free(e->inputs[i].path);
+    }
+    e->ninputs = 0;
+    free(e->out);
+    e->out = NULL;
+    e->len = e->cap = 0;
+    e->too_big = 0;
+}
+
+static void free_entry(OutEntry *e){
+    reset_entry(e);
+    free(e->key);
+    free(e->waiters);
+    memset(e, 0, sizeof(*e));
+}
+
+//turns e into a fill of pl, snapshotting the files it reads
+static void start_fill(OutEntry *e, const Pipeline *pl, long ttl){
+    reset_entry(e);
+    e->filling = 1;
+    e->expires = ttl;               //relative until the fill finishes
+    for(int s = 0; s < pl->nstages; s++){
+        const Command *c = &pl->stages[s];
+        for(int j = 1; j < c->argc; j++){
+            add_input(e, c->argv[j]);
+        }
+        for(int j = 0; j < c->nredirs; j++){
+            if(c->redirs[j].type == REDIR_FILE){
+                add_input(e, c->redirs[j].path);
+            }
+        }
+    }
+}
+
+int outcache_lookup(const char *text, const Pipeline *pl, char *const envp[], int wait_fd, OutEntry **entry, char **out,
+                    size_t *len, int *status){
+    long ttl = rule_ttl(text);
+    if(ttl == 0 || !read_only(pl)){
+        return OUTCACHE_BYPASS;
+    }
+    size_t key_len;
+    char *key = make_key(pl, envp, &key_len);
+    if(key == NULL){
+        return OUTCACHE_BYPASS;
+    }
+
+    pthread_mutex_lock(&cache_lock);
+    long now = shellcore_now_ns();
+    OutEntry *e = NULL;
+    OutEntry *victim = NULL;
+    for(int i = 0; i < OUTCACHE_ENTRIES && e == NULL; i++){
+        OutEntry *c = &entries[i];
+        if(c->key != NULL && c->key_len == key_len && memcmp(c->key, key, key_len) == 0){
+            e = c;
+        }else if(c->key == NULL){
+            if(victim == NULL || victim->key != NULL){
+                victim = c;
+            }
+        }else if(!c->filling && (victim == NULL || (victim->key != NULL && c->used < victim->used))){
+            victim = c;
+        }
+    }
+
+    int rc;
+    if(e != NULL && e->filling){
+        //single-flight: join the command already producing this result
+        if(e->nwaiters == e->waiters_cap){
+            int cap = e->waiters_cap ? e->waiters_cap * 2 : 4;
+            int *tmp = realloc(e->waiters, cap * sizeof(int));
+            if(tmp == NULL){
+                pthread_mutex_unlock(&cache_lock);
+                free(key);
+                return OUTCACHE_BYPASS;
+            }
+            e->waiters = tmp;
+            e->waiters_cap = cap;
+        }
+        e->waiters[e->nwaiters++] = wait_fd;
+        rc = OUTCACHE_WAIT;
+    }else if(e != NULL && now < e->expires && inputs_unchanged(e)){
+        *out = malloc(e->len ? e->len : 1);
+        if(*out == NULL){
+            pthread_mutex_unlock(&cache_lock);
+            free(key);
+            return OUTCACHE_BYPASS;
+        }
+        memcpy(*out, e->out, e->len);
+        *len = e->len;
+        *status = e->status;
+        e->used = now;
+        rc = OUTCACHE_HIT;
+    }else if(e != NULL || victim != NULL){
+        //expired, stale or not cached yet: the caller produces it, identical commands wait meanwhile
+        if(e == NULL){
+            e = victim;
+            free_entry(e);
+            e->key = key;
+            e->key_len = key_len;
+            key = NULL;
+        }
+        start_fill(e, pl, ttl);
+        e->used = now;
+        *entry = e;
+        rc = OUTCACHE_FILL;
+    }else{
+        rc = OUTCACHE_BYPASS;       //every slot is being filled
+    }
+    pthread_mutex_unlock(&cache_lock);
+    free(key);
+    return rc;
+}
+
+void outcache_append(OutEntry *e, const char *data, size_t len){
+    pthread_mutex_lock(&cache_lock);
+    if(!e->too_big && e->len + len > OUTCACHE_MAX_OUTPUT){
+        e->too_big = 1;
+        free(e->out);
+        e->out = NULL;
+        e->len = e->cap = 0;
+    }
+    if(!e->too_big && e->len + len > e->cap){
+        size_t cap = e->cap ? e->cap : 4096;
+        while(cap < e->len + len){
+            cap *= 2;
+        }
+        char *tmp = realloc(e->out, cap);
+        if(tmp == NULL){
+            e->too_big = 1;
+        }else{
+            e->out = tmp;
+            e->cap = cap;
+        }
+    }
+    if(!e->too_big){
+        memcpy(e->out + e->len, data, len);
+        e->len += len;
+    }
+    pthread_mutex_unlock(&cache_lock);
+}
+
+int outcache_finish(OutEntry *e, int ok, int status){
+    pthread_mutex_lock(&cache_lock);
+    uint64_t one = 1;
+    for(int i = 0; i < e->nwaiters; i++){
+        if(write(e->waiters[i], &one, sizeof(one)) < 0){
+            perror("eventfd write");
+        }
+    }
+    e->nwaiters = 0;
+    e->filling = 0;
+    int stored = ok && !e->too_big;
+    if(stored){
+        e->status = status;
+        e->expires += shellcore_now_ns();
+    }else{
+        free_entry(e);              //woken waiters look up again and one of them runs it
+    }
+    pthread_mutex_unlock(&cache_lock);
+    return stored;
+}
+
+void outcache_cancel(int wait_fd){
+    pthread_mutex_lock(&cache_lock);
+    for(int i = 0; i < OUTCACHE_ENTRIES; i++){
+        OutEntry *e = &entries[i];
+        for(int j = 0; j < e->nwaiters; j++){
+            if(e->waiters[j] == wait_fd){
+                e->waiters[j] = e->waiters[--e->nwaiters];
+                pthread_mutex_unlock(&cache_lock);
+                return;
+            }
+        }
+    }
+    pthread_mutex_unlock(&cache_lock);
+}
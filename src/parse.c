@@ -1,135 +1,564 @@
 #include "parse.h"
 #include "tokenize.h"
+#include "expand.h"
+#include "env.h"
 #include "util.h"
+#include "shellcore.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <stdint.h>
+#include <fcntl.h>
+#include <unistd.h>
 
 //maximum length for command input buffer
-#define MAX_CMD_LENGTH 1024 
+#define MAX_CMD_LENGTH 1024
 //maximum number of arguments a command can have
-#define MAX_ARGS 64         
+#define MAX_ARGS 64
 
-/*utility function to skip leading whitespace characters.
-This function advances the pointer past any spaces, tabs, or newlines at the beginning of a string, returning a pointer to the first non-whitespace character
+//words and redirections of one stage while the line is being parsed, the strings are heap copies owned by the parser
+typedef struct {
+    char *words[MAX_ARGS];
+    bool quoted[MAX_ARGS];
+    int nwords;
+    Redirect redirs[MAX_REDIRS];
+    int nredirs;
+} StageBuild;
+
+//an unquoted token that is exactly op
+static int is_op(const QTok *t, const char *op){
+    return !t->was_quoted && strcmp(t->val, op) == 0;
+}
+
+//releases the strings collected for the first n stages
+static void free_builds(StageBuild *b, int n){
+    for(int i = 0; i < n; i++){
+        for(int j = 0; j < b[i].nwords; j++){
+            free(b[i].words[j]);
+        }
+        for(int j = 0; j < b[i].nredirs; j++){
+            free(b[i].redirs[j].path);
+        }
+    }
+}
+
+/*pipeline validation on the tokens, so a | inside quotes is just a character
+prints the same messages the shell always has, returns the number of stages or -1
 */
-static char* skip_whitespace(char *str){
-    //loop through string while current character is whitespace
-    while(*str == ' ' || *str == '\t' || *str == '\n'){
-        str++;
+static int count_stages(const QTok *toks, int nt){
+    int stages = 1;
+    int words = 0;                      //tokens seen since the last pipe
+
+    if(nt > 0 && is_op(&toks[0], "|")){
+        printf("Command missing after pipe.\n");
+        return -1;
+    }
+    for(int i = 0; i < nt; i++){
+        if(!is_op(&toks[i], "|")){
+            words++;
+            continue;
+        }
+        if(words == 0){
+            printf("Empty command between pipes.\n");
+            return -1;
+        }
+        words = 0;
+        stages++;
+    }
+    if(words == 0){
+        printf("Command missing after pipe.\n");
+        return -1;
+    }
+    if(stages > MAX_PIPES){
+        printf("Too many commands in pipeline.\n");
+        return -1;
     }
-    return str;
+    return stages;
 }
 
-/*pipeline validation function to check if pipeline syntax is correct
-This function validates that pipes are used correctly and there are no empty commands. Returns 0 for valid pipeline, -1 for invalid pipeline with error message printed
+//heap copy of the first line of text, *rest is set to the lines after it (NULL if there are none)
+static char *first_line(const char *text, const char **rest){
+    size_t n = strcspn(text, "\n");
+    char *line = malloc(n + 1);
+    if(!line){
+        perror("malloc");
+        return NULL;
+    }
+    memcpy(line, text, n);
+    line[n] = '\0';
+    *rest = text[n] ? text + n + 1 : NULL;
+    return line;
+}
+
+/*takes the next here-document body off *rest: the lines before the one equal to tag, with <<- leading tabs are removed
+returns a heap copy of the body (every line ending in a newline) or NULL if the delimiter line never comes
 */
-int validate_pipeline(char *cmd){
-    //work on a copy so we don't modify the original
-    size_t n = strlen(cmd) + 1;
-    char buf[n];
-    memcpy(buf, cmd, n);
+static char *take_heredoc(const char **rest, const char *tag, int strip_tabs){
+    char *body = NULL;
+    size_t len = 0;
+    FILE *f = open_memstream(&body, &len);
+    if(!f){
+        perror("open_memstream");
+        return NULL;
+    }
+    for(const char *p = *rest; p != NULL; ){
+        const char *eol = strchr(p, '\n');
+        size_t n = eol ? (size_t)(eol - p) : strlen(p);
+        const char *text = p;
+        p = eol ? eol + 1 : NULL;
+        while(strip_tabs && n > 0 && *text == '\t'){
+            text++;
+            n--;
+        }
+        if(n == strlen(tag) && memcmp(text, tag, n) == 0){
+            fclose(f);
+            *rest = p;
+            return body;
+        }
+        fwrite(text, 1, n, f);
+        fputc('\n', f);
+    }
+    fclose(f);
+    free(body);
+    return NULL;
+}
 
-    //trim leading whitespace
-    char *p = skip_whitespace(buf);
+//an unquoted here-document operator, returns 2 for <<- (tabs stripped), 1 for <<, 0 otherwise
+static int heredoc_op(const QTok *t){
+    return is_op(t, "<<-") ? 2 : is_op(t, "<<") ? 1 : 0;
+}
 
-    //leading pipe check
-    if (*p == '|') {
-        printf("Command missing after pipe.\n");
+int heredoc_pending(const char *text){
+    const char *rest;
+    char *line = first_line(text, &rest);
+    QTok *toks = NULL;
+    int nt = 0;
+    if(line == NULL || qtokenize(line, &toks, &nt) != 0){
+        free(line);
+        return 0;                       //the parser reports it
+    }
+    free(line);
+
+    int missing = 0;
+    for(int i = 0; i + 1 < nt; i++){
+        int op = heredoc_op(&toks[i]);
+        if(op == 0){
+            continue;
+        }
+        //once one body is missing the rest cannot have started yet
+        char *tag = missing ? NULL : expand_literal(toks[i+1].val);
+        char *body = tag ? take_heredoc(&rest, tag, op == 2) : NULL;
+        free(tag);
+        if(body == NULL){
+            missing++;
+        }
+        free(body);
+        i++;
+    }
+    free_qtokens(toks, nt);
+    return missing;
+}
+
+/*decodes a redirection operator token (see op_length in tokenize.c): the descriptor it applies to, its kind and
+open flags; &> and &>> report fd 1 and set *both (stderr follows stdout), returns 0 if t is not a redirection
+*/
+static int redir_op(const QTok *t, int *fd, int *type, int *flags, int *both){
+    const char *op = t->val;
+    if(t->was_quoted){
+        return 0;
+    }
+    *type = REDIR_FILE;
+    *flags = 0;
+    *both = op[0] == '&' && op[1] == '>';
+    if(*both){
+        op++;
+        *fd = STDOUT_FILENO;
+    }else if(op[0] >= '0' && op[0] <= '9' && (op[1] == '<' || op[1] == '>')){
+        *fd = *op++ - '0';
+    }else{
+        *fd = op[0] == '<' ? STDIN_FILENO : STDOUT_FILENO;
+    }
+
+    if(strcmp(op, "<") == 0) *flags = O_RDONLY;
+    else if(strcmp(op, ">") == 0) *flags = O_WRONLY|O_CREAT|O_TRUNC;
+    else if(strcmp(op, ">>") == 0) *flags = O_WRONLY|O_CREAT|O_APPEND;
+    else if((strcmp(op, "<&") == 0 || strcmp(op, ">&") == 0) && !*both) *type = REDIR_DUP;
+    else if(heredoc_op(t) || strcmp(op, "<<<") == 0) *type = REDIR_DATA;
+    else return 0;
+    return 1;
+}
+
+//appends one redirection to the stage, path is taken over
+static void add_redirect(StageBuild *b, int fd, int type, int flags, int dup_fd, char *path){
+    Redirect *r = &b->redirs[b->nredirs++];
+    r->fd = fd;
+    r->type = type;
+    r->flags = flags;
+    r->dup_fd = dup_fd;
+    r->path = path;
+}
+
+/*collects the words and redirections of the stage in toks[0..nt), taking ownership of the word strings
+here-document bodies are taken off *rest in order, returns 0 on success, -1 on error (message printed,
+a stage without a command fails silently like it always did)
+*/
+static int build_stage(QTok *toks, int nt, StageBuild *b, int isPipeline, const char **rest){
+    if(nt >= MAX_ARGS - 1){
+        printf("Too many arguments.\n");
         return -1;
     }
+    for(int i = 0; i < nt; i++){
+        int fd, type, flags, both;
+        if(!redir_op(&toks[i], &fd, &type, &flags, &both)){
+            b->words[b->nwords] = toks[i].val;     //take ownership of the string
+            b->quoted[b->nwords] = toks[i].was_quoted;
+            b->nwords++;
+            toks[i].val = NULL;
+            continue;
+        }
+        int heredoc = heredoc_op(&toks[i]);
 
-    //scan to detect empties between pipes and trailing pipe
-    int saw_non_ws_since_pipe = 0;
-    for (char *q = p; *q; ++q) {
-        if (*q == '|') {
-            //if we hit a pipe and haven't seen a non-ws char since the last pipe, it's empty
-            if (!saw_non_ws_since_pipe) {
-                printf("Empty command between pipes.\n");
+        //redirections need a filename (a delimiter or the text for here-documents and here-strings, a descriptor for duplication)
+        if(i + 1 >= nt){
+            if(heredoc) printf("Here-document delimiter not specified.\n");
+            else if(type == REDIR_DATA) printf("Here-string not specified.\n");
+            else if(type == REDIR_DUP) printf("File descriptor not specified.\n");
+            else if(flags == O_RDONLY) printf("Input file not specified.\n");
+            else if(fd == STDERR_FILENO) printf("Error output file not specified.\n");
+            else printf(isPipeline ? "Output file not specified after redirection.\n" : "Output file not specified.\n");
+            return -1;
+        }
+        const char *word = toks[i+1].val;
+        char *path;
+        int dup_fd = -1;
+        if(heredoc){
+            path = take_heredoc(rest, word, heredoc == 2);
+            if(path == NULL){
+                printf("Here-document not terminated.\n");
+                return -1;
+            }
+        }else if(type == REDIR_DATA){
+            //a here-string is the word followed by a newline
+            size_t n = strlen(word);
+            path = malloc(n + 2);
+            if(!path){
+                perror("malloc");
                 return -1;
             }
-            saw_non_ws_since_pipe = 0; //reset for the next segment
-        } else if (*q != ' ' && *q != '\t' && *q != '\n') {
-            saw_non_ws_since_pipe = 1;
+            memcpy(path, word, n);
+            memcpy(path + n, "\n", 2);
+        }else if(type == REDIR_DUP){
+            //n>&m copies descriptor m, n>&- closes n
+            if(!(word[0] == '-' || (word[0] >= '0' && word[0] <= '9')) || word[1] != '\0'){
+                printf("Bad fd number.\n");
+                return -1;
+            }
+            dup_fd = word[0] == '-' ? -1 : word[0] - '0';
+            path = xstrdup(word);
+        }else{
+            path = strip_outer_quotes(word);
         }
+        add_redirect(b, fd, type, flags, dup_fd, path);
+        if(both){
+            add_redirect(b, STDERR_FILENO, REDIR_DUP, 0, STDOUT_FILENO, xstrdup("1"));
+        }
+        i++;
     }
 
-    //if the last segment had no non-ws (i.e., ended with '|' or only spaces after it)
-    if (!saw_non_ws_since_pipe) {
-        printf("Command missing after pipe.\n");
-        return -1;
+    if(b->nwords == 0){
+        return -1;                      //no command
     }
 
+    //apply globbing on unquoted argv words (NOT on redirection filenames)
+    b->words[b->nwords] = NULL;
+    apply_globbing(b->words, b->quoted, &b->nwords);
+    return 0;
+}
+
+//appends a token to a growing array, val is taken over (freed if there is no room)
+static int push_token(QTok **arr, int *n, int *cap, char *val, bool quoted){
+    if(*n == *cap){
+        int grown = *cap * 2;
+        QTok *tmp = realloc(*arr, grown * sizeof(QTok));
+        if(!tmp){
+            perror("realloc");
+            free(val);
+            return -1;
+        }
+        *arr = tmp;
+        *cap = grown;
+    }
+    (*arr)[*n].val = val;
+    (*arr)[*n].was_quoted = quoted;
+    (*n)++;
     return 0;
 }
 
-/*command parsing function that extracts command arguments and redirection information
-tokenizes the input command and identifies redirection symbols
-returns 0 on success, -1 on error (with args[0] set to NULL)
+//a word that would be read as a pipe or redirection if it had been typed, e.g. the value of X='|' in $X
+static bool looks_like_op(const char *w){
+    return w[0] != '\0' && strspn(w, "0123456789|<>&-") == strlen(w) && strpbrk(w, "|<>&") != NULL;
+}
+
+/*parameter expansion (expand.h) over the tokens, which can turn a word into several fields or into none
+a here-document delimiter stays as written, redirection targets and NAME=value words are never split, and a field
+that came out looking like an operator is marked quoted so it stays a word; returns 0, or -1 once a word could not
+be expanded (the message is printed)
 */
-int parse_command(char *cmd, char *args[], char **inputFile, char **outputFile, char **errorFile, int isPipeline){
-    *inputFile = *outputFile = *errorFile = NULL;
+static int expand_tokens(QTok **toks, int *nt){
+    QTok *in = *toks;
+    int n = *nt, cap = n + 16, m = 0;
+    QTok *out = malloc(cap * sizeof(QTok));
+    if(!out){
+        perror("malloc");
+        return -1;
+    }
+    int rc = 0;
+    for(int i = 0; i < n && rc == 0; i++){
+        char *w = in[i].val;
+        int fd, type, flags, both;
+        if(!expand_needed(w)){
+            in[i].val = NULL;
+            rc = push_token(&out, &m, &cap, w, in[i].was_quoted);
+            continue;
+        }
+        if(m > 0 && heredoc_op(&out[m-1])){
+            char *tag = expand_literal(w);
+            rc = tag ? push_token(&out, &m, &cap, tag, in[i].was_quoted) : -1;
+            continue;
+        }
+        const char *eq = strchr(w, '=');
+        int split = !(m > 0 && redir_op(&out[m-1], &fd, &type, &flags, &both)) && !(eq && env_valid_name(w, eq - w));
+        char **fields;
+        int nf = expand_word(w, split, &fields);
+        if(nf < 0){
+            rc = -1;
+            break;
+        }
+        //"" followed by an empty expansion is still one (empty) word
+        if(nf == 0 && in[i].was_quoted){
+            rc = push_token(&out, &m, &cap, xstrdup(""), true);
+        }
+        for(int j = 0; j < nf; j++){
+            if(rc == 0){
+                rc = push_token(&out, &m, &cap, fields[j], in[i].was_quoted || looks_like_op(fields[j]));
+            }else{
+                free(fields[j]);
+            }
+        }
+        free(fields);
+    }
+    free_qtokens(in, n);
+    if(rc < 0){
+        free_qtokens(out, m);
+        *toks = NULL;
+        *nt = 0;
+        return -1;
+    }
+    *toks = out;
+    *nt = m;
+    return 0;
+}
 
-    QTok *toks=NULL; int nt=0;
-    if(qtokenize(cmd, &toks, &nt)!=0){
+/*command line parser: tokenizes once, splits stages on unquoted | tokens and extracts redirections,
+then packs everything into a single allocation (see Pipeline in parse.h)
+*/
+static Pipeline *parse_line(const char *text){
+    QTok *toks = NULL;
+    int nt = 0;
+    const char *rest;                   //here-document bodies
+    char *line = first_line(text, &rest);
+    if(line == NULL){
+        return NULL;
+    }
+    int rc = qtokenize(line, &toks, &nt);
+    free(line);
+    if(rc != 0){
         printf("Unclosed quotes.\n");
-        args[0]=NULL; return -1;
-    }
-    if(nt==0){ args[0]=NULL; free_qtokens(toks,nt); return -1; }
-
-    //first pass: copy into args[] + parallel quoted flags
-    bool quoted[MAX_ARGS]; int ac=0;
-    for(int i=0;i<nt;i++){
-        if(ac>=MAX_ARGS-1){ printf("Too many arguments.\n"); free_qtokens(toks,nt); args[0]=NULL; return -1; }
-        args[ac] = toks[i].val;             //take ownership of the string
-        quoted[ac] = toks[i].was_quoted;
-        ac++;
-    }
-    //toks array structure is no longer needed, but strings are now in args[], so free only the array
-    free(toks);
-
-    //validate redirections have filenames (only for unquoted operators)
-    for(int i=0;i<ac;i++){
-        if(!quoted[i] && (strcmp(args[i],"<")==0 || strcmp(args[i],">")==0 || strcmp(args[i],"2>")==0)){
-            if(i+1>=ac){ 
-                if(strcmp(args[i],"<")==0) printf("Input file not specified.\n");
-                else if(strcmp(args[i],">")==0) printf(isPipeline ? "Output file not specified after redirection.\n" : "Output file not specified.\n");
-                else printf("Error output file not specified.\n");
-                //free any heap strings in args[]
-                for(int k=0;k<ac;k++) free(args[k]);
-                args[0]=NULL; return -1;
-            }
+        return NULL;
+    }
+    if(expand_tokens(&toks, &nt) < 0){
+        return NULL;
+    }
+    if(nt == 0){
+        free_qtokens(toks, nt);
+        return NULL;
+    }
+
+    int nstages = count_stages(toks, nt);
+    if(nstages < 0){
+        free_qtokens(toks, nt);
+        return NULL;
+    }
+
+    //first pass: collect every stage and work out how large the single block has to be
+    StageBuild builds[MAX_PIPES];
+    size_t ptrs = 0, redirs = 0, strings = 0;
+    int start = 0, built = 0;
+    for(int i = 0; i <= nt; i++){
+        if(i < nt && !is_op(&toks[i], "|")){
+            continue;
+        }
+        StageBuild *b = &builds[built++];
+        b->nwords = b->nredirs = 0;
+        if(build_stage(toks + start, i - start, b, nstages > 1, &rest) < 0){
+            free_builds(builds, built);
+            free_qtokens(toks, nt);
+            return NULL;
         }
+        ptrs += b->nwords + 1;
+        redirs += b->nredirs;
+        for(int j = 0; j < b->nwords; j++){
+            strings += strlen(b->words[j]) + 1;
+        }
+        for(int j = 0; j < b->nredirs; j++){
+            strings += strlen(b->redirs[j].path) + 1;
+        }
+        start = i + 1;
     }
+    free_qtokens(toks, nt);             //operators and pipes, the words were taken over
 
-    //extract redirection filenames & remove the operator/filename pairs from argv (only for unquoted operators)
-    char *argv2[MAX_ARGS]; bool quoted2[MAX_ARGS]; int m=0;
-    for(int i=0;i<ac;i++){
-        if(!quoted[i] && strcmp(args[i],"<")==0){
-            *inputFile = strip_outer_quotes(args[i+1]); i++; continue;
-        }else if(!quoted[i] && strcmp(args[i],">")==0){
-            *outputFile = strip_outer_quotes(args[i+1]); i++; continue;
-        }else if(!quoted[i] && strcmp(args[i],"2>")==0){
-            *errorFile = strip_outer_quotes(args[i+1]); i++; continue;
-        }else{
-            argv2[m]=args[i]; quoted2[m]=quoted[i]; m++;
+    //second pass: lay out Command array, argv arrays, Redirect arrays and strings back to back
+    size_t size = sizeof(Pipeline) + nstages * sizeof(Command) + ptrs * sizeof(char *) + redirs * sizeof(Redirect) + strings;
+    Pipeline *pl = malloc(size);
+    if(!pl){
+        perror("malloc");
+        free_builds(builds, built);
+        return NULL;
+    }
+    pl->size = size;
+    pl->nstages = nstages;
+    char **argv_area = (char **)&pl->stages[nstages];
+    Redirect *redir_area = (Redirect *)(argv_area + ptrs);
+    char *str_area = (char *)(redir_area + redirs);
+
+    for(int s = 0; s < nstages; s++){
+        StageBuild *b = &builds[s];
+        Command *c = &pl->stages[s];
+        c->argv = argv_area;
+        c->argc = b->nwords;
+        c->redirs = redir_area;
+        c->nredirs = b->nredirs;
+        for(int j = 0; j < b->nwords; j++){
+            size_t n = strlen(b->words[j]) + 1;
+            c->argv[j] = memcpy(str_area, b->words[j], n);
+            str_area += n;
         }
+        c->argv[b->nwords] = NULL;
+        for(int j = 0; j < b->nredirs; j++){
+            size_t n = strlen(b->redirs[j].path) + 1;
+            c->redirs[j] = b->redirs[j];
+            c->redirs[j].path = memcpy(str_area, b->redirs[j].path, n);
+            str_area += n;
+        }
+        argv_area += b->nwords + 1;
+        redir_area += b->nredirs;
     }
-    argv2[m]=NULL;
+    free_builds(builds, built);
+    return pl;
+}
 
-    if(m==0){             //no command
-        if(*inputFile){ free(*inputFile); *inputFile=NULL; }
-        if(*outputFile){ free(*outputFile); *outputFile=NULL; }
-        if(*errorFile){ free(*errorFile); *errorFile=NULL; }
-        args[0]=NULL; return -1;
+Pipeline *parse_pipeline(const char *text){
+    long start = shellcore_now_ns();
+    Pipeline *pl = parse_line(text);
+    if(pl != NULL){
+        SHELL_STAT_ADD(parsed, 1);
+    }else{
+        SHELL_STAT_ADD(parse_errors, 1);
     }
+    SHELL_STAT_ADD(parse_ns, shellcore_now_ns() - start);
+    return pl;
+}
 
-    //apply globbing on unquoted argv words (NOT on redirection filenames)
-    apply_globbing(argv2, quoted2, &m);
+void free_pipeline(Pipeline *pl){
+    free(pl);
+}
 
-    //Copy back into args[]
-    for(int i=0;i<m;i++) args[i]=argv2[i];
-    args[m]=NULL;
+//pointer <-> offset conversions for pack/unpack, offsets are relative to the start of the block
+#define TO_OFF(base, p) ((void *)(uintptr_t)((const char *)(p) - (const char *)(base)))
+#define FROM_OFF(base, o) ((void *)((char *)(base) + (uintptr_t)(o)))
 
-    return 0;
+void *pipeline_pack(const Pipeline *pl, size_t *len){
+    Pipeline *img = malloc(pl->size);
+    if(!img){
+        perror("malloc");
+        return NULL;
+    }
+    memcpy(img, pl, pl->size);
+
+    //the copy still points into pl, rewrite every pointer as an offset
+    for(int s = 0; s < img->nstages; s++){
+        Command *c = &img->stages[s];
+        char **argv = FROM_OFF(img, TO_OFF(pl, c->argv));
+        Redirect *r = FROM_OFF(img, TO_OFF(pl, c->redirs));
+        for(int j = 0; j < c->argc; j++){
+            argv[j] = TO_OFF(pl, argv[j]);
+        }
+        for(int j = 0; j < c->nredirs; j++){
+            r[j].path = TO_OFF(pl, r[j].path);
+        }
+        c->argv = TO_OFF(pl, c->argv);
+        c->redirs = TO_OFF(pl, c->redirs);
+    }
+    *len = pl->size;
+    return img;
+}
+
+//checks that [off, off+n) lies inside a block of size bytes
+static int in_block(uintptr_t off, size_t n, size_t size){
+    return off <= size && n <= size - off;
+}
+
+//checks that a string offset points at a NUL-terminated string inside the block
+static int valid_string(const Pipeline *pl, uintptr_t off){
+    return off < pl->size && memchr((const char *)pl + off, '\0', pl->size - off) != NULL;
+}
+
+Pipeline *pipeline_unpack(const void *data, size_t len){
+    if(len < sizeof(Pipeline)){
+        return NULL;
+    }
+    Pipeline *pl = malloc(len);
+    if(!pl){
+        perror("malloc");
+        return NULL;
+    }
+    memcpy(pl, data, len);
+    if(pl->size != len || pl->nstages < 1 || pl->nstages > MAX_PIPES ||
+       !in_block(sizeof(Pipeline), pl->nstages * sizeof(Command), len)){
+        free(pl);
+        return NULL;
+    }
+
+    for(int s = 0; s < pl->nstages; s++){
+        Command *c = &pl->stages[s];
+        uintptr_t argv_off = (uintptr_t)c->argv;
+        uintptr_t redir_off = (uintptr_t)c->redirs;
+        if(c->argc < 1 || c->argc >= MAX_ARGS || c->nredirs < 0 || c->nredirs >= MAX_REDIRS ||
+           argv_off % sizeof(char *) != 0 || redir_off % sizeof(char *) != 0 ||
+           !in_block(argv_off, (c->argc + 1) * sizeof(char *), len) ||
+           !in_block(redir_off, c->nredirs * sizeof(Redirect), len)){
+            free(pl);
+            return NULL;
+        }
+        c->argv = FROM_OFF(pl, argv_off);
+        c->redirs = FROM_OFF(pl, redir_off);
+        for(int j = 0; j < c->argc; j++){
+            if(!valid_string(pl, (uintptr_t)c->argv[j])){
+                free(pl);
+                return NULL;
+            }
+            c->argv[j] = FROM_OFF(pl, c->argv[j]);
+        }
+        c->argv[c->argc] = NULL;
+        for(int j = 0; j < c->nredirs; j++){
+            const Redirect *r = &c->redirs[j];
+            if(!valid_string(pl, (uintptr_t)r->path) || r->fd < 0 || r->fd > MAX_REDIR_FD ||
+               r->type < REDIR_FILE || r->type > REDIR_DUP || r->dup_fd < -1 || r->dup_fd > MAX_REDIR_FD){
+                free(pl);
+                return NULL;
+            }
+            c->redirs[j].path = FROM_OFF(pl, c->redirs[j].path);
+        }
+    }
+    return pl;
 }
@@ -1,11 +1,32 @@
+#define _GNU_SOURCE
 #include "redir.h"
 #include <fcntl.h>
 #include <stdio.h>
 #include <unistd.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/mman.h>
+
+/*moves a freshly opened descriptor onto target_fd, open() may already have returned target_fd itself
+when n> names a closed descriptor; returns 0 on success, -1 on failure
+*/
+static int move_fd(int fd, int target_fd){
+    if(fd == target_fd){
+        return 0;
+    }
+    if(dup2(fd, target_fd) < 0){
+        dprintf(STDERR_FILENO, "dup2 failed: %s\n", strerror(errno));
+        close(fd);
+        return -1;
+    }
+    close(fd);
+    return 0;
+}
 
 /*helper function for file redirection that redirects file to standard streams
 This function opens a file and redirects it to stdin, stdout, or stderr
 Returns 0 on success, -1 on failure
+Only called in freshly forked children, so messages go out with dprintf (no stdio locks or buffers)
 */
 int setup_redirection(const char *filename, int flags, int target_fd) {
     int fd = open(filename, flags, 0644);
@@ -13,19 +34,79 @@ int setup_redirection(const char *filename, int flags, int target_fd) {
         //use the target stream, not flags (O_RDONLY is 0 on POSIX)
         if(target_fd == STDIN_FILENO){
             //assignment requires this exact message on stdout
-            printf("File not found.\n");
+            dprintf(STDOUT_FILENO, "File not found.\n");
         }else{
-            //keep perror for output/error file issues
-            perror("bad file");
+            //perror-style message for output/error file issues
+            dprintf(STDERR_FILENO, "bad file: %s\n", strerror(errno));
         }
         return -1;
     }
 
-    if(dup2(fd, target_fd) < 0){
-        perror("dup2 failed");
-        close(fd);
+    return move_fd(fd, target_fd);
+}
+
+//writes all of data to fd, returns 0 on success, -1 on failure
+static int write_all(int fd, const char *data, size_t len){
+    while(len > 0){
+        ssize_t n = write(fd, data, len);
+        if(n < 0 && errno == EINTR){
+            continue;
+        }
+        if(n <= 0){
+            return -1;
+        }
+        data += n;
+        len -= n;
+    }
+    return 0;
+}
+
+/*feeds a here-document or here-string to target_fd
+text that fits a pipe's capacity is written into a pipe up front (nothing has to stay behind to feed it),
+larger text goes into an anonymous memory file; returns 0 on success, -1 on failure
+*/
+int setup_data_redirection(const char *data, int target_fd){
+    size_t len = strlen(data);
+    int fds[2];
+    int fd = -1;
+
+    if(pipe(fds) == 0){
+        int cap = fcntl(fds[1], F_GETPIPE_SZ);
+        if(cap >= 0 && (size_t)cap < len){
+            cap = fcntl(fds[1], F_SETPIPE_SZ, len);    //up to /proc/sys/fs/pipe-max-size
+        }
+        if(cap >= 0 && (size_t)cap >= len && write_all(fds[1], data, len) == 0){
+            fd = fds[0];
+        }else{
+            close(fds[0]);
+        }
+        close(fds[1]);
+    }
+    if(fd < 0){
+        fd = memfd_create("here-document", 0);
+        if(fd < 0 || write_all(fd, data, len) < 0 || lseek(fd, 0, SEEK_SET) < 0){
+            dprintf(STDERR_FILENO, "here-document: %s\n", strerror(errno));
+            if(fd >= 0){
+                close(fd);
+            }
+            return -1;
+        }
+    }
+
+    return move_fd(fd, target_fd);
+}
+
+/*points target_fd at a descriptor that is already open (n>&m, or a file the parent took from the descriptor cache),
+the source stays open; a negative fd closes target_fd instead (n>&-), returns 0 on success, -1 on failure
+*/
+int setup_fd_redirection(int fd, int target_fd){
+    if(fd < 0){
+        close(target_fd);
+        return 0;
+    }
+    if(fd != target_fd && dup2(fd, target_fd) < 0){
+        dprintf(STDERR_FILENO, "dup2 failed: %s\n", strerror(errno));
         return -1;
     }
-    close(fd);
     return 0;
 }
@@ -1,138 +1,1894 @@
+#define _GNU_SOURCE
 #include "net.h"
-#include "parse.h"
-#include "exec.h"
+#include "shellcore.h"
+#include "evloop.h"
+#include "lz.h"
+#include "outcache.h"
+#include "cgroup.h"
+#include "shmring.h"
+#include "dircache.h"
+#include "complete.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <signal.h>
+#include <fcntl.h>
+#include <sys/wait.h>
+#include <sys/ioctl.h>
+#include <sys/eventfd.h>
+#include <sys/timerfd.h>
+#include <pthread.h>
+#include <sched.h>
+#include <time.h>
 
-//maximum length for command input buffer
-#define MAX_CMD_LENGTH 1024 
-//maximum number of arguments a command can have
-#define MAX_ARGS 64         
+//maximum length for a command frame, here-document bodies included (anything that fits the receive ring)
+#define MAX_CMD_LENGTH RECV_RING_SIZE
+//bytes read from a command's output pipe per FRAME_OUT
+#define OUT_CHUNK 4096
+//bytes read per frame when the client negotiated compression, larger blocks compress better and still fit the client's ring
+#define ZOUT_CHUNK 12288
+//largest frame spliced straight from a command's pipe to the socket, it has to fit the client's receive ring too
+#define SPLICE_CHUNK 12288
+//longest run of raw frames sent without retrying compression after incompressible output
+#define Z_MAX_BACKOFF 64
+//queued output above which the command's pipe is paused until the client catches up
+#define OUT_HIGH_WATER (256 * 1024)
+//upper bound for -w
+#define MAX_WORKERS 256
+//prepared commands one session can hold
+#define MAX_PREPARED 32
+//stdin bytes a streaming client may have in flight to the running command, granted with FRAME_CREDIT
+#define STDIN_WINDOW (64 * 1024)
+//most candidates in one completion answer, and the bytes the answer may take
+#define COMPLETE_MAX 64
+#define COMPLETE_REPLY_MAX 8192
+//reasons a running command was killed by the server, reported as the statuses timeout(1) and sh use
+#define STOP_TIMEOUT 124
+#define STOP_CANCEL 130
+//pidfds[] entry of a stage that has been reaped
+#define PIDFD_REAPED -2
+
+//a command the client registered with "prepare name command" and runs as "@name"
+typedef struct {
+    char *name;
+    Prepared *cmd;
+} NamedCommand;
+
+//one connected client and the command it is currently running
+typedef struct {
+    int fd;
+    RecvRing ring;              //read-ahead buffer for the client's frames
+    char *out;                  //frames queued for the client that the socket has not taken yet
+    size_t out_off, out_len, out_cap;
+    pid_t pids[MAX_PIPES];      //stages of the running command, npids is 0 when idle
+    int npids;
+    int out_pipe;               //read end of the running command's output pipe, -1 when not relaying
+    int pidfds[MAX_PIPES];      //exit notification of each stage, -1 if it is not watched, PIDFD_REAPED once reaped
+    int live;                   //watched stages not yet reaped
+    int status;                 //wait status of the last stage
+    int stdio[3];               //stdin/stdout/stderr handed over by a local client, -1 when not passed
+    double tokens;              //rate limiter bucket, one token per command
+    double refilled_at;         //monotonic time of the last refill
+    int compress;               //client negotiated LZ-compressed output frames
+    int z_skip;                 //raw frames left to send before trying compression again
+    int z_backoff;              //current back-off length, doubles on every incompressible frame
+    int no_splice;              //the socket does not support splice, always copy output through the queue
+    int relaying;               //an output frame is on its way as a linked read and send (io_uring), hold the queue back
+    int stream_stdin;           //client negotiated streaming its stdin to commands
+    int in_pipe;                //write end of the running command's stdin pipe, -1 when not streaming
+    int in_watched;             //in_pipe is registered with the loop, only while bytes are queued for it
+    char *in;                   //stdin bytes received but not yet taken by the pipe (at most STDIN_WINDOW)
+    size_t in_off, in_len;
+    long in_unacked;            //bytes passed to the command since the last credit
+    long in_received;           //stdin bytes received for the current command, checked against FRAME_INEOF
+    int in_eof;                 //client sent FRAME_INEOF, close the pipe once drained
+    int in_held;                //the next frame is not stdin (a pipelined command), stop reading until idle
+    OutEntry *fill;             //output cache entry the running command's output is recorded into, NULL if none
+    int cache_fd;               //eventfd the output cache signals when a result waited for is ready, -1 until needed
+    char *wait_cmd;             //command waiting for an identical one already running, NULL when not waiting
+    int cg_fd;                  //the session's cgroup leaf (-g), created with its first command, -1 if none
+    double timeout;             //deadline for each command in seconds, 0 for none (-T, or lower if the client asked)
+    int timer_fd;               //timerfd armed while a command runs under a deadline, -1 until needed
+    int timer_armed;
+    int stopped;                //why the running command was killed: 0, STOP_TIMEOUT or STOP_CANCEL
+    char cg_name[48];
+    ShmRing shm;                //output ring shared with a local client (FRAME_SHM), output goes there while it has room
+    NamedCommand prepared[MAX_PREPARED];
+    int nprepared;
+    EnvStore *env;              //the session's variables and $?, shares the server's environment until it sets one
+    int closing;                //exit requested, close once queued output is flushed
+} Session;
+
+//one acceptor/event-loop thread, sessions it accepts stay on it for their whole life
+typedef struct {
+    int id;
+    int listen_fd;              //own SO_REUSEPORT socket for TCP, shared socket for local addresses
+    int cpu;                    //CPU to pin to, -1 for no affinity
+    EvLoop *loop;
+    pthread_t thread;
+} Worker;
 
 //global variables for signal handling
-static int server_fd = -1;
-static int client_fd = -1;
+static Worker workers[MAX_WORKERS];
+static int num_workers = 1;
+//event loop of the worker running on this thread
+static _Thread_local EvLoop *loop = NULL;
+//whether the kernel supports pidfd_open, required to run commands on the client's own descriptors
+static int have_pidfd = 0;
+//clients connect over a local socket and may pass descriptors, their bytes are read with recvmsg
+static int local_clients = 0;
+
+//admission control settings, 0 means unlimited
+static int listen_backlog = DEFAULT_LISTEN_BACKLOG;
+static long max_sessions = 0;       //concurrent client sessions
+static long max_children = 0;       //command processes in flight across all sessions
+static double cmd_rate = 0;         //commands per second per client (token bucket refill rate)
+static double cmd_burst = 0;        //token bucket capacity
+static double cmd_timeout = 0;      //default and longest deadline per command in seconds
 
-//signal handler for graceful shutdown, closes sockets and exits cleanly
+//server-wide counters shared by all workers, updated with atomic builtins and reported by server-stats
+static struct {
+    long sessions;                  //open sessions
+    long children;                  //command processes running
+    long queued_bytes;              //output waiting in session queues for slow clients
+    long accepted;
+    long rejected_sessions;
+    long commands;
+    long rejected_commands;
+    long out_raw_bytes;             //command output produced
+    long out_wire_bytes;            //output frame payload actually queued after compression
+    long cache_hits;                //commands answered from the output cache
+    long cache_waits;               //commands that waited for an identical one already running
+    long cache_fills;               //results stored in the cache
+    long cg_usage_usec;             //CPU time used by the commands of ended sessions, from their cgroups
+    long cg_io_rbytes;              //and the bytes they read and wrote
+    long cg_io_wbytes;
+    long timeouts;                  //commands killed at their deadline
+    long cancels;                   //commands cancelled by their client
+    long shm_bytes;                 //output handed over through shared rings instead of frames
+    long completions;               //completion requests answered
+} stats;
+
+#define STAT_ADD(field, n) __atomic_add_fetch(&stats.field, (n), __ATOMIC_RELAXED)
+#define STAT_GET(field) __atomic_load_n(&stats.field, __ATOMIC_RELAXED)
+
+//signal handler for graceful shutdown, closes the listening sockets and exits cleanly
 void signal_handler(int sig){
+    (void)sig;
     printf("\n[INFO] Shutting down server...\n");
-    if(client_fd >= 0){
-        close_socket(client_fd);
-    }
-    if(server_fd >= 0){
-        close_socket(server_fd);
+    for(int i = 0; i < num_workers; i++){
+        if(workers[i].listen_fd >= 0 && (i == 0 || workers[i].listen_fd != workers[0].listen_fd)){
+            close_socket(workers[i].listen_fd);
+        }
     }
     exit(0);
 }
 
-//server main function, sets up socket, accepts client connections, and processes commands
-int main(int argc, char *argv[]) {
-    int port;
-    char cmd_buffer[MAX_CMD_LENGTH];
-    char *args[MAX_ARGS];
-    char *inputFile, *outputFile, *errorFile;
+//number of bytes queued for the client
+static size_t session_pending(const Session *s){
+    return s->out_len - s->out_off;
+}
 
-    //check command line arguments
-    if(argc != 2){
-        fprintf(stderr, "Usage: %s <port>\n", argv[0]);
-        exit(1);
+//whether the session is running a command or waiting for a cached result, no further commands are read meanwhile
+static int session_busy(const Session *s){
+    return s->npids > 0 || s->wait_cmd != NULL;
+}
+
+/*recomputes what the loop should watch for this session: client input unless a pipelined command waits for the running
+one (stdin and cancel frames are read meanwhile), socket writability only while output is queued, and the command's pipe
+only below the high-water mark
+*/
+static void session_update_interest(Session *s){
+    int events = 0;
+    if((!session_busy(s) || !s->in_held) && !s->closing){
+        events |= EV_READ;
+    }
+    if(session_pending(s) > 0 && !s->relaying){
+        events |= EV_WRITE;
     }
+    evloop_mod(loop, s->fd, events);
+    if(s->out_pipe >= 0){
+        evloop_mod(loop, s->out_pipe, session_pending(s) < OUT_HIGH_WATER && !s->relaying ? EV_READ : 0);
+    }
+}
 
-    port = atoi(argv[1]);
-    if(port <= 0 || port > 65535){
-        fprintf(stderr, "Error: Invalid port number\n");
-        exit(1);
+//ends the running command's stdin stream, anything still queued for it is dropped
+static void session_stdin_close(Session *s){
+    if(s->in_watched){
+        evloop_del(loop, s->in_pipe);
+        s->in_watched = 0;
+    }
+    if(s->in_pipe >= 0){
+        close(s->in_pipe);
+        s->in_pipe = -1;
     }
+    s->in_off = s->in_len = 0;
+}
 
-    //set up signal handlers for graceful shutdown
-    signal(SIGINT, signal_handler);
-    signal(SIGTERM, signal_handler);
+//children a closed session left behind that no pidfd watches, swept with WNOHANG until they exit
+static _Thread_local pid_t *orphans = NULL;
+static _Thread_local int norphans = 0, orphans_cap = 0;
 
-    //create server socket
-    server_fd = create_server_socket(port);
-    if(server_fd < 0){
-        fprintf(stderr, "Error: Failed to create server socket\n");
-        exit(1);
+//an orphaned stage's pidfd fired: it has exited, reap it
+static void on_orphan(EvLoop *lp, int fd, int events, void *arg){
+    (void)events;
+    waitpid((pid_t)(long)arg, NULL, WNOHANG);
+    evloop_del(lp, fd);
+    close(fd);
+}
+
+/*hands a stage whose session is gone to the loop so the worker never blocks on it, pidfd is its open pidfd or -1
+it is watched by a pidfd when there is one and otherwise kept for sweep_orphans
+*/
+static void session_orphan(pid_t pid, int pidfd){
+    if(pidfd < 0 && have_pidfd){
+        pidfd = open_pidfd(pid);
+    }
+    if(pidfd >= 0){
+        if(evloop_add(loop, pidfd, EV_READ, on_orphan, (void *)(long)pid) == 0){
+            return;
+        }
+        close(pidfd);
     }
+    if(waitpid(pid, NULL, WNOHANG) != 0){
+        return;
+    }
+    if(norphans == orphans_cap){
+        int cap = orphans_cap ? orphans_cap * 2 : 16;
+        pid_t *tmp = realloc(orphans, cap * sizeof(*tmp));
+        if(tmp == NULL){
+            perror("realloc");
+            return;                 //left a zombie until the server exits
+        }
+        orphans = tmp;
+        orphans_cap = cap;
+    }
+    orphans[norphans++] = pid;
+}
 
-    printf("[INFO] Server started on port %d\n", port);
+//reaps the orphans that exited since the last sweep
+static void sweep_orphans(void){
+    int kept = 0;
+    for(int i = 0; i < norphans; i++){
+        if(waitpid(orphans[i], NULL, WNOHANG) == 0){
+            orphans[kept++] = orphans[i];
+        }
+    }
+    norphans = kept;
+}
 
-    //main server loop
-    while (1){
-        //accept client connection
-        client_fd = accept_client_connection(server_fd);
-        if(client_fd < 0){
-            fprintf(stderr, "Error: Failed to accept client connection\n");
+//accounts a session's cgroup into the server-wide counters and removes it, its commands have been killed
+static void session_cgroup_close(Session *s){
+    CgroupUsage u;
+    if(cgroup_usage(s->cg_fd, &u) == 0){
+        STAT_ADD(cg_usage_usec, u.usage_usec);
+        STAT_ADD(cg_io_rbytes, u.io_rbytes);
+        STAT_ADD(cg_io_wbytes, u.io_wbytes);
+        printf("[INFO] Session used %ld ms CPU (%ld user, %ld system), %ld KB peak memory, %ld/%ld bytes read/written\n",
+               u.usage_usec / 1000, u.user_usec / 1000, u.system_usec / 1000, u.memory_peak >= 0 ? u.memory_peak / 1024 : -1,
+               u.io_rbytes, u.io_wbytes);
+    }
+    cgroup_destroy(s->cg_fd, s->cg_name);
+    s->cg_fd = -1;
+}
+
+//tears a session down, a command still running is killed with its whole process group
+//and its stages are left to the loop to reap, the session is freed right away
+static void session_close(Session *s){
+    STAT_ADD(sessions, -1);
+    STAT_ADD(children, -s->npids);
+    STAT_ADD(queued_bytes, -(long)session_pending(s));
+    evloop_del(loop, s->fd);
+    close_socket(s->fd);
+    session_stdin_close(s);
+    if(s->fill != NULL){
+        outcache_finish(s->fill, 0, 0);
+    }
+    if(s->wait_cmd != NULL){
+        outcache_cancel(s->cache_fd);
+        evloop_del(loop, s->cache_fd);
+    }
+    shmring_unmap(&s->shm);
+    env_free(s->env);
+    for(int i = 0; i < s->nprepared; i++){
+        free(s->prepared[i].name);
+        free_prepared(s->prepared[i].cmd);
+    }
+    if(s->cache_fd >= 0){
+        close(s->cache_fd);
+    }
+    if(s->out_pipe >= 0){
+        evloop_del(loop, s->out_pipe);
+        close(s->out_pipe);
+    }
+    //nothing is left to read the command's output, it dies with everything it forked, even what ignores a hangup (nohup),
+    //before the loop reaps it: the process group as on a deadline, and the cgroup leaf for whatever left the group
+    if(s->npids > 0){
+        kill(-s->pids[0], SIGKILL);
+    }
+    if(s->cg_fd >= 0){
+        cgroup_kill(s->cg_fd);
+    }
+    for(int i = 0; i < s->npids; i++){
+        if(s->pidfds[i] == PIDFD_REAPED){
             continue;
         }
+        if(s->pidfds[i] >= 0){
+            evloop_del(loop, s->pidfds[i]);
+        }
+        session_orphan(s->pids[i], s->pidfds[i]);
+    }
+    if(s->timer_fd >= 0){
+        if(s->timer_armed){
+            evloop_del(loop, s->timer_fd);
+        }
+        close(s->timer_fd);
+    }
+    for(int i = 0; i < 3; i++){
+        if(s->stdio[i] >= 0){
+            close(s->stdio[i]);
+        }
+    }
+    if(s->cg_fd >= 0){
+        session_cgroup_close(s);
+    }
+    recv_ring_take_fds(&s->ring, NULL, 0);     //closes descriptors that arrived without their frame
+    free(s->out);
+    free(s->in);
+    free(s->wait_cmd);
+    free(s);
+    printf("[INFO] Client session ended\n");
+}
 
-        printf("[INFO] Client session started\n");
+//makes room for len more bytes at the end of the output queue, returns where they go or NULL if out of memory
+static char *session_reserve(Session *s, size_t len){
+    size_t need = s->out_len + len;
 
-        //process commands from client
-        while(1){
-            //receive command from client
-            int bytes_received = receive_line(client_fd, cmd_buffer, sizeof(cmd_buffer));
-            
-            if(bytes_received <= 0){
-                if(bytes_received == 0){
-                    printf("[INFO] Client disconnected\n");
-                }else{
-                    perror("Error receiving command");
-                }
+    //compact consumed bytes before growing
+    if(s->out_off > 0 && need > s->out_cap){
+        memmove(s->out, s->out + s->out_off, s->out_len - s->out_off);
+        s->out_len -= s->out_off;
+        s->out_off = 0;
+        need = s->out_len + len;
+    }
+    if(need > s->out_cap){
+        size_t cap = s->out_cap ? s->out_cap : OUT_CHUNK * 4;
+        while(cap < need){
+            cap *= 2;
+        }
+        char *tmp = realloc(s->out, cap);
+        if(!tmp){
+            perror("realloc");
+            return NULL;
+        }
+        s->out = tmp;
+        s->out_cap = cap;
+    }
+    return s->out + s->out_len;
+}
+
+//appends one frame to the session's output queue
+static int session_queue(Session *s, int type, const void *data, size_t len){
+    uint32_t header = FRAME_HEADER(type, len);
+    char *p = session_reserve(s, sizeof(header) + len);
+    if(p == NULL){
+        return -1;
+    }
+    memcpy(p, &header, sizeof(header));
+    memcpy(p + sizeof(header), data, len);
+    s->out_len += sizeof(header) + len;
+    STAT_ADD(queued_bytes, sizeof(header) + len);
+    return 0;
+}
+
+//puts bytes in front of everything queued, for the part of a frame that was already on its way
+static int session_requeue(Session *s, const void *data, size_t len){
+    if(session_reserve(s, len) == NULL){
+        return -1;
+    }
+    memmove(s->out + s->out_off + len, s->out + s->out_off, session_pending(s));
+    memcpy(s->out + s->out_off, data, len);
+    s->out_len += len;
+    STAT_ADD(queued_bytes, len);
+    return 0;
+}
+
+//pushes queued frames into the socket until it would block, returns -1 if the client is gone
+//frames queued behind a relayed one wait for it to complete
+static int session_flush(Session *s){
+    while(session_pending(s) > 0 && !s->relaying){
+        ssize_t n = send(s->fd, s->out + s->out_off, session_pending(s), MSG_NOSIGNAL);
+        if(n < 0){
+            if(errno == EINTR){
+                continue;
+            }
+            if(errno == EAGAIN || errno == EWOULDBLOCK){
                 break;
             }
+            return -1;
+        }
+        s->out_off += n;
+        STAT_ADD(queued_bytes, -n);
+    }
+    if(session_pending(s) == 0){
+        s->out_off = s->out_len = 0;
+    }
+    return 0;
+}
+
+static void on_output(EvLoop *lp, int fd, int events, void *arg);
+static void on_child(EvLoop *lp, int fd, int events, void *arg);
+static int session_output_closed(Session *s);
+static void on_stdin(EvLoop *lp, int fd, int events, void *arg);
+static void on_cache_ready(EvLoop *lp, int fd, int events, void *arg);
+static void on_timeout(EvLoop *lp, int fd, int events, void *arg);
+static int session_queue_output(Session *s, const char *buf, int n);
+static int session_done(Session *s);
+static int session_process_input(Session *s);
+static int session_refuse(Session *s, const char *reason);
+
+//starts the running command's deadline, if the timer cannot be set the command runs without one
+static void session_arm_timer(Session *s){
+    if(s->timeout <= 0){
+        return;
+    }
+    if(s->timer_fd < 0 && (s->timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC)) < 0){
+        perror("timerfd_create");
+        return;
+    }
+    struct itimerspec its;
+    memset(&its, 0, sizeof(its));
+    its.it_value.tv_sec = (time_t)s->timeout;
+    its.it_value.tv_nsec = (long)((s->timeout - its.it_value.tv_sec) * 1e9);
+    if(its.it_value.tv_sec == 0 && its.it_value.tv_nsec == 0){
+        its.it_value.tv_nsec = 1;                   //all zero would disarm it
+    }
+    if(timerfd_settime(s->timer_fd, 0, &its, NULL) < 0 || evloop_add(loop, s->timer_fd, EV_READ, on_timeout, s) < 0){
+        perror("command timer");
+        return;
+    }
+    s->timer_armed = 1;
+}
+
+static void session_disarm_timer(Session *s){
+    if(!s->timer_armed){
+        return;
+    }
+    struct itimerspec off;
+    memset(&off, 0, sizeof(off));
+    timerfd_settime(s->timer_fd, 0, &off, NULL);
+    evloop_del(loop, s->timer_fd);
+    s->timer_armed = 0;
+}
+
+/*tracks every stage through a pidfd so the loop hears when it exits, without SIGCHLD or a blocking waitpid
+a stage that cannot be watched keeps pidfds[i] == -1 for session_reap_unwatched, returns the number watched
+*/
+static int session_watch_children(Session *s){
+    s->live = 0;
+    for(int i = 0; i < s->npids; i++){
+        s->pidfds[i] = have_pidfd ? open_pidfd(s->pids[i]) : -1;
+        if(s->pidfds[i] >= 0 && evloop_add(loop, s->pidfds[i], EV_READ, on_child, s) < 0){
+            close(s->pidfds[i]);
+            s->pidfds[i] = -1;
+        }
+        if(s->pidfds[i] < 0 && have_pidfd){
+            perror("pidfd_open failed");
+        }
+        s->live += s->pidfds[i] >= 0;
+    }
+    return s->live;
+}
+
+//reaps the stages no pidfd watches, blocking; only called once their output is closed or they have been killed
+static void session_reap_unwatched(Session *s){
+    for(int i = 0; i < s->npids; i++){
+        int st;
+        if(s->pidfds[i] != -1){
+            continue;
+        }
+        if(waitpid(s->pids[i], &st, 0) > 0 && i == s->npids - 1){
+            s->status = st;
+        }
+        s->pidfds[i] = PIDFD_REAPED;
+    }
+}
+
+//creates the pipe a command reads the client's stdin stream from, in[0] goes to the command, returns -1 on failure
+static int session_stdin_pipe(Session *s, int in[2]){
+    if(pipe(in) < 0){
+        perror("pipe failed");
+        return -1;
+    }
+    fcntl(in[0], F_SETFD, FD_CLOEXEC);
+    set_nonblocking(in[1]);
+    tune_pipe(in[1]);
+    if(s->in == NULL && (s->in = malloc(STDIN_WINDOW)) == NULL){
+        perror("malloc");
+        close(in[0]);
+        close(in[1]);
+        return -1;
+    }
+    return 0;
+}
+
+/*answers a command from the output cache when a rule covers it, returns 1 if it was handled (the cached result is queued,
+or the session now waits for an identical command already running), 0 to run it (its output is recorded when s->fill
+is set), -1 on failure
+*/
+static int session_try_cache(Session *s, const char *cmd, const Pipeline *pl){
+    char *out;
+    size_t len;
+    int status;
+
+    if(s->cache_fd < 0 && (s->cache_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)) < 0){
+        perror("eventfd");
+        return 0;
+    }
+    int rc = outcache_lookup(cmd, pl, env_envp(s->env), s->cache_fd, &s->fill, &out, &len, &status);
+    if(rc == OUTCACHE_WAIT){
+        if((s->wait_cmd = strdup(cmd)) == NULL || evloop_add(loop, s->cache_fd, EV_READ, on_cache_ready, s) < 0){
+            outcache_cancel(s->cache_fd);
+            free(s->wait_cmd);
+            s->wait_cmd = NULL;
+            return -1;
+        }
+        STAT_ADD(cache_waits, 1);
+        printf("[INFO] Waiting for an identical command already running\n");
+        return 1;
+    }
+    if(rc != OUTCACHE_HIT){
+        return 0;
+    }
+
+    STAT_ADD(cache_hits, 1);
+    printf("[INFO] Answered from the output cache\n");
+    for(size_t off = 0; off < len; off += ZOUT_CHUNK){
+        if(session_queue_output(s, out + off, len - off < ZOUT_CHUNK ? len - off : ZOUT_CHUNK) < 0){
+            free(out);
+            return -1;
+        }
+    }
+    free(out);
+    char done[16];
+    snprintf(done, sizeof(done), "%d", status);
+    return session_queue(s, FRAME_DONE, done, strlen(done)) < 0 ? -1 : 1;
+}
+
+static const Prepared *session_find_prepared(Session *s, const char *name){
+    for(int i = 0; i < s->nprepared; i++){
+        if(strcmp(s->prepared[i].name, name) == 0){
+            return s->prepared[i].cmd;
+        }
+    }
+    return NULL;
+}
+
+/*handles "prepare name command" (the command may be quoted as a whole) and "unprepare name", answered without forking
+a prepared command is parsed, planned and has its binaries resolved right here, "@name" then only spawns it
+*/
+static void session_prepare(Session *s, const char *args, int remove){
+    char name[64];
+    char text[256];
+    int n = 0;
+    const char *status = "1";
+
+    args += strspn(args, " \t");
+    size_t len = strcspn(args, " \t");
+    if(len == 0 || len >= sizeof(name)){
+        n = snprintf(text, sizeof(text), "usage: prepare name command | unprepare name\n");
+        session_queue(s, FRAME_OUT, text, n);
+        session_queue(s, FRAME_DONE, status, 1);
+        return;
+    }
+    memcpy(name, args, len);
+    name[len] = '\0';
+    const char *cmd = args + len + strspn(args + len, " \t");
+    env_use(s->env);
+
+    int slot = 0;
+    while(slot < s->nprepared && strcmp(s->prepared[slot].name, name) != 0){
+        slot++;
+    }
+    if(remove){
+        if(slot == s->nprepared){
+            n = snprintf(text, sizeof(text), "%s: no such prepared command.\n", name);
+        }else{
+            free(s->prepared[slot].name);
+            free_prepared(s->prepared[slot].cmd);
+            s->prepared[slot] = s->prepared[--s->nprepared];
+            status = "0";
+        }
+    }else if(slot == MAX_PREPARED){
+        n = snprintf(text, sizeof(text), "prepare: at most %d prepared commands per session\n", MAX_PREPARED);
+    }else{
+        //prepare q1 "grep -c ERROR app.log" is the same as prepare q1 grep -c ERROR app.log
+        char *line = strdup(cmd);
+        size_t m = line != NULL ? strlen(line) : 0;
+        if(m >= 2 && (line[0] == '"' || line[0] == '\'') && strchr(line + 1, line[0]) == line + m - 1){
+            memmove(line, line + 1, m - 2);
+            line[m - 2] = '\0';
+        }
+        Prepared *p = line != NULL && line[0] != '\0' ? prepare_pipeline(line) : NULL;
+        char *dup = p != NULL ? strdup(name) : NULL;
+        if(dup == NULL){
+            const char *why = expand_take_error();
+            n = snprintf(text, sizeof(text), "prepare: %s: %s", name, why != NULL ? why : "invalid command\n");
+            free_prepared(p);
+        }else{
+            if(slot < s->nprepared){
+                free(s->prepared[slot].name);
+                free_prepared(s->prepared[slot].cmd);
+            }else{
+                s->nprepared++;
+            }
+            s->prepared[slot].name = dup;
+            s->prepared[slot].cmd = p;
+            status = "0";
+            printf("[INFO] Prepared %s: \"%s\"\n", name, line);
+        }
+        free(line);
+    }
+    if(n > 0){
+        session_queue(s, FRAME_OUT, text, n);
+    }
+    session_queue(s, FRAME_DONE, status, 1);
+}
+
+//parses and launches one command with its output routed through a pipe back to the client, returns -1 if nothing was started
+//when a local client handed over its own descriptors the stages write straight to them and are tracked with pidfds,
+//otherwise output is relayed through a pipe and a streaming client's stdin is fed to the command through another one
+static int session_start(Session *s, const char *cmd_buffer){
+    int fds[2] = {-1, -1};
+    int in[2] = {-1, -1};
+    int pipe_io[3];
+    const int *io;
+    int direct = have_pidfd && s->stdio[1] >= 0;
+
+    s->npids = 0;
+    //words expand from the session's variables, and its commands get them as their environment
+    env_use(s->env);
+    //"@name" runs a prepared command: no parsing, planning or PATH search
+    const Prepared *prep = NULL;
+    Pipeline *owned = NULL;
+    if(cmd_buffer[0] == '@'){
+        if((prep = session_find_prepared(s, cmd_buffer + 1)) == NULL){
+            char text[96];
+            int n = snprintf(text, sizeof(text), "%.64s: no such prepared command.\n", cmd_buffer + 1);
+            session_queue(s, FRAME_OUT, text, n);
+            return -1;
+        }
+    }else if((owned = parse_pipeline(cmd_buffer)) == NULL){
+        //a word that could not be expanded is explained to the client
+        const char *why = expand_take_error();
+        if(why != NULL){
+            session_queue(s, FRAME_OUT, why, strlen(why));
+        }
+        printf("[INFO] Command parsing failed\n");
+        return -1;
+    }
+    const Pipeline *pl = prep != NULL ? prep->pl : owned;
+
+    //assignments, export and unset only change the session's variables, answered without forking
+    int status;
+    if(owned != NULL && env_builtin(s->env, owned, &status)){
+        char done[16];
+        free_pipeline(owned);
+        env_set_status(s->env, status);
+        snprintf(done, sizeof(done), "%d", status);
+        return session_queue(s, FRAME_DONE, done, strlen(done)) < 0 ? -1 : 0;
+    }
 
-            //log the received command
-            printf("[RECEIVED] Received command: \"%s\" from client.\n", cmd_buffer);
+    //each stage can be a process, refuse up front rather than fork past the limit
+    if(max_children > 0 && STAT_GET(children) + pl->nstages > max_children){
+        free_pipeline(owned);
+        STAT_ADD(commands, -1);         //counted when it was read, it never ran
+        return session_refuse(s, "too many commands running") < 0 ? -1 : 0;
+    }
 
-            //handle exit command
-            if(strcmp(cmd_buffer, "exit") == 0){
-                printf("[INFO] Client requested exit\n");
+    //relayed output can come from the output cache instead
+    if(!direct && outcache_enabled()){
+        int rc = session_try_cache(s, prep != NULL ? prep->text : cmd_buffer, pl);
+        if(rc != 0){
+            free_pipeline(owned);
+            return rc > 0 ? 0 : -1;
+        }
+    }
+
+    if(direct){
+        io = s->stdio;
+    }else{
+        if(s->stream_stdin && session_stdin_pipe(s, in) < 0){
+            free_pipeline(owned);
+            return -1;
+        }
+        if(pipe(fds) < 0){
+            perror("pipe failed");
+            if(in[0] >= 0){
+                close(in[0]);
+                close(in[1]);
+            }
+            free_pipeline(owned);
+            return -1;
+        }
+        //both ends close-on-exec so concurrent commands never hold each other's pipes open, the child's dup2'd copies survive
+        fcntl(fds[1], F_SETFD, FD_CLOEXEC);
+        set_nonblocking(fds[0]);
+        tune_pipe(fds[0]);
+        pipe_io[0] = in[0];
+        pipe_io[1] = pipe_io[2] = fds[1];
+        io = pipe_io;
+    }
+
+    //the session's commands share a cgroup leaf, a failure to create one leaves them in the server's
+    if(cgroup_enabled() && s->cg_fd < 0){
+        s->cg_fd = cgroup_create(s->cg_name, sizeof(s->cg_name));
+    }
+    printf(pl->nstages > 1 ? "[INFO] Executing pipeline command\n" : "[INFO] Executing single command\n");
+    //a process group of its own lets a timeout or cancel kill the whole command in one go
+    SpawnOptions opt = {io, s->cg_fd, 1};
+    int n = prep != NULL ? spawn_prepared(prep, &opt, s->pids) : spawn_pipeline_opts(pl, &opt, s->pids);
+    if(n > 0){
+        s->npids = n;
+        session_arm_timer(s);
+    }
+    free_pipeline(owned);
+    STAT_ADD(children, s->npids);
+
+    if(direct){
+        if(s->npids == 0){
+            return -1;
+        }
+        //the stages exit on their own, each pidfd turns readable when its process does
+        if(session_watch_children(s) < s->npids){
+            session_reap_unwatched(s);
+        }
+        if(s->live == 0){
+            //everything was reaped above, report it like any other finished command
+            return session_done(s) < 0 ? -2 : 0;
+        }
+        return 0;
+    }
+
+    close(fds[1]);
+    if(in[0] >= 0){
+        close(in[0]);
+    }
+    if(s->npids == 0){
+        close(fds[0]);
+        if(in[1] >= 0){
+            close(in[1]);
+        }
+        return -1;
+    }
+    if(evloop_add(loop, fds[0], EV_READ, on_output, s) < 0){
+        //nobody will drain the output, the stages are killed like on a closed session
+        close(fds[0]);
+        if(in[1] >= 0){
+            close(in[1]);
+        }
+        kill(-s->pids[0], SIGKILL);
+        for(int i = 0; i < s->npids; i++){
+            session_orphan(s->pids[i], -1);
+        }
+        STAT_ADD(children, -s->npids);
+        s->npids = 0;
+        return -1;
+    }
+    s->out_pipe = fds[0];
+    //the command is over once its output hit EOF and every stage was reaped, in whichever order the loop sees them
+    session_watch_children(s);
+
+    //open the stdin window, the client starts sending as soon as it sees the credit
+    if(in[1] >= 0){
+        char credit[24];
+        s->in_pipe = in[1];
+        s->in_off = s->in_len = 0;
+        s->in_unacked = s->in_received = 0;
+        s->in_eof = s->in_held = 0;
+        snprintf(credit, sizeof(credit), "%d", STDIN_WINDOW);
+        if(session_queue(s, FRAME_CREDIT, credit, strlen(credit)) < 0){
+            return -1;
+        }
+    }
+    return 0;
+}
+
+//reports the finished command's status and resumes reading commands, returns -1 if the session was closed
+static int session_done(Session *s){
+    int status = s->status;
+    char done[16];
+
+    STAT_ADD(children, -s->npids);
+    s->npids = 0;
+    s->live = 0;
+    s->status = 0;
+    session_stdin_close(s);
+    session_disarm_timer(s);
+    s->in_eof = s->in_held = 0;
+
+    int code = WIFEXITED(status) ? WEXITSTATUS(status) : 128 + WTERMSIG(status);
+    int stopped = s->stopped;
+    s->stopped = 0;
+    if(stopped){
+        code = stopped;
+    }
+    if(s->fill != NULL){
+        //output that may depend on what the client streamed to stdin is not reusable, nor is a killed command's
+        if(outcache_finish(s->fill, s->in_received == 0 && !stopped, code)){
+            STAT_ADD(cache_fills, 1);
+        }
+        s->fill = NULL;
+    }
+    if(stopped == STOP_TIMEOUT){
+        static const char msg[] = "Command timed out.\n";
+        if(session_queue(s, FRAME_OUT, msg, sizeof(msg) - 1) < 0){
+            session_close(s);
+            return -1;
+        }
+    }
+    env_set_status(s->env, code);
+    snprintf(done, sizeof(done), "%d", code);
+    if(session_queue(s, FRAME_DONE, done, strlen(done)) < 0 || session_flush(s) < 0){
+        session_close(s);
+        return -1;
+    }
+
+    //frames the client pipelined while the command ran are already sitting in the ring
+    return session_process_input(s);
+}
+
+/*kills the running command's process group (a timeout or the client's cancel) and reaps it through pidfds rather than
+waiting for EOF on its output pipe, which something it forked could hold open; returns -1 if the session was closed
+*/
+static int session_stop(Session *s, int reason){
+    if(s->npids == 0 || s->stopped){
+        return 0;
+    }
+    s->stopped = reason;
+    kill(-s->pids[0], SIGKILL);
+    session_stdin_close(s);
+    if(s->out_pipe < 0){
+        return 0;                       //already tracked by pidfd, on_child finishes the command
+    }
+    evloop_del(loop, s->out_pipe);
+    close(s->out_pipe);
+    s->out_pipe = -1;
+    return session_output_closed(s);
+}
+
+//the running command reached its deadline
+static void on_timeout(EvLoop *lp, int fd, int events, void *arg){
+    Session *s = arg;
+    uint64_t expirations;
+    (void)lp;
+    (void)events;
+
+    if(read(fd, &expirations, sizeof(expirations)) < 0 && errno != EAGAIN){
+        perror("timerfd read");
+    }
+    session_disarm_timer(s);
+    if(s->npids == 0){
+        return;
+    }
+    STAT_ADD(timeouts, 1);
+    printf("[INFO] Command timed out after %g s\n", s->timeout);
+    if(session_stop(s, STOP_TIMEOUT) == 0 && session_flush(s) < 0){
+        session_close(s);
+    }
+}
+
+/*the relayed command's output is closed: it is done unless a watched stage is still running (one that closed its
+stdout early, or is still reading the client's stdin), on_child finishes it then; returns -1 if the session was closed
+*/
+static int session_output_closed(Session *s){
+    session_reap_unwatched(s);
+    if(s->live > 0){
+        session_update_interest(s);
+        return 0;
+    }
+    return session_done(s);
+}
+
+//a command's output pipe hit EOF, returns -1 if the session was closed
+static int session_finish(Session *s){
+    evloop_del(loop, s->out_pipe);
+    close(s->out_pipe);
+    s->out_pipe = -1;
+    return session_output_closed(s);
+}
+
+//a stage exited, reap it and finish the command once all have and its output (if relayed) is closed
+static void on_child(EvLoop *lp, int fd, int events, void *arg){
+    Session *s = arg;
+    (void)events;
+
+    for(int i = 0; i < s->npids; i++){
+        if(s->pidfds[i] != fd){
+            continue;
+        }
+        int st;
+        if(waitpid(s->pids[i], &st, 0) > 0 && i == s->npids - 1){
+            s->status = st;
+        }
+        evloop_del(lp, fd);
+        close(fd);
+        s->pidfds[i] = PIDFD_REAPED;
+        if(--s->live == 0 && s->out_pipe < 0){
+            session_done(s);
+        }
+        return;
+    }
+}
+
+//maps the output ring a local client passed, its HELLO answer says whether it is used
+static void session_take_shm(Session *s){
+    int fd;
+    if(recv_ring_take_fds(&s->ring, &fd, 1) != 1){
+        return;
+    }
+    shmring_unmap(&s->shm);
+    if(shmring_map(&s->shm, fd) < 0){
+        fprintf(stderr, "[WARN] Client passed an unusable output ring\n");
+    }else{
+        printf("[INFO] Client shares a %zu KB output ring\n", s->shm.size / 1024);
+    }
+    close(fd);
+}
+
+//adopts descriptors passed by a local client, later commands read and write them directly
+static void session_take_stdio(Session *s){
+    int fds[RING_MAX_FDS];
+    int n = recv_ring_take_fds(&s->ring, fds, RING_MAX_FDS);
+
+    for(int i = 0; i < 3; i++){
+        if(s->stdio[i] >= 0){
+            close(s->stdio[i]);
+        }
+        s->stdio[i] = i < n ? fds[i] : -1;
+    }
+    printf("[INFO] Client passed %d descriptor(s)%s\n", n, have_pidfd ? "" : ", relaying output (no pidfd support)");
+}
+
+//monotonic clock in seconds, for the rate limiter
+static double now_seconds(void){
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+//admission control for one command before it is parsed, returns NULL if it may run or the reason it is refused
+//(the child process limit is checked once the parsed command says how many stages it has)
+static const char *session_admit(Session *s){
+    //token bucket: refill by elapsed time, each command spends one token
+    if(cmd_rate > 0){
+        double now = now_seconds();
+        s->tokens += (now - s->refilled_at) * cmd_rate;
+        if(s->tokens > cmd_burst){
+            s->tokens = cmd_burst;
+        }
+        s->refilled_at = now;
+        if(s->tokens < 1.0){
+            return "rate limit exceeded";
+        }
+        s->tokens -= 1.0;
+    }
+    return NULL;
+}
+
+//answers a command admission control turned down, returns -1 if the session is out of memory
+static int session_refuse(Session *s, const char *reason){
+    STAT_ADD(rejected_commands, 1);
+    printf("[INFO] Command refused: %s\n", reason);
+    return session_queue(s, FRAME_BUSY, reason, strlen(reason));
+}
+
+//reports what this session's commands have used so far, read from its cgroup
+static void session_send_usage(Session *s){
+    char text[512];
+    CgroupUsage u;
+    int n;
+    if(s->cg_fd < 0 || cgroup_usage(s->cg_fd, &u) < 0){
+        n = snprintf(text, sizeof(text), "no cgroup accounting for this session\n");
+    }else{
+        n = snprintf(text, sizeof(text), "cpu_usec %ld\nuser_usec %ld\nsystem_usec %ld\nmemory_peak %ld\nio_rbytes %ld\nio_wbytes %ld\n",
+                     u.usage_usec, u.user_usec, u.system_usec, u.memory_peak, u.io_rbytes, u.io_wbytes);
+    }
+    session_queue(s, FRAME_OUT, text, n);
+    session_queue(s, FRAME_DONE, "0", 1);
+}
+
+//formats the server-wide counters and accept-queue depths for the server-stats command
+static void session_send_stats(Session *s){
+    char text[2048];
+    int n = snprintf(text, sizeof(text),
+                     "sessions %ld\nchildren %ld\nqueued_bytes %ld\naccepted %ld\nrejected_sessions %ld\ncommands %ld\nrejected_commands %ld\n"
+                     "out_raw_bytes %ld\nout_wire_bytes %ld\ncache_hits %ld\ncache_waits %ld\ncache_fills %ld\n"
+                     "cgroup_cpu_usec %ld\ncgroup_io_rbytes %ld\ncgroup_io_wbytes %ld\ntimeouts %ld\ncancels %ld\nshm_bytes %ld\ncompletions %ld\n",
+                     STAT_GET(sessions), STAT_GET(children), STAT_GET(queued_bytes), STAT_GET(accepted),
+                     STAT_GET(rejected_sessions), STAT_GET(commands), STAT_GET(rejected_commands),
+                     STAT_GET(out_raw_bytes), STAT_GET(out_wire_bytes), STAT_GET(cache_hits), STAT_GET(cache_waits),
+                     STAT_GET(cache_fills), STAT_GET(cg_usage_usec), STAT_GET(cg_io_rbytes), STAT_GET(cg_io_wbytes),
+                     STAT_GET(timeouts), STAT_GET(cancels), STAT_GET(shm_bytes), STAT_GET(completions));
+
+    //parser and executor counters from the core library
+    ShellStats core;
+    shellcore_stats(&core);
+    n += snprintf(text + n, sizeof(text) - n,
+                  "parsed %ld\nparse_errors %ld\nprocesses %ld\nbuiltin_stages %ld\nparse_us %ld\nspawn_us %ld\n"
+                  "fd_cache_hits %ld\nfd_cache_opens %ld\nprepared_runs %ld\nsubstitutions %ld\nsubstitutions_inproc %ld\n",
+                  core.parsed, core.parse_errors, core.processes, core.builtin_stages,
+                  core.parse_ns / 1000, core.spawn_ns / 1000, core.fd_cache_hits, core.fd_cache_opens, core.prepared_runs,
+                  core.substitutions, core.substitutions_inproc);
+    for(int i = 0; i < num_workers && n < (int)sizeof(text) - 64; i++){
+        int limit = 0;
+        int depth = listen_queue_depth(workers[i].listen_fd, &limit);
+        if(depth >= 0){
+            n += snprintf(text + n, sizeof(text) - n, "worker%d_accept_queue %d/%d\n", i, depth, limit);
+        }
+    }
+    session_queue(s, FRAME_OUT, text, n);
+    session_queue(s, FRAME_DONE, "0", 1);
+}
+
+/*answers a completion request: line is the client's input up to the cursor, the answer is the number of matches, the
+prefix they all share and the best COMPLETE_MAX of them, one per line; PATH commands in command position, file names
+(from the directory cache) otherwise
+*/
+static int session_complete(Session *s, const char *line){
+    char *found[COMPLETE_MAX];
+    char *common = NULL;
+    int total = 0;
+    int start = complete_word_start(line, strlen(line));
+    env_use(s->env);                //commands come from the session's PATH
+    int n = complete_in_command_position(line, start) ?
+            complete_command(line + start, found, COMPLETE_MAX, &total, &common) :
+            dircache_complete(line + start, found, COMPLETE_MAX, &total, &common);
+
+    char reply[COMPLETE_REPLY_MAX];
+    size_t len = snprintf(reply, sizeof(reply), "%d\n%s\n", total, common ? common : "");
+    if(len >= sizeof(reply)){
+        len = snprintf(reply, sizeof(reply), "0\n\n");
+    }
+    for(int i = 0; i < n; i++){
+        size_t l = strlen(found[i]);
+        //names with a newline cannot be listed, the client still learns how many there were
+        if(len + l + 1 < sizeof(reply) && strchr(found[i], '\n') == NULL){
+            memcpy(reply + len, found[i], l);
+            reply[len + l] = '\n';
+            len += l + 1;
+        }
+        free(found[i]);
+    }
+    free(common);
+    STAT_ADD(completions, 1);
+    return session_queue(s, FRAME_COMPLETE, reply, len);
+}
+
+/*writes queued stdin into the command's pipe until it is full, hands the window back to the client as the command
+consumes it and closes the pipe after FRAME_INEOF once everything is delivered, returns -1 if the session is out of memory
+*/
+static int session_feed_stdin(Session *s){
+    while(s->in_pipe >= 0 && s->in_off < s->in_len){
+        ssize_t n = write(s->in_pipe, s->in + s->in_off, s->in_len - s->in_off);
+        if(n < 0 && errno == EINTR){
+            continue;
+        }
+        if(n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)){
+            break;
+        }
+        if(n <= 0){
+            //the command closed its stdin, the rest of the stream is dropped
+            session_stdin_close(s);
+            return 0;
+        }
+        s->in_off += n;
+        s->in_unacked += n;
+    }
+    if(s->in_off == s->in_len){
+        s->in_off = s->in_len = 0;
+    }
+    if(s->in_pipe < 0){
+        return 0;
+    }
+
+    //credit goes back in batches so small writes do not cost a frame each
+    if(s->in_unacked >= STDIN_WINDOW / 4){
+        char credit[24];
+        snprintf(credit, sizeof(credit), "%ld", s->in_unacked);
+        if(session_queue(s, FRAME_CREDIT, credit, strlen(credit)) < 0){
+            return -1;
+        }
+        s->in_unacked = 0;
+    }
+
+    if(s->in_eof && s->in_len == 0){
+        session_stdin_close(s);        //the command sees EOF
+    }else if(s->in_len > 0 && !s->in_watched){
+        s->in_watched = evloop_add(loop, s->in_pipe, EV_WRITE, on_stdin, s) == 0;
+    }else if(s->in_len == 0 && s->in_watched){
+        evloop_del(loop, s->in_pipe);
+        s->in_watched = 0;
+    }
+    return 0;
+}
+
+//one FRAME_IN or FRAME_INEOF for the running command, returns -1 if the session has to be closed
+static int session_stdin_frame(Session *s, int type, const char *data, int n){
+    if(type == FRAME_INEOF){
+        if(atol(data) != s->in_received){
+            fprintf(stderr, "[WARN] Client sent %ld stdin bytes but reported %s\n", s->in_received, data);
+        }
+        s->in_eof = 1;
+        return session_feed_stdin(s);
+    }
+    s->in_received += n;
+    if(s->in_pipe < 0){
+        return 0;                       //the command no longer reads its stdin
+    }
+    if(s->in_len + n > STDIN_WINDOW){
+        memmove(s->in, s->in + s->in_off, s->in_len - s->in_off);
+        s->in_len -= s->in_off;
+        s->in_off = 0;
+    }
+    if(s->in_len + n > STDIN_WINDOW){
+        fprintf(stderr, "[WARN] Client overran its stdin window\n");
+        return -1;
+    }
+    memcpy(s->in + s->in_len, data, n);
+    s->in_len += n;
+    return session_feed_stdin(s);
+}
+
+//stops the command for its client, or the wait for an identical one's cached result; returns -1 if the session was closed
+static int session_cancel(Session *s){
+    STAT_ADD(cancels, 1);
+    printf("[INFO] Client cancelled the command\n");
+    if(s->wait_cmd == NULL){
+        return session_stop(s, STOP_CANCEL);
+    }
+    uint64_t count;
+    outcache_cancel(s->cache_fd);
+    evloop_del(loop, s->cache_fd);
+    if(read(s->cache_fd, &count, sizeof(count)) < 0 && errno != EAGAIN){       //a wakeup that raced the cancel
+        perror("eventfd read");
+    }
+    free(s->wait_cmd);
+    s->wait_cmd = NULL;
+    if(session_queue(s, FRAME_DONE, "130", 3) < 0){
+        session_close(s);
+        return -1;
+    }
+    return session_process_input(s);
+}
+
+//reads stdin and cancel frames while a command runs, a frame of any other type stays buffered until the command is done
+//returns -1 if the session was closed
+static int session_read_stdin(Session *s){
+    char data[RECV_RING_SIZE];
+
+    while(session_busy(s) && !s->in_held){
+        int type;
+        int rc = recv_ring_peek_type(&s->ring, &type);
+        if(rc == 1 && type != FRAME_IN && type != FRAME_INEOF && type != FRAME_CANCEL){
+            s->in_held = 1;
+            break;
+        }
+        if(rc == 1){
+            rc = receive_frame_buffered(&s->ring, &type, data, sizeof(data));
+        }
+        if(rc == NET_AGAIN){
+            break;
+        }
+        if(rc <= 0){
+            if(rc == 0){
+                printf("[INFO] Client disconnected\n");
+            }else{
+                perror("Error receiving stdin");
+            }
+            session_close(s);
+            return -1;
+        }
+        if(type == FRAME_CANCEL){
+            if(session_cancel(s) < 0){
+                return -1;
+            }
+            continue;
+        }
+        if(!s->in_eof && session_stdin_frame(s, type, data, rc) < 0){
+            session_close(s);
+            return -1;
+        }
+    }
+    if(session_flush(s) < 0){
+        session_close(s);
+        return -1;
+    }
+    session_update_interest(s);
+    return 0;
+}
+
+//the command's stdin pipe has room again
+static void on_stdin(EvLoop *lp, int fd, int events, void *arg){
+    Session *s = arg;
+    (void)lp;
+    (void)fd;
+    (void)events;
+
+    if(session_feed_stdin(s) < 0 || session_flush(s) < 0){
+        session_close(s);
+        return;
+    }
+    session_update_interest(s);
+}
+
+//starts one admitted command, a command that could not be started still gets a status so the client does not wait forever
+//returns -1 if the session was closed
+static int session_run(Session *s, const char *cmd){
+    int rc = session_start(s, cmd);
+    if(rc == -2){
+        return -1;                      //the session went away while reporting
+    }
+    if(rc < 0){
+        session_disarm_timer(s);
+        if(s->fill != NULL){
+            outcache_finish(s->fill, 0, 0);
+            s->fill = NULL;
+        }
+        env_set_status(s->env, 1);
+        if(session_queue(s, FRAME_DONE, "1", 1) < 0){
+            session_close(s);
+            return -1;
+        }
+    }
+    return 0;
+}
+
+//the identical command this session waited for is done, looking it up again normally finds its result now
+static void on_cache_ready(EvLoop *lp, int fd, int events, void *arg){
+    Session *s = arg;
+    char *cmd = s->wait_cmd;
+    uint64_t count;
+    (void)events;
+
+    evloop_del(lp, fd);
+    if(read(fd, &count, sizeof(count)) < 0 && errno != EAGAIN){
+        perror("eventfd read");
+    }
+    s->wait_cmd = NULL;
+    int rc = session_run(s, cmd);
+    free(cmd);
+    if(rc == 0){
+        session_process_input(s);
+    }
+}
+
+//handles every complete frame buffered for an idle session, returns -1 if the session was closed
+static int session_process_input(Session *s){
+    char cmd_buffer[MAX_CMD_LENGTH];
+
+    while(!session_busy(s) && !s->closing){
+        int type;
+        int bytes_received = receive_frame_buffered(&s->ring, &type, cmd_buffer, sizeof(cmd_buffer));
+        if(bytes_received == NET_AGAIN){
+            break;
+        }
+        if(bytes_received <= 0){
+            if(bytes_received == 0){
+                printf("[INFO] Client disconnected\n");
+            }else{
+                perror("Error receiving command");
+            }
+            session_close(s);
+            return -1;
+        }
+        if(type == FRAME_FDS){
+            session_take_stdio(s);
+            continue;
+        }
+        if(type == FRAME_SHM){
+            session_take_shm(s);
+            continue;
+        }
+        if(type == FRAME_IN || type == FRAME_INEOF || type == FRAME_CANCEL){
+            continue;                   //stdin for (or a cancel of) a command that has already finished
+        }
+        if(type == FRAME_HELLO){
+            //feature negotiation, answer with what we accept
+            s->compress = strstr(cmd_buffer, "lz") != NULL;
+            s->stream_stdin = strstr(cmd_buffer, "stdin") != NULL;
+            //a client may ask for a shorter command deadline than the server's, never a longer one
+            const char *want = strstr(cmd_buffer, "timeout=");
+            if(want != NULL && atof(want + 8) > 0 && (cmd_timeout == 0 || atof(want + 8) < cmd_timeout)){
+                s->timeout = atof(want + 8);
+            }
+            //a shared ring takes the output uncompressed, the client passed it before saying hello
+            s->compress = s->compress && s->shm.hdr == NULL;
+            char accepted[64];
+            int n = snprintf(accepted, sizeof(accepted), "%s%s%s%s", s->compress ? "lz," : "", s->stream_stdin ? "stdin," : "",
+                             s->shm.hdr != NULL && strstr(cmd_buffer, "shm") != NULL ? "shm," : "",
+                             strstr(cmd_buffer, "complete") != NULL ? "complete," : "");
+            if(s->timeout > 0){
+                n += snprintf(accepted + n, sizeof(accepted) - n, "timeout=%g,", s->timeout);
+            }
+            if(n == 0){
+                strcpy(accepted, "none,");
+            }
+            accepted[strlen(accepted) - 1] = '\0';
+            if(session_queue(s, FRAME_HELLO, accepted, strlen(accepted)) < 0){
+                session_close(s);
+                return -1;
+            }
+            continue;
+        }
+        if(type == FRAME_COMPLETE){
+            if(session_complete(s, cmd_buffer) < 0){
+                session_close(s);
+                return -1;
+            }
+            continue;
+        }
+        if(type != FRAME_CMD){
+            fprintf(stderr, "[WARN] Ignoring unexpected frame type %d\n", type);
+            continue;
+        }
+
+        //log the received command
+        printf("[RECEIVED] Received command: \"%s\" from client.\n", cmd_buffer);
+
+        //handle exit command
+        if(strcmp(cmd_buffer, "exit") == 0){
+            printf("[INFO] Client requested exit\n");
+            s->closing = 1;
+            break;
+        }
+
+        //server-side introspection, answered without forking
+        if(strcmp(cmd_buffer, "server-stats") == 0){
+            session_send_stats(s);
+            continue;
+        }
+        if(strcmp(cmd_buffer, "session-stats") == 0){
+            session_send_usage(s);
+            continue;
+        }
+        if(strncmp(cmd_buffer, "prepare ", 8) == 0 || strncmp(cmd_buffer, "unprepare ", 10) == 0){
+            session_prepare(s, strchr(cmd_buffer, ' '), cmd_buffer[0] == 'u');
+            continue;
+        }
+
+        //shed load with an explicit answer instead of queueing work the box cannot take
+        const char *refusal = session_admit(s);
+        if(refusal != NULL){
+            if(session_refuse(s, refusal) < 0){
+                session_close(s);
+                return -1;
+            }
+            continue;
+        }
+        STAT_ADD(commands, 1);
+
+        if(session_run(s, cmd_buffer) < 0){
+            return -1;
+        }
+    }
+
+    if(session_flush(s) < 0 || (s->closing && session_pending(s) == 0 && !s->relaying)){
+        session_close(s);
+        return -1;
+    }
+    session_update_interest(s);
+    return 0;
+}
+
+//queues one chunk of command output, compressed if the client asked for it and it actually shrinks
+//a chunk that does not save at least 1/8 goes out raw and compression backs off exponentially, so binary or
+//already-compressed output costs almost no CPU after the first few blocks
+static int session_queue_output(Session *s, const char *buf, int n){
+    char zbuf[sizeof(uint32_t) + ZOUT_CHUNK];
+
+    STAT_ADD(out_raw_bytes, n);
+    if(s->fill != NULL){
+        outcache_append(s->fill, buf, n);
+    }
+    if(s->compress && s->z_skip == 0){
+        int zn = lz_compress(buf, n, zbuf + sizeof(uint32_t), n - n / 8);
+        if(zn > 0){
+            uint32_t raw = htonl(n);
+            memcpy(zbuf, &raw, sizeof(raw));
+            s->z_backoff = 0;
+            STAT_ADD(out_wire_bytes, sizeof(raw) + zn);
+            return session_queue(s, FRAME_OUTZ, zbuf, sizeof(raw) + zn);
+        }
+        s->z_backoff = s->z_backoff ? s->z_backoff * 2 : 1;
+        if(s->z_backoff > Z_MAX_BACKOFF){
+            s->z_backoff = Z_MAX_BACKOFF;
+        }
+        s->z_skip = s->z_backoff;
+    }else if(s->z_skip > 0){
+        s->z_skip--;
+    }
+    STAT_ADD(out_wire_bytes, n);
+    return session_queue(s, FRAME_OUT, buf, n);
+}
+
+/*zero-copy relay for uncompressed output when nothing else is queued: the frame header is sent, then the payload is
+spliced from the command's pipe straight into the socket; whatever the socket does not take is still in the pipe and
+finishes the frame through the queue. Returns the payload size relayed, 0 if the fast path did not apply, -1 if the client is gone
+*/
+static ssize_t session_splice(Session *s, int fd){
+    int avail;
+    if(ioctl(fd, FIONREAD, &avail) < 0 || avail <= 0){
+        return 0;                       //empty (or EOF), the read path sorts it out
+    }
+    if(avail > SPLICE_CHUNK){
+        avail = SPLICE_CHUNK;
+    }
+
+    uint32_t header = FRAME_HEADER(FRAME_OUT, avail);
+    ssize_t sent = send(s->fd, &header, sizeof(header), MSG_NOSIGNAL | MSG_MORE);
+    if(sent < 0){
+        return errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR ? 0 : -1;
+    }
+
+    size_t moved = 0;
+    if(sent == sizeof(header)){
+        while(moved < (size_t)avail){
+            ssize_t n = splice(fd, NULL, s->fd, NULL, avail - moved, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+            if(n < 0 && errno == EINTR){
+                continue;
+            }
+            if(n < 0 && errno != EAGAIN && errno != EWOULDBLOCK){
+                if(errno != EINVAL && errno != ENOSYS){
+                    return -1;
+                }
+                s->no_splice = 1;
+            }
+            if(n <= 0){
                 break;
             }
+            moved += n;
+        }
+    }
 
-            //skip empty commands
-            if(strlen(cmd_buffer) == 0){
+    //the rest of the header and payload go through the queue, we are the pipe's only reader so the bytes are there
+    size_t rest = sizeof(header) - sent + avail - moved;
+    if(rest > 0){
+        char *p = session_reserve(s, rest);
+        if(p == NULL){
+            return -1;
+        }
+        memcpy(p, (char *)&header + sent, sizeof(header) - sent);
+        for(size_t got = sizeof(header) - sent; got < rest; ){
+            ssize_t n = read(fd, p + got, rest - got);
+            if(n < 0 && errno == EINTR){
                 continue;
             }
+            if(n <= 0){
+                return -1;
+            }
+            got += n;
+        }
+        s->out_len += rest;
+        STAT_ADD(queued_bytes, rest);
+    }
+    STAT_ADD(out_raw_bytes, avail);
+    STAT_ADD(out_wire_bytes, avail);
+    return avail;
+}
 
-            //execute command using existing shell functions
-            if(strchr(cmd_buffer, '|') != NULL){
-                //pipeline command
-                printf("[INFO] Executing pipeline command\n");
-                execute_pipeline(cmd_buffer);
-            }else if(parse_command(cmd_buffer, args, &inputFile, &outputFile, &errorFile, 0) == 0){
-                //single command
-                printf("[INFO] Executing single command\n");
-                execute_command(args, inputFile, outputFile, errorFile);
-                
-                //free memory allocated by parse_command
-                for(int i = 0; args[i] != NULL; i++){
-                    free(args[i]);
-                }
-                if(inputFile){
-                    free(inputFile);
-                }
-                if(outputFile){
-                    free(outputFile);
-                }
-                if(errorFile){
-                    free(errorFile);
-                }
-            }else{
-                printf("[INFO] Command parsing failed\n");
+//a relayed output frame is over, whatever the read did not fill or the socket did not take goes out through the queue
+static void on_relayed(EvLoop *lp, int fd, const char *buf, ssize_t nread, ssize_t nsent, void *arg){
+    Session *s = arg;
+    uint32_t header;
+    (void)lp;
+    (void)fd;
+
+    s->relaying = 0;
+    memcpy(&header, buf, sizeof(header));
+    size_t len = ntohl(header) & FRAME_LEN_MASK;
+    int rc = 0;
+    if(nread > 0){
+        STAT_ADD(out_raw_bytes, nread);
+        STAT_ADD(out_wire_bytes, nread);
+    }
+    if(nsent > 0 && (size_t)nsent < sizeof(header) + len){
+        rc = session_requeue(s, buf + nsent, sizeof(header) + len - nsent);
+    }else if(nsent < 0 && nread == (ssize_t)len){
+        rc = session_requeue(s, buf, sizeof(header) + len);
+    }else if(nsent < 0 && nread > 0){
+        //a short read cancels the send, the bytes that did arrive make a smaller frame
+        char frame[sizeof(header) + SPLICE_CHUNK];
+        header = FRAME_HEADER(FRAME_OUT, nread);
+        memcpy(frame, &header, sizeof(header));
+        memcpy(frame + sizeof(header), buf + sizeof(header), nread);
+        rc = session_requeue(s, frame, sizeof(header) + nread);
+    }
+    if(rc < 0 || session_flush(s) < 0 || (s->closing && session_pending(s) == 0)){
+        session_close(s);
+        return;
+    }
+    session_update_interest(s);
+}
+
+/*io_uring counterpart of session_splice: the frame header and a read of the payload from the command's pipe go to the
+kernel as one linked read and send, on_relayed queues what did not make it; returns 1 if the relay started
+*/
+static int session_relay(Session *s, int fd){
+    int avail;
+    if(ioctl(fd, FIONREAD, &avail) < 0 || avail <= 0){
+        return 0;                       //empty (or EOF), the read path sorts it out
+    }
+    if(avail > SPLICE_CHUNK){
+        avail = SPLICE_CHUNK;
+    }
+    uint32_t header = FRAME_HEADER(FRAME_OUT, avail);
+    if(evloop_relay(loop, s->fd, fd, &header, sizeof(header), avail, on_relayed) < 0){
+        return 0;
+    }
+    s->relaying = 1;
+    return 1;
+}
+
+//tells the client how many output bytes were put into the shared ring since the last notice
+static int session_shm_notify(Session *s, size_t *n){
+    char count[24];
+    if(*n == 0){
+        return 0;
+    }
+    snprintf(count, sizeof(count), "%zu", *n);
+    STAT_ADD(out_raw_bytes, *n);
+    STAT_ADD(shm_bytes, *n);
+    *n = 0;
+    return session_queue(s, FRAME_SHMOUT, count, strlen(count));
+}
+
+/*output from the running command, forwarded to the client as FRAME_OUT (or FRAME_OUTZ) chunks, or read straight into
+the client's shared ring while it has room (output being recorded for the cache takes the frame path)
+*/
+static void on_output(EvLoop *lp, int fd, int events, void *arg){
+    Session *s = arg;
+    char buf[ZOUT_CHUNK];
+    size_t shm_new = 0;
+    (void)events;
+
+    if(s->relaying){
+        return;                         //readiness from before the pipe was paused
+    }
+    while(session_pending(s) < OUT_HIGH_WATER){
+        if(s->shm.hdr != NULL && s->fill == NULL){
+            ssize_t n = shmring_fill(&s->shm, fd);
+            if(n > 0){
+                shm_new += n;
+                continue;
             }
+            if(n == -1 && errno == EINTR){
+                continue;
+            }
+            if(n == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)){
+                break;
+            }
+            //a full ring (the client is behind) falls back to frames, which must follow what the ring already holds
+            if(session_shm_notify(s, &shm_new) < 0){
+                session_close(s);
+                return;
+            }
+        }
+        if(!s->compress && s->fill == NULL && session_pending(s) == 0 && evloop_native(lp)){
+            if(session_relay(s, fd)){
+                break;                  //the pipe is paused until on_relayed
+            }
+        }else if(!s->compress && !s->no_splice && s->fill == NULL && session_pending(s) == 0){
+            ssize_t n = session_splice(s, fd);
+            if(n < 0){
+                session_close(s);
+                return;
+            }
+            if(n > 0){
+                continue;
+            }
+        }
+        ssize_t n = read(fd, buf, s->compress ? ZOUT_CHUNK : OUT_CHUNK);
+        if(n > 0){
+            if(session_queue_output(s, buf, n) < 0){
+                session_close(s);
+                return;
+            }
+            continue;
+        }
+        if(n < 0 && errno == EINTR){
+            continue;
+        }
+        if(n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)){
+            break;
+        }
+        //EOF (or a read error), the command is done with its output
+        if(session_shm_notify(s, &shm_new) < 0){
+            session_close(s);
+            return;
+        }
+        session_finish(s);
+        return;
+    }
+
+    if(session_shm_notify(s, &shm_new) < 0 || session_flush(s) < 0){
+        session_close(s);
+        return;
+    }
+    session_update_interest(s);
+}
+
+//client socket readiness, drains queued output and reads new commands
+static void on_client(EvLoop *lp, int fd, int events, void *arg){
+    Session *s = arg;
+    (void)lp;
+    (void)fd;
+
+    if(events & EV_WRITE){
+        if(session_flush(s) < 0 || (s->closing && session_pending(s) == 0 && !s->relaying)){
+            session_close(s);
+            return;
+        }
+    }
+    if(events & EV_READ){
+        if(session_busy(s)){
+            session_read_stdin(s);
+        }else{
+            session_process_input(s);
+        }
+        return;
+    }
+    session_update_interest(s);
+}
+
+/*bytes received on a TCP client's socket by the io_uring loop, fed into the session's ring and handled like readiness
+on the socket; returns how many were taken, the loop keeps the rest until the ring has room
+*/
+static size_t on_client_data(EvLoop *lp, int fd, const char *data, ssize_t n, void *arg){
+    Session *s = arg;
+    size_t took = 0;
+    (void)lp;
+    (void)fd;
+
+    for(;;){
+        size_t fed = recv_ring_feed(&s->ring, data + took, n > 0 ? n - (ssize_t)took : n);
+        took += fed;
+        int rc = session_busy(s) ? session_read_stdin(s) : session_process_input(s);
+        if(rc < 0 || fed == 0 || n <= 0 || took == (size_t)n){
+            return took;                //rc < 0: the session is gone, and so is fd's registration
         }
+    }
+}
 
-        //close client connection
+//a connection accepted on a listening socket, becomes a session on this worker
+static void on_accepted(EvLoop *lp, int fd, int client_fd, void *arg){
+    (void)fd;
+    (void)arg;
+
+    log_client_peer(client_fd);
+    STAT_ADD(accepted, 1);
+
+    //over the session limit: say so and hang up right away, the tiny frame always fits the fresh socket buffer
+    if(STAT_ADD(sessions, 1) > max_sessions && max_sessions > 0){
+        static const char busy[] = "too many sessions";
+        uint32_t header = FRAME_HEADER(FRAME_BUSY, sizeof(busy) - 1);
+        char frame[sizeof(header) + sizeof(busy)];
+        memcpy(frame, &header, sizeof(header));
+        memcpy(frame + sizeof(header), busy, sizeof(busy) - 1);
+        send(client_fd, frame, sizeof(header) + sizeof(busy) - 1, MSG_NOSIGNAL);
+        STAT_ADD(sessions, -1);
+        STAT_ADD(rejected_sessions, 1);
+        printf("[INFO] Connection refused: %s\n", busy);
         close_socket(client_fd);
-        client_fd = -1;
-        printf("[INFO] Client session ended\n");
+        return;
+    }
+
+    Session *s = calloc(1, sizeof(Session));
+    if(s != NULL && (s->env = env_create()) == NULL){
+        free(s);
+        s = NULL;
+    }
+    if(!s){
+        perror("calloc");
+        STAT_ADD(sessions, -1);
+        close_socket(client_fd);
+        return;
+    }
+    s->fd = client_fd;
+    s->out_pipe = -1;
+    s->in_pipe = -1;
+    s->cache_fd = -1;
+    s->cg_fd = -1;
+    s->timer_fd = -1;
+    s->timeout = cmd_timeout;
+    s->stdio[0] = s->stdio[1] = s->stdio[2] = -1;
+    s->tokens = cmd_burst;
+    s->refilled_at = now_seconds();
+    recv_ring_init(&s->ring, client_fd);
+    //io_uring receives TCP clients' bytes into its own buffers, local clients keep recvmsg for the descriptors they pass
+    int fed = !local_clients && evloop_native(lp);
+    if(fed){
+        recv_ring_fed(&s->ring);
+    }
+    if(evloop_add(lp, client_fd, EV_READ, on_client, s) < 0 || (fed && evloop_recv(lp, client_fd, on_client_data) < 0)){
+        evloop_del(lp, client_fd);
+        STAT_ADD(sessions, -1);
+        close_socket(client_fd);
+        env_free(s->env);
+        free(s);
+        return;
+    }
+    printf("[INFO] Client session started\n");
+}
+
+//a partial pipeline spawn_plan gave up on, reaped like a closed session's stages
+static void reap_orphan(pid_t pid){
+    session_orphan(pid, -1);
+}
+
+//worker thread body, pins itself if asked and runs its own event loop until it fails
+static void *worker_main(void *arg){
+    Worker *w = arg;
+
+    if(w->cpu >= 0){
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        CPU_SET(w->cpu, &set);
+        if(pthread_setaffinity_np(pthread_self(), sizeof(set), &set) != 0){
+            fprintf(stderr, "[WARN] Worker %d could not be pinned to CPU %d\n", w->id, w->cpu);
+        }
+    }
+
+    loop = w->loop;
+    expand_keep_errors(1);
+    //orphans without a pidfd are swept now and then, nothing wakes the loop when they exit
+    while(evloop_run_once(loop, norphans > 0 ? 100 : -1) >= 0){
+        sweep_orphans();
+    }
+    return NULL;
+}
+
+//server main function, sets up sockets and one event loop per worker, then serves every client concurrently
+int main(int argc, char *argv[]) {
+    const char *address;
+    int backend = EVLOOP_EPOLL;
+    int pin = 0;
+    int opt;
+
+    /*parse options, -e selects the I/O engine, -w the number of worker threads, -a pins workers to CPUs
+    admission control: -b listen backlog, -c max sessions, -j max command processes, -r commands/sec per client[:burst]
+    -P sets the capacity of command pipes in bytes, -F keeps up to that many >> targets open between commands
+    -C pattern=seconds caches the output of matching commands that long (repeatable, the first matching rule wins)
+    -g dir runs each session's commands in a cgroup v2 leaf under dir, -L file=value sets a limit in every leaf (repeatable)
+    -T seconds kills a command's whole process group at that deadline (clients may ask for a shorter one)
+    */
+    const char *cgroup_dir = NULL;
+    while((opt = getopt(argc, argv, "e:w:ab:c:j:r:P:F:C:g:L:T:")) != -1){
+        if(opt == 'e' && strcmp(optarg, "epoll") == 0){
+            backend = EVLOOP_EPOLL;
+        }else if(opt == 'e' && strcmp(optarg, "uring") == 0){
+            backend = EVLOOP_URING;
+        }else if(opt == 'w' && atoi(optarg) > 0 && atoi(optarg) <= MAX_WORKERS){
+            num_workers = atoi(optarg);
+        }else if(opt == 'a'){
+            pin = 1;
+        }else if(opt == 'b' && atoi(optarg) > 0){
+            listen_backlog = atoi(optarg);
+        }else if(opt == 'c' && atol(optarg) >= 0){
+            max_sessions = atol(optarg);
+        }else if(opt == 'j' && atol(optarg) >= 0){
+            max_children = atol(optarg);
+        }else if(opt == 'P' && atoi(optarg) > 0){
+            set_pipe_size(atoi(optarg));
+        }else if(opt == 'F' && atoi(optarg) >= 0){
+            set_fd_cache(atoi(optarg));
+        }else if(opt == 'C' && outcache_add_rule(optarg) < 0){
+            fprintf(stderr, "Invalid cache rule \"%s\", expected pattern=seconds\n", optarg);
+            exit(1);
+        }else if(opt == 'C'){
+            printf("[INFO] Caching output of \"%s\"\n", optarg);
+        }else if(opt == 'T' && atof(optarg) > 0){
+            cmd_timeout = atof(optarg);
+        }else if(opt == 'g'){
+            cgroup_dir = optarg;
+        }else if(opt == 'L' && cgroup_add_limit(optarg) < 0){
+            fprintf(stderr, "Invalid cgroup limit \"%s\", expected file=value\n", optarg);
+            exit(1);
+        }else if(opt == 'L'){
+            continue;
+        }else if(opt == 'r' && atof(optarg) >= 0){
+            char *burst = strchr(optarg, ':');
+            cmd_rate = atof(optarg);
+            cmd_burst = burst ? atof(burst + 1) : cmd_rate;
+            if(cmd_burst < 1){
+                cmd_burst = 1;
+            }
+        }else{
+            fprintf(stderr, "Usage: %s [-e epoll|uring] [-w workers] [-a] [-b backlog] [-c sessions] [-j children] [-r rate[:burst]] [-P pipe_size] [-F fd_cache] [-C pattern=ttl] [-g cgroup_dir [-L file=value]] [-T timeout] <port|address>\n", argv[0]);
+            exit(1);
+        }
+    }
+
+    //check command line arguments
+    if(optind != argc - 1){
+        fprintf(stderr, "Usage: %s [-e epoll|uring] [-w workers] [-a] [-b backlog] [-c sessions] [-j children] [-r rate[:burst]] [-P pipe_size] [-F fd_cache] [-C pattern=ttl] [-g cgroup_dir [-L file=value]] [-T timeout] <port|address>\n", argv[0]);
+        exit(1);
+    }
+
+    address = argv[optind];
+
+    //set up signal handlers for graceful shutdown
+    signal(SIGINT, signal_handler);
+    signal(SIGTERM, signal_handler);
+    //a command that stops reading its stdin must not kill the server, the write just fails with EPIPE
+    signal(SIGPIPE, SIG_IGN);
+    //a command substitution would run while its line is parsed, on the worker's event loop and outside the session's
+    //process group, cgroup and child limit, so only the in-process builtins are substituted
+    expand_allow_commands(0);
+    spawn_set_orphan_handler(reap_orphan);
+
+    if(cgroup_dir != NULL && cgroup_init(cgroup_dir) < 0){
+        exit(1);
+    }
+
+    //probe once whether children can be tracked by pidfd
+    int probe = open_pidfd(getpid());
+    if(probe >= 0){
+        have_pidfd = 1;
+        close(probe);
+    }
+
+    //create one listening socket per worker so the kernel load-balances accepts (SO_REUSEPORT); local sockets cannot
+    //be sharded that way, so their workers share one non-blocking socket and simply race for each accept
+    long ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+    int shared = is_local_address(address);
+    local_clients = shared;
+    for(int i = 0; i < num_workers; i++){
+        Worker *w = &workers[i];
+        w->id = i;
+        w->cpu = pin && ncpu > 0 ? (int)(i % ncpu) : -1;
+        if(shared && i > 0){
+            w->listen_fd = workers[0].listen_fd;
+        }else{
+            //a bare port keeps the old IPv4 behaviour, unix:/path and @name listen locally
+            w->listen_fd = create_listen_socket(address, num_workers > 1, listen_backlog);
+            if(w->listen_fd < 0 || set_nonblocking(w->listen_fd) < 0){
+                fprintf(stderr, "Error: Failed to create server socket\n");
+                exit(1);
+            }
+        }
+
+        w->loop = evloop_create(backend);
+        if(!w->loop || evloop_accept(w->loop, w->listen_fd, on_accepted, NULL) < 0){
+            fprintf(stderr, "Error: Failed to set up event loop\n");
+            exit(1);
+        }
+    }
+
+    printf("[INFO] Server started on %s (%s, %d worker%s)\n", address,
+           evloop_backend(workers[0].loop) == EVLOOP_URING ? "io_uring" : "epoll", num_workers, num_workers > 1 ? "s" : "");
+
+    //a single worker runs on the main thread exactly as before, more workers get a thread each
+    if(num_workers == 1){
+        worker_main(&workers[0]);
+    }else{
+        for(int i = 0; i < num_workers; i++){
+            if(pthread_create(&workers[i].thread, NULL, worker_main, &workers[i]) != 0){
+                fprintf(stderr, "Error: Failed to start worker %d\n", i);
+                exit(1);
+            }
+        }
+        for(int i = 0; i < num_workers; i++){
+            pthread_join(workers[i].thread, NULL);
+        }
     }
 
     //clean up
-    close_socket(server_fd);
+    for(int i = 0; i < num_workers; i++){
+        evloop_destroy(workers[i].loop);
+        if(i == 0 || workers[i].listen_fd != workers[0].listen_fd){
+            close_socket(workers[i].listen_fd);
+        }
+    }
     return 0;
 }
@@ -0,0 +1,32 @@
+#include "shellcore.h"
+#include <string.h>
+#include <time.h>
+
+ShellStats shell_stats;
+
+void shellcore_stats(ShellStats *out){
+    //field by field so every value is read atomically
+    out->parsed = __atomic_load_n(&shell_stats.parsed, __ATOMIC_RELAXED);
+    out->parse_errors = __atomic_load_n(&shell_stats.parse_errors, __ATOMIC_RELAXED);
+    out->pipelines = __atomic_load_n(&shell_stats.pipelines, __ATOMIC_RELAXED);
+    out->processes = __atomic_load_n(&shell_stats.processes, __ATOMIC_RELAXED);
+    out->builtin_stages = __atomic_load_n(&shell_stats.builtin_stages, __ATOMIC_RELAXED);
+    out->spawn_failures = __atomic_load_n(&shell_stats.spawn_failures, __ATOMIC_RELAXED);
+    out->parse_ns = __atomic_load_n(&shell_stats.parse_ns, __ATOMIC_RELAXED);
+    out->spawn_ns = __atomic_load_n(&shell_stats.spawn_ns, __ATOMIC_RELAXED);
+    out->fd_cache_hits = __atomic_load_n(&shell_stats.fd_cache_hits, __ATOMIC_RELAXED);
+    out->fd_cache_opens = __atomic_load_n(&shell_stats.fd_cache_opens, __ATOMIC_RELAXED);
+    out->prepared_runs = __atomic_load_n(&shell_stats.prepared_runs, __ATOMIC_RELAXED);
+    out->substitutions = __atomic_load_n(&shell_stats.substitutions, __ATOMIC_RELAXED);
+    out->substitutions_inproc = __atomic_load_n(&shell_stats.substitutions_inproc, __ATOMIC_RELAXED);
+}
+
+void shellcore_stats_reset(void){
+    memset(&shell_stats, 0, sizeof(shell_stats));
+}
+
+long shellcore_now_ns(void){
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000L + ts.tv_nsec;
+}
@@ -0,0 +1,115 @@
+#define _GNU_SOURCE
+#include "shmring.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+//bytes in front of the data area, the counters sit on separate cache lines
+#define SHMRING_HEADER 4096
+
+struct ShmHeader {
+    uint64_t head;              //bytes ever written, stored by the producer
+    char pad0[56];
+    uint64_t tail;              //bytes ever consumed, stored by the consumer
+};
+
+//maps a ring memfd of map_len bytes
+static int map_ring(ShmRing *r, int fd, size_t map_len){
+    void *p = mmap(NULL, map_len, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if(p == MAP_FAILED){
+        perror("mmap");
+        return -1;
+    }
+    r->hdr = p;
+    r->data = (char *)p + SHMRING_HEADER;
+    r->size = map_len - SHMRING_HEADER;
+    r->map_len = map_len;
+    r->pos = 0;
+    return 0;
+}
+
+int shmring_create(ShmRing *r, size_t size){
+    size_t data = SHMRING_MIN_SIZE;
+    while(data < size && data < SHMRING_MAX_SIZE){
+        data *= 2;
+    }
+    int fd = memfd_create("shell-output", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+    if(fd < 0){
+        perror("memfd_create");
+        return -1;
+    }
+    //the server maps it too: sealed so it can never shrink under the server's feet (SIGBUS)
+    if(ftruncate(fd, SHMRING_HEADER + data) < 0 ||
+       fcntl(fd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_SEAL) < 0 ||
+       map_ring(r, fd, SHMRING_HEADER + data) < 0){
+        perror("shared ring");
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+int shmring_map(ShmRing *r, int fd){
+    struct stat st;
+    int seals = fcntl(fd, F_GET_SEALS);
+    if(fstat(fd, &st) < 0 || seals < 0 || !(seals & F_SEAL_SHRINK)){
+        return -1;
+    }
+    size_t data = st.st_size > SHMRING_HEADER ? (size_t)st.st_size - SHMRING_HEADER : 0;
+    if(data < SHMRING_MIN_SIZE || data > SHMRING_MAX_SIZE || (data & (data - 1)) != 0){
+        return -1;
+    }
+    if(map_ring(r, fd, st.st_size) < 0){
+        return -1;
+    }
+    //start from whatever the consumer published, the counters only have to agree with each other
+    r->pos = __atomic_load_n(&r->hdr->tail, __ATOMIC_ACQUIRE);
+    __atomic_store_n(&r->hdr->head, r->pos, __ATOMIC_RELEASE);
+    return 0;
+}
+
+void shmring_unmap(ShmRing *r){
+    if(r->hdr != NULL){
+        munmap(r->hdr, r->map_len);
+        r->hdr = NULL;
+    }
+}
+
+ssize_t shmring_fill(ShmRing *r, int fd){
+    //the tail comes from the other process, a bogus one just reads as a full ring
+    uint64_t used = r->pos - __atomic_load_n(&r->hdr->tail, __ATOMIC_ACQUIRE);
+    if(used >= r->size){
+        return -2;
+    }
+    size_t room = r->size - used;
+    size_t off = r->pos & (r->size - 1);
+    size_t first = room < r->size - off ? room : r->size - off;
+    struct iovec iov[2] = {
+        { r->data + off, first },
+        { r->data, room - first },
+    };
+    ssize_t n = readv(fd, iov, room > first ? 2 : 1);
+    if(n > 0){
+        r->pos += n;
+        __atomic_store_n(&r->hdr->head, r->pos, __ATOMIC_RELEASE);
+    }
+    return n;
+}
+
+size_t shmring_peek(const ShmRing *r, size_t max, const char **p){
+    size_t off = r->pos & (r->size - 1);
+    size_t n = r->size - off;
+    *p = r->data + off;
+    return n < max ? n : max;
+}
+
+void shmring_advance(ShmRing *r, size_t n){
+    r->pos += n;
+    __atomic_store_n(&r->hdr->tail, r->pos, __ATOMIC_RELEASE);
+}
@@ -1,5 +1,7 @@
 #include "tokenize.h"
+#include "expand.h"
 #include "util.h"
+#include <ctype.h>
 #include <glob.h>
 #include <stdbool.h>
 #include <stddef.h>
@@ -13,6 +15,58 @@
 //maximum number of arguments a command can have
 #define MAX_ARGS 64         
 
+//length of the pipe or redirection operator at p, 0 if there is none: | [n]< [n]> [n]>> [n]<& [n]>& &> &>> << <<- <<<
+static int op_length(const char *p){
+    if(*p=='|') return 1;
+    if(*p=='&' && p[1]=='>') return p[2]=='>' ? 3 : 2;
+    int n = (*p>='0' && *p<='9' && (p[1]=='<' || p[1]=='>')) ? 1 : 0;      //single-digit descriptor, like sh
+    const char *q = p + n;
+    if(*q=='<'){
+        if(!n && q[1]=='<') return (q[2]=='<' || q[2]=='-') ? 3 : 2;
+        return n + (q[1]=='&' ? 2 : 1);
+    }
+    if(*q=='>') return n + ((q[1]=='>' || q[1]=='&') ? 2 : 1);
+    return 0;
+}
+
+//appends one byte of the word, escaping the ones expand_word() would take for a marker; -1 if the word is too long
+static int put_char(char *buf, int *bl, char c){
+    bool marker = c==QTOK_EXPAND || c==QTOK_EXPAND_QUOTED || c==QTOK_LITERAL;
+    if(*bl+marker >= MAX_CMD_LENGTH-1) return -1;
+    if(marker) buf[(*bl)++]=QTOK_LITERAL;
+    buf[(*bl)++]=c;
+    return 0;
+}
+
+/*copies the expansion starting with the '$' at p into the word behind its marker, $NAME and the special parameters
+($? $$ $# $! $0-$9 $@ $* $-) as ${NAME}; returns the number of bytes of p taken, 0 if p is an ordinary '$',
+-1 for an unclosed $( or ${ or a word that gets too long
+*/
+static int take_expansion(const char *p, char *buf, int *bl, bool quoted){
+    size_t n;
+    if(p[1]=='(' || p[1]=='{'){
+        n = expand_span(p);
+        if(n==0 || *bl+(int)n+1 >= MAX_CMD_LENGTH-1) return -1;
+        buf[(*bl)++] = quoted ? QTOK_EXPAND_QUOTED : QTOK_EXPAND;
+        memcpy(buf+*bl, p, n); *bl+=n;
+        return n;
+    }
+    if((p[1]>='a' && p[1]<='z') || (p[1]>='A' && p[1]<='Z') || p[1]=='_'){
+        n = 1;
+        while(isalnum((unsigned char)p[n+1]) || p[n+1]=='_') n++;
+    }else if(p[1] && strchr("?$#!@*-0123456789", p[1])){
+        n = 1;
+    }else{
+        return 0;
+    }
+    if(*bl+(int)n+4 >= MAX_CMD_LENGTH-1) return -1;
+    buf[(*bl)++] = quoted ? QTOK_EXPAND_QUOTED : QTOK_EXPAND;
+    buf[(*bl)++]='$'; buf[(*bl)++]='{';
+    memcpy(buf+*bl, p+1, n); *bl+=n;
+    buf[(*bl)++]='}';
+    return n+1;
+}
+
 /* Returns 0 on success, -1 on unclosed quote or OOM.
    On success, *out = heap array of QToks (count elements). Caller frees.
 */
@@ -38,47 +92,56 @@ int qtokenize(const char *line, QTok **out, int *count){
         while(*p){
             if(in_s){
                 if(*p=='\''){ in_s=false; was_quoted=true; p++; continue; }
-                if(bl>=MAX_CMD_LENGTH-1){ free(arr); return -1; }
-                buf[bl++]=*p++;
+                if(put_char(buf,&bl,*p++)<0){ free_qtokens(arr,n); return -1; }
             } else if(in_d){
                 if(*p=='"'){ in_d=false; was_quoted=true; p++; continue; }
-                if(*p=='\\' && (p[1]=='"'||p[1]=='\\')){ p++; if(bl>=MAX_CMD_LENGTH-1){ free(arr); return -1; } buf[bl++]=*p++; }
-                else { if(bl>=MAX_CMD_LENGTH-1){ free(arr); return -1; } buf[bl++]=*p++; }
+                if(*p=='$'){
+                    int k = take_expansion(p, buf, &bl, true);
+                    if(k<0){ free_qtokens(arr,n); return -1; }
+                    if(k>0){ p+=k; continue; }
+                }
+                if(*p=='\\' && (p[1]=='"'||p[1]=='\\'||p[1]=='$')) p++;
+                if(put_char(buf,&bl,*p++)<0){ free_qtokens(arr,n); return -1; }
             } else {
                 if(*p=='\''){ in_s=true; p++; continue; }
                 if(*p=='"'){ in_d=true; p++; continue; }
+                if(*p=='$'){
+                    int k = take_expansion(p, buf, &bl, false);
+                    if(k<0){ free_qtokens(arr,n); return -1; }
+                    if(k>0){ p+=k; continue; }
+                }
                 if(*p==' '||*p=='\t'||*p=='\n'||*p=='\r') break; /* token end */
-                if(*p=='|'||*p=='<'||*p=='>'){
+                if(*p=='|'||*p=='<'||*p=='>'||(*p=='&' && p[1]=='>')){
                     //operator ends token if we started; otherwise emit operator as its own token outside this loop
-                    if(bl==0) break;
-                    else break;
+                    break;
                 }
-                if(bl>=MAX_CMD_LENGTH-1){ free(arr); return -1; }
-                buf[bl++]=*p++;
+                //a token starting with n< or n> is a redirection of descriptor n
+                if(bl==0 && !was_quoted && op_length(p)) break;
+                //\$ is a literal dollar sign, every other backslash is kept as it always was
+                if(*p=='\\' && p[1]=='$') p++;
+                if(put_char(buf,&bl,*p++)<0){ free_qtokens(arr,n); return -1; }
             }
         }
 
         //emit token if we captured any or if it was empty-quoted
         if(bl>0 || was_quoted){
-            if(n==cap){ cap*=2; QTok *tmp=realloc(arr, cap*sizeof(QTok)); if(!tmp){ perror("realloc"); free(arr); return -1;} arr=tmp; }
+            if(n==cap){ cap*=2; QTok *tmp=realloc(arr, cap*sizeof(QTok)); if(!tmp){ perror("realloc"); free_qtokens(arr,n); return -1;} arr=tmp; }
             buf[bl]='\0';
             arr[n].val = xstrdup(buf);
             arr[n].was_quoted = was_quoted;
             n++;
         }
 
-        //outside quotes: treat single-char | < > and two-char 2> as separate tokens
+        //outside quotes: pipes and redirection operators (see op_length) are separate tokens
         if(!in_s && !in_d){
             while(*p==' '||*p=='\t'||*p=='\n'||*p=='\r') p++;
-            if(*p=='2' && p[1]=='>'){
-                if(n==cap){ cap*=2; QTok *tmp=realloc(arr, cap*sizeof(QTok)); if(!tmp){ perror("realloc"); free(arr); return -1;} arr=tmp; }
-                arr[n].val = xstrdup("2>");
-                arr[n].was_quoted=false; n++; p+=2;
-            } else if(*p=='|'||*p=='<'||*p=='>'){
-                char op[2]={*p,0};
-                if(n==cap){ cap*=2; QTok *tmp=realloc(arr, cap*sizeof(QTok)); if(!tmp){ perror("realloc"); free(arr); return -1;} arr=tmp; }
+            int oplen = op_length(p);
+            if(oplen){
+                char op[4]={0};
+                memcpy(op, p, oplen);
+                if(n==cap){ cap*=2; QTok *tmp=realloc(arr, cap*sizeof(QTok)); if(!tmp){ perror("realloc"); free_qtokens(arr,n); return -1;} arr=tmp; }
                 arr[n].val = xstrdup(op);
-                arr[n].was_quoted=false; n++; p++;
+                arr[n].was_quoted=false; n++; p+=oplen;
             }
         }
     }
@@ -94,6 +157,12 @@ int qtokenize(const char *line, QTok **out, int *count){
 
 void free_qtokens(QTok *arr, int n){ for(int i=0;i<n;i++) free(arr[i].val); free(arr); }
 
+//appends w to the expanded argv if there is room, otherwise drops it (the string is owned, so free it)
+static void glob_keep(char **outv, bool *outq, int *m, char *w, bool q){
+    if(*m<MAX_ARGS-1){ outv[*m]=w; outq[*m]=q; (*m)++; }
+    else free(w);
+}
+
 /* Expand * ? [ ] on unquoted argv words using glob(3).
    Keeps redirection filenames unexpanded.
 */
@@ -107,14 +176,14 @@ void apply_globbing(char **argv, bool *was_quoted, int *argc){
 
         //detect redirection markers and skip the following filename
         if((strcmp(w,"<")==0)||(strcmp(w,">")==0)||(strcmp(w,"2>")==0)){
-            if(m<MAX_ARGS-1){ outv[m]=w; outq[m]=false; m++; }
-            if(i+1<*argc){ outv[m]=argv[i+1]; outq[m]=true; m++; i++; }          //filename as-is
+            glob_keep(outv,outq,&m,w,false);
+            if(i+1<*argc){ glob_keep(outv,outq,&m,argv[i+1],true); i++; }          //filename as-is
             continue;
         }
 
         if(q){
             //keep quoted tokens as-is
-            if(m<MAX_ARGS-1){ outv[m]=w; outq[m]=true; m++; }
+            glob_keep(outv,outq,&m,w,true);
             continue;
         }
 
@@ -123,7 +192,7 @@ void apply_globbing(char **argv, bool *was_quoted, int *argc){
         for(char *p=w; *p; ++p){ if(*p=='*'||*p=='?'||*p=='['||*p==']'){ hasg=true; break; } }
 
         if(!hasg){
-            if(m<MAX_ARGS-1){ outv[m]=w; outq[m]=false; m++; }
+            glob_keep(outv,outq,&m,w,false);
             continue;
         }
 
@@ -136,7 +205,7 @@ void apply_globbing(char **argv, bool *was_quoted, int *argc){
             free(w);             //was original token; replaced by duplicates
         }else{
             //fallback: keep as-is
-            if(m<MAX_ARGS-1){ outv[m]=w; outq[m]=false; m++; }
+            glob_keep(outv,outq,&m,w,false);
         }
         globfree(&gr);
     }